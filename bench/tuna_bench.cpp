@@ -0,0 +1,178 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+/* Times the code that runs on every tick of the query thread, so changes to
+ * it can be compared with numbers. The plugin module is never loaded, only
+ * the formatting, song and output code is called directly.
+ *
+ * Usage: tuna_bench [iterations] [audio files with embedded covers...] */
+
+#include "../src/query/song.hpp"
+#include "../src/util/config.hpp"
+#include "../src/util/cover_tag_handler.hpp"
+#include "../src/util/format.hpp"
+#include "../src/util/output_thread.hpp"
+#include "../src/util/render_pool.hpp"
+#include "../src/util/utility.hpp"
+#include <QDir>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <vector>
+
+static const char* templates[] = {
+    "{title}",
+    "{first_artist} - {title}",
+    "{title} by {artists} on {album} ({release_year})",
+    "{progress}/{duration} {TITLE:24}\\n{time_left} left",
+    "{track_number}/{track_total} {album_artist} - {album} [{genre}] {release_date}",
+};
+
+/* Keeps results alive, so the compiler can't drop the work that produced them */
+static volatile bool sink;
+
+static void run(const char* name, int iterations, const std::function<void(int)>& f)
+{
+    using clock = std::chrono::steady_clock;
+    f(0); /* Warm up caches and lazily started threads */
+    const auto start = clock::now();
+    for (int i = 0; i < iterations; i++)
+        f(i);
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    printf("%-36s %12.0f ns/op (%i iterations)\n", name, double(ns) / iterations, iterations);
+}
+
+static void fill(song& s)
+{
+    s.set(meta::TITLE, QString("Never Gonna Give You Up"));
+    s.set(meta::ARTIST, QStringList { "Rick Astley", "Somebody Else" });
+    s.set(meta::ALBUM, QString("Whenever You Need Somebody"));
+    s.set(meta::ALBUM_ARTIST, QString("Rick Astley"));
+    s.set(meta::GENRE, QString("Pop"));
+    s.set(meta::RELEASE_YEAR, 1987);
+    s.set(meta::RELEASE_MONTH, 11);
+    s.set(meta::RELEASE_DAY, 12);
+    s.set(meta::TRACK_NUMBER, 1);
+    s.set(meta::TRACK_TOTAL, 10);
+    s.set(meta::DURATION, 213000);
+    s.set(meta::PROGRESS, 42000);
+    s.set(meta::STATUS, int(state_playing));
+}
+
+static void bench_format(int iterations, const song& s)
+{
+    QString out;
+    for (auto const* t : templates) {
+        auto const c = format::compile(t);
+        run(qt_to_utf8(QString("render '%1'").arg(QString(t).left(24))), iterations,
+            [&](int) { sink = c->render(s, out); });
+    }
+    run("compile (all templates)", iterations, [&](int) {
+        for (auto const* t : templates)
+            format::compile(t);
+    });
+}
+
+static void bench_song(int iterations, const song& s)
+{
+    song other = s;
+    run("song copy", iterations, [&](int) { other = s; });
+    run("song diff", iterations, [&](int i) {
+        other.set(meta::PROGRESS, i);
+        sink = s.diff(other).any();
+    });
+    run("song compare", iterations, [&](int) { sink = s == other; });
+
+    QJsonObject obj;
+    run("song to_json", iterations, [&](int) {
+        obj = {};
+        s.to_json(obj);
+    });
+    run("song from_json", iterations, [&](int) { other.from_json(obj); });
+}
+
+static void bench_outputs(int iterations, const song& s, const QString& dir)
+{
+    for (int count : { 1, 4, 16 }) {
+        config::outputs.clear();
+        for (int i = 0; i < count; i++) {
+            config::output o {};
+            o.format = templates[i % (sizeof(templates) / sizeof(*templates))];
+            o.path = dir + QString("/output_%1.txt").arg(i);
+            o.log_mode = false;
+            config::outputs.append(o);
+        }
+        config::publish_outputs();
+
+        /* The progress changes every tick, so every output is rendered again */
+        song tick = s;
+        run(qt_to_utf8(QString("handle_outputs (%1 outputs)").arg(count)), iterations, [&](int i) {
+            tick.set(meta::PROGRESS, i * 1000);
+            util::handle_outputs(tick, meta::mask(meta::bit(meta::PROGRESS)));
+        });
+    }
+    config::outputs.clear();
+    config::publish_outputs();
+}
+
+static void bench_covers(int iterations, int argc, char** argv)
+{
+    for (int i = 2; i < argc; i++) {
+        const QString path = utf8_to_qt(argv[i]);
+        if (!util::find_embedded_cover(path)) {
+            printf("%s has no embedded cover, skipped\n", argv[i]);
+            continue;
+        }
+        /* Tags are cached after the first read, so this mostly measures
+         * the cover being written to disk */
+        run(qt_to_utf8(("find_embedded_cover " + util::file_from_path(path))), iterations,
+            [&](int) { util::find_embedded_cover(path); });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = argc > 1 ? std::max(1, atoi(argv[1])) : 10000;
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fprintf(stderr, "Couldn't create a temporary folder\n");
+        return 1;
+    }
+
+    config::placeholder = "n/a";
+    config::cover_path = dir.filePath("cover.png");
+    config::cover_by_reference = false;
+    format::init();
+    output_thread::start();
+
+    song s;
+    fill(s);
+    bench_format(iterations, s);
+    bench_song(iterations, s);
+    bench_outputs(iterations, s, dir.path());
+    bench_covers(std::max(1, iterations / 100), argc, argv);
+
+    output_thread::stop();
+    render_pool::stop();
+    return 0;
+}
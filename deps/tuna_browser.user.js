@@ -1,7 +1,7 @@
 // ==UserScript==
 // @name         Tuna browser script
 // @namespace    univrsal
-// @version      1.0.18
+// @version      1.0.20
 // @description  Get song information from web players, based on NowSniper by Kıraç Armağan Önal
 // @author       univrsal
 // @match        *://open.spotify.com/*
@@ -24,12 +24,31 @@
     var port = 1608;
     var refresh_rate_ms = 500;
     var cooldown_ms = 10000;
+    // Collect updates and send them together with navigator.sendBeacon instead of one request each
+    var use_beacon = false;
+    var beacon_interval_ms = 2000;
+    // Hidden tabs that aren't playing anything only check every few ticks
+    var hidden_tick_divider = 4;
 
     // Tuna isn't running we sleep, because every failed request will log into the console
     // so we don't want to spam it
     var failure_count = 0;
     var cooldown = 0;
     var last_state = {};
+    // Tuna only listens to one tab at a time, the one that played last
+    var tab_id = Math.random().toString(36).slice(2);
+    var active = true;
+    var queue = [];
+    var tick_count = 0;
+
+    // Everything but the progress has to match for tuna to only receive the new progress
+    function same_track(a, b) {
+        for (const key of new Set([...Object.keys(a), ...Object.keys(b)])) {
+            if (key !== 'progress' && JSON.stringify(a[key]) !== JSON.stringify(b[key]))
+                return false;
+        }
+        return true;
+    }
 
     function post(data) {
         if (data.status) {
@@ -41,7 +60,42 @@
                 return; // Prevent the paused state from being continously sent, since this tab is not playing, should prevent tabs from clashing with eachother
             }
         }
+        if (!active && data.status !== "playing")
+            return; // Another tab is playing, tuna would ignore us anyway
+        var body;
+        if (same_track(data, last_state)) {
+            if (data.progress === last_state.progress)
+                return; // Nothing changed, no need to bother tuna
+            body = { data: { progress: data.progress }, delta: true, tab: tab_id };
+        } else {
+            body = { data, hostname: window.location.hostname, tab: tab_id };
+        }
         last_state = data;
+
+        if (use_beacon) {
+            // Only the latest progress matters
+            let last = queue[queue.length - 1];
+            if (body.delta && last && last.delta)
+                queue.pop();
+            queue.push(body);
+            return;
+        }
+        send(body);
+    }
+
+    function flush() {
+        if (queue.length === 0)
+            return;
+        // text/plain doesn't need a CORS preflight, which beacons can't do
+        let blob = new Blob([JSON.stringify({ batch: queue })], { type: 'text/plain' });
+        queue = [];
+        if (!navigator.sendBeacon('http://localhost:' + port + '/', blob)) {
+            failure_count++;
+            last_state = {};
+        }
+    }
+
+    function send(body) {
         var url = 'http://localhost:' + port + '/';
         var xhr = new XMLHttpRequest();
         xhr.open('POST', url);
@@ -55,11 +109,20 @@
             if (xhr.readyState === 4) {
                 if (xhr.status !== 200) {
                     failure_count++;
+                    last_state = {}; // Send everything again once tuna is reachable
+                    return;
                 }
+                try {
+                    active = JSON.parse(xhr.responseText).active !== false;
+                } catch (e) {
+                    active = true; // Older tuna versions answer with plain text
+                }
+                if (!active)
+                    last_state = {}; // Send everything once this tab plays again
             }
         };
 
-        xhr.send(JSON.stringify({data,hostname:window.location.hostname,date:Date.now()}));
+        xhr.send(JSON.stringify(body));
     }
 
     // Safely query something, and perform operations on it
@@ -81,272 +144,318 @@
         return 0;
     }
 
-    function StartFunction() {
-        setInterval(()=>{
-            if (failure_count > 3) {
-                console.log('Failed to connect multiple times, waiting a few seconds');
-                cooldown = cooldown_ms;
-                failure_count = 0;
-            }
-
-            if (cooldown > 0) {
-                cooldown -= refresh_rate_ms;
-                return;
-            }
+    function tick() {
+        if (failure_count > 3) {
+            console.log('Failed to connect multiple times, waiting a few seconds');
+            cooldown = cooldown_ms;
+            failure_count = 0;
+        }
 
-            let hostname = window.location.hostname;
-            // TODO: maybe add more?
-            if (hostname === 'soundcloud.com') {
-                let status = query('.playControl', e => e.classList.contains('playing') ? "playing" : "stopped", 'unknown');
-                let cover = query('.playbackSoundBadge span.sc-artwork', e => e.style.backgroundImage.slice(5, -2).replace('t50x50','t500x500'));
-                let title = query('.playbackSoundBadge__titleLink', e => e.title);
-                let artists = [ query('.playbackSoundBadge__lightLink', e => e.title) ];
-                let progress = query('.playbackTimeline__timePassed span:nth-child(2)', e => timestamp_to_ms(e.textContent));
-                let duration = query('.playbackTimeline__duration span:nth-child(2)', e => timestamp_to_ms(e.textContent));
-                let album_url = query('.playbackSoundBadge__titleLink', e => e.href);
-                let album = null;
-                // this header only exists on album/set pages so we know this is a full album
-                album = query('.fullListenHero .soundTitle__title', e => {
-                    album_url = window.location.href;
-                    return e.innerText
-                })
-
-                album = query('div.playlist.playing', e => {
-                    return e.getElementsByClassName('soundTitle__title')[0].innerText;
-                })
+        if (cooldown > 0) {
+            cooldown -= refresh_rate_ms;
+            return;
+        }
 
-                if (title !== null) {
-                    post({ cover, title, artists, status, progress, duration, album_url, album });
+        let hostname = window.location.hostname;
+        // TODO: maybe add more?
+        if (hostname === 'soundcloud.com') {
+            let status = query('.playControl', e => e.classList.contains('playing') ? "playing" : "stopped", 'unknown');
+            let cover = query('.playbackSoundBadge span.sc-artwork', e => e.style.backgroundImage.slice(5, -2).replace('t50x50','t500x500'));
+            let title = query('.playbackSoundBadge__titleLink', e => e.title);
+            let artists = [ query('.playbackSoundBadge__lightLink', e => e.title) ];
+            let progress = query('.playbackTimeline__timePassed span:nth-child(2)', e => timestamp_to_ms(e.textContent));
+            let duration = query('.playbackTimeline__duration span:nth-child(2)', e => timestamp_to_ms(e.textContent));
+            let album_url = query('.playbackSoundBadge__titleLink', e => e.href);
+            let album = null;
+            // this header only exists on album/set pages so we know this is a full album
+            album = query('.fullListenHero .soundTitle__title', e => {
+                album_url = window.location.href;
+                return e.innerText
+            })
+
+            album = query('div.playlist.playing', e => {
+                return e.getElementsByClassName('soundTitle__title')[0].innerText;
+            })
+
+            if (title !== null) {
+                post({ cover, title, artists, status, progress, duration, album_url, album });
+            }
+        } else if (hostname === 'open.spotify.com') {
+            let data = navigator.mediaSession;
+            let album = data.metadata.album;
+            let status = query('.vnCew8qzJq3cVGlYFXRI', e => e === null ? 'stopped' : (e.getAttribute('aria-label') === 'Play' ? 'stopped' : 'playing'));
+            let cover = data.metadata.artwork[0].src;
+            let title =  data.metadata.title
+            let artists = [data.metadata.artist]
+            let progress = query('.playback-bar__progress-time-elapsed', e => timestamp_to_ms(e.textContent));
+            let duration = query('.npFSJSO1wsu3mEEGb5bh', e => timestamp_to_ms(e.textContent));
+
+
+            if (title !== null) {
+                post({ cover, title, artists, status, progress, duration, album });
+            }
+        } else if (hostname === 'music.yandex.ru') {
+            // Yandex music support by MjKey
+            let status = query('.player-controls__btn_play', e => e.classList.contains('player-controls__btn_pause') ? "playing" : "stopped", 'unknown');
+            let cover = query('.track-cover .entity-cover__image', e => e.src.replace('50x50','200x200'));
+            let title = query('.track__title', e => e.title);
+            let artists = [ query('.track__artists', e => e.textContent) ];
+            let progress = query('.progress__left', e => timestamp_to_ms(e.textContent));
+            let duration = query('.progress__right', e => timestamp_to_ms(e.textContent));
+            let album_url = query('.track-cover a', e => e.title);
+
+            if (title !== null) {
+                post({ cover, title, artists, status, progress, duration, album_url });
+            }
+        } else if (hostname === 'www.youtube.com') {
+          if (!navigator.mediaSession.metadata) // if nothing is playing we don't submit anything, otherwise having two youtube tabs open causes issues
+              return;
+          let artists = [];
+
+          try {
+            artists = [ document.querySelector('div#upload-info').querySelector('a').innerText.trim().replace("\n", "") ];
+          } catch(e) {}
+
+          let title = query('.style-scope.ytd-video-primary-info-renderer', e => {
+            let t = e.getElementsByClassName('title');
+            if (t && t.length > 0)
+              return t[0].innerText;
+            return "";
+          });
+          let duration = query('video', e => e.duration * 1000);
+          let progress = query('video', e => e.currentTime * 1000);
+          let cover = "";
+          let status = query('video', e => e.paused ? 'stopped' : 'playing', 'unknown');
+          let regExp = /^.*(youtu\.be\/|v\/|u\/\w\/|embed\/|watch\?v=|\&v=)([^#\&\?]*).*/;
+          let match = window.location.toString().match(regExp);
+          if (match && match[2].length == 11) {
+            cover = `https://i.ytimg.com/vi/${match[2]}/maxresdefault.jpg`;
+          }
+
+
+          if (title !== null) {
+            title = title.replace(`${artists.join(", ")} - `, "");
+            title = title.replace(` - ${artists.join(", ")}`, "");
+            title = title.replace(`${artists.join(", ")}`, "");
+            title = title.replace("(Official Audio)", "");
+            title = title.replace("(Official Music Video)", "");
+            title = title.replace("(Original Video)", "");
+            title = title.replace("(Original Mix)", "");
+            if (status !== 'stopped') {
+                 post({ cover, title, artists, status, progress: Math.floor(progress), duration });
+            } else {
+              post({ status: 'stopped', title: '', artists: [], progress: 0, duration: 0});
+            }
+          }
+        } else if (hostname === 'music.youtube.com') {
+            if (!navigator.mediaSession.metadata) // if nothing is playing we don't submit anything, otherwise having two youtube tabs open causes issues
+              return;
+            // Youtube Music support by Rubecks
+            const artistsSelectors = [
+                '.ytmusic-player-bar.byline [href*="channel/"]:not([href*="channel/MPREb_"]):not([href*="browse/MPREb_"])', // Artists with links
+                '.ytmusic-player-bar.byline .yt-formatted-string:nth-child(2n+1):not([href*="browse/"]):not([href*="channel/"]):not(:nth-last-child(1)):not(:nth-last-child(3))', // Artists without links
+                '.ytmusic-player-bar.byline [href*="browse/FEmusic_library_privately_owned_artist_detaila_"]', // Self uploaded music
+            ];
+            const albumSelectors = [
+                '.ytmusic-player-bar [href*="browse/MPREb_"]', // Albums from YTM with links
+                '.ytmusic-player-bar [href*="browse/FEmusic_library_privately_owned_release_detailb_"]', // Self uploaded music
+            ];
+            let time = query('.ytmusic-player-bar.time-info', e => e.innerText.split(" / "));
+
+            let status = "unknown";
+            if (document.querySelector(".ytmusic-player-bar.play-pause-button path[d^='M6 19h4V5H6v14zm8-14v14h4V5h-4z']")) {
+              status = "playing";
+            }
+            if (document.querySelector(".ytmusic-player-bar.play-pause-button path[d^='M8 5v14l11-7z']")) {
+              status = "stopped"
+            }
+            let title = query('.ytmusic-player-bar.title', e => e.title);
+            let artists = Array.from(document.querySelectorAll(artistsSelectors)).map(x => x.innerText);
+            let album = query(albumSelectors, e => e.textContent);
+            let artwork = navigator.mediaSession.metadata.artwork;
+            let cover = artwork[artwork.length - 1].src;
+            let album_url = query(albumSelectors, e => e.href);
+            let progress = timestamp_to_ms(time[0]);
+            let duration = timestamp_to_ms(time[1]);
+            if (title !== null) {
+                post({ cover, title, artists, status, progress, duration, album_url, album });
+            }
+        } else if (hostname === 'www.deezer.com') {
+            let status = query('.player-controls', e => {
+                let buttons = e.getElementsByTagName('button');
+                if (buttons && buttons.length > 1) {
+                    if (buttons[1].getAttribute('aria-label') === 'Pause') {
+                        return "playing";
+                    } else {
+                        return "stopped";
+                    }
                 }
-            } else if (hostname === 'open.spotify.com') {
-                let data = navigator.mediaSession;
-                let album = data.metadata.album;
-                let status = query('.vnCew8qzJq3cVGlYFXRI', e => e === null ? 'stopped' : (e.getAttribute('aria-label') === 'Play' ? 'stopped' : 'playing'));
-                let cover = data.metadata.artwork[0].src;
-                let title =  data.metadata.title
-                let artists = [data.metadata.artist]
-                let progress = query('.playback-bar__progress-time-elapsed', e => timestamp_to_ms(e.textContent));
-                let duration = query('.npFSJSO1wsu3mEEGb5bh', e => timestamp_to_ms(e.textContent));
-
-
-                if (title !== null) {
-                    post({ cover, title, artists, status, progress, duration, album });
+                return "unknown";
+            });
+
+            let cover = query('button.queuelist.is-available', e => {
+                let img = e.getElementsByTagName('img');
+                if (img.length > 0) {
+                    let src = img[0].src; // https://e-cdns-images.dzcdn.net/images/cover/c4217689cc86e3e6a289162239424dc3/28x28-000000-80-0-0.jpg
+                    return src.replace('28x28', '512x512');
                 }
-            } else if (hostname === 'music.yandex.ru') {
-                // Yandex music support by MjKey
-                let status = query('.player-controls__btn_play', e => e.classList.contains('player-controls__btn_pause') ? "playing" : "stopped", 'unknown');
-                let cover = query('.track-cover .entity-cover__image', e => e.src.replace('50x50','200x200'));
-                let title = query('.track__title', e => e.title);
-                let artists = [ query('.track__artists', e => e.textContent) ];
-                let progress = query('.progress__left', e => timestamp_to_ms(e.textContent));
-                let duration = query('.progress__right', e => timestamp_to_ms(e.textContent));
-                let album_url = query('.track-cover a', e => e.title);
+                return null;
+            });
 
-                if (title !== null) {
-                    post({ cover, title, artists, status, progress, duration, album_url });
-                }
-            } else if (hostname === 'www.youtube.com') {
-              if (!navigator.mediaSession.metadata) // if nothing is playing we don't submit anything, otherwise having two youtube tabs open causes issues
-                  return;
-              let artists = [];
-
-              try {
-                artists = [ document.querySelector('div#upload-info').querySelector('a').innerText.trim().replace("\n", "") ];
-              } catch(e) {}
-
-              let title = query('.style-scope.ytd-video-primary-info-renderer', e => {
-                let t = e.getElementsByClassName('title');
-                if (t && t.length > 0)
-                  return t[0].innerText;
-                return "";
-              });
-              let duration = query('video', e => e.duration * 1000);
-              let progress = query('video', e => e.currentTime * 1000);
-              let cover = "";
-              let status = query('video', e => e.paused ? 'stopped' : 'playing', 'unknown');
-              let regExp = /^.*(youtu\.be\/|v\/|u\/\w\/|embed\/|watch\?v=|\&v=)([^#\&\?]*).*/;
-              let match = window.location.toString().match(regExp);
-              if (match && match[2].length == 11) {
-                cover = `https://i.ytimg.com/vi/${match[2]}/maxresdefault.jpg`;
-              }
-
-
-              if (title !== null) {
-                title = title.replace(`${artists.join(", ")} - `, "");
-                title = title.replace(` - ${artists.join(", ")}`, "");
-                title = title.replace(`${artists.join(", ")}`, "");
-                title = title.replace("(Official Audio)", "");
-                title = title.replace("(Official Music Video)", "");
-                title = title.replace("(Original Video)", "");
-                title = title.replace("(Original Mix)", "");
-                if (status !== 'stopped') {
-                     post({ cover, title, artists, status, progress: Math.floor(progress), duration });
-                } else {
-                  post({ status: 'stopped', title: '', artists: [], progress: 0, duration: 0});
-                }
-              }
-            } else if (hostname === 'music.youtube.com') {
-                if (!navigator.mediaSession.metadata) // if nothing is playing we don't submit anything, otherwise having two youtube tabs open causes issues
-                  return;
-                // Youtube Music support by Rubecks
-                const artistsSelectors = [
-                    '.ytmusic-player-bar.byline [href*="channel/"]:not([href*="channel/MPREb_"]):not([href*="browse/MPREb_"])', // Artists with links
-                    '.ytmusic-player-bar.byline .yt-formatted-string:nth-child(2n+1):not([href*="browse/"]):not([href*="channel/"]):not(:nth-last-child(1)):not(:nth-last-child(3))', // Artists without links
-                    '.ytmusic-player-bar.byline [href*="browse/FEmusic_library_privately_owned_artist_detaila_"]', // Self uploaded music
-                ];
-                const albumSelectors = [
-                    '.ytmusic-player-bar [href*="browse/MPREb_"]', // Albums from YTM with links
-                    '.ytmusic-player-bar [href*="browse/FEmusic_library_privately_owned_release_detailb_"]', // Self uploaded music
-                ];
-                let time = query('.ytmusic-player-bar.time-info', e => e.innerText.split(" / "));
-
-                let status = "unknown";
-                if (document.querySelector(".ytmusic-player-bar.play-pause-button path[d^='M6 19h4V5H6v14zm8-14v14h4V5h-4z']")) {
-                  status = "playing";
-                }
-                if (document.querySelector(".ytmusic-player-bar.play-pause-button path[d^='M8 5v14l11-7z']")) {
-                  status = "stopped"
+            let title = query('.marquee-content', e => {
+                let links = e.getElementsByClassName('track-link');
+                if (links.length > 0) {
+                    return links[0].textContent;
                 }
-                let title = query('.ytmusic-player-bar.title', e => e.title);
-                let artists = Array.from(document.querySelectorAll(artistsSelectors)).map(x => x.innerText);
-                let album = query(albumSelectors, e => e.textContent);
-                let artwork = navigator.mediaSession.metadata.artwork;
-                let cover = artwork[artwork.length - 1].src;
-                let album_url = query(albumSelectors, e => e.href);
-                let progress = timestamp_to_ms(time[0]);
-                let duration = timestamp_to_ms(time[1]);
-                if (title !== null) {
-                    post({ cover, title, artists, status, progress, duration, album_url, album });
-                }
-            } else if (hostname === 'www.deezer.com') {
-                let status = query('.player-controls', e => {
-                    let buttons = e.getElementsByTagName('button');
-                    if (buttons && buttons.length > 1) {
-                        if (buttons[1].getAttribute('aria-label') === 'Pause') {
-                            return "playing";
-                        } else {
-                            return "stopped";
-                        }
+                return null;
+            });
+            let artists = query('.marquee-content', e => {
+                let links = e.getElementsByClassName('track-link');
+                let artists = [];
+                if (links.length > 1) {
+                    for (var i = 1; i < links.length; i++) {
+                        artists.push(links[i].textContent);
                     }
-                    return "unknown";
-                });
+                    return artists;
+                }
+                return null;
+            });
 
-                let cover = query('button.queuelist.is-available', e => {
-                    let img = e.getElementsByTagName('img');
-                    if (img.length > 0) {
-                        let src = img[0].src; // https://e-cdns-images.dzcdn.net/images/cover/c4217689cc86e3e6a289162239424dc3/28x28-000000-80-0-0.jpg
-                        return src.replace('28x28', '512x512');
-                    }
-                    return null;
-                });
+            let duration = query('.slider-counter-max', e => timestamp_to_ms(e.textContent));
+            let progress = query('.slider-counter-current', e => timestamp_to_ms(e.textContent));
+            if (title !== null) {
+                post({ cover, title, artists, status, progress, duration });
+            }
+        } else if (hostname === "play.pretzel.rocks") {
+            // Pretzel.rocks support by Tarulia
+            // Thanks to Rory from Pretzel for helping out :)
 
-                let title = query('.marquee-content', e => {
-                    let links = e.getElementsByClassName('track-link');
-                    if (links.length > 0) {
-                        return links[0].textContent;
-                    }
-                    return null;
-                });
-                let artists = query('.marquee-content', e => {
-                    let links = e.getElementsByClassName('track-link');
-                    let artists = [];
-                    if (links.length > 1) {
-                        for (var i = 1; i < links.length; i++) {
-                            artists.push(links[i].textContent);
-                        }
-                        return artists;
-                    }
-                    return null;
-                });
+            let status = "unknown";
 
-                let duration = query('.slider-counter-max', e => timestamp_to_ms(e.textContent));
-                let progress = query('.slider-counter-current', e => timestamp_to_ms(e.textContent));
-                if (title !== null) {
-                    post({ cover, title, artists, status, progress, duration });
-                }
-            } else if (hostname === "play.pretzel.rocks") {
-                // Pretzel.rocks support by Tarulia
-                // Thanks to Rory from Pretzel for helping out :)
+            if (document.querySelector("[data-testid=pause-button]")) {
+              status = "playing";
+            }
 
-                let status = "unknown";
+            if (document.querySelector("[data-testid=play-button]")) {
+              status = "stopped";
+            }
 
-                if (document.querySelector("[data-testid=pause-button]")) {
-                  status = "playing";
+            let cover = query('[data-testid=track-artwork]', e => {
+                let img = e.getElementsByTagName('img');
+                if (img.length > 0) {
+                    let src = img[0].src; // https://img.pretzel.rocks/artwork/9Mf8m9/medium.jpg
+                    return src.replace('medium.jpg', 'large.jpg'); // https://img.pretzel.rocks/artwork/9Mf8m9/large.jpg
                 }
-
-                if (document.querySelector("[data-testid=play-button]")) {
-                  status = "stopped";
+                return null;
+            });
+
+            let title = query('[data-testid=title]', e => {
+                return e.textContent;
+            });
+
+            let artists = query('[data-testid=artist]', e => {
+                let elements = e.getElementsByTagName('a');
+                if (elements.length > 0) {
+                    let artistArray = [];
+                    for (let i = 0; i < elements.length; i++) {
+                        artistArray.push(elements[i].textContent);
+                    }
+                    return artistArray;
                 }
+                return null;
+            });
 
-                let cover = query('[data-testid=track-artwork]', e => {
-                    let img = e.getElementsByTagName('img');
-                    if (img.length > 0) {
-                        let src = img[0].src; // https://img.pretzel.rocks/artwork/9Mf8m9/medium.jpg
-                        return src.replace('medium.jpg', 'large.jpg'); // https://img.pretzel.rocks/artwork/9Mf8m9/large.jpg
-                    }
-                    return null;
-                });
+            let album = query('[data-testid=album]', e => {
+                return e.textContent;
+            });
 
-                let title = query('[data-testid=title]', e => {
-                    return e.textContent;
-                });
+            let album_url = query('[data-testid=album]', e => {
+                return e.href;
+            });
 
-                let artists = query('[data-testid=artist]', e => {
-                    let elements = e.getElementsByTagName('a');
-                    if (elements.length > 0) {
-                        let artistArray = [];
-                        for (let i = 0; i < elements.length; i++) {
-                            artistArray.push(elements[i].textContent);
-                        }
-                        return artistArray;
-                    }
-                    return null;
-                });
+            let duration = query('[data-testid=track-progress-bar]', e => e.max * 1000);
+            let progress = query('[data-testid=track-progress-bar]', e => e.value * 1000);
 
-                let album = query('[data-testid=album]', e => {
-                    return e.textContent;
-                });
+            if (title !== null) {
+                post({ cover, title, artists, status, progress, duration, album_url, album });
+            }
+        } else if (hostname === "app.plex.tv") {
+            // simple plex web support by javaarchive
+            // this is kind of more "universal" as it reads data from the browser media session api
+            // see https://developer.mozilla.org/en-US/docs/Web/API/Media_Session_API for more info
+            const mediaSessionStatesToTunaStates = {
+                "none": "unknown",
+                "playing":"playing",
+                "paused":"stopped"
+            }
+            let status = mediaSessionStatesToTunaStates[navigator.mediaSession.playbackState] || "unknown";
+            if(navigator.mediaSession.metadata){
+                let title = navigator.mediaSession.metadata.title;
+                let artists = [navigator.mediaSession.metadata.artist];
 
-                let album_url = query('[data-testid=album]', e => {
-                    return e.href;
-                });
+                let mediaElem = document.getElementsByTagName("audio")[0]; // add || document.getElementsByTagName("video")[0] to support sites like yt music where video includes audio
+                let progress = Math.floor(mediaElem.currentTime) * 1000;
+                let duration = Math.floor(mediaElem.duration) * 1000;
 
-                let duration = query('[data-testid=track-progress-bar]', e => e.max * 1000);
-                let progress = query('[data-testid=track-progress-bar]', e => e.value * 1000);
+                let artworks = navigator.mediaSession.metadata.artwork;
+                let album = navigator.mediaSession.metadata.album;
+                let album_url = artworks[artworks.length - 1].src;
+                let cover = album_url; // For now.
 
                 if (title !== null) {
-                    post({ cover, title, artists, status, progress, duration, album_url, album });
+                    post({ cover, title, artists, status, progress, duration, album, album_url });
                 }
-            } else if (hostname === "app.plex.tv") {
-                // simple plex web support by javaarchive
-                // this is kind of more "universal" as it reads data from the browser media session api
-                // see https://developer.mozilla.org/en-US/docs/Web/API/Media_Session_API for more info
-                const mediaSessionStatesToTunaStates = {
-                    "none": "unknown",
-                    "playing":"playing",
-                    "paused":"stopped"
-                }
-                let status = mediaSessionStatesToTunaStates[navigator.mediaSession.playbackState] || "unknown";
-                if(navigator.mediaSession.metadata){
-                    let title = navigator.mediaSession.metadata.title;
-                    let artists = [navigator.mediaSession.metadata.artist];
-
-                    let mediaElem = document.getElementsByTagName("audio")[0]; // add || document.getElementsByTagName("video")[0] to support sites like yt music where video includes audio
-                    let progress = Math.floor(mediaElem.currentTime) * 1000;
-                    let duration = Math.floor(mediaElem.duration) * 1000;
-
-                    let artworks = navigator.mediaSession.metadata.artwork;
-                    let album = navigator.mediaSession.metadata.album;
-                    let album_url = artworks[artworks.length - 1].src;
-                    let cover = album_url; // For now.
-
-                    if (title !== null) {
-                        post({ cover, title, artists, status, progress, duration, album, album_url });
+            }
+        }
+    }
+
+    // Reports right away when playback or the media session changes instead of waiting for the next tick
+    var pending_report = null;
+    function report_soon() {
+        if (pending_report === null)
+            pending_report = setTimeout(() => { pending_report = null; tick(); }, 50);
+    }
+
+    function watch_media_session() {
+        for (const event of ['play', 'pause', 'ended', 'seeked', 'loadedmetadata', 'emptied']) {
+            // Media events don't bubble, but they can be caught on the way down
+            document.addEventListener(event, report_soon, true);
+        }
+        try {
+            let proto = unsafeWindow.MediaSession.prototype;
+            for (const name of ['metadata', 'playbackState']) {
+                let prop = Object.getOwnPropertyDescriptor(proto, name);
+                if (!prop || !prop.set)
+                    continue;
+                Object.defineProperty(proto, name, {
+                    configurable: true,
+                    enumerable: prop.enumerable,
+                    get: prop.get,
+                    set: function(value) {
+                        prop.set.call(this, value);
+                        report_soon();
                     }
-                }
+                });
             }
+        } catch (e) {
+            console.log('Media session changes will be picked up on the next tick');
+        }
+    }
+
+    function StartFunction() {
+        watch_media_session();
+        setInterval(() => {
+            if (document.hidden && last_state.status !== 'playing' && (tick_count++ % hidden_tick_divider) !== 0)
+                return;
+            tick();
         }, refresh_rate_ms);
 
+        if (use_beacon) {
+            setInterval(flush, beacon_interval_ms);
+            // Last chance to send what's queued before the tab goes away
+            window.addEventListener('pagehide', flush);
+            document.addEventListener('visibilitychange', () => { if (document.hidden) flush(); });
+        }
     }
 
     StartFunction();
@@ -60,13 +60,16 @@ music_control::music_control(QWidget* parent)
     }
     connect(ui->cb_source, qOverload<int>(&QComboBox::currentIndexChanged), this, &music_control::source_changed);
     this->setContextMenuPolicy(Qt::CustomContextMenu);
-    m_timer = new QTimer(this);
-    connect(m_timer, SIGNAL(timeout()), SLOT(refresh_play_state()));
-
     connect(this, SIGNAL(customContextMenuRequested(QPoint)), this, SLOT(showcontextmenu(QPoint)));
 
-    /* This is dependent on tuna thread speed so lowering this wouldn't make a difference */
-    m_timer->start(700);
+    /* The query thread tells us about new songs, so nothing has to be polled */
+    connect(tuna_thread::events(), &tuna_thread::event_source::published, this, &music_control::refresh_play_state, Qt::QueuedConnection);
+    connect(tuna_thread::events(), &tuna_thread::event_source::state_changed, this, &music_control::refresh_thread_state, Qt::QueuedConnection);
+    connect(tuna_thread::events(), &tuna_thread::event_source::players_changed, this, &music_control::refresh_thread_state, Qt::QueuedConnection);
+
+    m_play_icon = QIcon("://images/icons/play.svg");
+    m_pause_icon = QIcon("://images/icons/pause.svg");
+    ui->btn_play_pause->setIcon(m_play_icon);
 
     m_song_text = new scroll_text(this);
     m_song_text->setMinimumWidth(200);
@@ -76,6 +79,7 @@ music_control::music_control(QWidget* parent)
     ui->volume_widget->setVisible(CGET_BOOL(CFG_DOCK_VOLUME_VISIBLE));
     m_song_text->setVisible(CGET_BOOL(CFG_DOCK_INFO_VISIBLE));
     ui->cb_source->setVisible(CGET_BOOL(CFG_DOCK_SOURCE_VISIBLE));
+    refresh_play_state(tuna_thread::snapshot());
 }
 
 void music_control::save_settings()
@@ -92,7 +96,7 @@ music_control::~music_control()
     CSET_BOOL(CFG_DOCK_VISIBLE, isVisible());
     if (isVisible()) {
         CSET_STR(CFG_DOCK_GEOMETRY, saveGeometry().toBase64().constData());
-        config_save_safe(config::instance, "tmp", nullptr);
+        config::request_save();
     }
 
     delete ui;
@@ -125,39 +129,49 @@ void music_control::on_btn_next_clicked()
     music_sources::selected_source()->execute_capability(CAP_NEXT_SONG);
 }
 
-void music_control::refresh_play_state()
+void music_control::refresh_play_state(std::shared_ptr<const tuna_thread::song_snapshot> snapshot)
 {
     static QString last_title = "";
-    song copy;
-
-    tuna_thread::copy_mutex.lock();
-    copy = tuna_thread::copy;
-    tuna_thread::copy_mutex.unlock();
-    QString icon = copy.get<int>(meta::STATUS) == state_playing ? "://images/icons/pause.svg" : "://images/icons/play.svg";
-    ui->btn_play_pause->setIcon(QIcon(icon));
-
-    /* refresh song info */
-    if (copy.get(meta::TITLE) != last_title) {
-        QString info = utf8_to_qt(T_DOCK_SONG_INFO);
-        if (copy.get<int>(meta::STATUS) <= state_paused) {
-            last_title = copy.get(meta::TITLE);
-            QString artists, title = copy.get(meta::TITLE);
-            artists = copy.get<QStringList>(meta::ARTIST).join(", ");
-            // Icecast and window title don't provide these
-            if (!artists.isEmpty()) {
-                info.append(artists);
-                info.append(" - ");
+    /* Queued signals can arrive out of order with the initial refresh */
+    if (m_last_snapshot && snapshot->generation < m_last_snapshot->generation)
+        return;
+    if (snapshot != m_last_snapshot) {
+        m_last_snapshot = snapshot;
+        const song& copy = snapshot->info;
+        bool const playing = copy.get<int>(meta::STATUS) == state_playing;
+        if (playing != m_showing_pause) {
+            m_showing_pause = playing;
+            ui->btn_play_pause->setIcon(playing ? m_pause_icon : m_play_icon);
+        }
+
+        /* refresh song info */
+        if (copy.get(meta::TITLE) != last_title) {
+            QString info = utf8_to_qt(T_DOCK_SONG_INFO);
+            if (copy.get<int>(meta::STATUS) <= state_paused) {
+                last_title = copy.get(meta::TITLE);
+                QString artists, title = copy.get(meta::TITLE);
+                artists = copy.get<QStringList>(meta::ARTIST).join(", ");
+                // Icecast and window title don't provide these
+                if (!artists.isEmpty()) {
+                    info.append(artists);
+                    info.append(" - ");
+                }
+                info.append(title);
+                last_title = title;
+            } else {
+                info.append(config::placeholder);
+                last_title = "n/a";
             }
-            info.append(title);
-            last_title = title;
-        } else {
-            info.append(config::placeholder);
-            last_title = "n/a";
+            info.replace("%s", " ");
+            m_song_text->set_text(info);
         }
-        info.replace("%s", " ");
-        m_song_text->set_text(info);
     }
 
+    refresh_thread_state();
+}
+
+void music_control::refresh_thread_state()
+{
     refresh_source();
     last_thread_state = tuna_thread::thread_flag;
     setEnabled(tuna_thread::thread_flag);
@@ -248,6 +262,7 @@ void music_control::source_changed(int index)
     if (config::post_load) {
         music_sources::select(qt_to_utf8(id));
         CSET_STR(CFG_SELECTED_SOURCE, qt_to_utf8(id));
+        refresh_source();
     }
 }
 
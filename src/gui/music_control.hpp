@@ -18,9 +18,10 @@
 
 #pragma once
 
+#include "../util/tuna_thread.hpp"
 #include "scrolltext.hpp"
 #include <QDockWidget>
-#include <QTimer>
+#include <QIcon>
 #include <memory>
 
 class music_source;
@@ -41,7 +42,8 @@ public:
     void select_source(int index);
 
 private slots:
-    void refresh_play_state();
+    void refresh_play_state(std::shared_ptr<const tuna_thread::song_snapshot> snapshot);
+    void refresh_thread_state();
     void showcontextmenu(const QPoint& pos);
     void toggle_title();
     void toggle_volume();
@@ -59,8 +61,12 @@ private:
     void save_settings();
     void refresh_source();
     bool last_thread_state = false;
+    /* Last song that was displayed, a new snapshot is only published if something changed */
+    std::shared_ptr<const tuna_thread::song_snapshot> m_last_snapshot;
     Ui::music_control* ui;
-    QTimer* m_timer = nullptr;
+    /* Loaded once instead of parsing the SVGs on every update */
+    QIcon m_play_icon, m_pause_icon;
+    bool m_showing_pause = false;
     scroll_text* m_song_text = nullptr;
 };
 
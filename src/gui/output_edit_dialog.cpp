@@ -20,8 +20,10 @@
 #include "../query/music_source.hpp"
 #include "../util/constants.hpp"
 #include "../util/format.hpp"
+#include "../util/utility.hpp"
 #include "tuna_gui.hpp"
 #include "ui_output_edit_dialog.h"
+#include <QComboBox>
 #include <QDir>
 #include <QFileDialog>
 #include <QFileInfo>
@@ -44,6 +46,9 @@ output_edit_dialog::output_edit_dialog(edit_mode m, QWidget* parent)
     connect(ui->browse, &QPushButton::clicked, this, &output_edit_dialog::browse_clicked);
     connect(ui->txt_format, &QLineEdit::textChanged, this, &output_edit_dialog::format_changed);
     connect(ui->buttonBox->button(QDialogButtonBox::Ok), &QPushButton::clicked, this, &output_edit_dialog::accept_clicked);
+    m_preview_timer.setSingleShot(true);
+    m_preview_timer.setInterval(150);
+    connect(&m_preview_timer, &QTimer::timeout, this, &output_edit_dialog::update_preview);
 
     ui->lbl_format_old->setVisible(false);
     ui->lbl_format_error->setVisible(false);
@@ -69,13 +74,24 @@ output_edit_dialog::output_edit_dialog(edit_mode m, QWidget* parent)
         }
     }
 
+    /* Offer all text sources that can be updated directly */
+    ui->cb_text_source->addItem("");
+    obs_enum_sources(
+        [](void* data, obs_source_t* src) {
+            if (util::is_text_source(src))
+                static_cast<QComboBox*>(data)->addItem(utf8_to_qt(obs_source_get_name(src)));
+            return true;
+        },
+        ui->cb_text_source);
+
     if (m == edit_mode::modify) {
-        QString format, path;
+        QString format, path, text_source;
         bool log_mode = false;
-        m_tuna->get_selected_output(format, path, log_mode);
+        m_tuna->get_selected_output(format, path, log_mode, text_source);
         ui->txt_format->setText(format);
         ui->txt_path->setText(path);
         ui->cb_logmode->setChecked(log_mode);
+        ui->cb_text_source->setCurrentText(text_source);
     }
 }
 
@@ -104,32 +120,39 @@ static inline bool is_valid_file(const QString& file)
 void output_edit_dialog::accept_clicked()
 {
     bool empty = ui->txt_format->text().isEmpty();
-    bool valid = is_valid_file(ui->txt_path->text());
+    auto text_source = ui->cb_text_source->currentText();
+    /* Outputs that only update a text source don't need a file */
+    bool valid = (ui->txt_path->text().isEmpty() && !text_source.isEmpty()) || is_valid_file(ui->txt_path->text());
 
     if (empty || !valid) {
         QMessageBox::warning(this, T_OUTPUT_ERROR_TITLE, T_OUTPUT_ERROR);
     }
 
     if (m_mode == edit_mode::create) {
-        m_tuna->add_output(ui->txt_format->text(), ui->txt_path->text(), ui->cb_logmode->isChecked());
+        m_tuna->add_output(ui->txt_format->text(), ui->txt_path->text(), ui->cb_logmode->isChecked(), text_source);
     } else {
-        m_tuna->edit_output(ui->txt_format->text(), ui->txt_path->text(), ui->cb_logmode->isChecked());
+        m_tuna->edit_output(ui->txt_format->text(), ui->txt_path->text(), ui->cb_logmode->isChecked(), text_source);
     }
 }
 
 void output_edit_dialog::format_changed(const QString& format)
 {
-    auto src = music_sources::selected_source();
-    if (src) {
-        auto copy = format;
-        ui->lbl_format_error->setVisible(!format::execute(copy));
-    }
+    m_preview_timer.start();
 
     static QRegularExpression e("%[a-zA-Z](\\[[0-9]+\\])?");
     Q_ASSERT(e.isValid());
     ui->lbl_format_old->setVisible(e.match(format).hasMatch());
 }
 
+void output_edit_dialog::update_preview()
+{
+    if (!music_sources::selected_source())
+        return;
+    auto preview = ui->txt_format->text();
+    ui->lbl_format_error->setVisible(!format::execute(preview));
+    ui->lbl_preview->setText(preview);
+}
+
 void output_edit_dialog::browse_clicked()
 {
     QString path = QFileDialog::getSaveFileName(this, tr(T_SELECT_SONG_FILE), QDir::home().path(),
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <QDialog>
+#include <QTimer>
 
 namespace Ui {
 class output_edit_dialog;
@@ -38,9 +39,12 @@ private slots:
     void browse_clicked();
     void accept_clicked();
     void format_changed(const QString& text);
+    void update_preview();
 
 private:
     Ui::output_edit_dialog* ui;
     edit_mode m_mode;
     tuna_gui* m_tuna;
+    /* Typing only renders the preview once it paused for a moment */
+    QTimer m_preview_timer;
 };
@@ -41,6 +41,8 @@ QString scroll_text::text() const
 
 void scroll_text::set_text(QString text)
 {
+    if (text == m_text)
+        return;
     m_text = text;
     update_text();
     update();
@@ -71,13 +73,35 @@ void scroll_text::update_text()
     if (m_scroll_enabled) {
         m_scroll_pos = -64;
         m_static_text.setText(m_text + m_separator);
-        m_timer.start();
     } else
         m_static_text.setText(m_text);
 
     m_static_text.prepare(QTransform(), font());
     m_whole_text_size = QSize(fontMetrics().horizontalAdvance(m_static_text.text()), fontMetrics().height());
 #undef horizontalAdvance
+
+    if (m_scroll_enabled && m_whole_text_size.width() > 0) {
+        auto const ratio = devicePixelRatioF();
+        m_strip = QPixmap(m_whole_text_size * ratio);
+        m_strip.setDevicePixelRatio(ratio);
+        m_strip.fill(Qt::transparent);
+        QPainter p(&m_strip);
+        p.setPen(palette().color(QPalette::WindowText));
+        p.setFont(font());
+        p.drawStaticText(QPointF(0, 0), m_static_text);
+    } else {
+        m_strip = QPixmap();
+    }
+    update_timer();
+}
+
+/* Only scroll while somebody can see it */
+void scroll_text::update_timer()
+{
+    if (m_scroll_enabled && isVisible() && !m_strip.isNull())
+        m_timer.start();
+    else
+        m_timer.stop();
 }
 
 void scroll_text::paintEvent(QPaintEvent*)
@@ -87,12 +111,10 @@ void scroll_text::paintEvent(QPaintEvent*)
     if (m_scroll_enabled) {
         m_buffer.fill(qRgba(0, 0, 0, 0));
         QPainter pb(&m_buffer);
-        pb.setPen(p.pen());
-        pb.setFont(p.font());
 
         int x = qMin(-m_scroll_pos, 0) + m_left_margin;
         while (x < width()) {
-            pb.drawStaticText(QPointF(x, (height() - m_whole_text_size.height()) / 2), m_static_text);
+            pb.drawPixmap(QPointF(x, (height() - m_whole_text_size.height()) / 2), m_strip);
             x += m_whole_text_size.width();
         }
 
@@ -142,6 +164,24 @@ void scroll_text::resizeEvent(QResizeEvent*)
         update_text();
 }
 
+void scroll_text::showEvent(QShowEvent*)
+{
+    update_timer();
+}
+
+void scroll_text::hideEvent(QHideEvent*)
+{
+    update_timer();
+}
+
+void scroll_text::changeEvent(QEvent* e)
+{
+    /* The strip has to be rendered again with the new font or colors */
+    if (e->type() == QEvent::FontChange || e->type() == QEvent::PaletteChange)
+        update_text();
+    QWidget::changeEvent(e);
+}
+
 void scroll_text::timer_timeout()
 {
     m_scroll_pos = (m_scroll_pos + 1) % m_whole_text_size.width();
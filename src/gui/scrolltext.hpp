@@ -21,6 +21,7 @@
  *************************************************************************/
 
 #pragma once
+#include <QPixmap>
 #include <QStaticText>
 #include <QTimer>
 #include <QWidget>
@@ -42,9 +43,13 @@ public:
 protected:
     virtual void paintEvent(QPaintEvent*);
     virtual void resizeEvent(QResizeEvent*);
+    virtual void showEvent(QShowEvent*);
+    virtual void hideEvent(QHideEvent*);
+    virtual void changeEvent(QEvent*);
 
 private:
     void update_text();
+    void update_timer();
     QString m_text;
     QString m_separator;
     QStaticText m_static_text;
@@ -55,6 +60,8 @@ private:
     int m_scroll_pos;
     QImage m_alpha_channel;
     QImage m_buffer;
+    /* Text and separator rendered once, scrolling only blits it */
+    QPixmap m_strip;
     QTimer m_timer;
 
 private slots:
@@ -19,8 +19,10 @@
 #include "tuna_gui.hpp"
 #include "../plugin-macros.generated.h"
 #include "../query/vlc_obs_source.hpp"
+#include "../util/activity.hpp"
 #include "../util/config.hpp"
 #include "../util/constants.hpp"
+#include "../util/shared_song.hpp"
 #include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include "../util/web_server.hpp"
@@ -73,6 +75,7 @@ tuna_gui::tuna_gui(QWidget* parent)
     setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
     ui->tbl_outputs->setColumnWidth(0, 100);
     ui->tbl_outputs->setColumnWidth(1, 180);
+    ui->tbl_outputs->setColumnWidth(2, 180);
 
     auto about_text = ui->label->text();
 #define MAKE_VERSION_STRING(prefix, postfix)                                                       \
@@ -97,9 +100,14 @@ tuna_gui::tuna_gui(QWidget* parent)
 
     ui->label->setText(about_text);
 
-    m_refresh = new QTimer(this);
-    connect(m_refresh, &QTimer::timeout, this, &tuna_gui::refresh);
-    m_refresh->stop();
+    /* Source tabs only have to be updated while the dialog is shown and something changed */
+    auto const refresh_visible = [this] {
+        if (isVisible())
+            refresh();
+    };
+    connect(tuna_thread::events(), &tuna_thread::event_source::published, this, refresh_visible, Qt::QueuedConnection);
+    connect(tuna_thread::events(), &tuna_thread::event_source::players_changed, this, refresh_visible, Qt::QueuedConnection);
+    connect(tuna_thread::events(), &tuna_thread::event_source::state_changed, this, &tuna_gui::set_state, Qt::QueuedConnection);
 
     int i = 0;
     for (const auto& Size : { 64, 128, 256, 512, 1024 }) {
@@ -113,21 +121,35 @@ tuna_gui::tuna_gui(QWidget* parent)
     if (config::cover_size == 8129)
         ui->cb_cover_size->setCurrentIndex(i);
 
+    ui->cb_idle_mode->addItem(T_IDLE_OFF, activity::IDLE_OFF);
+    ui->cb_idle_mode->addItem(T_IDLE_SLOW, activity::IDLE_SLOW);
+    ui->cb_idle_mode->addItem(T_IDLE_SUSPEND, activity::IDLE_SUSPEND);
+
     connect(ui->cb_dl_lyrics, &QCheckBox::stateChanged, this, [this](int s) {
         ui->frame_lyrics->setEnabled(s == Qt::CheckState::Checked);
     });
 
     connect(ui->cb_dl_cover, &QCheckBox::stateChanged, this, [this](int s) {
         ui->cb_download_missing->setEnabled(s == Qt::CheckState::Checked);
-        ui->cb_cover_size->setEnabled(s == Qt::CheckState::Checked && ui->cb_download_missing->isChecked());
+        ui->cb_normalize_cover->setEnabled(s == Qt::CheckState::Checked);
+        update_cover_size_state();
         ui->frame_cover->setEnabled(s == Qt::CheckState::Checked);
     });
 
-    connect(ui->cb_download_missing, &QCheckBox::stateChanged, this, [this](int s) {
-        ui->cb_cover_size->setEnabled(s == Qt::CheckState::Checked);
+    connect(ui->cb_download_missing, &QCheckBox::stateChanged, this, [this](int) {
+        update_cover_size_state();
+    });
+    connect(ui->cb_normalize_cover, &QCheckBox::stateChanged, this, [this](int) {
+        update_cover_size_state();
     });
 }
 
+void tuna_gui::update_cover_size_state()
+{
+    /* The size is used for iTunes searches and for scaling covers */
+    ui->cb_cover_size->setEnabled(ui->cb_dl_cover->isChecked() && (ui->cb_download_missing->isChecked() || ui->cb_normalize_cover->isChecked()));
+}
+
 void tuna_gui::choose_file(QString& path, const char* title, const char* file_types)
 {
     path = QFileDialog::getSaveFileName(this, tr(title), QDir::home().path(), tr(file_types));
@@ -150,7 +172,7 @@ void tuna_gui::toggleShowHide()
 {
     setVisible(!isVisible());
     if (isVisible()) {
-        m_refresh->start(250);
+        refresh();
         /* Load config values for sources on dialog show */
         music_sources::set_gui_values();
 
@@ -158,24 +180,32 @@ void tuna_gui::toggleShowHide()
         ui->txt_song_cover->setText(config::cover_path);
         ui->txt_song_lyrics->setText(config::lyrics_path);
         ui->sb_refresh_rate->setValue(config::refresh_rate);
+        ui->cb_idle_mode->setCurrentIndex(qMax(0, ui->cb_idle_mode->findData(config::idle_mode)));
         ui->txt_song_placeholder->setText(config::placeholder);
         ui->cb_dl_lyrics->setChecked(config::download_lyrics);
         ui->cb_dl_cover->setChecked(config::download_cover);
         ui->cb_download_missing->setChecked(config::download_missing_cover);
+        ui->cb_normalize_cover->setChecked(config::cover_normalize);
         auto idx = ui->cb_source->findData(config::selected_source);
 
         ui->frame_lyrics->setEnabled(ui->cb_dl_lyrics->isChecked());
         ui->frame_cover->setEnabled(ui->cb_dl_cover->isChecked());
         ui->cb_download_missing->setEnabled(ui->cb_dl_cover->isChecked());
-        ui->cb_cover_size->setEnabled(ui->cb_dl_cover->isChecked() && ui->cb_download_missing->isChecked());
+        ui->cb_normalize_cover->setEnabled(ui->cb_dl_cover->isChecked());
+        update_cover_size_state();
 
         if (idx >= 0)
             ui->cb_source->setCurrentIndex(idx);
         else
             ui->cb_source->setCurrentIndex(0);
+        ui->cb_auto_select->setChecked(config::auto_select_source);
         ui->cb_host_server->setChecked(config::webserver_enabled);
         ui->sb_web_port->setValue(config::webserver_port);
+        ui->cb_server_local_only->setChecked(config::webserver_local_only);
+        ui->cb_server_control->setChecked(config::webserver_control);
         ui->cb_remove_file_extensions->setChecked(config::remove_file_extensions);
+        ui->cb_shared_memory->setChecked(config::shared_memory);
+        ui->cb_restore_state->setChecked(config::restore_state);
         set_state();
 
         /* Load table contents */
@@ -188,10 +218,9 @@ void tuna_gui::toggleShowHide()
             ui->tbl_outputs->setItem(row, 0, new QTableWidgetItem(entry.log_mode ? "Yes" : "No"));
             ui->tbl_outputs->setItem(row, 1, new QTableWidgetItem(entry.format));
             ui->tbl_outputs->setItem(row, 2, new QTableWidgetItem(entry.path));
+            ui->tbl_outputs->setItem(row, 3, new QTableWidgetItem(entry.text_source));
             row++;
         }
-    } else {
-        m_refresh->stop();
     }
 }
 
@@ -220,16 +249,23 @@ void tuna_gui::tuna_gui_accepted()
     tuna_thread::thread_mutex.lock();
     // Save UI values into temp storage
     config::selected_source = qt_to_utf8(ui->cb_source->currentData().toString());
+    config::auto_select_source = ui->cb_auto_select->isChecked();
     config::cover_path = qt_to_utf8(ui->txt_song_cover->text());
     config::lyrics_path = qt_to_utf8(ui->txt_song_lyrics->text());
     config::refresh_rate = ui->sb_refresh_rate->value();
+    config::idle_mode = ui->cb_idle_mode->currentData().toUInt();
     config::placeholder = qt_to_utf8(ui->txt_song_placeholder->text());
     config::download_lyrics = ui->cb_dl_lyrics->isChecked();
     config::download_cover = ui->cb_dl_cover->isChecked();
     config::download_missing_cover = ui->cb_download_missing->isChecked();
+    config::cover_normalize = ui->cb_normalize_cover->isChecked();
     config::webserver_enabled = ui->cb_host_server->isChecked();
     config::webserver_port = ui->sb_web_port->value();
+    config::webserver_local_only = ui->cb_server_local_only->isChecked();
+    config::webserver_control = ui->cb_server_control->isChecked();
     config::remove_file_extensions = ui->cb_remove_file_extensions->isChecked();
+    config::shared_memory = ui->cb_shared_memory->isChecked();
+    config::restore_state = ui->cb_restore_state->isChecked();
     config::cover_size = ui->cb_cover_size->currentData().toInt();
     config::refresh_rate = ui->sb_refresh_rate->value();
 
@@ -240,6 +276,7 @@ void tuna_gui::tuna_gui_accepted()
         tmp.log_mode = ui->tbl_outputs->item(row, 0)->text() == "Yes";
         tmp.format = ui->tbl_outputs->item(row, 1)->text();
         tmp.path = ui->tbl_outputs->item(row, 2)->text();
+        tmp.text_source = ui->tbl_outputs->item(row, 3)->text();
         config::outputs.push_back(tmp);
     }
 
@@ -254,6 +291,8 @@ void tuna_gui::tuna_gui_accepted()
 
     config::save();
     config::load();
+    /* Opens or removes the shared memory segment right away */
+    shared_song::publish(*tuna_thread::snapshot());
     if (music_dock)
         music_dock->select_source(ui->cb_source->currentIndex());
 }
@@ -294,22 +333,24 @@ void tuna_gui::btn_browse_song_lyrics_clicked()
         ui->txt_song_lyrics->setText(path);
 }
 
-void tuna_gui::add_output(const QString& format, const QString& path, bool log_mode)
+void tuna_gui::add_output(const QString& format, const QString& path, bool log_mode, const QString& text_source)
 {
     int row = ui->tbl_outputs->rowCount();
     ui->tbl_outputs->insertRow(row);
     ui->tbl_outputs->setItem(row, 0, new QTableWidgetItem(log_mode ? "Yes" : "No"));
     ui->tbl_outputs->setItem(row, 1, new QTableWidgetItem(format));
     ui->tbl_outputs->setItem(row, 2, new QTableWidgetItem(path));
+    ui->tbl_outputs->setItem(row, 3, new QTableWidgetItem(text_source));
 }
 
-void tuna_gui::edit_output(const QString& format, const QString& path, bool log_mode)
+void tuna_gui::edit_output(const QString& format, const QString& path, bool log_mode, const QString& text_source)
 {
     auto selection = ui->tbl_outputs->selectedItems();
-    if (!selection.empty() && selection.size() > 1) {
+    if (!selection.empty() && selection.size() > 3) {
         selection.at(0)->setText(log_mode ? "Yes" : "No");
         selection.at(1)->setText(format);
         selection.at(2)->setText(path);
+        selection.at(3)->setText(text_source);
     }
 }
 
@@ -332,13 +373,14 @@ void tuna_gui::btn_remove_output_clicked()
     }
 }
 
-void tuna_gui::get_selected_output(QString& format, QString& path, bool& log_mode)
+void tuna_gui::get_selected_output(QString& format, QString& path, bool& log_mode, QString& text_source)
 {
     auto selection = ui->tbl_outputs->selectedItems();
-    if (!selection.empty() && selection.size() > 1) {
+    if (!selection.empty() && selection.size() > 3) {
         log_mode = selection.at(0)->text() == "Yes";
         format = selection.at(1)->text();
         path = selection.at(2)->text();
+        text_source = selection.at(3)->text();
     }
 }
 
@@ -353,7 +395,7 @@ void tuna_gui::btn_edit_output_clicked()
     }
 }
 
-void tuna_gui::cb_download_missing_covers_clicked(int state)
+void tuna_gui::cb_download_missing_covers_clicked(int)
 {
-    ui->cb_cover_size->setEnabled(state == Qt::CheckState::Checked);
+    update_cover_size_state();
 }
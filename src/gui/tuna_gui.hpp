@@ -42,7 +42,6 @@ class tuna_gui : public QDialog {
     Q_OBJECT
 
     QList<source_widget*> m_source_widgets;
-    QTimer* m_refresh = nullptr;
 
 public:
     explicit tuna_gui(QWidget* parent = nullptr);
@@ -50,9 +49,9 @@ public:
     ~tuna_gui();
 
     void toggleShowHide();
-    void add_output(const QString& format, const QString& path, bool log_mode);
-    void edit_output(const QString& format, const QString& path, bool log_mode);
-    void get_selected_output(QString& format, QString& path, bool& log_mode);
+    void add_output(const QString& format, const QString& path, bool log_mode, const QString& text_source);
+    void edit_output(const QString& format, const QString& path, bool log_mode, const QString& text_source);
+    void get_selected_output(QString& format, QString& path, bool& log_mode, QString& text_source);
 
     void add_source(const QString& display, const QString& id, source_widget* w);
     void refresh();
@@ -74,6 +73,7 @@ private slots:
 
 private:
     void choose_file(QString& path, const char* title, const char* file_types);
+    void update_cover_size_state();
     Ui::tuna_gui* ui;
 };
 
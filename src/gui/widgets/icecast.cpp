@@ -37,9 +37,11 @@ icecast::~icecast()
 void icecast::load_settings()
 {
     ui->txt_icecast_url->setText(utf8_to_qt(CGET_STR(CFG_ICECAST_URL)));
+    ui->cb_icecast_stream->setChecked(CGET_BOOL(CFG_ICECAST_STREAM));
 }
 
 void icecast::save_settings()
 {
     CSET_STR(CFG_ICECAST_URL, qt_to_utf8(ui->txt_icecast_url->text()));
+    CSET_BOOL(CFG_ICECAST_STREAM, ui->cb_icecast_stream->isChecked());
 }
@@ -186,7 +186,9 @@ void spotify::on_btn_request_token_clicked()
             if (spotify) {
                 QString log;
                 bool result = spotify->new_token(log);
-                m_token_request_promise->set_value_at_thread_exit({ result, log });
+                m_token_request_promise->set_value({ result, log });
+                /* Picks up the result on the UI thread */
+                QMetaObject::invokeMethod(this, [this] { tick(); }, Qt::QueuedConnection);
             }
         }).detach();
     } else {
@@ -237,7 +239,8 @@ void spotify::on_btn_performrefresh_clicked()
             if (spotify) {
                 QString log;
                 bool result = spotify->do_refresh_token(log);
-                m_token_refresh_promise->set_value_at_thread_exit({ result, log });
+                m_token_refresh_promise->set_value({ result, log });
+                QMetaObject::invokeMethod(this, [this] { tick(); }, Qt::QueuedConnection);
             }
         }).detach();
     } else {
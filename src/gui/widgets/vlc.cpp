@@ -232,7 +232,7 @@ void vlc::on_add_source()
     auto* scene = obs_get_scene_by_name(qt_to_utf8(scene_id));
 
     if (src && scene) {
-        std::lock_guard<std::mutex> lock(tuna_thread::thread_mutex);
+        std::lock_guard<std::shared_mutex> lock(tuna_thread::thread_mutex);
         if (m_source_map[sc].toObject().contains(scene_id)) {
             auto arr = m_source_map[sc].toObject()[scene_id].toArray();
             arr.append(src_id);
@@ -19,11 +19,120 @@
 #include "icecast_source.hpp"
 #include "../gui/widgets/icecast.hpp"
 #include "../util/config.hpp"
+#include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
+#include "util/dstr.h"
+#include "util/platform.h"
 #include <QDateTime>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <curl/curl.h>
+#include <mutex>
+
+/* The stream is closed once the source hasn't been refreshed for this long,
+ * which happens when another source was selected */
+static const uint64_t stream_idle_timeout = 15 * SECOND_TO_NS;
+static const uint64_t stream_retry_delay = 5 * SECOND_TO_NS;
+
+/* Shared with the http thread, which is still reading the stream
+ * after a new one was opened */
+struct icy_stream {
+    std::atomic<bool> closed { false };
+    std::atomic<uint64_t> last_used { 0 };
+
+    /* Only touched by the http thread */
+    size_t metaint = 0;
+    size_t until_meta = 0;
+    size_t meta_left = 0;
+    std::string meta;
+
+    std::mutex mutex;
+    QString title;
+    bool no_metadata = false;
+
+    bool header(const char* line, size_t len);
+    bool data(const char* ptr, size_t len);
+    void parse_meta();
+};
+
+bool icy_stream::header(const char* line, size_t len)
+{
+    static const char key[] = "icy-metaint:";
+    const size_t key_len = sizeof(key) - 1;
+    /* A new response after a redirect */
+    if (len >= 5 && strncmp(line, "HTTP/", 5) == 0)
+        metaint = 0;
+    else if (len > key_len && astrcmpi_n(line, key, key_len) == 0)
+        until_meta = metaint = strtoul(std::string(line + key_len, len - key_len).c_str(), nullptr, 10);
+    return true;
+}
+
+bool icy_stream::data(const char* ptr, size_t len)
+{
+    if (metaint == 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        no_metadata = true;
+        return false;
+    }
+
+    /* The audio is skipped without being copied, only the metadata
+     * blocks in between are kept */
+    while (len > 0) {
+        if (meta_left > 0) {
+            auto n = std::min(len, meta_left);
+            meta.append(ptr, n);
+            meta_left -= n;
+            ptr += n;
+            len -= n;
+            if (meta_left == 0) {
+                parse_meta();
+                until_meta = metaint;
+            }
+        } else if (until_meta > 0) {
+            auto n = std::min(len, until_meta);
+            until_meta -= n;
+            ptr += n;
+            len -= n;
+        } else {
+            /* The length byte counts in blocks of 16 bytes */
+            meta_left = size_t(uint8_t(*ptr)) * 16;
+            meta.clear();
+            ptr++;
+            len--;
+            if (meta_left == 0)
+                until_meta = metaint;
+        }
+    }
+    return !closed && os_gettime_ns() - last_used < stream_idle_timeout;
+}
+
+void icy_stream::parse_meta()
+{
+    static const char key[] = "StreamTitle='";
+    auto begin = meta.find(key);
+    if (begin == std::string::npos)
+        return;
+    begin += sizeof(key) - 1;
+    auto end = meta.find("';", begin);
+    if (end == std::string::npos)
+        end = meta.find_last_of('\'');
+    if (end == std::string::npos || end < begin)
+        return;
+
+    auto raw = QByteArray(meta.data() + begin, int(end - begin));
+    auto new_title = QString::fromUtf8(raw);
+    /* Older stations still send latin1 */
+    if (new_title.contains(QChar::ReplacementCharacter))
+        new_title = QString::fromLatin1(raw);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (new_title == title)
+            return;
+        title = new_title;
+    }
+    tuna_thread::wakeup(S_SOURCE_ICECAST);
+}
 
 icecast_source::icecast_source()
     : music_source(S_SOURCE_ICECAST, T_SOURCE_ICECAST, new icecast)
@@ -35,63 +144,135 @@ void icecast_source::load()
 {
     music_source::load();
     CDEF_STR(CFG_ICECAST_URL, "");
-    m_url = utf8_to_qt(CGET_STR(CFG_ICECAST_URL)) + "/status-json.xsl";
+    CDEF_BOOL(CFG_ICECAST_STREAM, false);
+    m_use_stream = CGET_BOOL(CFG_ICECAST_STREAM);
+    m_url = utf8_to_qt(CGET_STR(CFG_ICECAST_URL));
+    if (!m_use_stream && !m_url.isEmpty())
+        m_url += "/status-json.xsl";
     m_logged_response_too_big = false;
+
+    /* The old stream or status request is dropped, the http thread
+     * lets go of the stream on its own */
+    if (m_stream)
+        m_stream->closed = true;
+    m_stream.reset();
+    m_pending = {};
 }
 
-void icecast_source::refresh()
+uint64_t icecast_source::next_refresh(uint64_t now) const
+{
+    /* New titles wake up the query thread when they're broadcast */
+    if (m_use_stream)
+        return std::max(now + stream_retry_delay, m_blocked_until);
+    return music_source::next_refresh(now);
+}
+
+void icecast_source::refresh_stream()
 {
-    static char error_buffer[CURL_ERROR_SIZE];
+    begin_refresh();
+    const auto now = os_gettime_ns();
+
+    if (m_pending.valid() && m_pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        auto const res = m_pending.get();
+        bool no_metadata;
+        {
+            std::lock_guard<std::mutex> lock(m_stream->mutex);
+            no_metadata = m_stream->no_metadata;
+        }
+        if (res.status >= 400) {
+            berr("The IceCast stream %s responded with HTTP %li", qt_to_utf8(m_url), res.status);
+            defer_refresh(stream_retry_delay * 12);
+        } else if (no_metadata) {
+            berr("The IceCast stream %s doesn't send ICY metadata", qt_to_utf8(m_url));
+            defer_refresh(stream_retry_delay * 12);
+        } else if (res.result != CURLE_OK && res.result != CURLE_WRITE_ERROR && res.result != CURLE_ABORTED_BY_CALLBACK) {
+            berr("IceCast stream %s closed: cURL error '%s' (%i)", qt_to_utf8(m_url), res.error.c_str(), res.result);
+            defer_refresh(stream_retry_delay);
+        }
+        m_stream.reset();
+        return;
+    }
+
+    if (!m_pending.valid()) {
+        /* Without the http thread the stream would block the query thread */
+        if (!async_http::running())
+            return;
+        m_stream = std::make_shared<icy_stream>();
+        m_stream->last_used = now;
 
+        auto stream = m_stream;
+        async_http::request req;
+        req.url = qt_to_utf8(m_url);
+        req.headers.emplace_back("Icy-MetaData: 1");
+        req.timeout_ms = 0;
+        req.cancelled = [stream] { return stream->closed || os_gettime_ns() - stream->last_used >= stream_idle_timeout; };
+        req.on_header = [stream](const char* line, size_t len) { return stream->header(line, len); };
+        req.on_data = [stream](const char* ptr, size_t len) { return stream->data(ptr, len); };
+        m_pending = async_http::fetch(std::move(req), [] { tuna_thread::wakeup(S_SOURCE_ICECAST); });
+    }
+
+    m_stream->last_used = now;
+    std::lock_guard<std::mutex> lock(m_stream->mutex);
+    if (!m_stream->title.isEmpty()) {
+        m_current.set(meta::TITLE, m_stream->title);
+        m_current.set(meta::STATUS, state_playing);
+    }
+}
+
+void icecast_source::refresh()
+{
     if (m_logged_response_too_big || m_url.isEmpty())
         return;
 
+    if (m_use_stream) {
+        refresh_stream();
+        return;
+    }
+
     begin_refresh();
-    auto* curl = curl_easy_init();
-    if (curl) {
-        error_buffer[0] = '\0';
-        std::string response;
-        curl_easy_setopt(curl, CURLOPT_URL, qt_to_utf8(m_url));
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, util::write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buffer);
-        auto result = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
-
-        if (result == CURLE_OK) {
-            // Pretty arbitrary, but I have tested this with some stations
-            // and they respond with ~1MB of data which we will not parse
-            if (response.length() > 1024 * 512) {
-                m_logged_response_too_big = true;
-                berr("The IceCast server at %s responded with %zu bytes of data "
-                     "which is too long and therefore will not be processed",
-                    qt_to_utf8(m_url), response.length());
-                return;
-            }
-            QJsonParseError err;
-            auto doc = QJsonDocument::fromJson(response.c_str(), &err);
-
-            if (doc.isNull() || !doc.isObject()) {
-                berr("Failed to parse json response from IceCast server: %s", qt_to_utf8(err.errorString()));
-            } else {
-                auto stats = doc.object()["icestats"].toObject();
-                if (!stats.isEmpty()) {
-                    auto source = stats["source"].toObject();
-                    if (source["title"].isString()) {
-                        m_current.set(meta::TITLE, source["title"].toString());
-                        m_current.set(meta::STATUS, state_playing);
-                    }
-                }
-            }
+    if (!m_pending.valid()) {
+        async_http::request req;
+        req.url = qt_to_utf8(m_url);
+        m_pending = async_http::fetch(std::move(req), [] { tuna_thread::wakeup(S_SOURCE_ICECAST); });
+    }
+
+    /* The previous information stays until the response is there, which
+     * wakes up the query thread */
+    if (m_pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+
+    auto const res = m_pending.get();
+    if (res.result == CURLE_OK) {
+        // Pretty arbitrary, but I have tested this with some stations
+        // and they respond with ~1MB of data which we will not parse
+        if (res.body.length() > 1024 * 512) {
+            m_logged_response_too_big = true;
+            berr("The IceCast server at %s responded with %zu bytes of data "
+                 "which is too long and therefore will not be processed",
+                qt_to_utf8(m_url), res.body.length());
+            return;
+        }
+        QJsonParseError err;
+        auto doc = QJsonDocument::fromJson(QByteArray::fromStdString(res.body), &err);
+
+        if (doc.isNull() || !doc.isObject()) {
+            berr("Failed to parse json response from IceCast server: %s", qt_to_utf8(err.errorString()));
         } else {
-            auto epoch = QDateTime::currentSecsSinceEpoch();
-            if (m_last_log == 0 || m_last_log - epoch > 10) {
-                m_last_log = epoch;
-                berr("Failed to retrieve information from IceCast server %s: cURL error '%s' (%i)",
-                    qt_to_utf8(m_url), curl_easy_strerror(result), result);
-                if (strlen(error_buffer) > 0)
-                    berr("Additional curl error message: %s", error_buffer);
+            auto stats = doc.object()["icestats"].toObject();
+            if (!stats.isEmpty()) {
+                auto source = stats["source"].toObject();
+                if (source["title"].isString()) {
+                    m_current.set(meta::TITLE, source["title"].toString());
+                    m_current.set(meta::STATUS, state_playing);
+                }
             }
         }
+    } else {
+        auto epoch = QDateTime::currentSecsSinceEpoch();
+        if (m_last_log == 0 || m_last_log - epoch > 10) {
+            m_last_log = epoch;
+            berr("Failed to retrieve information from IceCast server %s: cURL error '%s' (%i)",
+                qt_to_utf8(m_url), res.error.c_str(), res.result);
+        }
     }
 }
@@ -17,20 +17,36 @@
  *************************************************************************/
 
 #pragma once
+#include "../util/async_http.hpp"
 #include "../util/constants.hpp"
 #include "music_source.hpp"
 #include <QString>
+#include <atomic>
+#include <future>
+#include <memory>
+
+struct icy_stream;
 
 class icecast_source : public music_source {
     QString m_url {};
+    /* Request that was sent by a previous refresh */
+    std::future<async_http::response> m_pending;
     qint64 m_last_log {};
     bool m_logged_response_too_big { false };
 
+    /* Reads the titles from the metadata interleaved with the stream
+     * instead of downloading the server's status page on every refresh */
+    bool m_use_stream { false };
+    std::shared_ptr<icy_stream> m_stream;
+
+    void refresh_stream();
+
 public:
     icecast_source();
 
     void load() override;
     void refresh() override;
+    uint64_t next_refresh(uint64_t now) const override;
     bool execute_capability(capability) override { return false; };
     bool enabled() const override { return true; };
 };
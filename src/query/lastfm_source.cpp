@@ -18,7 +18,9 @@
 
 #include "lastfm_source.hpp"
 #include "../gui/widgets/lastfm.hpp"
+#include "../util/async_http.hpp"
 #include "../util/config.hpp"
+#include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include "util/platform.h"
 #include <QJsonArray>
@@ -28,12 +30,12 @@
 #include <QUrl>
 #include <curl/curl.h>
 
-long lastfm_request(QJsonDocument& response_json, const QString& url);
+long lastfm_result(const async_http::response& res, QJsonDocument& response_json);
 
 lastfm_source::lastfm_source()
     : music_source(S_SOURCE_LAST_FM, T_SOURCE_LASTFM, new lastfm)
 {
-    supported_metadata({ meta::ALBUM, meta::COVER, meta::TITLE, meta::ARTIST, meta::DURATION });
+    supported_metadata({ meta::ALBUM, meta::COVER, meta::TITLE, meta::ARTIST, meta::DURATION, meta::PROGRESS });
 }
 
 void lastfm_source::load()
@@ -59,19 +61,22 @@ void lastfm_source::refresh()
     if (m_username.isEmpty())
         return;
 
-    /* last.fm doesn't want apps to constantly send requets
-     * to their API points
-     * so this source uses slower refresh than the user might configure
-     * in the gui if the shared api key is used
-     */
-    if (!m_custom_api_key && os_gettime_ns() < m_next_refresh)
+    begin_refresh();
+    if (!m_pending.valid()) {
+        QString track_request = "https://ws.audioscrobbler.com/2.0/?method=user.getrecenttracks&user=" + m_username + "&api_key=" + m_api_key + "&limit=1&format=json";
+        async_http::request req;
+        req.url = qt_to_utf8(track_request);
+        m_pending = async_http::fetch(std::move(req), [] { tuna_thread::wakeup(S_SOURCE_LAST_FM); });
+    }
+
+    /* The previous information stays until the response is there, which
+     * wakes up the query thread */
+    if (m_pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
         return;
 
-    begin_refresh();
     m_current.clear();
-    QString track_request = "https://ws.audioscrobbler.com/2.0/?method=user.getrecenttracks&user=" + m_username + "&api_key=" + m_api_key + "&limit=1&format=json";
     QJsonDocument response;
-    auto code = lastfm_request(response, track_request);
+    auto code = lastfm_result(m_pending.get(), response);
     if (code == HTTP_OK) {
         auto recent_tracks = response.object()["recenttracks"].toObject();
 
@@ -84,16 +89,70 @@ void lastfm_source::refresh()
             }
         }
 
-        /* Since we don't know the progress of the song there's no way to
-         * determine when the next request would be due, so a query every
-         * five seconds should be slow enough, unless a custom api key is
-         * used.
+        /* last.fm doesn't want apps to constantly send requets
+         * to their API points, so there are at least five seconds between
+         * queries unless a custom api key is used. next_refresh() waits even
+         * longer if the track duration is known
          */
-        m_next_refresh = os_gettime_ns() + 5000000000;
+        if (!m_custom_api_key)
+            defer_refresh(5 * SECOND_TO_NS);
     } else {
         berr("Received error code from last.fm request: %i", int(code));
-        m_next_refresh = os_gettime_ns() + 1500000000;
+        if (!m_custom_api_key)
+            defer_refresh(1500000000);
+    }
+}
+
+uint64_t lastfm_source::next_refresh(uint64_t now) const
+{
+    const uint64_t min_wait = m_custom_api_key ? config::refresh_rate : 5000;
+    /* Skipped tracks are still noticed after this long */
+    const uint64_t max_wait = std::max<uint64_t>(min_wait, 30000);
+    uint64_t wait = std::max<uint64_t>(min_wait, 10000);
+
+    if (m_current.get<int>(meta::STATUS) == state_playing) {
+        const int duration = m_current.get<int>(meta::DURATION);
+        const int progress = m_current.get<int>(meta::PROGRESS);
+        wait = min_wait;
+        /* Wake up right before the track is expected to end */
+        if (duration > 0 && progress >= 0 && uint64_t(duration - progress) > min_wait * 2)
+            wait = std::min(max_wait, duration - progress - min_wait);
+    }
+    return std::max(now + wait * 1000000, m_blocked_until);
+}
+
+/* Tracks rarely change their duration, so lookups are cached for the session */
+static const int max_durations = 512;
+
+int lastfm_source::track_duration(const QString& artist, const QString& title)
+{
+    auto const key = artist + "\n" + title;
+    {
+        std::lock_guard<std::mutex> lock(m_duration_mutex);
+        auto it = m_durations.find(key);
+        if (it != m_durations.end())
+            return *it;
+        if (m_durations.size() >= max_durations)
+            m_durations.clear();
+        m_durations.insert(key, -1);
     }
+
+    async_http::request req;
+    req.url = qt_to_utf8(("https://ws.audioscrobbler.com/2.0/?method=track.getInfo&api_key=" + m_api_key + "&artist=" + QUrl::toPercentEncoding(artist) + "&track=" + QUrl::toPercentEncoding(title) + "&format=json"));
+    async_http::submit(std::move(req), [this, key](async_http::response&& res) {
+        QJsonDocument response;
+        int duration = 0;
+        if (lastfm_result(res, response) == HTTP_OK)
+            duration = response.object()["track"].toObject()["duration"].toString().toInt();
+
+        {
+            std::lock_guard<std::mutex> lock(m_duration_mutex);
+            m_durations.insert(key, duration);
+        }
+        if (duration > 0)
+            tuna_thread::wakeup(S_SOURCE_LAST_FM);
+    });
+    return -1;
 }
 
 void lastfm_source::parse_song(const QJsonObject& s)
@@ -111,7 +170,6 @@ void lastfm_source::parse_song(const QJsonObject& s)
                     m_current.set(meta::COVER, cover.toObject()["#text"].toString());
             }
         }
-        util::download_cover(m_current.get(meta::COVER));
     }
 
     if (s["artist"].isObject())
@@ -122,6 +180,27 @@ void lastfm_source::parse_song(const QJsonObject& s)
 
     if (s["name"].isString())
         m_current.set(meta::TITLE, s["name"].toString());
+
+    if (m_current.get<int>(meta::STATUS) != state_playing) {
+        m_track_key.clear();
+        return;
+    }
+
+    auto const artists = m_current.get<QStringList>(meta::ARTIST);
+    auto const artist = artists.isEmpty() ? QString() : artists[0];
+    auto const title = m_current.get(meta::TITLE);
+    auto const now = os_gettime_ns();
+    auto const key = artist + "\n" + title;
+    if (key != m_track_key) {
+        m_track_key = key;
+        m_track_start = now;
+    }
+
+    auto const duration = track_duration(artist, title);
+    if (duration > 0) {
+        m_current.set(meta::DURATION, duration);
+        m_current.set(meta::PROGRESS, std::min<int>(int((now - m_track_start) / 1000000), duration));
+    }
 }
 
 bool lastfm_source::execute_capability(capability)
@@ -136,30 +215,18 @@ bool lastfm_source::enabled() const
 
 /* === cURL stuff == */
 
-long lastfm_request(QJsonDocument& response_json, const QString& url)
+long lastfm_result(const async_http::response& res, QJsonDocument& response_json)
 {
-    CURL* curl = curl_easy_init();
-    std::string response;
     long http_code = -1;
-    // curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_URL, qt_to_utf8(url));
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, util::write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-#ifdef DEBUG
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-#endif
-    CURLcode res = curl_easy_perform(curl);
-
-    if (res == CURLE_OK) {
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (res.result == CURLE_OK) {
+        http_code = res.status;
         QJsonParseError err;
-        response_json = QJsonDocument::fromJson(response.c_str(), &err);
-        if (response_json.isNull() && !response.empty())
-            berr("Failed to parse json response: %s, Error: %s", response.c_str(), qt_to_utf8(err.errorString()));
+        response_json = QJsonDocument::fromJson(QByteArray::fromStdString(res.body), &err);
+        if (response_json.isNull() && !res.body.empty())
+            berr("Failed to parse json response: %s, Error: %s", res.body.c_str(), qt_to_utf8(err.errorString()));
     } else {
-        berr("CURL failed while sending spotify command");
+        berr("CURL failed while sending last.fm request: %s", res.error.c_str());
     }
 
-    curl_easy_cleanup(curl);
     return http_code;
 }
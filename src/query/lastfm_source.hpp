@@ -17,20 +17,38 @@
  *************************************************************************/
 
 #pragma once
+#include "../util/async_http.hpp"
 #include "../util/constants.hpp"
 #include "music_source.hpp"
+#include <QHash>
+#include <future>
+#include <mutex>
 
 class lastfm_source : public music_source {
     QString m_username, m_api_key;
     bool m_custom_api_key = false;
-    uint64_t m_next_refresh = 0;
+    /* Request that was sent by a previous refresh */
+    std::future<async_http::response> m_pending;
+
+    /* last.fm only tells us what's playing, so the progress is estimated
+     * from when the track was first seen playing */
+    QString m_track_key;
+    uint64_t m_track_start = 0;
+
+    /* Durations in ms from track.getInfo by artist and title,
+     * zero if last.fm doesn't know it, -1 while it's looked up */
+    std::mutex m_duration_mutex;
+    QHash<QString, int> m_durations;
+
     void parse_song(const QJsonObject& s);
+    int track_duration(const QString& artist, const QString& title);
 
 public:
     lastfm_source();
 
     void load() override;
     void refresh() override;
+    uint64_t next_refresh(uint64_t now) const override;
     bool execute_capability(capability c) override;
     bool enabled() const override;
 };
@@ -21,11 +21,25 @@
 #include "../gui/widgets/mpd.hpp"
 #include "../util/config.hpp"
 #include "../util/cover_tag_handler.hpp"
+#include "../util/lyrics_cache.hpp"
 #include "../util/lyrics_handler.hpp"
+#include "../util/media_thread.hpp"
+#include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include <QStringList>
 #include <obs-module.h>
 #include <taglib/fileref.h>
+#include <util/platform.h>
+#if _WIN32
+#include <winsock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+/* The idle connection is closed once the source hasn't been refreshed
+ * for this long, which happens when another source was selected */
+static const uint64_t idle_timeout = 15 * SECOND_TO_NS;
 
 mpd_source::mpd_source()
     : music_source(S_SOURCE_MPD, T_SOURCE_MPD, new mpd)
@@ -89,6 +103,76 @@ void mpd_source::load()
     m_base_folder = utf8_to_qt(CGET_STR(CFG_MPD_BASE_FOLDER));
     m_port = CGET_UINT(CFG_MPD_PORT);
     m_local = CGET_BOOL(CFG_MPD_LOCAL);
+
+    /* Reconnect with the new settings */
+    stop_idle();
+    close_connection();
+    m_have_status = false;
+}
+
+void mpd_source::start_idle()
+{
+    if (m_idle_running)
+        return;
+    if (m_idle_thread.joinable())
+        m_idle_thread.join();
+    m_idle_running = true;
+    m_idle_thread = std::thread(&mpd_source::idle_method, this, m_address, m_port, m_local);
+}
+
+void mpd_source::stop_idle()
+{
+    m_idle_running = false;
+    if (m_idle_thread.joinable())
+        m_idle_thread.join();
+    m_idle_connected = false;
+}
+
+void mpd_source::idle_method(QString address, uint16_t port, bool local)
+{
+    util::set_thread_name("tuna-mpd-idle");
+    mpd_connection* connection = nullptr;
+
+    while (m_idle_running) {
+        if (os_gettime_ns() - m_idle_used > idle_timeout)
+            break;
+
+        if (!connection) {
+            connection = local ? mpd_connection_new(nullptr, 0, 1000) : mpd_connection_new(qt_to_utf8(address), port, 1000);
+            if (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS || !mpd_send_idle_mask(connection, mpd_idle(MPD_IDLE_PLAYER | MPD_IDLE_QUEUE))) {
+                /* The query connection logs the error */
+                mpd_connection_free(connection);
+                connection = nullptr;
+                os_sleep_ms(2000);
+                continue;
+            }
+            m_idle_connected = true;
+            /* Anything could have happened while we were disconnected */
+            m_idle_events++;
+            tuna_thread::wakeup(id());
+        }
+
+        /* Poll with a timeout instead of blocking in mpd_recv_idle,
+         * so that the thread can be stopped */
+        pollfd fd {};
+        fd.fd = mpd_connection_get_fd(connection);
+        fd.events = POLLIN;
+        if (poll(&fd, 1, 250) <= 0)
+            continue;
+
+        if (mpd_recv_idle(connection, false) == 0 || !mpd_send_idle_mask(connection, mpd_idle(MPD_IDLE_PLAYER | MPD_IDLE_QUEUE))) {
+            m_idle_connected = false;
+            mpd_connection_free(connection);
+            connection = nullptr;
+        }
+        m_idle_events++;
+        tuna_thread::wakeup(id());
+    }
+
+    m_idle_connected = false;
+    if (connection)
+        mpd_connection_free(connection);
+    m_idle_running = false;
 }
 
 static inline play_state from_mpd_state(mpd_state s)
@@ -108,6 +192,23 @@ static inline play_state from_mpd_state(mpd_state s)
 
 void mpd_source::refresh()
 {
+    const auto now = os_gettime_ns();
+    m_idle_used = now;
+    start_idle();
+
+    /* Nothing happened since the last status, so only the progress moves on */
+    if (m_have_status && m_idle_connected && m_idle_events == m_seen_events) {
+        begin_refresh();
+        if (m_current.get<int>(meta::STATUS) == state_playing) {
+            auto progress = m_elapsed + int((now - m_elapsed_at) / 1000000);
+            auto const duration = m_current.get<int>(meta::DURATION);
+            if (duration > 0)
+                progress = std::min(progress, duration);
+            m_current.set<int>(meta::PROGRESS, progress);
+        }
+        return;
+    }
+
     ensure_connection();
     struct mpd_status* status = nullptr;
     struct mpd_song* mpd_song = nullptr;
@@ -117,12 +218,29 @@ void mpd_source::refresh()
     begin_refresh();
     m_current.clear();
 
-    status = mpd_run_status(m_connection);
-    mpd_song = mpd_run_current_song(m_connection);
+    /* Events that arrive while we're querying cause another refresh */
+    m_seen_events = m_idle_events;
+
+    /* Status and song in a single round trip */
+    if (mpd_command_list_begin(m_connection, true) && mpd_send_status(m_connection) && mpd_send_current_song(m_connection) && mpd_command_list_end(m_connection)) {
+        status = mpd_recv_status(m_connection);
+        if (status && mpd_response_next(m_connection))
+            mpd_song = mpd_recv_song(m_connection);
+        if (!mpd_response_finish(m_connection) && status) {
+            if (mpd_song)
+                mpd_song_free(mpd_song);
+            mpd_song = nullptr;
+            mpd_status_free(status);
+            status = nullptr;
+        }
+    }
 
+    m_have_status = status != nullptr;
     if (status) {
         auto new_state = mpd_status_get_state(status);
-        m_current.set<int>(meta::PROGRESS, ((int)mpd_status_get_elapsed_ms(status)));
+        m_elapsed = int(mpd_status_get_elapsed_ms(status));
+        m_elapsed_at = now;
+        m_current.set<int>(meta::PROGRESS, m_elapsed);
         m_current.set<int>(meta::STATUS, from_mpd_state(new_state));
     } else {
         if (util::epoch() - m_last_error_log > 5) {
@@ -210,62 +328,91 @@ void mpd_source::refresh()
         m_current.set(meta::COVER, path);
     }
 
+    if (status)
+        prefetch_next(status);
+
     if (mpd_song)
         mpd_song_free(mpd_song);
     if (status)
         mpd_status_free(status);
 }
 
+void mpd_source::prefetch_next(const mpd_status* status)
+{
+    auto const next_id = mpd_status_get_next_song_id(status);
+    if (next_id < 0 || next_id == m_next_song_id)
+        return;
+    m_next_song_id = next_id;
+
+    auto* next = mpd_run_get_queue_song_id(m_connection, unsigned(next_id));
+    if (!next) {
+        mpd_connection_clear_error(m_connection);
+        return;
+    }
+    auto const path = m_base_folder + utf8_to_qt(mpd_song_get_uri(next));
+    mpd_song_free(next);
+
+    media_thread::submit(media_thread::JOB_PREFETCH, [path] { cover::prefetch(path); });
+}
+
 void mpd_source::handle_cover()
 {
-    if (m_current == m_prev)
+    if ((m_changes & meta::song_fields).none())
         return;
 
-    if (m_current.get<int>(meta::STATUS) == state_playing) {
-        bool result = false;
-        QString file_path = m_song_file_path, tmp;
-        if (cover::find_embedded_cover(file_path)) {
-            result = true;
-        } else {
-            cover::get_file_folder(file_path);
+    media_thread::submit(media_thread::JOB_COVER, [s = m_current, file_path = m_song_file_path]() mutable {
+        if (s.get<int>(meta::STATUS) == state_playing) {
+            bool result = false;
+            QString tmp;
+            if (cover::find_embedded_cover(file_path)) {
+                result = true;
+            } else {
+                cover::get_file_folder(file_path);
 
-            /* try to find a cover image in the same folder*/
-            if (cover::find_local_cover(file_path, tmp)) {
-                tmp = "file://" + tmp; /* cURL needs this to "download" the file */
-                result = util::download_cover(tmp);
+                /* try to find a cover image in the same folder*/
+                if (cover::find_local_cover(file_path, tmp)) {
+                    tmp = "file://" + tmp; /* cURL needs this to "download" the file */
+                    result = util::download_cover(tmp);
+                }
             }
+            if (!result && !download_missing_cover(s) && !media_thread::cancelled())
+                util::reset_cover();
+        } else if (s.get<int>(meta::STATUS) != state_paused || config::placeholder_when_paused) {
+            /* We either
+                - are in a stopped/unknown state                -> reset cover
+                - are paused & want a placeholder when paused   -> reset cover
+                - do not have a cover                           -> try downloading cover
+            */
+            if (!s.has(meta::COVER))
+                download_missing_cover(s);
+            else
+                util::reset_cover();
         }
-        if (!result && !download_missing_cover())
-            util::reset_cover();
-    } else if (m_current.get<int>(meta::STATUS) != state_paused || config::placeholder_when_paused) {
-        /* We either
-            - are in a stopped/unknown state                -> reset cover
-            - are paused & want a placeholder when paused   -> reset cover
-            - do not have a cover                           -> try downloading cover
-        */
-        if (!m_current.has(meta::COVER))
-            download_missing_cover();
-        else
-            util::reset_cover();
-    }
+    });
 }
 
 void mpd_source::handle_lyrics()
 {
-    if (m_current == m_prev)
+    /* Changes of the cover, label etc. don't need new lyrics, only another track does */
+    auto const playing = m_current.get<int>(meta::STATUS) == state_playing;
+    auto identity = m_song_file_path.isEmpty() ? lyrics_cache::track_key(m_current) : m_song_file_path;
+    identity += playing ? "\nplaying" : "\nidle";
+    if (identity == m_lyrics_identity)
         return;
+    m_lyrics_identity = identity;
 
-    if (m_current.get<int>(meta::STATUS) == state_playing) {
-        bool result = false;
-        QString file_path = m_song_file_path;
-        if (lyrics::find_embedded_lyrics(file_path)) {
-            result = true;
-        }
-        if (!result && !lyrics::download_missing_lyrics(m_current))
+    media_thread::submit(media_thread::JOB_LYRICS, [s = m_current, file_path = m_song_file_path] {
+        if (s.get<int>(meta::STATUS) == state_playing) {
+            bool result = false;
+            if (lyrics::find_embedded_lyrics(file_path)) {
+                result = true;
+            }
+            if (!result && !lyrics::download_missing_lyrics(s) && !media_thread::cancelled())
+                util::reset_lyrics();
+        } else {
             util::reset_lyrics();
-    } else {
-        util::reset_lyrics();
-    }
+        }
+    });
 }
 
 bool mpd_source::execute_capability(capability c)
@@ -20,7 +20,9 @@
 #include "../util/constants.hpp"
 #include "music_source.hpp"
 
+#include <atomic>
 #include <mpd/client.h>
+#include <thread>
 
 class mpd_source : public music_source {
     bool m_stopped = false;
@@ -31,10 +33,41 @@ class mpd_source : public music_source {
     bool m_local;
     mpd_connection* m_connection {};
     int m_connection_error_count {};
+    /* Queue id of the upcoming song whose cover was prefetched */
+    int m_next_song_id = -1;
+    /* File and play state the lyrics were last looked up for */
+    QString m_lyrics_identity;
+
+    /* A second connection waits for player events with "idle", so the
+     * status only has to be queried after something changed */
+    std::thread m_idle_thread;
+    std::atomic<bool> m_idle_running { false };
+    std::atomic<bool> m_idle_connected { false };
+    std::atomic<uint64_t> m_idle_events { 0 };
+    std::atomic<uint64_t> m_idle_used { 0 };
+    uint64_t m_seen_events = 0;
+
+    /* Elapsed time reported with the last status, the progress
+     * is interpolated from it until the next event */
+    bool m_have_status = false;
+    int m_elapsed = 0;
+    uint64_t m_elapsed_at = 0;
+
+    void on_stop() override
+    {
+        /* Both connections are opened again by the next refresh */
+        stop_idle();
+        close_connection();
+        m_have_status = false;
+    }
 
 public:
     mpd_source();
-    ~mpd_source() { close_connection(); }
+    ~mpd_source()
+    {
+        stop_idle();
+        close_connection();
+    }
 
     void load() override;
     void refresh() override;
@@ -46,6 +79,10 @@ public:
 
 private:
     void ensure_connection();
+    void prefetch_next(const mpd_status* status);
+    void start_idle();
+    void stop_idle();
+    void idle_method(QString address, uint16_t port, bool local);
 
     void close_connection()
     {
@@ -20,7 +20,15 @@
 #include "../gui/widgets/mpris.hpp"
 #include "../util/config.hpp"
 #include "../util/constants.hpp"
+#include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <util/platform.h>
 
 /**
  * Large chunks of this source were taken from
@@ -44,7 +52,9 @@ bool mpris_source::init_dbus_session()
     DBusError error;
 
     dbus_error_init(&error);
-    cbus = dbus_bus_get(DBUS_BUS_SESSION, &error);
+    /* A private connection, because the main loop takes over its watches,
+     * which would break anyone else using the shared one */
+    cbus = dbus_bus_get_private(DBUS_BUS_SESSION, &error);
     if (dbus_error_is_set(&error)) {
         berr("[MPRIS] Error getting Bus: %s", error.message);
         dbus_error_free(&error);
@@ -57,10 +67,92 @@ bool mpris_source::init_dbus_session()
 
     bdebug("DBus name is %s", dbus_bus_get_unique_name(cbus));
 
+    dbus_connection_set_exit_on_disconnect(cbus, false);
     m_dbus_connection = cbus;
+    return dbus_setup_main_loop();
+}
+
+/* Expiry of a timeout in os_gettime_ns() nanoseconds */
+static void arm_timeout(DBusTimeout* timeout)
+{
+    auto* deadline = static_cast<uint64_t*>(dbus_timeout_get_data(timeout));
+    if (!deadline) {
+        deadline = new uint64_t;
+        dbus_timeout_set_data(timeout, deadline, [](void* data) { delete static_cast<uint64_t*>(data); });
+    }
+    *deadline = os_gettime_ns() + uint64_t(dbus_timeout_get_interval(timeout)) * 1000000;
+}
+
+bool mpris_source::dbus_setup_main_loop()
+{
+    if (pipe(m_wakeup_pipe) != 0) {
+        berr("[MPRIS] Failed to create wakeup pipe");
+        return false;
+    }
+    fcntl(m_wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(m_wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
+    auto add_watch = [](DBusWatch* watch, void* data) -> dbus_bool_t {
+        auto* self = static_cast<mpris_source*>(data);
+        {
+            std::lock_guard<std::mutex> lock(self->m_watch_mutex);
+            self->m_watches.push_back(watch);
+        }
+        self->wake_loop();
+        return true;
+    };
+    auto remove_watch = [](DBusWatch* watch, void* data) {
+        auto* self = static_cast<mpris_source*>(data);
+        std::lock_guard<std::mutex> lock(self->m_watch_mutex);
+        self->m_watches.erase(std::remove(self->m_watches.begin(), self->m_watches.end(), watch), self->m_watches.end());
+    };
+    auto toggle_watch = [](DBusWatch*, void* data) { static_cast<mpris_source*>(data)->wake_loop(); };
+
+    auto add_timeout = [](DBusTimeout* timeout, void* data) -> dbus_bool_t {
+        auto* self = static_cast<mpris_source*>(data);
+        arm_timeout(timeout);
+        {
+            std::lock_guard<std::mutex> lock(self->m_watch_mutex);
+            self->m_timeouts.push_back(timeout);
+        }
+        self->wake_loop();
+        return true;
+    };
+    auto remove_timeout = [](DBusTimeout* timeout, void* data) {
+        auto* self = static_cast<mpris_source*>(data);
+        std::lock_guard<std::mutex> lock(self->m_watch_mutex);
+        self->m_timeouts.erase(std::remove(self->m_timeouts.begin(), self->m_timeouts.end(), timeout), self->m_timeouts.end());
+    };
+    auto toggle_timeout = [](DBusTimeout* timeout, void* data) {
+        arm_timeout(timeout);
+        static_cast<mpris_source*>(data)->wake_loop();
+    };
+
+    if (!dbus_connection_set_watch_functions(m_dbus_connection, add_watch, remove_watch, toggle_watch, this, nullptr)
+        || !dbus_connection_set_timeout_functions(m_dbus_connection, add_timeout, remove_timeout, toggle_timeout, this, nullptr)) {
+        berr("[MPRIS] Failed to set up the dbus main loop");
+        return false;
+    }
+
+    dbus_connection_set_wakeup_main_function(
+        m_dbus_connection, [](void* data) { static_cast<mpris_source*>(data)->wake_loop(); }, this, nullptr);
+    dbus_connection_set_dispatch_status_function(
+        m_dbus_connection, [](DBusConnection*, DBusDispatchStatus status, void* data) {
+            if (status == DBUS_DISPATCH_DATA_REMAINS)
+                static_cast<mpris_source*>(data)->wake_loop();
+        },
+        this, nullptr);
     return true;
 }
 
+void mpris_source::wake_loop()
+{
+    if (m_wakeup_pipe[1] >= 0) {
+        char c = 0;
+        [[maybe_unused]] auto r = write(m_wakeup_pipe[1], &c, 1);
+    }
+}
+
 bool mpris_source::dbus_add_matches()
 {
     DBusError error;
@@ -73,6 +165,14 @@ bool mpris_source::dbus_add_matches()
         return false;
     }
 
+    dbus_bus_add_match(m_dbus_connection, "type='signal', interface='org.mpris.MediaPlayer2.Player',member='Seeked', path='/org/mpris/MediaPlayer2'", &error);
+
+    if (dbus_error_is_set(&error)) {
+        berr("[MPRIS] Error while adding match (%s)", error.message);
+        dbus_error_free(&error);
+        return false;
+    }
+
     dbus_bus_add_match(m_dbus_connection, "type='signal', interface='org.freedesktop.DBus', member='NameOwnerChanged', path='/org/freedesktop/DBus'", &error);
 
     if (dbus_error_is_set(&error)) {
@@ -85,80 +185,149 @@ bool mpris_source::dbus_add_matches()
         m_dbus_connection, [](DBusConnection* connection, DBusMessage* message, void* user_data) {
             return static_cast<mpris_source*>(user_data)->handle_message(connection, message);
         },
-        this, dbus_free);
+        this, nullptr);
     dbus_connection_flush(m_dbus_connection);
     return true;
 }
 
-bool mpris_source::dbus_register_names()
+/* Context of a call that was sent for a specific player */
+struct mpris_call {
+    mpris_source* source;
+    QString name;
+};
+
+static void free_call(void* data)
 {
-    DBusMessage* msg;
-    DBusPendingCall* resp_pending = NULL;
+    delete static_cast<mpris_call*>(data);
+}
 
-    msg = dbus_message_new_method_call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "ListNames");
+/* Takes the reply of a finished call, nullptr if the call failed */
+static DBusMessage* steal_reply(DBusPendingCall* pending)
+{
+    auto* resp = dbus_pending_call_steal_reply(pending);
+    if (resp && dbus_message_get_type(resp) == DBUS_MESSAGE_TYPE_ERROR) {
+        bdebug("[MPRIS] Call failed: %s", dbus_message_get_error_name(resp));
+        dbus_message_unref(resp);
+        resp = nullptr;
+    }
+    return resp;
+}
 
-    if (!dbus_connection_send_with_reply(m_dbus_connection, msg, &resp_pending, -1)) {
-        berr("[MPRIS] Out Of Memory!");
-        return false;
+bool mpris_source::dbus_call_async(DBusMessage* msg, DBusPendingCallNotifyFunction notify, void* data, DBusFreeFunction free_data)
+{
+    DBusPendingCall* pending = nullptr;
+    bool result = msg && dbus_connection_send_with_reply(m_dbus_connection, msg, &pending, 5000) && pending;
+
+    if (result) {
+        /* The pending call keeps itself alive until the reply or the timeout */
+        result = dbus_pending_call_set_notify(pending, notify, data, free_data);
+        dbus_pending_call_unref(pending);
+    }
+    if (!result) {
+        berr("[MPRIS] Failed to send dbus message");
+        if (free_data)
+            free_data(data);
     }
+    if (msg)
+        dbus_message_unref(msg);
+    return result;
+}
 
-    dbus_pending_call_block(resp_pending); // TODO: remove blocking call
-
-    if (dbus_pending_call_get_completed(resp_pending)) {
-        DBusMessage* resp;
-        resp = dbus_pending_call_steal_reply(resp_pending);
-        int current_type;
-        DBusMessageIter iter, iter2;
-
-        dbus_message_iter_init(resp, &iter);
-        if (dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY) {
-            dbus_message_iter_recurse(&iter, &iter2); // Array of String
-            while ((current_type = dbus_message_iter_get_arg_type(&iter2)) != DBUS_TYPE_INVALID) {
-                if (current_type == DBUS_TYPE_STRING) {
-                    char* name;
-                    dbus_message_iter_get_basic(&iter2, &name);
-                    if (utf8_to_qt(name).startsWith(MPRIS_NAME_START)) {
-                        char* unique_name = dbus_get_name_owner(name);
-                        m_players[utf8_to_qt(unique_name)] = format_name(name);
-                        bfree(unique_name);
+bool mpris_source::dbus_register_names()
+{
+    auto* msg = dbus_message_new_method_call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "ListNames");
+
+    return dbus_call_async(
+        msg, [](DBusPendingCall* pending, void* data) {
+            auto* self = static_cast<mpris_source*>(data);
+            auto* resp = steal_reply(pending);
+            if (!resp)
+                return;
+
+            int current_type;
+            DBusMessageIter iter, iter2;
+            dbus_message_iter_init(resp, &iter);
+            if (dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY) {
+                dbus_message_iter_recurse(&iter, &iter2); // Array of String
+                while ((current_type = dbus_message_iter_get_arg_type(&iter2)) != DBUS_TYPE_INVALID) {
+                    if (current_type == DBUS_TYPE_STRING) {
+                        char* name;
+                        dbus_message_iter_get_basic(&iter2, &name);
+                        if (utf8_to_qt(name).startsWith(MPRIS_NAME_START))
+                            self->dbus_request_owner(name);
                     }
+                    dbus_message_iter_next(&iter2);
                 }
-                dbus_message_iter_next(&iter2);
             }
-        }
-        dbus_message_unref(resp);
-    }
-    dbus_message_unref(msg);
-    return true;
+            dbus_message_unref(resp);
+        },
+        this, nullptr);
 }
 
-char* mpris_source::dbus_get_name_owner(const char* name)
+void mpris_source::dbus_request_owner(const char* name)
 {
-    DBusMessage *msg {}, *resp {};
-    DBusMessageIter imsg {};
-    DBusError error {};
-    char* ret {};
-    dbus_error_init(&error);
-    msg = dbus_message_new_method_call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetNameOwner");
-    dbus_message_iter_init_append(msg, &imsg);
-    dbus_message_iter_append_basic(&imsg, DBUS_TYPE_STRING, &name);
-
-    resp = dbus_connection_send_with_reply_and_block(m_dbus_connection, msg, -1, &error); // TODO: remove blocking call
-    if (dbus_error_is_set(&error)) {
-        berr("[MPRIS] Error while reading owner name (%s)", error.message);
-    } else {
-        char* resp_name {};
+    auto* msg = dbus_message_new_method_call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetNameOwner");
+    if (msg)
+        dbus_message_append_args(msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID);
+
+    dbus_call_async(
+        msg, [](DBusPendingCall* pending, void* data) {
+            auto* call = static_cast<mpris_call*>(data);
+            auto* resp = steal_reply(pending);
+            if (!resp)
+                return;
+
+            DBusError error;
+            dbus_error_init(&error);
+            char* unique_name {};
+            if (!dbus_message_get_args(resp, &error, DBUS_TYPE_STRING, &unique_name, DBUS_TYPE_INVALID)) {
+                if (dbus_error_is_set(&error)) {
+                    berr("[MPRIS] Error while reading owner name (%s)", error.message);
+                    dbus_error_free(&error);
+                }
+            } else {
+                auto const player = utf8_to_qt(unique_name);
+                {
+                    std::lock_guard<std::mutex> lock(call->source->m_internal_mutex);
+                    call->source->m_players[player] = call->name;
+                }
+                emit tuna_thread::events()->players_changed();
+                call->source->dbus_request_properties(player);
+            }
+            dbus_message_unref(resp);
+        },
+        new mpris_call { this, format_name(name) }, free_call);
+}
 
-        if (!dbus_message_get_args(resp, &error, DBUS_TYPE_STRING, &resp_name, DBUS_TYPE_INVALID)) {
-            if (dbus_error_is_set(&error))
-                berr("[MPRIS] Error while reading owner name (%s)", error.message);
-        } else {
-            ret = bstrdup(resp_name);
-        }
-        dbus_message_unref(resp);
-    }
-    dbus_message_unref(msg);
-    return ret;
+void mpris_source::dbus_request_properties(QString const& player)
+{
+    /* Players only send changes, so everything that was set
+     * before we started listening has to be asked for */
+    auto const dest = player.toUtf8();
+    const char* interface = "org.mpris.MediaPlayer2.Player";
+    auto* msg = dbus_message_new_method_call(dest.constData(), "/org/mpris/MediaPlayer2", "org.freedesktop.DBus.Properties", "GetAll");
+    if (msg)
+        dbus_message_append_args(msg, DBUS_TYPE_STRING, &interface, DBUS_TYPE_INVALID);
+
+    dbus_call_async(
+        msg, [](DBusPendingCall* pending, void* data) {
+            auto* call = static_cast<mpris_call*>(data);
+            auto* resp = steal_reply(pending);
+            if (!resp)
+                return;
+
+            DBusMessageIter iter, sub;
+            dbus_message_iter_init(resp, &iter);
+            if (dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY && dbus_message_iter_get_element_count(&iter) > 0) {
+                dbus_message_iter_recurse(&iter, &sub);
+                std::lock_guard<std::mutex> lock(call->source->m_internal_mutex);
+                call->source->ensure_entry(call->name);
+                call->source->parse_array(&sub, call->name);
+                call->source->publish_player(call->name);
+            }
+            dbus_message_unref(resp);
+        },
+        new mpris_call { this, player }, free_call);
 }
 
 DBusHandlerResult mpris_source::handle_dbus(DBusMessage* message)
@@ -185,13 +354,18 @@ DBusHandlerResult mpris_source::handle_dbus(DBusMessage* message)
     if (QString(name).startsWith(MPRIS_NAME_START)) { // if mpris name
         if (registering_name) {
             binfo("[MPRIS] Registration of %s as %s", new_name, name);
-            std::lock_guard<std::mutex> lock(m_internal_mutex);
-            m_players[utf8_to_qt(new_name)] = format_name(name);
+            {
+                std::lock_guard<std::mutex> lock(m_internal_mutex);
+                m_players[utf8_to_qt(new_name)] = format_name(name);
+            }
+            dbus_request_properties(utf8_to_qt(new_name));
         } else {
             binfo("[MPRIS] Unregistering of %s as %s", old_name, name);
             std::lock_guard<std::mutex> lock(m_internal_mutex);
             m_players.remove(utf8_to_qt(old_name));
         }
+        emit tuna_thread::events()->players_changed();
+        tuna_thread::wakeup(id());
     }
     return DBUS_HANDLER_RESULT_HANDLED;
 }
@@ -244,10 +418,10 @@ void mpris_source::parse_metadata(DBusMessageIter* iter, QString const& player,
                 m_info[player].metadata.set(meta::DURATION, length);
                 m_info[player].update_time = util::epoch();
             } else if (prop == "mpris:length") {
-                int length;
+                dbus_int64_t length;
                 dbus_message_iter_recurse(iter, &sub);
                 dbus_message_iter_get_basic(&sub, &length);
-                m_info[player].metadata.set(meta::DURATION, length / 1000);
+                m_info[player].metadata.set(meta::DURATION, int(length / 1000));
                 m_info[player].update_time = util::epoch();
             } else if (prop == "vlc:publisher") {
                 // borked
@@ -372,7 +546,6 @@ void mpris_source::parse_array(DBusMessageIter* iter, QString const& player, int
                 continue;
             }
             if (strcmp(property_name, "PlaybackStatus") == 0) {
-                std::lock_guard<std::mutex> lock(m_internal_mutex);
                 char* status;
                 dbus_message_iter_recurse(iter, &sub);
                 dbus_message_iter_get_basic(&sub, &status);
@@ -384,17 +557,36 @@ void mpris_source::parse_array(DBusMessageIter* iter, QString const& player, int
                 else
                     m_info[player].metadata.set(meta::STATUS, play_state::state_stopped);
                 m_info[player].update_time = util::epoch();
+
+                /* Continue (or freeze) the position from where it is now */
+                auto& position = m_info[player].position;
+                auto const now = os_gettime_ns();
+                position.set(position.at(now), now);
+                position.playing = strcmp(status, "Playing") == 0;
             } else if (strcmp(property_name, "Metadata") == 0) {
+                auto const old_title = m_info[player].metadata.get(meta::TITLE);
                 dbus_message_iter_recurse(iter, &sub);
                 dbus_message_iter_recurse(&sub, &subsub);
                 parse_metadata(&subsub, player, level + 1);
+
+                /* A new track starts from the beginning, unless the player
+                 * also sent the position in this message */
+                if (m_info[player].metadata.get(meta::TITLE) != old_title)
+                    m_info[player].position.set(0, os_gettime_ns());
             } else if (strcmp(property_name, "Position") == 0) {
-                std::lock_guard<std::mutex> lock(m_internal_mutex);
-                int pos;
+                dbus_int64_t pos;
                 dbus_message_iter_recurse(iter, &sub);
                 dbus_message_iter_get_basic(&sub, &pos);
-                m_info[player].metadata.set(meta::PROGRESS, pos / 1000);
+                m_info[player].position.set(pos / 1000, os_gettime_ns());
                 m_info[player].update_time = util::epoch();
+            } else if (strcmp(property_name, "Rate") == 0) {
+                double rate;
+                dbus_message_iter_recurse(iter, &sub);
+                dbus_message_iter_get_basic(&sub, &rate);
+                auto& position = m_info[player].position;
+                auto const now = os_gettime_ns();
+                position.set(position.at(now), now);
+                position.rate = rate;
             } else {
                 bdebug("[MPRIS] Not handled %s", property_name);
             }
@@ -416,6 +608,8 @@ DBusHandlerResult mpris_source::handle_mpris(DBusMessage* message)
 
     const char* property_name;
     auto player = utf8_to_qt(dbus_message_get_sender(message));
+    /* players() reads m_info from other threads */
+    std::lock_guard<std::mutex> lock(m_internal_mutex);
 
     dbus_message_iter_init(message, &iter);
     while ((current_type = dbus_message_iter_get_arg_type(&iter)) != DBUS_TYPE_INVALID) {
@@ -442,7 +636,6 @@ DBusHandlerResult mpris_source::handle_mpris(DBusMessage* message)
         dbus_message_iter_next(&iter);
     }
 
-    std::lock_guard<std::mutex> lock(m_internal_mutex);
     if (m_players[player].toLower().contains("vlc")) {
 
         auto a = m_info[player].metadata;
@@ -456,13 +649,63 @@ DBusHandlerResult mpris_source::handle_mpris(DBusMessage* message)
         }
         m_info[player].metadata.set(meta::TRACK_NUMBER, 0);                       // borked on vlc
     }
+
+    publish_player(player);
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+DBusHandlerResult mpris_source::handle_seeked(DBusMessage* message)
+{
+    DBusError error;
+    dbus_error_init(&error);
+    dbus_int64_t pos;
+
+    if (!dbus_message_get_args(message, &error, DBUS_TYPE_INT64, &pos, DBUS_TYPE_INVALID)) {
+        if (dbus_error_is_set(&error)) {
+            berr("[MPRIS] Error while reading seeked signal (%s)", error.message);
+            dbus_error_free(&error);
+        }
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    auto player = utf8_to_qt(dbus_message_get_sender(message));
+    std::lock_guard<std::mutex> lock(m_internal_mutex);
+    ensure_entry(player);
+    m_info[player].position.set(pos / 1000, os_gettime_ns());
+    publish_player(player);
     return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+int64_t mpris_source::position_anchor::at(uint64_t now) const
+{
+    if (position < 0 || !playing || now < time)
+        return position;
+    return position + int64_t(double(now - time) / 1000000 * rate);
+}
+
+void mpris_source::publish_player(QString const& player)
+{
+    auto& info = m_info[player];
+    info.snapshot = std::make_shared<const song>(info.metadata);
+    m_generation++;
+
+    /* Let the query thread pick up the change right away instead of on the next tick */
+    tuna_thread::wakeup(id());
+}
+
 mpris_source::mpris_source()
     : music_source(S_SOURCE_MPRIS, T_SOURCE_MPRIS, new mpris)
 {
     supported_metadata({ meta::ALBUM, meta::TITLE, meta::ARTIST, meta::STATUS, meta::DURATION, meta::DISC_NUMBER, meta::TRACK_NUMBER, meta::PROGRESS, meta::COVER });
+}
+
+mpris_source::~mpris_source()
+{
+    stop();
+}
+
+void mpris_source::on_start()
+{
     bdebug("[MPRIS] Initialising dbus session for mpris source");
     if (init_dbus()) {
         m_thread_flag = true;
@@ -473,15 +716,44 @@ mpris_source::mpris_source()
             this);
     } else {
         berr("[MPRIS] Failed to initialize mpris source");
+        close_dbus();
     }
 }
 
-mpris_source::~mpris_source()
+void mpris_source::on_stop()
 {
     m_thread_flag = false;
-    m_internal_thread.join();
-    //    dbus_connection_close(m_dbus_connection); // apparently you shouldn't close them???
+    wake_loop();
+    if (m_internal_thread.joinable())
+        m_internal_thread.join();
+    close_dbus();
+
+    /* Players are looked up again when the source is started again */
+    std::lock_guard<std::mutex> lock(m_internal_mutex);
+    m_players.clear();
+    m_info.clear();
+    m_generation++;
+    emit tuna_thread::events()->players_changed();
+}
+
+void mpris_source::close_dbus()
+{
+    /* Private connections have to be closed */
+    if (m_dbus_connection) {
+        dbus_connection_close(m_dbus_connection);
+        dbus_connection_unref(m_dbus_connection);
+    }
     m_dbus_connection = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        m_watches.clear();
+        m_timeouts.clear();
+    }
+    for (auto& fd : m_wakeup_pipe) {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
 }
 
 void mpris_source::load()
@@ -489,46 +761,166 @@ void mpris_source::load()
     music_source::load();
     CDEF_STR(CFG_MPRIS_PLAYER, "");
     m_selected_player = utf8_to_qt(CGET_STR(CFG_MPRIS_PLAYER));
+    /* Pick the player again on the next refresh */
+    m_seen_generation = ~0ull;
+}
+
+std::vector<player_state> mpris_source::players()
+{
+    const uint64_t now = os_gettime_ns();
+    std::vector<player_state> result;
+    std::lock_guard<std::mutex> lock(m_internal_mutex);
+    for (auto it = m_info.constBegin(); it != m_info.constEnd(); ++it) {
+        if (!it->snapshot)
+            continue;
+        player_state p { it.key(), m_players.value(it.key(), it.key()), *it->snapshot };
+        auto progress = it->position.at(now);
+        if (progress >= 0) {
+            auto const duration = p.info.get<int>(meta::DURATION);
+            if (duration > 0)
+                progress = std::min<int64_t>(progress, duration);
+            p.info.set(meta::PROGRESS, int(progress));
+        }
+        result.push_back(std::move(p));
+    }
+    return result;
 }
 
 void mpris_source::refresh()
 {
     music_source::begin_refresh();
-    std::lock_guard<std::mutex> lock(m_internal_mutex);
-    if (m_info.contains(m_selected_player)) {
-        m_current = m_info[m_selected_player].metadata;
-    } else {
-        qint64 most_recent {};
-        QString recent_key {};
-        for (auto const& p : m_info.keys()) {
-            auto const& info = m_info[p];
-            if (info.update_time > most_recent) {
-                most_recent = info.update_time;
-                recent_key = p;
+
+    /* Only the position moves on while nothing was published */
+    auto const generation = m_generation.load();
+    if (generation != m_seen_generation) {
+        std::shared_ptr<const song> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(m_internal_mutex);
+            auto it = m_info.constFind(m_selected_player);
+            const SongInfo* selected = it != m_info.constEnd() ? &*it : nullptr;
+            if (!selected) {
+                qint64 most_recent {};
+                for (auto const& info : std::as_const(m_info)) {
+                    if (info.update_time > most_recent) {
+                        most_recent = info.update_time;
+                        selected = &info;
+                    }
+                }
+            }
+            if (selected) {
+                snapshot = selected->snapshot;
+                m_position = selected->position;
             }
         }
 
-        if (!recent_key.isEmpty()) {
-            m_current = m_info[recent_key].metadata;
-        }
+        m_seen_generation = generation;
+        if (snapshot)
+            m_current = *snapshot;
+    }
+
+    auto progress = m_position.at(os_gettime_ns());
+    if (progress >= 0) {
+        auto const duration = m_current.get<int>(meta::DURATION);
+        if (duration > 0)
+            progress = std::min<int64_t>(progress, duration);
+        m_current.set(meta::PROGRESS, int(progress));
     }
 }
 
 void mpris_source::internal_refresh()
 {
+    std::vector<DBusWatch*> watches;
+    std::vector<pollfd> fds;
+
     while (m_thread_flag) {
-        DBusDispatchStatus remains;
+        /* Sleep until there's something to read or write or a timeout expires */
+        int wait = -1;
+        auto now = os_gettime_ns();
+        {
+            std::lock_guard<std::mutex> lock(m_watch_mutex);
+            watches.clear();
+            for (auto* w : m_watches) {
+                if (dbus_watch_get_enabled(w))
+                    watches.push_back(w);
+            }
+            for (auto* t : m_timeouts) {
+                if (!dbus_timeout_get_enabled(t))
+                    continue;
+                auto const deadline = *static_cast<uint64_t*>(dbus_timeout_get_data(t));
+                auto const ms = deadline > now ? int((deadline - now + 999999) / 1000000) : 0;
+                wait = wait < 0 ? ms : std::min(wait, ms);
+            }
+        }
 
-        do {
-            if (!dbus_connection_read_write_dispatch(m_dbus_connection, 500)) {
-                berr("[MPRIS] Failed to call dbus_connection_read_write_dispatch");
-                break;
+        fds.resize(watches.size() + 1);
+        fds[0] = { m_wakeup_pipe[0], POLLIN, 0 };
+        for (size_t i = 0; i < watches.size(); i++) {
+            auto const flags = dbus_watch_get_flags(watches[i]);
+            fds[i + 1].fd = dbus_watch_get_unix_fd(watches[i]);
+            fds[i + 1].events = short(((flags & DBUS_WATCH_READABLE) ? POLLIN : 0) | ((flags & DBUS_WATCH_WRITABLE) ? POLLOUT : 0));
+            fds[i + 1].revents = 0;
+        }
+
+        if (poll(fds.data(), fds.size(), wait) < 0 && errno != EINTR) {
+            berr("[MPRIS] poll() failed: %s", strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(m_wakeup_pipe[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+
+        for (size_t i = 0; i < watches.size(); i++) {
+            auto const revents = fds[i + 1].revents;
+            if (!revents)
+                continue;
+            {
+                /* An earlier watch could have removed this one */
+                std::lock_guard<std::mutex> lock(m_watch_mutex);
+                if (std::find(m_watches.begin(), m_watches.end(), watches[i]) == m_watches.end())
+                    continue;
             }
-            remains = dbus_connection_get_dispatch_status(m_dbus_connection);
-            if (remains == DBUS_DISPATCH_NEED_MEMORY) {
-                bwarn("[MPRIS] Need more memory to read dbus messages");
+            unsigned flags = 0;
+            if (revents & POLLIN)
+                flags |= DBUS_WATCH_READABLE;
+            if (revents & POLLOUT)
+                flags |= DBUS_WATCH_WRITABLE;
+            if (revents & POLLERR)
+                flags |= DBUS_WATCH_ERROR;
+            if (revents & POLLHUP)
+                flags |= DBUS_WATCH_HANGUP;
+            dbus_watch_handle(watches[i], flags);
+        }
+
+        /* Reading a reply removes the timeout of its call, so the
+         * list is checked again for every timeout that's handled */
+        now = os_gettime_ns();
+        for (;;) {
+            DBusTimeout* due = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_watch_mutex);
+                for (auto* t : m_timeouts) {
+                    if (dbus_timeout_get_enabled(t) && *static_cast<uint64_t*>(dbus_timeout_get_data(t)) <= now) {
+                        due = t;
+                        break;
+                    }
+                }
             }
-        } while (remains != DBUS_DISPATCH_COMPLETE);
+            if (!due)
+                break;
+            arm_timeout(due);
+            dbus_timeout_handle(due);
+        }
+
+        while (dbus_connection_dispatch(m_dbus_connection) == DBUS_DISPATCH_DATA_REMAINS)
+            ;
+
+        if (!dbus_connection_get_is_connected(m_dbus_connection)) {
+            berr("[MPRIS] Lost connection to the session bus");
+            break;
+        }
     }
 }
 
@@ -548,7 +940,9 @@ DBusHandlerResult mpris_source::handle_message(DBusConnection* connection, DBusM
         return ret;
     const char* member = dbus_message_get_member(message);
 
-    if (strcmp(path, "/org/mpris/MediaPlayer2") == 0) {
+    if (strcmp(path, "/org/mpris/MediaPlayer2") == 0 && member && strcmp(member, "Seeked") == 0) {
+        ret = handle_seeked(message);
+    } else if (strcmp(path, "/org/mpris/MediaPlayer2") == 0) {
         ret = handle_mpris(message);
     } else if (strcmp(path, "/org/freedesktop/DBus") == 0 && strcmp(member, "NameOwnerChanged") == 0) {
         ret = handle_dbus(message);
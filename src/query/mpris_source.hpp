@@ -19,8 +19,10 @@
 #include "music_source.hpp"
 #include <atomic>
 #include <dbus/dbus.h>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 class mpris_source : public music_source {
     friend class mpris;
@@ -30,11 +32,18 @@ class mpris_source : public music_source {
     bool init_dbus_session();
     bool dbus_add_matches();
     bool dbus_register_names();
-    char* dbus_get_name_owner(const char*);
+
+    /* None of the calls wait for the reply, which is handled on the
+     * tuna-mpris thread, so a hung player can't block anything */
+    bool dbus_call_async(DBusMessage* msg, DBusPendingCallNotifyFunction notify, void* data, DBusFreeFunction free_data);
+    void dbus_request_owner(const char* name);
+    void dbus_request_properties(QString const& player);
 
     DBusHandlerResult handle_dbus(DBusMessage*);
     DBusHandlerResult handle_mpris(DBusMessage*);
+    DBusHandlerResult handle_seeked(DBusMessage*);
 
+    /* Both write to m_info and expect m_internal_mutex to be locked */
     void parse_array(DBusMessageIter* iter, QString const& player, int level = 0);
     void parse_metadata(DBusMessageIter* iter, QString const& player, int level = 0);
 
@@ -48,15 +57,55 @@ class mpris_source : public music_source {
     std::thread m_internal_thread;
     std::atomic<bool> m_thread_flag;
 
+    /* The connection is driven by its watches and timeouts in a poll loop,
+     * the pipe wakes it up when something has to be sent or on shutdown */
+    int m_wakeup_pipe[2] { -1, -1 };
+    std::mutex m_watch_mutex;
+    std::vector<DBusWatch*> m_watches;
+    std::vector<DBusTimeout*> m_timeouts;
+    bool dbus_setup_main_loop();
+    void wake_loop();
+
+    /* Players only report the position when it jumps, so it's
+     * extrapolated from the last known position and playback rate */
+    struct position_anchor {
+        int64_t position = -1; /* ms, negative if unknown */
+        uint64_t time {};      /* os_gettime_ns() of when position was reported */
+        double rate = 1.0;
+        bool playing = false;
+
+        int64_t at(uint64_t now) const;
+        void set(int64_t pos, uint64_t now)
+        {
+            position = pos;
+            time = now;
+        }
+    };
+
     struct SongInfo {
         song metadata {};
+        position_anchor position {};
         int64_t update_time {};
+        /* Copy of the metadata that the query thread picks up */
+        std::shared_ptr<const song> snapshot;
     };
 
+    /* Increased whenever a player publishes a new snapshot */
+    std::atomic<uint64_t> m_generation { 0 };
+    uint64_t m_seen_generation = ~0ull;
+    position_anchor m_position {};
+
+    /* Expects m_internal_mutex to be locked */
+    void publish_player(QString const& player);
+
     QMap<QString, QString> m_players {};
     QMap<QString, SongInfo> m_info {};
     QString m_selected_player {};
     bool init_dbus();
+    void close_dbus();
+
+    void on_start() override;
+    void on_stop() override;
 
 public:
     mpris_source();
@@ -67,6 +116,8 @@ public:
     void internal_refresh();
     bool execute_capability(capability) override { return false; }
     bool enabled() const override { return true; }
+    std::vector<player_state> players() override;
+    uint64_t players_generation() const override { return m_generation; }
 
     DBusHandlerResult handle_message(DBusConnection*, DBusMessage*);
 };
@@ -20,6 +20,8 @@
 #include "../gui/music_control.hpp"
 #include "../gui/tuna_gui.hpp"
 #include "../util/config.hpp"
+#include "../util/cover_cache.hpp"
+#include "../util/media_thread.hpp"
 #include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include "gpmdp_source.hpp"
@@ -32,6 +34,7 @@
 #if _WIN32
 #    include "wmc_source.hpp"
 #endif
+#include "replay_source.hpp"
 #include "spotify_source.hpp"
 #include "vlc_obs_source.hpp"
 #include "web_source.hpp"
@@ -40,7 +43,9 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QRegularExpression>
+#include <algorithm>
 #include <obs-frontend-api.h>
+#include <util/platform.h>
 
 namespace music_sources {
 static std::atomic<int> selected_index = -1;
@@ -57,6 +62,7 @@ void init()
     //    instances.append(std::make_shared<gpmdp_source>()); // Deprecated, Youtube music can send information to tuna
     instances.append(std::make_shared<web_source>());
     instances.append(std::make_shared<icecast_source>());
+    instances.append(std::make_shared<replay_source>());
 
 #if WITH_DBUS
     instances.append(std::make_shared<mpris_source>());
@@ -117,19 +123,38 @@ void select(const char* id)
     if (selected && strcmp(selected->id(), id) == 0)
         return;
 
-    if (selected)
-        selected->reset_info();
-    int i = 0;
-    for (const auto& src : std::as_const(instances)) {
-        if (strcmp(src->id(), id) == 0) {
-            selected_index = i;
-            break;
+    {
+        /* When sources are queried in parallel it might be refreshing right now */
+        std::lock_guard<std::shared_mutex> lock(tuna_thread::thread_mutex);
+        if (selected) {
+            selected->reset_info();
+            /* In parallel mode all enabled sources keep running */
+            if (!tuna_thread::parallel_mode() || !tuna_thread::thread_flag)
+                selected->stop();
+        }
+        int i = 0;
+        for (const auto& src : std::as_const(instances)) {
+            if (strcmp(src->id(), id) == 0) {
+                selected_index = i;
+                src->start();
+                break;
+            }
+            i++;
         }
-        i++;
     }
 
     /* Ensure that cover is set to place holder on switch */
-    util::reset_cover();
+    media_thread::submit(media_thread::JOB_COVER, util::reset_cover);
+    tuna_thread::invalidate();
+}
+
+void stop_unused()
+{
+    auto const selected = selected_source();
+    for (const auto& src : std::as_const(instances)) {
+        if (src != selected)
+            src->stop();
+    }
 }
 
 void set_gui_values()
@@ -146,8 +171,53 @@ std::shared_ptr<music_source> selected_source()
     return nullptr;
 }
 
+bool find_player(const QString& name, player_state& out)
+{
+    for (const auto& src : std::as_const(instances)) {
+        for (auto& p : src->players()) {
+            if (p.id == name || p.name.contains(name, Qt::CaseInsensitive)) {
+                out = std::move(p);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+uint64_t players_generation()
+{
+    uint64_t generation = 0;
+    for (const auto& src : std::as_const(instances))
+        generation += src->players_generation();
+    return generation;
+}
+
+std::shared_ptr<music_source> auto_select()
+{
+    int most_recent = -1;
+    uint64_t playing_since = 0;
+    for (int i = 0; i < instances.count(); i++) {
+        const auto since = instances[i]->playing_since();
+        if (since > playing_since) {
+            playing_since = since;
+            most_recent = i;
+        }
+    }
+
+    /* Nothing is playing, so just stay with the current source */
+    if (most_recent >= 0 && most_recent != selected_index) {
+        binfo("Switching to %s, because it started playing", instances[most_recent]->id());
+        selected_index = most_recent;
+        instances[most_recent]->activate();
+    }
+    return selected_source();
+}
+
 void deinit()
 {
+    for (const auto& src : std::as_const(instances))
+        src->stop();
+
     /* check if all source references were decreased correctly */
     for (int i = 0; i < instances.count(); i++) {
         if (instances[i].use_count() > 1) {
@@ -160,32 +230,57 @@ void deinit()
 }
 }
 
-bool music_source::download_missing_cover()
+bool music_source::download_missing_cover(const song& s)
 {
     static const QString request = "https://itunes.apple.com/search?term={}&media=music&entity=album"; // should we also look for singles?
-    if (config::download_missing_cover && m_current.has_cover_lookup_information()) {
-        auto artists = m_current.get<QStringList>(meta::ARTIST);
-        auto search_term = QUrl::toPercentEncoding(artists[0] + " " + m_current.get(meta::ALBUM));
+    if (config::download_missing_cover && s.has_cover_lookup_information()) {
+        /* Previously found covers don't need another search */
+        auto const cache_key = cover_cache::album_key(s);
+        if (util::use_cached_cover(cache_key))
+            return true;
+
+        /* The artwork url depends on the requested size */
+        auto const lookup_key = cache_key + "\n" + QString::number(config::cover_size);
+        QString cached_url;
+        switch (cover_cache::find_url(lookup_key, cached_url)) {
+        case cover_cache::LOOKUP_FOUND:
+            return util::download_cover(cached_url, cache_key);
+        case cover_cache::LOOKUP_NOT_FOUND:
+            return false;
+        default:;
+        }
+        if (!cover_cache::take_request_budget()) {
+            bdebug("Skipping cover search, too many requests");
+            return false;
+        }
+
+        auto artists = s.get<QStringList>(meta::ARTIST);
+        auto search_term = QUrl::toPercentEncoding(artists[0] + " " + s.get(meta::ALBUM));
         auto url = request;
         url = url.replace("{}", search_term);
         auto doc = util::curl_get_json(qt_to_utf8(url));
         if (doc["results"].isArray()) {
-            if (doc["results"].toArray().isEmpty())
+            if (doc["results"].toArray().isEmpty()) {
+                cover_cache::remember_url(lookup_key, {});
                 return false;
+            }
             auto first = doc["results"].toArray()[0].toObject();
 
             // We don't want to use the wrong cover so we check if the first (probably also best) search result
             // has a matching title. (We search if the title contains the currently playing title or the other
             // way around in case the titles aren't exactly the same (eg. it has something like a "(Single)"
             // prefix or postfix
-            if (!first["collectionName"].toString().toLower().contains(m_current.get(meta::TITLE).toLower()) || m_current.get(meta::TITLE).toLower().contains(first["collectionName"].toString().toLower())) {
+            if (!first["collectionName"].toString().toLower().contains(s.get(meta::TITLE).toLower()) || s.get(meta::TITLE).toLower().contains(first["collectionName"].toString().toLower())) {
+                cover_cache::remember_url(lookup_key, {});
                 return false;
             }
             if (first["artworkUrl60"].isString()) {
                 auto url2 = first["artworkUrl60"].toString();
                 url2 = url2.replace("60x60", QString::number(config::cover_size) + "x" + QString::number(config::cover_size));
-                return util::download_cover(url2);
+                cover_cache::remember_url(lookup_key, url2);
+                return util::download_cover(url2, cache_key);
             }
+            cover_cache::remember_url(lookup_key, {});
         }
     }
     return false;
@@ -198,6 +293,32 @@ music_source::music_source(const char* id, const char* name, source_widget* w)
 {
 }
 
+void music_source::start()
+{
+    std::lock_guard<std::mutex> lock(m_start_mutex);
+    if (m_started)
+        return;
+    bdebug("Starting source %s", m_id);
+    m_started = true;
+    on_start();
+}
+
+void music_source::stop()
+{
+    std::lock_guard<std::mutex> lock(m_start_mutex);
+    if (!m_started)
+        return;
+    bdebug("Stopping source %s", m_id);
+    m_started = false;
+    on_stop();
+}
+
+bool music_source::started()
+{
+    std::lock_guard<std::mutex> lock(m_start_mutex);
+    return m_started;
+}
+
 void music_source::load()
 {
     if (m_settings_tab)
@@ -218,29 +339,36 @@ void music_source::set_gui_values()
 
 void music_source::handle_cover()
 {
-    if (m_current == m_prev)
+    if ((m_changes & meta::song_fields).none())
         return;
 
-    if (m_current.get<int>(meta::STATUS) == state_playing) {
-        if (!util::download_cover(m_current.get(meta::COVER))) {
-            if (!download_missing_cover())
+    media_thread::submit(media_thread::JOB_COVER, [s = m_current] {
+        if (s.get<int>(meta::STATUS) == state_playing) {
+            if (!util::download_cover(s.get(meta::COVER))) {
+                if (!download_missing_cover(s) && !media_thread::cancelled())
+                    util::reset_cover();
+            }
+        } else if (s.get<int>(meta::STATUS) != state_paused || config::placeholder_when_paused) {
+            /* We either
+                - are in a stopped/unknown state                -> reset cover
+                - are paused & want a placeholder when paused   -> reset cover
+                - do not have a cover                           -> try downloading cover
+            */
+            if (!s.has(meta::COVER))
+                download_missing_cover(s);
+            else
                 util::reset_cover();
         }
-    } else if (m_current.get<int>(meta::STATUS) != state_paused || config::placeholder_when_paused) {
-        /* We either
-            - are in a stopped/unknown state                -> reset cover
-            - are paused & want a placeholder when paused   -> reset cover
-            - do not have a cover                           -> try downloading cover
-        */
-        if (!m_current.has(meta::COVER))
-            download_missing_cover();
-        else
-            util::reset_cover();
-    }
+    });
 }
 
 void music_source::post_refresh()
 {
+    if (m_current.get<int>(meta::STATUS) != state_playing)
+        m_playing_since = 0;
+    else if (!m_playing_since)
+        m_playing_since = os_gettime_ns();
+
     if (m_prev == m_current) {
         /* Just copy previous data */
         m_current.set(meta::PLAYBACK_DATE, m_prev.get(meta::PLAYBACK_DATE));
@@ -250,4 +378,45 @@ void music_source::post_refresh()
         m_current.set(meta::PLAYBACK_DATE, QDate::currentDate().toString("yyyy.MM.dd"));
         m_current.set(meta::PLAYBACK_TIME, QTime::currentTime().toString("HH:mm:ss"));
     }
+
+    m_changes = m_current.diff(m_prev);
+}
+
+void music_source::defer_refresh(uint64_t ns)
+{
+    m_blocked_until = std::max(m_blocked_until, os_gettime_ns() + ns);
+}
+
+uint64_t music_source::track_timing_refresh(uint64_t now) const
+{
+    const uint64_t interval = config::refresh_rate;
+    /* Polling while paused or in the middle of a song can be slower,
+     * since nothing is expected to change for a while */
+    const uint64_t slow_interval = std::max<uint64_t>(interval * 5, 5000);
+    uint64_t wait = slow_interval;
+
+    if (m_current.get<int>(meta::STATUS) == state_playing) {
+        const int duration = m_current.get<int>(meta::DURATION);
+        const int progress = m_current.get<int>(meta::PROGRESS);
+
+        if (duration > 0 && progress >= 0 && progress <= duration) {
+            /* Wake up one interval before the song is predicted to end
+             * and then poll at the normal rate until it has changed */
+            const uint64_t remaining = duration - progress;
+            if (remaining <= interval * 2)
+                wait = interval;
+            else
+                wait = std::min(slow_interval, remaining - interval);
+        } else {
+            /* No timing information, so we can't predict anything */
+            wait = interval;
+        }
+    }
+
+    return std::max(now + wait * 1000000, m_blocked_until);
+}
+
+uint64_t music_source::next_refresh(uint64_t now) const
+{
+    return std::max(now + uint64_t(config::refresh_rate) * 1000000, m_blocked_until);
 }
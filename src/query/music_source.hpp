@@ -21,8 +21,11 @@
 #include "song.hpp"
 #include <QDate>
 #include <QObject>
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "../gui/tuna_gui.hpp"
@@ -41,6 +44,12 @@ enum capability : uint32_t {
 
 /* clang-format on */
 
+/* Song information of one of the players a source follows at the same time */
+struct player_state {
+    QString id, name;
+    song info;
+};
+
 class music_source : public QObject {
     Q_OBJECT
     const char *m_id, *m_name;
@@ -49,11 +58,43 @@ protected:
     std::array<bool, meta::COUNT> m_supported_metadata {};
     uint32_t m_capabilities = 0x0;
     song m_current = {}, m_prev = {};
+    /* Fields that changed during the last refresh */
+    meta::mask m_changes;
     source_widget* m_settings_tab = nullptr;
 
+    /* os_gettime_ns() timestamp before which this source must not be queried,
+     * used by sources that have to respect API rate limits */
+    uint64_t m_blocked_until = 0;
+
+    /* os_gettime_ns() timestamp of the next scheduled refresh, see schedule() */
+    uint64_t m_next_refresh = 0;
+    /* Set by tuna_thread::wakeup(id) if this source has news before its next refresh */
+    std::atomic<bool> m_refresh_requested { false };
+
+    /* os_gettime_ns() timestamp of when this source started playing,
+     * zero if it isn't playing right now. Read by other query threads */
+    std::atomic<uint64_t> m_playing_since { 0 };
+    std::atomic<bool> m_activated { false };
+
+    /* Background work like bus connections or threads is only started once the
+     * source is used, so unused sources don't slow down OBS startup */
+    std::mutex m_start_mutex;
+    bool m_started = false;
+    virtual void on_start() { }
+    virtual void on_stop() { }
+
     void begin_refresh() { m_prev = m_current; }
 
-    bool download_missing_cover();
+    /* Don't refresh this source for at least the given amount of nanoseconds */
+    void defer_refresh(uint64_t ns);
+
+    /* Schedules the next refresh based on the progress of the current track:
+     * fast polling near the predicted end of the song and slow polling
+     * in between or while nothing is playing */
+    uint64_t track_timing_refresh(uint64_t now) const;
+
+    /* Tries to find a cover via the iTunes search API, blocks until the download is done */
+    static bool download_missing_cover(const song& s);
 
     void supported_metadata(std::vector<meta::type> data)
     {
@@ -82,10 +123,17 @@ public:
     {
         m_current.clear();
         m_prev.clear();
+        m_changes.set();
     }
     const char* name() const { return m_name; }
     const char* id() const { return m_id; }
 
+    /* Starts the background work of this source if it isn't running yet */
+    void start();
+    /* Stops it again once the source isn't queried anymore */
+    void stop();
+    bool started();
+
     /* Abstract stuff */
     virtual bool enabled() const = 0;
     /* Save/load config values */
@@ -96,6 +144,8 @@ public:
     /* Execute and return true if successful */
     virtual bool execute_capability(capability c) = 0;
     virtual void set_gui_values();
+    /* Called on the query thread after each refresh, the actual
+     * retrieval should be submitted to media_thread */
     virtual void handle_cover();
     virtual void handle_lyrics()
     { /* NO-OP */
@@ -113,6 +163,47 @@ public:
     }
 
     virtual void post_refresh();
+
+    /* Returns the os_gettime_ns() timestamp at which refresh() should be
+     * called next, by default this just adds the configured refresh rate */
+    virtual uint64_t next_refresh(uint64_t now) const;
+
+    /* When the query thread should refresh this source next, a requested
+     * refresh is due right away unless the source is blocked */
+    uint64_t due() const
+    {
+        return m_refresh_requested ? m_blocked_until : std::max(m_blocked_until, m_next_refresh);
+    }
+
+    bool refresh_due(uint64_t now) const { return now >= due(); }
+
+    /* Only called by the query thread that refreshes this source */
+    void schedule(uint64_t next) { m_next_refresh = next; }
+
+    void request_refresh() { m_refresh_requested = true; }
+    /* Clears the request before a refresh, so one that comes in meanwhile isn't lost */
+    bool take_refresh_request() { return m_refresh_requested.exchange(false); }
+
+    uint64_t playing_since() const { return m_playing_since; }
+
+    /* Marks this source as the one that was just automatically selected */
+    void activate() { m_activated = true; }
+
+    /* Returns true once after the source was activated */
+    bool take_activation() { return m_activated.exchange(false); }
+
+    const meta::mask& changes() const { return m_changes; }
+
+    /* Every player this source follows, for sources like MPRIS that see several
+     * players at once. Can be called from any thread */
+    virtual std::vector<player_state> players() { return {}; }
+
+    /* Changes whenever one of the players changed */
+    virtual uint64_t players_generation() const { return 0; }
+
+    /* Treats all fields as changed, so everything is processed again.
+     * Only call this from the thread that refreshes this source */
+    void force_update() { m_changes.set(); }
 };
 
 namespace music_sources {
@@ -123,7 +214,16 @@ extern void save();
 extern void set_gui_values();
 extern void deinit();
 extern void select(const char* id);
+/* Stops the background work of all sources except the selected one */
+extern void stop_unused();
 extern std::shared_ptr<music_source> selected_source();
+/* Selects the source that most recently started playing and returns
+ * the selected source, used when all sources are queried in parallel */
+extern std::shared_ptr<music_source> auto_select();
+/* Finds a player of any source by id or by a case insensitive part of its name */
+extern bool find_player(const QString& name, player_state& out);
+/* Sum of the players generations of all sources */
+extern uint64_t players_generation();
 
 template<class T>
 std::shared_ptr<T> get(const char* id)
@@ -0,0 +1,167 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "replay_source.hpp"
+#include "../util/config.hpp"
+#include "../util/constants.hpp"
+#include "../util/output_thread.hpp"
+#include "../util/tuna_thread.hpp"
+#include "../util/utility.hpp"
+#include <QFile>
+#include <QJsonDocument>
+#include <algorithm>
+#include <mutex>
+#include <util/platform.h>
+
+static std::mutex record_mutex;
+static QString record_path;
+static uint64_t record_start = 0;
+
+replay_source::replay_source()
+    : music_source(S_SOURCE_REPLAY, T_SOURCE_REPLAY)
+{
+    supported_metadata({ meta::TITLE, meta::ARTIST, meta::ALBUM, meta::RELEASE, meta::COVER, meta::LYRICS,
+        meta::DURATION, meta::PROGRESS, meta::STATUS, meta::URL, meta::LABEL, meta::GENRE });
+}
+
+void replay_source::load()
+{
+    music_source::load();
+    CDEF_STR(CFG_REPLAY_FILE, "");
+    CDEF_STR(CFG_REPLAY_RECORD, "");
+    CDEF_UINT(CFG_REPLAY_SPEED, 100);
+    CDEF_BOOL(CFG_REPLAY_LOOP, true);
+    m_path = utf8_to_qt(CGET_STR(CFG_REPLAY_FILE));
+    m_speed = std::max<uint32_t>(uint32_t(CGET_UINT(CFG_REPLAY_SPEED)), 1);
+    m_loop = CGET_BOOL(CFG_REPLAY_LOOP);
+
+    std::lock_guard<std::mutex> lock(record_mutex);
+    record_path = utf8_to_qt(CGET_STR(CFG_REPLAY_RECORD));
+    record_start = 0;
+}
+
+void replay_source::load_timeline()
+{
+    m_timeline.clear();
+    m_index = 0;
+    m_shown = SIZE_MAX;
+    QFile f(m_path);
+    if (m_path.isEmpty() || !f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        if (!m_path.isEmpty())
+            berr("Couldn't open replay file %s", qt_to_utf8(m_path));
+        return;
+    }
+
+    while (!f.atEnd()) {
+        const auto line = f.readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        const auto obj = QJsonDocument::fromJson(line).object();
+        if (!obj["song"].isObject())
+            continue;
+        m_timeline.push_back({ uint64_t(std::max<qint64>(obj["time"].toVariant().toLongLong(), 0)), obj["song"].toObject() });
+    }
+    /* Recordings can be concatenated, so entries are not necessarily in order */
+    std::stable_sort(m_timeline.begin(), m_timeline.end(), [](const entry& a, const entry& b) { return a.time < b.time; });
+    binfo("Loaded %i entries from replay file %s", int(m_timeline.size()), qt_to_utf8(m_path));
+}
+
+void replay_source::on_start()
+{
+    load_timeline();
+    m_replay_start = os_gettime_ns();
+}
+
+void replay_source::on_stop()
+{
+    m_timeline.clear();
+    m_index = 0;
+    m_shown = SIZE_MAX;
+}
+
+uint64_t replay_source::replay_time(uint64_t now) const
+{
+    return (now - m_replay_start) / 1000000 * m_speed / 100;
+}
+
+void replay_source::refresh()
+{
+    begin_refresh();
+    if (m_timeline.empty()) {
+        m_current.clear();
+        m_shown = SIZE_MAX;
+        return;
+    }
+
+    uint64_t now = os_gettime_ns();
+    if (m_loop && replay_time(now) > m_timeline.back().time) {
+        m_replay_start = now;
+        m_index = 0;
+    }
+
+    const auto time = replay_time(now);
+    size_t index = m_index;
+    while (index + 1 < m_timeline.size() && m_timeline[index + 1].time <= time)
+        index++;
+
+    /* Only parse the entry again once the timeline moved on */
+    m_index = index;
+    if (m_shown != index) {
+        m_shown = index;
+        m_current.from_json(m_timeline[index].song);
+    }
+}
+
+uint64_t replay_source::next_refresh(uint64_t now) const
+{
+    /* Refresh right when the next entry is due, so accelerated replays aren't
+     * limited by the refresh rate */
+    if (m_index + 1 < m_timeline.size()) {
+        const uint64_t due = m_timeline[m_index + 1].time;
+        const uint64_t time = replay_time(now);
+        const uint64_t wait = due > time ? (due - time) * 100 / m_speed * 1000000 : 0;
+        return std::min(now + wait, music_source::next_refresh(now));
+    }
+    return music_source::next_refresh(now);
+}
+
+bool replay_source::execute_capability(capability)
+{
+    return false;
+}
+
+bool replay_source::enabled() const
+{
+    return true;
+}
+
+void replay_source::record(const tuna_thread::song_snapshot& snap)
+{
+    std::lock_guard<std::mutex> lock(record_mutex);
+    if (record_path.isEmpty())
+        return;
+
+    const uint64_t now = os_gettime_ns();
+    if (!record_start)
+        record_start = now;
+
+    QByteArray line = "{\"time\":" + QByteArray::number(qulonglong((now - record_start) / 1000000)) + ",\"song\":";
+    line += snap.json();
+    line += "}";
+    output_thread::write(record_path, QString::fromUtf8(line), true);
+}
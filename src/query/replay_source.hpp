@@ -0,0 +1,67 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include "music_source.hpp"
+#include <QJsonObject>
+#include <cstdint>
+#include <vector>
+
+namespace tuna_thread {
+class song_snapshot;
+}
+
+/* Plays back a timeline of song information recorded from real sources,
+ * so the whole pipeline can be exercised without a player or API credentials.
+ * Every line of the file is one published snapshot:
+ * { "time": <ms since the recording started>, "song": { ... } } */
+class replay_source : public music_source {
+    struct entry {
+        uint64_t time; /* Milliseconds since the start of the recording */
+        QJsonObject song;
+    };
+
+    QString m_path;
+    uint32_t m_speed = 100; /* In percent of real time */
+    bool m_loop = true;
+
+    std::vector<entry> m_timeline;
+    size_t m_index = 0;
+    /* Index of the entry in m_current, SIZE_MAX if none was parsed yet */
+    size_t m_shown = SIZE_MAX;
+    uint64_t m_replay_start = 0;
+
+    void load_timeline();
+    uint64_t replay_time(uint64_t now) const;
+
+protected:
+    void on_start() override;
+    void on_stop() override;
+
+public:
+    replay_source();
+
+    void load() override;
+    void refresh() override;
+    bool execute_capability(capability c) override;
+    bool enabled() const override;
+    uint64_t next_refresh(uint64_t now) const override;
+
+    /* Appends the snapshot to the recording file if recording is enabled */
+    static void record(const tuna_thread::song_snapshot& snap);
+};
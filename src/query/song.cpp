@@ -19,11 +19,82 @@
 #include "song.hpp"
 #include "../util/config.hpp"
 #include "../util/format.hpp"
+#include "../util/utility.hpp"
 #include "music_source.hpp"
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
-#include <QLocale>
+#include <QSet>
+#include <list>
+#include <mutex>
+
+namespace meta {
+/* Longer strings are kept in a much smaller pool of recent values */
+static const int max_interned_length = 512;
+/* The pool starts over once it's full, so values of old songs don't pile up */
+static const int max_interned = 4096;
+/* Large values like lyrics or VLC descriptions of the last few songs */
+static const size_t max_large = 16;
+
+struct large_value {
+    size_t hash;
+    QString str;
+};
+
+static std::mutex intern_mutex;
+static QSet<QString> interned;
+/* Most recently used first */
+static std::list<large_value> large;
+
+/* Sources read large fields again on every refresh. Reusing the buffer of the
+ * equal value keeps only one copy alive and lets song::diff skip comparing them.
+ * The hash is computed before locking, contents are only compared on a match */
+static QString intern_large(QString const& str, size_t hash)
+{
+    for (auto it = large.begin(); it != large.end(); ++it) {
+        if (it->hash != hash || it->str.size() != str.size())
+            continue;
+        if (it->str.constData() == str.constData() || it->str == str) {
+            large.splice(large.begin(), large, it);
+            return large.front().str;
+        }
+    }
+    large.push_front({ hash, str });
+    if (large.size() > max_large)
+        large.pop_back();
+    return str;
+}
+
+QString intern(QString const& str)
+{
+    if (str.isEmpty())
+        return str;
+
+    if (str.size() > max_interned_length) {
+        auto const hash = size_t(qHash(str));
+        std::lock_guard<std::mutex> lock(intern_mutex);
+        return intern_large(str, hash);
+    }
+
+    std::lock_guard<std::mutex> lock(intern_mutex);
+    auto it = interned.constFind(str);
+    if (it != interned.constEnd())
+        return *it;
+    if (interned.size() >= max_interned)
+        interned.clear();
+    interned.insert(str);
+    return str;
+}
+
+QStringList intern(QStringList const& list)
+{
+    QStringList result;
+    result.reserve(list.size());
+    for (auto const& str : list)
+        result.append(intern(str));
+    return result;
+}
+}
 
 song::song()
 {
@@ -32,9 +103,11 @@ song::song()
 
 void song::clear()
 {
-    m_data = QJsonObject();
-    set(meta::COVER, QString("n/a"));
-    set(meta::LYRICS, QString("n/a"));
+    /* Shared by every song, so clearing doesn't allocate */
+    static const QString not_available = QStringLiteral("n/a");
+    m_data.fill(std::monostate());
+    m_data[meta::COVER] = not_available;
+    m_data[meta::LYRICS] = not_available;
     set(meta::STATUS, state_unknown);
     m_release_precision = prec_unknown;
 }
@@ -55,9 +128,7 @@ void song::update_release_precision()
 
     if (day && month && year) {
         m_release_precision = prec_day;
-        QDate d;
-        d.setDate(get<int>(meta::RELEASE_YEAR), get<int>(meta::RELEASE_MONTH), get<int>(meta::RELEASE_DAY));
-        set(meta::RELEASE, QLocale::system().toString(d, QLocale::ShortFormat));
+        set(meta::RELEASE, util::short_date(get<int>(meta::RELEASE_YEAR), get<int>(meta::RELEASE_MONTH), get<int>(meta::RELEASE_DAY)));
     } else if (month && year) {
         m_release_precision = prec_month;
         set(meta::RELEASE, QString::number(get<int>(meta::RELEASE_YEAR)) + "." + QString::number(get<int>(meta::RELEASE_MONTH)));
@@ -70,18 +141,29 @@ void song::update_release_precision()
     }
 }
 
+/* Interned strings share their buffer, so most equal strings are found without comparing them */
+static bool same_field(song::field const& a, song::field const& b)
+{
+    auto const* sa = std::get_if<QString>(&a);
+    auto const* sb = std::get_if<QString>(&b);
+    if (sa && sb && sa->constData() == sb->constData() && sa->size() == sb->size())
+        return true;
+    return a == b;
+}
+
+meta::mask song::diff(const song& other) const
+{
+    meta::mask result;
+    for (int i = meta::NONE + 1; i < meta::COUNT; i++) {
+        if (!same_field(m_data[i], other.m_data[i]))
+            result.set(i);
+    }
+    return result;
+}
+
 bool song::operator==(const song& other) const
 {
-    /* basically compare all data that shouldn't change in between
-     * updates, unless the song changes
-     */
-    /* clang-format off */
-    return get<int>(meta::STATUS) == other.get<int>(meta::STATUS) &&
-            get(meta::COVER) == other.get(meta::COVER) && get(meta::LABEL) == other.get(meta::LABEL) &&
-           get<int>(meta::DISC_NUMBER) == other.get<int>(meta::DISC_NUMBER) && get<int>(meta::TRACK_NUMBER) == other.get<int>(meta::TRACK_NUMBER) &&
-           get<int>(meta::DURATION) == other.get<int>(meta::DURATION) && get(meta::TITLE) == other.get(meta::TITLE) && get(meta::ALBUM) == get(meta::ALBUM) &&
-           get(meta::RELEASE) == other.get(meta::RELEASE);
-    /* clang-format on */
+    return (diff(other) & meta::song_fields).none();
 }
 
 bool song::operator!=(const song& other) const
@@ -89,9 +171,73 @@ bool song::operator!=(const song& other) const
     return !((*this) == other);
 }
 
+static QJsonValue field_to_json(song::field const& f)
+{
+    if (auto const* i = std::get_if<int>(&f))
+        return *i;
+    if (auto const* b = std::get_if<bool>(&f))
+        return *b;
+    if (auto const* str = std::get_if<QString>(&f))
+        return *str;
+    if (auto const* list = std::get_if<QStringList>(&f))
+        return QJsonArray::fromStringList(*list);
+    return QJsonValue();
+}
+
+/* Converts the value to the type the field is read as, monostate if it can't be */
+static song::field field_from_json(meta::type id, QJsonValue const& v)
+{
+    switch (id) {
+    case meta::RELEASE_DAY:
+    case meta::RELEASE_MONTH:
+    case meta::RELEASE_YEAR:
+    case meta::DURATION:
+    case meta::DISC_NUMBER:
+    case meta::TRACK_NUMBER:
+    case meta::PROGRESS:
+    case meta::STATUS:
+    case meta::TRACK_TOTAL:
+    case meta::DISC_TOTAL: {
+        if (v.isDouble())
+            return v.toInt();
+        bool ok = false;
+        int const i = v.toString().toInt(&ok);
+        if (ok)
+            return i;
+        return std::monostate();
+    }
+    case meta::EXPLICIT:
+        if (v.isBool())
+            return v.toBool();
+        return std::monostate();
+    case meta::ARTIST: {
+        if (v.isString())
+            return QStringList(meta::intern(v.toString()));
+        if (!v.isArray())
+            return std::monostate();
+        QStringList l;
+        for (auto const& e : v.toArray()) {
+            if (e.isString())
+                l.append(meta::intern(e.toString()));
+        }
+        return l;
+    }
+    default:
+        if (v.isString())
+            return meta::intern(v.toString());
+        if (v.isDouble())
+            return QString::number(v.toDouble());
+        return std::monostate();
+    }
+}
+
 void song::to_json(QJsonObject& obj) const
 {
-    obj = m_data;
+    obj = QJsonObject();
+    for (int i = meta::NONE + 1; i < meta::COUNT; i++) {
+        if (has(meta::type(i)))
+            obj[meta::ids[i]] = field_to_json(m_data[i]);
+    }
 
     /* Special cases: Status, Cover link, Artists as list, release as year, month, day */
     QString status = "unknown";
@@ -146,12 +292,24 @@ void song::to_json(QJsonObject& obj) const
     }
 }
 
-void song::from_json(const QJsonObject& obj)
+meta::mask song::from_json(const QJsonObject& obj)
 {
     /* This is currently only used for POSTing info from the web browser
-     * so we only parse supported options */
+     * so we only parse supported options. Values of the wrong type are
+     * dropped, since the body comes from whatever sent the request */
     clear();
-    m_data = obj;
+    meta::mask present;
+    for (int i = meta::NONE + 1; i < meta::COUNT; i++) {
+        auto const it = obj.find(meta::ids[i]);
+        if (it == obj.end())
+            continue;
+        auto value = field_from_json(meta::type(i), *it);
+        /* null still clears the field */
+        if (std::holds_alternative<std::monostate>(value) && !it->isNull())
+            continue;
+        present.set(i);
+        m_data[i] = std::move(value);
+    }
 
     // TODO: Use only one of the three cover_path/cover_url/cover
     // currently sources use cover_path, the web browser widget uses cover_url
@@ -160,6 +318,10 @@ void song::from_json(const QJsonObject& obj)
         set(meta::COVER, obj["cover"].toString());
     else
         set(meta::COVER, obj["cover_url"].toString());
+    if (obj.contains("cover") || obj.contains("cover_url"))
+        present.set(meta::COVER);
+    if (obj.contains("status"))
+        present.set(meta::STATUS);
 
     auto status = play_state::state_unknown;
     if (obj["status"].toString() == "playing")
@@ -172,6 +334,7 @@ void song::from_json(const QJsonObject& obj)
 
     auto release = obj["release_date"];
     if (release.isObject()) {
+        present |= meta::mask(meta::bit(meta::RELEASE) | meta::bit(meta::RELEASE_DAY) | meta::bit(meta::RELEASE_MONTH) | meta::bit(meta::RELEASE_YEAR));
         if (release["precision"].isString()) {
             auto prec = release["precision"].toString();
             if (prec == "year")
@@ -203,4 +366,15 @@ void song::from_json(const QJsonObject& obj)
             }
         }
     }
+    return present;
+}
+
+void song::merge(const song& other, const meta::mask& fields)
+{
+    for (int i = meta::NONE + 1; i < meta::COUNT; i++) {
+        if (fields.test(i))
+            m_data[i] = other.m_data[i];
+    }
+    if (fields.test(meta::RELEASE) || fields.test(meta::RELEASE_YEAR))
+        m_release_precision = other.m_release_precision;
 }
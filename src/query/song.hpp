@@ -22,9 +22,12 @@
 #include <QList>
 #include <QMap>
 #include <QString>
+#include <QStringList>
 #include <QVariant>
 #include <array>
+#include <bitset>
 #include <stdint.h>
+#include <variant>
 
 class QJsonObject;
 
@@ -151,11 +154,36 @@ enum type : uint8_t {
     COUNT
 };
 static_assert(sizeof(ids) / sizeof(char*) - 1 == COUNT, "");
+
+/* One bit per field, used to track which fields changed between two refreshes */
+typedef std::bitset<COUNT> mask;
+static_assert(COUNT <= 64, "meta::bit() needs a wider type");
+
+constexpr unsigned long long bit(type t)
+{
+    return 1ull << t;
+}
+
+/* Fields that shouldn't change in between updates, unless the song changes */
+static const mask song_fields { bit(STATUS) | bit(COVER) | bit(LABEL) | bit(DISC_NUMBER) | bit(TRACK_NUMBER)
+    | bit(DURATION) | bit(TITLE) | bit(ALBUM) | bit(RELEASE) };
+
+/* Returns the shared copy of an equal string that was set before, so values
+ * that repeat on every refresh reuse one buffer and usually compare by pointer.
+ * Long values like lyrics are only remembered for the last few songs */
+QString intern(QString const& str);
+QStringList intern(QStringList const& list);
 }
 
 class song {
+public:
+    /* A single metadata field, std::monostate means it isn't set */
+    typedef std::variant<std::monostate, int, bool, QString, QStringList> field;
+
+private:
     date_precision m_release_precision;
-    QJsonObject m_data;
+    /* Indexed by meta::type, copying a song only bumps the refcounts of the strings */
+    std::array<field, meta::COUNT> m_data;
 
 public:
     song();
@@ -167,12 +195,12 @@ public:
     template<meta::type T>
     void reset()
     {
-        m_data[meta::ids[T]] = QJsonValue();
+        m_data[T] = std::monostate();
     }
 
     bool has(meta::type id) const
     {
-        return m_data.contains(meta::ids[id]) && !m_data[meta::ids[id]].isNull();
+        return !std::holds_alternative<std::monostate>(m_data[id]);
     }
 
     template<class T = QString>
@@ -184,82 +212,71 @@ public:
     template<class T>
     bool is(meta::type id) const;
 
-    QJsonObject const& data() const { return m_data; }
     date_precision release_precision() const { return m_release_precision; }
 
+    /* Returns a mask of all fields that differ between the two songs */
+    meta::mask diff(const song& other) const;
+
     bool operator==(const song& other) const;
     bool operator!=(const song& other) const;
 
     void to_json(QJsonObject& obj) const;
-    void from_json(const QJsonObject& obj);
+    /* Replaces all fields, returns the fields that were present in the json */
+    meta::mask from_json(const QJsonObject& obj);
+
+    /* Copies the given fields from other, used to apply partial updates */
+    void merge(const song& other, const meta::mask& fields);
 };
 
+template<class T>
+inline T song_field_get(song::field const& f, T const& def)
+{
+    /* Fields that hold another type are treated as missing */
+    if (auto const* v = std::get_if<T>(&f))
+        return *v;
+    return def;
+}
+
 template<>
 inline QString song::get(meta::type id, QString const& def) const
 {
-    if (has(id)) {
-        auto const& data = m_data[meta::ids[id]];
-        Q_ASSERT(data.isString());
-        return data.toString();
-    }
-    return def;
+    return song_field_get(m_data[id], def);
 }
 
 template<>
 inline int song::get(meta::type id, int const& def) const
 {
-    if (has(id)) {
-        auto const& data = m_data[meta::ids[id]];
-        Q_ASSERT(data.isDouble());
-        return data.toInt();
-    }
-    return def;
+    return song_field_get(m_data[id], def);
 }
 
 template<>
 inline QStringList song::get(meta::type id, QStringList const& def) const
 {
-    if (has(id)) {
-        auto const& data = m_data[meta::ids[id]];
-        Q_ASSERT(data.isArray());
-        QStringList l;
-        auto const& arr = data.toArray();
-        for (auto const& v : arr) {
-            if (v.isString())
-                l.append(v.toString());
-        }
-        return l;
-    }
-    return def;
+    return song_field_get(m_data[id], def);
 }
 
 template<>
 inline bool song::get(meta::type id, bool const& def) const
 {
-    if (has(id)) {
-        auto const& data = m_data[meta::ids[id]];
-        Q_ASSERT(data.isBool());
-        return data.toBool();
-    }
-    return def;
+    return song_field_get(m_data[id], def);
 }
 
 template<>
 inline bool song::is<bool>(meta::type id) const
 {
-    return has(id) && m_data[meta::ids[id]].isBool();
+    return std::holds_alternative<bool>(m_data[id]);
 }
 
 template<>
 inline bool song::is<QString>(meta::type id) const
 {
-    return has(id) && m_data[meta::ids[id]].isString();
+    return std::holds_alternative<QString>(m_data[id]);
 }
 
 template<>
 inline bool song::is<int>(meta::type id) const
 {
-    return has(id) && m_data[meta::ids[id]].isDouble();
+    return std::holds_alternative<int>(m_data[id]);
 }
 
 template<>
@@ -267,32 +284,29 @@ inline void song::set(meta::type id, QString const& v)
 {
     // This _needs_ to be a qstringlist
     Q_ASSERT(id != meta::ARTIST);
-    m_data[meta::ids[id]] = v;
+    m_data[id] = meta::intern(v);
 }
 
 template<>
 inline void song::set(meta::type id, play_state const& v)
 {
-    m_data[meta::ids[id]] = (int)v;
+    m_data[id] = (int)v;
 }
 
 template<>
 inline void song::set(meta::type id, int const& v)
 {
-    m_data[meta::ids[id]] = v;
+    m_data[id] = v;
 }
 
 template<>
 inline void song::set(meta::type id, bool const& v)
 {
-    m_data[meta::ids[id]] = v;
+    m_data[id] = v;
 }
 
 template<>
 inline void song::set(meta::type id, QStringList const& v)
 {
-    QJsonArray a;
-    for (auto const& l : v)
-        a.append(l);
-    m_data[meta::ids[id]] = a;
+    m_data[id] = meta::intern(v);
 }
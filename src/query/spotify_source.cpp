@@ -20,8 +20,12 @@
 #include "spotify_source.hpp"
 #include "../gui/tuna_gui.hpp"
 #include "../gui/widgets/spotify.hpp"
+#include "../util/async_http.hpp"
 #include "../util/config.hpp"
 #include "../util/constants.hpp"
+#include "../util/media_thread.hpp"
+#include "../util/metrics.hpp"
+#include "../util/tuna_thread.hpp"
 #if !defined(SPOTIFY_CREDENTIALS)
 #    include "../util/creds.hpp"
 #endif
@@ -31,6 +35,8 @@
 #include <QJsonObject>
 #include <QString>
 #include <curl/curl.h>
+#include <functional>
+#include <mutex>
 #include <util/config-file.h>
 #include <util/platform.h>
 
@@ -41,9 +47,14 @@
 #define PLAYER_NEXT_URL (PLAYER_URL "/next")
 #define PLAYER_PREVIOUS_URL (PLAYER_URL "/previous")
 #define PLAYER_VOLUME_URL (PLAYER_URL "/volume")
-#define CURL_DEBUG 0L
+#define PLAYER_QUEUE_URL (PLAYER_URL "/queue")
 #define REDIRECT_URI "https%3A%2F%2Funivrsal.github.io%2Fauth%2Ftoken"
 
+/* Tokens are renewed this many seconds before they expire,
+ * failed renewals are retried after token_retry_delay seconds */
+static const int64_t token_refresh_margin = 5 * 60;
+static const int64_t token_retry_delay = 30;
+
 spotify_source::spotify_source()
     : music_source(S_SOURCE_SPOTIFY, T_SOURCE_SPOTIFY, new spotify)
 {
@@ -83,10 +94,13 @@ void spotify_source::load()
     CDEF_INT(CFG_SPOTIFY_REQUEST_TIMEOUT, 1000);
 
     m_logged_in = CGET_BOOL(CFG_SPOTIFY_LOGGEDIN);
-    m_token = utf8_to_qt(CGET_STR(CFG_SPOTIFY_TOKEN));
-    m_refresh_token = utf8_to_qt(CGET_STR(CFG_SPOTIFY_REFRESH_TOKEN));
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        m_token = utf8_to_qt(CGET_STR(CFG_SPOTIFY_TOKEN));
+        m_refresh_token = utf8_to_qt(CGET_STR(CFG_SPOTIFY_REFRESH_TOKEN));
+        m_token_termination = CGET_INT(CFG_SPOTIFY_TOKEN_TERMINATION);
+    }
     m_auth_code = utf8_to_qt(CGET_STR(CFG_SPOTIFY_AUTH_CODE));
-    m_token_termination = CGET_INT(CFG_SPOTIFY_TOKEN_TERMINATION);
     m_curl_timeout_ms = CGET_INT(CFG_SPOTIFY_REQUEST_TIMEOUT);
 
     build_credentials();
@@ -94,7 +108,7 @@ void spotify_source::load()
 
     /* Token handling */
     if (m_logged_in) {
-        if (util::epoch() > m_token_termination) {
+        if (util::epoch() > token_termination()) {
             binfo("Refreshing Spotify token");
             QString log;
             const auto result = do_refresh_token(log);
@@ -110,6 +124,11 @@ void spotify_source::load()
 long execute_command(const char* auth_token, const char* url, std::string& response_header,
     QJsonDocument& response_json, int64_t curl_timeout, const char* custom_request_type = nullptr, const char* request_data = nullptr);
 
+/* Sends a GET request without waiting for it, done runs on the http thread
+ * (or right away with an http code of zero while requests are held back) */
+void execute_command_async(const char* auth_token, const char* url, int64_t curl_timeout,
+    std::function<void(long, QJsonDocument&)> done);
+
 void extract_timeout(const std::string& header, uint64_t& timeout)
 {
     static const std::string what = "Retry-After: ";
@@ -134,30 +153,23 @@ void spotify_source::refresh()
     begin_refresh();
     bdebug("[Spotify] begin refresh");
 
-    if (util::epoch() > m_token_termination) {
-        binfo("Refreshing Spotify token");
-        QString log;
-        do_refresh_token(log);
-        //        emit(get_ui<spotify>())->login_state_changed(result, log);
-        save();
-    }
-
-    if (m_timout_start) {
-        if (os_gettime_ns() - m_timout_start >= m_timeout_length) {
-            m_timout_start = 0;
-            m_timeout_length = 0;
-            binfo("API timeout of %i seconds is over", int(m_timeout_length));
-        } else {
-            bdebug("Waiting for Spotify-API timeout");
-            return;
-        }
+    /* The token is renewed in the background ahead of its expiry, so
+     * polling never has to wait for the token endpoint */
+    auto const now = util::epoch();
+    auto const termination = token_termination();
+    if (now > termination - token_refresh_margin && now >= m_next_token_attempt)
+        refresh_token_async();
+    if (now > termination) {
+        /* No point in polling with an expired token */
+        defer_refresh(SECOND_TO_NS);
+        return;
     }
 
     std::string header = "";
     QJsonDocument response;
     QJsonObject obj;
 
-    const auto http_code = execute_command(qt_to_utf8(m_token), PLAYER_URL, header, response, m_curl_timeout_ms);
+    const auto http_code = execute_command(qt_to_utf8(token()), PLAYER_URL, header, response, m_curl_timeout_ms);
     bdebug("Executed %s command", PLAYER_URL);
     if (response.isObject())
         obj = response.object();
@@ -178,8 +190,22 @@ void spotify_source::refresh()
             if (device.toObject()["is_private"].toBool()) {
                 berr("Spotify session is private! Can't read track");
             } else {
-                parse_track_json(obj);
+                /* Most polls only move the progress, so artists, album, images
+                 * and context are only parsed again once the track changes */
+                const auto track = obj["item"].toObject()["id"].toString();
+                const auto context = obj["context"].toObject()["uri"].toString();
+                if (track.isEmpty() || track != m_parsed_track || context != m_parsed_context || !m_current.has(meta::TITLE)) {
+                    parse_track_json(obj);
+                    m_parsed_track = track;
+                    m_parsed_context = context;
+                    m_parsed_playlist = obj["context"].toObject()["href"].toString();
+                } else if (!m_parsed_playlist.isEmpty()) {
+                    /* The playlist name can arrive after the track was parsed */
+                    lookup_playlist(m_parsed_playlist);
+                }
                 m_current.set(meta::STATUS, playing.toBool() ? state_playing : state_stopped);
+                if (playing.toBool())
+                    prefetch_next();
             }
             m_current.set(meta::PROGRESS, progress.toInt());
         } else {
@@ -190,23 +216,102 @@ void spotify_source::refresh()
     } else if (http_code == HTTP_NO_CONTENT) {
         /* No session running */
         m_current.clear();
+        m_parsed_track.clear();
+        m_parsed_playlist.clear();
     } else {
         /* Don't reset cover or info here since
          * we're just waiting for the API to give a proper
          * response again
          */
         if (http_code == STATUS_RETRY_AFTER && !header.empty()) {
-            extract_timeout(header, m_timeout_length);
-            if (m_timeout_length) {
-                bwarn("Spotify-API Rate limit hit, waiting %i seconds\n", int(m_timeout_length));
-                m_timeout_length *= SECOND_TO_NS;
-                m_timout_start = os_gettime_ns();
+            uint64_t timeout = 0;
+            extract_timeout(header, timeout);
+            if (timeout) {
+                bwarn("Spotify-API Rate limit hit, waiting %i seconds\n", int(timeout));
+                metrics::rate_limited(id());
+                defer_refresh(timeout * SECOND_TO_NS);
             }
         }
     }
     bdebug("[Spotify] Finished refresh");
 }
 
+uint64_t spotify_source::next_refresh(uint64_t now) const
+{
+    /* The API returns the progress and duration, so we only have to ask often
+     * when the song is about to end */
+    return track_timing_refresh(now);
+}
+
+void spotify_source::prefetch_next()
+{
+    /* Only ask for the queue once per track */
+    auto const track = m_current.get(meta::URL);
+    if (track.isEmpty() || track == m_prefetched_for)
+        return;
+    m_prefetched_for = track;
+
+    execute_command_async(qt_to_utf8(token()), PLAYER_QUEUE_URL, m_curl_timeout_ms, [](long http_code, QJsonDocument& response) {
+        if (http_code != HTTP_OK)
+            return;
+
+        auto const queue = response["queue"].toArray();
+        if (queue.isEmpty())
+            return;
+        auto const images = queue[0].toObject()["album"].toObject()["images"].toArray();
+        if (images.isEmpty())
+            return;
+
+        auto const url = images[0].toObject()["url"].toString();
+        media_thread::submit(media_thread::JOB_PREFETCH, [url] { util::prefetch_cover(url); });
+    });
+}
+
+/* Playlists are rarely renamed, failed lookups are retried a bit sooner */
+static const int64_t playlist_ttl = 60 * 60;
+static const int64_t failed_playlist_ttl = 5 * 60;
+static const int max_playlists = 64;
+
+void spotify_source::lookup_playlist(const QString& url)
+{
+    auto const now = util::epoch();
+    bool lookup = false;
+    {
+        std::lock_guard<std::mutex> lock(m_playlist_mutex);
+        if (m_playlists.size() > max_playlists && !m_playlists.contains(url))
+            m_playlists.clear();
+
+        auto& info = m_playlists[url];
+        if (!info.pending && now - info.fetched > (info.name.isEmpty() ? failed_playlist_ttl : playlist_ttl)) {
+            info.pending = true;
+            lookup = true;
+        }
+        /* An outdated name is still better than none while it's looked up again */
+        if (!info.name.isEmpty())
+            m_current.set(meta::PLAYLIST_NAME, info.name);
+    }
+    if (!lookup)
+        return;
+
+    /* The name is added by a later refresh, which the lookup triggers once it's done */
+    execute_command_async(qt_to_utf8(token()), qt_to_utf8(url), m_curl_timeout_ms, [this, url](long http_code, QJsonDocument& playlist) {
+        bool changed = false;
+        {
+            std::lock_guard<std::mutex> lock(m_playlist_mutex);
+            auto& info = m_playlists[url];
+            info.pending = false;
+            info.fetched = util::epoch();
+            if (http_code == HTTP_OK) {
+                auto const name = playlist["name"].toString();
+                changed = name != info.name;
+                info.name = name;
+            }
+        }
+        if (changed)
+            tuna_thread::wakeup(id());
+    });
+}
+
 void spotify_source::parse_track_json(const QJsonValue& response)
 {
     const auto& trackObj = response["item"].toObject();
@@ -226,20 +331,8 @@ void spotify_source::parse_track_json(const QJsonValue& response)
         if (context["external_urls"].isObject())
             m_current.set(meta::CONTEXT_EXTERNAL_URL, context["external_urls"].toObject()["spotify"].toString());
 
-        if (context["href"].isString()) {
-            QJsonDocument playlist_response;
-            QJsonObject obj;
-            std::string header = "";
-            const auto& url = context["href"].toString();
-            const auto http_code = execute_command(qt_to_utf8(m_token), qt_to_utf8(url), header, playlist_response, m_curl_timeout_ms);
-
-            if (playlist_response.isObject())
-                obj = playlist_response.object();
-
-            if (http_code == HTTP_OK) {
-                m_current.set(meta::PLAYLIST_NAME, playlist_response["name"].toString());
-            }
-        }
+        if (context["href"].isString())
+            lookup_playlist(context["href"].toString());
     }
 
     QStringList tmp;
@@ -288,7 +381,7 @@ void spotify_source::parse_track_json(const QJsonValue& response)
 
 bool spotify_source::execute_capability(capability c)
 {
-    QString const token = qt_to_utf8(m_token);
+    QString const token = this->token();
     auto const playing = m_current.get<int>(meta::STATUS);
     auto timeout = m_curl_timeout_ms;
     // offload this into a separate thread because the request
@@ -338,60 +431,21 @@ bool spotify_source::execute_capability(capability c)
 
 /* === CURL/Spotify API handling === */
 
-size_t header_callback(char* ptr, size_t size, size_t nmemb, std::string* str)
+static async_http::request token_request(const std::string& request, const std::string& credentials, int64_t timeout)
 {
-    size_t new_length = size * nmemb;
-    try {
-        str->append(ptr, new_length);
-    } catch (std::bad_alloc& e) {
-        berr("Error reading curl header: %s", e.what());
-        return 0;
-    }
-    return new_length;
-}
-
-CURL* prepare_curl(struct curl_slist* header, std::string* response, std::string* response_header,
-    const std::string& request, int64_t timeout)
-{
-    CURL* curl = curl_easy_init();
-
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_URL, TOKEN_URL);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(request.c_str()));
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, util::write_callback);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, response_header);
-#ifdef DEBUG
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, CURL_DEBUG);
-#endif
-    return curl;
+    async_http::request req;
+    req.url = TOKEN_URL;
+    req.body = request;
+    req.timeout_ms = long(timeout);
+    req.headers.push_back("Authorization: Basic " + credentials);
+    return req;
 }
 
-/* Requests an access token via request body
- * over a POST request to spotify */
-void request_token(const std::string& request, const std::string& credentials, QJsonDocument& response_json, int64_t timeout)
+static void parse_token_response(const async_http::response& res, QJsonDocument& response_json)
 {
-    if (request.empty() || credentials.empty()) {
-        berr("Cannot request token without valid credentials"
-             " and/or auth code!");
-        return;
-    }
-
-    std::string response, response_header;
-    std::string header = "Authorization: Basic ";
-    header.append(credentials);
-
-    auto* list = curl_slist_append(nullptr, header.c_str());
-    CURL* curl = prepare_curl(list, &response, &response_header, request, timeout);
-    CURLcode res = curl_easy_perform(curl);
-
-    if (res == CURLE_OK) {
+    if (res.result == CURLE_OK) {
         QJsonParseError err;
-        response_json = QJsonDocument::fromJson(response.c_str(), &err);
+        response_json = QJsonDocument::fromJson(QByteArray::fromStdString(res.body), &err);
         if (response_json.isNull()) {
             berr("Couldn't parse response to json: %s", err.errorString().toStdString().c_str());
         } else {
@@ -406,67 +460,119 @@ void request_token(const std::string& request, const std::string& credentials, Q
             binfo("Spotify response: %s", qt_to_utf8(str));
         }
     } else {
-        berr("Curl returned error code (%i) %s", res, curl_easy_strerror(res));
+        berr("Curl returned error code (%i) %s", res.result, res.error.c_str());
     }
-
-    curl_slist_free_all(list);
-    curl_easy_cleanup(curl);
 }
 
-/* Gets a new token using the refresh token */
-bool spotify_source::do_refresh_token(QString& log)
+/* Requests an access token via request body
+ * over a POST request to spotify */
+void request_token(const std::string& request, const std::string& credentials, QJsonDocument& response_json, int64_t timeout)
 {
-    build_credentials();
-    static std::string request;
-    bool result = false;
-    QJsonDocument response;
-
-    if (m_refresh_token.isEmpty()) {
-        berr("Refresh token is empty!");
+    if (request.empty() || credentials.empty()) {
+        berr("Cannot request token without valid credentials"
+             " and/or auth code!");
+        return;
     }
+    parse_token_response(async_http::fetch(token_request(request, credentials, timeout)).get(), response_json);
+}
 
-    request = "grant_type=refresh_token&refresh_token=";
-    request.append(m_refresh_token.toStdString());
-    request_token(request, m_creds.toStdString(), response, m_curl_timeout_ms);
+std::string spotify_source::refresh_request() const
+{
+    auto const refresh = refresh_token();
+    if (refresh.isEmpty())
+        berr("Refresh token is empty!");
+    return "grant_type=refresh_token&refresh_token=" + refresh.toStdString();
+}
 
+bool spotify_source::apply_refreshed_token(const QJsonDocument& response, QString& log)
+{
+    bool result = false;
     if (response.isNull()) {
         berr("Couldn't refresh Spotify token, response was null");
-    } else {
-        const auto& response_obj = response.object();
-        const auto& token = response_obj["access_token"];
-        const auto& expires = response_obj["expires_in"];
-        const auto& error = response_obj["error"];
-        const auto& refresh_token = response_obj["refresh_token"];
+        return false;
+    }
 
-        /* Dump the json into the log text */
-        log = QString(response.toJson(QJsonDocument::Indented));
-        if (token.isString() && expires.isDouble()) {
-            m_token = token.toString();
-            m_token_termination = util::epoch() + expires.toInt();
-            result = true;
-            binfo("Successfully logged in");
-        } else {
-            if (error.isString())
-                berr("Received error from spotify: %s", qt_to_utf8(error.toString()));
-            else
-                berr("Couldn't parse json response");
-        }
+    const auto& response_obj = response.object();
+    const auto& token = response_obj["access_token"];
+    const auto& expires = response_obj["expires_in"];
+    const auto& error = response_obj["error"];
+    const auto& refresh_token = response_obj["refresh_token"];
+
+    /* Dump the json into the log text */
+    log = QString(response.toJson(QJsonDocument::Indented));
+
+    std::lock_guard<std::mutex> lock(m_token_mutex);
+    if (token.isString() && expires.isDouble()) {
+        m_token = token.toString();
+        m_token_termination = util::epoch() + expires.toInt();
+        result = true;
+        binfo("Successfully logged in");
+    } else {
+        if (error.isString())
+            berr("Received error from spotify: %s", qt_to_utf8(error.toString()));
+        else
+            berr("Couldn't parse json response");
+    }
 
-        /* Refreshing the token can return a new refresh token */
-        if (refresh_token.isString()) {
-            QString tmp = refresh_token.toString();
-            if (!tmp.isEmpty()) {
-                binfo("Received a new fresh token");
-                m_refresh_token = refresh_token.toString();
-            }
+    /* Refreshing the token can return a new refresh token */
+    if (refresh_token.isString()) {
+        QString tmp = refresh_token.toString();
+        if (!tmp.isEmpty()) {
+            binfo("Received a new fresh token");
+            m_refresh_token = tmp;
         }
     }
+    return result;
+}
+
+/* Gets a new token using the refresh token */
+bool spotify_source::do_refresh_token(QString& log)
+{
+    build_credentials();
+    QJsonDocument response;
+    request_token(refresh_request(), m_creds.toStdString(), response, m_curl_timeout_ms);
 
+    bool result = apply_refreshed_token(response, log);
     m_logged_in = result;
     save();
     return result;
 }
 
+void spotify_source::refresh_token_async()
+{
+    if (m_token_refreshing.exchange(true))
+        return;
+
+    binfo("Refreshing Spotify token");
+    build_credentials();
+    async_http::submit(token_request(refresh_request(), m_creds.toStdString(), m_curl_timeout_ms), [this](async_http::response&& res) {
+        QJsonDocument response;
+        parse_token_response(res, response);
+        QString log;
+        bool const result = apply_refreshed_token(response, log);
+
+        /* Only an actual answer from Spotify logs us out, network hiccups are retried */
+        if (result || !response.isNull())
+            m_logged_in = result;
+        if (!result)
+            m_next_token_attempt = util::epoch() + token_retry_delay;
+        save_token();
+        m_token_refreshing = false;
+        tuna_thread::wakeup(id());
+    });
+}
+
+void spotify_source::save_token()
+{
+    /* Not save(), that reads the settings widget which only the UI thread may touch.
+     * Called on the http thread, so the config is written later by the flush thread */
+    std::lock_guard<std::mutex> lock(m_token_mutex);
+    config::defer_str(CFG_SPOTIFY_TOKEN, m_token);
+    config::defer_str(CFG_SPOTIFY_REFRESH_TOKEN, m_refresh_token);
+    config::defer_bool(CFG_SPOTIFY_LOGGEDIN, m_logged_in);
+    config::defer_int(CFG_SPOTIFY_TOKEN_TERMINATION, m_token_termination);
+}
+
 /* Gets the first token from the access code */
 bool spotify_source::new_token(QString& log)
 {
@@ -489,6 +595,7 @@ bool spotify_source::new_token(QString& log)
         log = QString(response.toJson(QJsonDocument::Indented));
 
         if (token.isString() && refresh.isString() && expires.isDouble()) {
+            std::lock_guard<std::mutex> lock(m_token_mutex);
             m_token = token.toString();
             m_refresh_token = refresh.toString();
             m_token_termination = util::epoch() + expires.toInt();
@@ -504,78 +611,91 @@ bool spotify_source::new_token(QString& log)
     return result;
 }
 
-/* Sends commands to spotify api via url */
+/* Failed requests make all commands wait for a growing amount of seconds */
+static std::mutex command_timeout_mutex;
+static int64_t command_timeout_start = 0;
+static int command_timeout = 0;
+static int command_timeout_multiplier = 1;
 
-long execute_command(const char* auth_token, const char* url, std::string& response_header,
-    QJsonDocument& response_json, int64_t curl_timeout, const char* custom_request_type, const char* request_data)
+static bool waiting_for_timeout()
 {
-    static int timeout_start = 0;
-    static int timeout = 0;
-    static int timeout_multiplier = 1;
-
-    if (timeout > 0) {
-        if (util::epoch() - timeout_start >= timeout) {
+    std::lock_guard<std::mutex> lock(command_timeout_mutex);
+    if (command_timeout > 0) {
+        if (util::epoch() - command_timeout_start >= command_timeout) {
             binfo("cURL request timeout over.");
-            timeout = 0;
+            command_timeout = 0;
         } else {
-            return 0; // Waiting for timeout to be over
+            return true;
         }
     }
+    return false;
+}
 
-    long http_code = -1;
-    std::string response;
-
-    std::string header = "Authorization: Bearer ";
-    header.append(auth_token);
-
-    auto* list = curl_slist_append(nullptr, header.c_str());
-
-    CURL* curl = curl_easy_init();
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, util::write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, curl_timeout);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response_header);
-
+static async_http::request command_request(const char* auth_token, const char* url, int64_t curl_timeout,
+    const char* custom_request_type, const char* request_data)
+{
+    async_http::request req;
+    req.url = url;
+    req.timeout_ms = long(curl_timeout);
+    req.headers.push_back(std::string("Authorization: Bearer ") + auth_token);
     if (custom_request_type != nullptr) {
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, custom_request_type);
-        if (request_data)
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request_data);
-        else
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "{}");
+        req.method = custom_request_type;
+        req.body = request_data ? request_data : "{}";
     }
+    return req;
+}
 
-    if (!response_header.empty())
-        bdebug("Response header: %s", response_header.c_str());
-
-#ifdef DEBUG
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, CURL_DEBUG);
-#endif
-    CURLcode res = curl_easy_perform(curl);
+static long command_result(const async_http::response& res, std::string& response_header, QJsonDocument& response_json)
+{
+    long http_code = -1;
+    response_header = res.header;
 
-    if (res == CURLE_OK) {
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    std::lock_guard<std::mutex> lock(command_timeout_mutex);
+    if (res.result == CURLE_OK) {
+        http_code = res.status;
         QJsonParseError err;
 
-        response_json = QJsonDocument::fromJson(response.c_str(), &err);
-        if (response_json.isNull() && !response.empty()) {
-            berr("Failed to parse json response: %s, Error: %s", response.c_str(), qt_to_utf8(err.errorString()));
+        response_json = QJsonDocument::fromJson(QByteArray::fromStdString(res.body), &err);
+        if (response_json.isNull() && !res.body.empty()) {
+            berr("Failed to parse json response: %s, Error: %s", res.body.c_str(), qt_to_utf8(err.errorString()));
         } else {
-            timeout_multiplier = 1; // Reset on successful requests
-            timeout_start = 0;
-            timeout = 0;
+            command_timeout_multiplier = 1; // Reset on successful requests
+            command_timeout_start = 0;
+            command_timeout = 0;
         }
     } else {
-        timeout_start = util::epoch();
-        timeout = 5 * timeout_multiplier++;
+        command_timeout_start = util::epoch();
+        command_timeout = 5 * command_timeout_multiplier++;
         berr(
             "cURL failed while sending spotify command (HTTP error %i, cURL error %i: '%s'). Waiting %i seconds before trying again",
-            int(http_code), res, curl_easy_strerror(res), timeout);
+            int(res.status), res.result, res.error.c_str(), command_timeout);
     }
-
-    curl_slist_free_all(list);
-    curl_easy_cleanup(curl);
     return http_code;
 }
+
+/* Sends commands to spotify api via url */
+long execute_command(const char* auth_token, const char* url, std::string& response_header,
+    QJsonDocument& response_json, int64_t curl_timeout, const char* custom_request_type, const char* request_data)
+{
+    if (waiting_for_timeout())
+        return 0;
+    auto const res = async_http::fetch(command_request(auth_token, url, curl_timeout, custom_request_type, request_data)).get();
+    return command_result(res, response_header, response_json);
+}
+
+void execute_command_async(const char* auth_token, const char* url, int64_t curl_timeout,
+    std::function<void(long, QJsonDocument&)> done)
+{
+    if (waiting_for_timeout()) {
+        QJsonDocument json;
+        done(0, json);
+        return;
+    }
+    async_http::submit(command_request(auth_token, url, curl_timeout, nullptr, nullptr),
+        [done = std::move(done)](async_http::response&& res) {
+            std::string header;
+            QJsonDocument json;
+            auto const http_code = command_result(res, header, json);
+            done(http_code, json);
+        });
+}
@@ -19,26 +19,61 @@
 #pragma once
 
 #include "music_source.hpp"
+#include <QHash>
 #include <QJsonValue>
 #include <QString>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+class QJsonDocument;
 
 class spotify_source : public music_source {
-    bool m_logged_in = false;
+    std::atomic<bool> m_logged_in { false };
     bool m_last_state = false;
-    QString m_token = "";
+    /* Track and context that m_current was parsed from, the full track is
+     * only parsed again if one of them changes. Empty if nothing was parsed */
+    QString m_parsed_track, m_parsed_context;
+    /* Api url of the parsed context, whose name is looked up in the background */
+    QString m_parsed_playlist;
     QString m_creds = "";
     QString m_auth_code = "";
-    QString m_refresh_token = "";
 
+    /* The tokens are renewed in the background, so they're only
+     * accessed through the getters below */
+    mutable std::mutex m_token_mutex;
+    QString m_token = "";
+    QString m_refresh_token = "";
     /* epoch time in seconds */
     int64_t m_token_termination = 0;
+    std::atomic<bool> m_token_refreshing { false };
+    /* epoch time in seconds before which a failed renewal isn't retried */
+    std::atomic<int64_t> m_next_token_attempt { 0 };
 
     int64_t m_curl_timeout_ms = 1000;
 
-    uint64_t m_timeout_length = 0, /* Rate limit timeout length */
-        m_timout_start = 0;        /* Timeout start */
+    /* Track whose successor's cover was last prefetched */
+    QString m_prefetched_for = "";
+
+    /* Playlist names by context href, filled in by background requests */
+    struct playlist_info {
+        QString name;
+        /* epoch time in seconds of the last lookup */
+        int64_t fetched = 0;
+        bool pending = false;
+    };
+    std::mutex m_playlist_mutex;
+    QHash<QString, playlist_info> m_playlists;
+
+    void lookup_playlist(const QString& url);
+
     void parse_track_json(const QJsonValue& track);
+    void prefetch_next();
     void build_credentials();
+    std::string refresh_request() const;
+    bool apply_refreshed_token(const QJsonDocument& response, QString& log);
+    void refresh_token_async();
+    void save_token();
 
 public:
     spotify_source();
@@ -46,13 +81,26 @@ public:
     bool enabled() const override;
     void load() override;
     void refresh() override;
+    uint64_t next_refresh(uint64_t now) const override;
     bool execute_capability(capability c) override;
     bool do_refresh_token(QString& log);
     bool new_token(QString& log);
     void set_auth_code(const QString& auth_code) { m_auth_code = auth_code; }
     bool is_logged_in() const { return m_logged_in; }
-    int token_termination() const { return m_token_termination; }
+    int token_termination() const
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        return m_token_termination;
+    }
     const QString& auth_code() const { return m_auth_code; }
-    const QString& token() const { return m_token; }
-    const QString& refresh_token() const { return m_refresh_token; }
+    QString token() const
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        return m_token;
+    }
+    QString refresh_token() const
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        return m_refresh_token;
+    }
 };
@@ -24,6 +24,44 @@
 #include "../util/utility.hpp"
 #include <QUrl>
 #include <obs-frontend-api.h>
+#include <util/platform.h>
+
+/* Without mappings the first VLC source in the scene is used,
+ * adding one to the scene isn't a frontend event, so we look again
+ * every now and then while there's nothing to track */
+static const uint64_t retarget_interval = 5 * SECOND_TO_NS;
+
+static const char* media_signals[] = { "media_started", "media_ended", "media_next", "media_previous",
+    "media_stopped", "media_play", "media_pause", "media_restart" };
+
+static const char* target_signals[] = { "remove", "rename" };
+
+static void handle_media_signal(void* data, calldata_t*)
+{
+    static_cast<vlc_obs_source*>(data)->invalidate_metadata();
+}
+
+static void handle_target_signal(void* data, calldata_t*)
+{
+    static_cast<vlc_obs_source*>(data)->invalidate_target();
+}
+
+static void handle_frontend_event(enum obs_frontend_event event, void* data)
+{
+    auto* self = static_cast<vlc_obs_source*>(data);
+    switch (event) {
+    case OBS_FRONTEND_EVENT_SCENE_CHANGED:
+    case OBS_FRONTEND_EVENT_SCENE_LIST_CHANGED:
+    case OBS_FRONTEND_EVENT_SCENE_COLLECTION_CHANGED:
+        self->invalidate_target();
+        break;
+    case OBS_FRONTEND_EVENT_SCENE_COLLECTION_CLEANUP:
+    case OBS_FRONTEND_EVENT_EXIT:
+        self->release_target();
+        break;
+    default:;
+    }
+}
 
 vlc_obs_source::vlc_obs_source()
     : music_source(S_SOURCE_VLC, T_SOURCE_VLC, new vlc)
@@ -39,39 +77,82 @@ vlc_obs_source::vlc_obs_source()
         meta::ENCODED_BY, meta::ARTWORK_URL, meta::TRACK_TOTAL, meta::DIRECTOR, meta::SEASON,
         meta::EPISODE, meta::SHOW_NAME, meta::ALBUM_ARTIST, meta::DISC_TOTAL });
     /* clang-format on */
+    obs_frontend_add_event_callback(handle_frontend_event, this);
 }
 
 vlc_obs_source::~vlc_obs_source()
 {
+    obs_frontend_remove_event_callback(handle_frontend_event, this);
+    disconnect_signals();
     m_weak_src = nullptr;
 }
 
-bool vlc_obs_source::reload()
+void vlc_obs_source::invalidate_target()
 {
-    auto result = !!m_weak_src;
-    auto target_source_name = get_target_source_name();
-    const auto name_changed_or_no_weak_src = !m_weak_src || m_target_source_name != target_source_name;
+    m_target_dirty = true;
+    tuna_thread::wakeup(id());
+}
 
-    // Try to find the vlc source with the new name
-    if (name_changed_or_no_weak_src && !target_source_name.empty())
-        load_vlc_source();
+void vlc_obs_source::invalidate_metadata()
+{
+    m_meta_dirty = true;
+    tuna_thread::wakeup(id());
+}
 
-    if (m_weak_src) {
-        OBSSourceAutoRelease src = obs_weak_source_get_source(m_weak_src);
-        if (src) {
-            result = obs_source_showing(src);
-            if (!result) {
-                m_current.clear();
-                m_current.set(meta::STATUS, state_stopped);
-            }
-        } else {
-            get_ui<vlc>()->rebuild_mapping();
-            result = false;
-            m_weak_src = nullptr;
+void vlc_obs_source::release_target()
+{
+    /* Sources can't be kept alive past their scene collection */
+    std::lock_guard<std::shared_mutex> lock(tuna_thread::thread_mutex);
+    disconnect_signals();
+    m_weak_src = nullptr;
+    m_target_dirty = true;
+}
+
+void vlc_obs_source::connect_signals(obs_source_t* src)
+{
+    disconnect_signals();
+    m_signal_src = obs_source_get_weak_source(src);
+    auto* sh = obs_source_get_signal_handler(src);
+    if (!sh)
+        return;
+
+    for (auto* s : media_signals) {
+        signal_handler_connect(sh, s, handle_media_signal, this);
+    }
+    for (auto* s : target_signals) {
+        signal_handler_connect(sh, s, handle_target_signal, this);
+    }
+}
+
+void vlc_obs_source::disconnect_signals()
+{
+    if (!m_signal_src)
+        return;
+    OBSSourceAutoRelease src = obs_weak_source_get_source(m_signal_src);
+    auto* sh = src ? obs_source_get_signal_handler(src) : nullptr;
+    if (sh) {
+        for (auto* s : media_signals) {
+            signal_handler_disconnect(sh, s, handle_media_signal, this);
+        }
+        for (auto* s : target_signals) {
+            signal_handler_disconnect(sh, s, handle_target_signal, this);
         }
     }
+    m_signal_src = nullptr;
+}
 
-    return result;
+void vlc_obs_source::retarget()
+{
+    /* Only happens after a scene change or when our source was removed or renamed,
+     * so it's looked up again even if the name stayed the same */
+    if (!get_target_source_name().empty()) {
+        load_vlc_source();
+    } else {
+        disconnect_signals();
+        m_weak_src = nullptr;
+    }
+    if (!m_weak_src)
+        m_next_retarget = os_gettime_ns() + retarget_interval;
 }
 
 void vlc_obs_source::load_vlc_source()
@@ -80,11 +161,14 @@ void vlc_obs_source::load_vlc_source()
 
     OBSSourceAutoRelease src = obs_get_source_by_name(m_target_source_name.c_str());
     m_weak_src = nullptr;
+    disconnect_signals();
+    m_meta_dirty = true;
 
     if (src) {
         const auto* id = obs_source_get_id(src);
         if (strcmp(id, "vlc_source") == 0) {
             m_weak_src = obs_source_get_weak_source(src);
+            connect_signals(src);
         } else {
             binfo("%s (%s) is not a valid vlc source", m_target_source_name.c_str(), id);
         }
@@ -140,22 +224,24 @@ bool vlc_obs_source::enabled() const
 
 void vlc_obs_source::next_vlc_source()
 {
-    std::lock_guard<std::mutex> lock(tuna_thread::thread_mutex);
+    std::lock_guard<std::shared_mutex> lock(tuna_thread::thread_mutex);
     auto mappings = static_cast<vlc*>(get_settings_tab())->get_mappings_for_scene(m_target_scene.c_str());
     if (mappings.empty())
         return;
     m_index = (m_index + 1) % mappings.size();
+    invalidate_target();
 }
 
 void vlc_obs_source::prev_vlc_source()
 {
-    std::lock_guard<std::mutex> lock(tuna_thread::thread_mutex);
+    std::lock_guard<std::shared_mutex> lock(tuna_thread::thread_mutex);
     auto mappings = static_cast<vlc*>(get_settings_tab())->get_mappings_for_scene(m_target_scene.c_str());
     if (mappings.empty())
         return;
     m_index--;
     if (m_index < 0)
         m_index = mappings.size() - 1;
+    invalidate_target();
 }
 
 void vlc_obs_source::set_gui_values()
@@ -167,9 +253,8 @@ void vlc_obs_source::set_gui_values()
 void vlc_obs_source::load()
 {
     music_source::load();
-    if (!util::have_vlc_source || m_weak_src)
-        return;
-    load_vlc_source();
+    /* The mappings might have changed */
+    m_target_dirty = true;
 }
 
 static play_state from_obs_state(obs_media_state s)
@@ -195,23 +280,48 @@ static play_state from_obs_state(obs_media_state s)
 void vlc_obs_source::refresh()
 {
     begin_refresh();
-    m_current.clear();
-    if (!reload())
+    if (!util::have_vlc_source)
         return;
 
+    if (m_target_dirty.exchange(false) || (!m_weak_src && os_gettime_ns() >= m_next_retarget))
+        retarget();
+
     /* we keep a reference here to make sure that this source won't be freed
      * while we still need it */
     OBSSourceAutoRelease src = get_source();
-    if (!src)
+    if (!src) {
+        if (m_signal_src) {
+            get_ui<vlc>()->rebuild_mapping();
+            disconnect_signals();
+        }
+        m_current.clear();
         return;
+    }
 
-    m_current.set(meta::STATUS, from_obs_state(obs_source_media_get_state(src)));
+    auto const state = from_obs_state(obs_source_media_get_state(src));
 
     /* Prevent polling when vlc is stopped, which otherwise could cause a crash
        when closing obs */
-    if (m_current.get<int>(meta::STATUS) == state_stopped)
+    if (!obs_source_showing(src) || state == state_stopped) {
+        m_current.clear();
+        m_current.set(meta::STATUS, state_stopped);
+        m_meta_dirty = true;
         return;
+    }
+
+    /* The tags only change with the media, which the signals tell us about */
+    if (state <= state_paused && m_meta_dirty.exchange(false)) {
+        m_current.clear();
+        read_metadata(src);
+    }
+
+    m_current.set(meta::STATUS, state);
+    m_current.set(meta::PROGRESS, (int)obs_source_media_get_time(src));
+    m_current.set(meta::DURATION, (int)obs_source_media_get_duration(src));
+}
 
+void vlc_obs_source::read_metadata(obs_source_t* src)
+{
     proc_handler_t* ph = obs_source_get_proc_handler(src);
 
     if (!ph)
@@ -228,10 +338,7 @@ void vlc_obs_source::refresh()
         return utf8_to_qt(result);
     };
 
-    m_current.set(meta::PROGRESS, (int)obs_source_media_get_time(src));
-    m_current.set(meta::DURATION, (int)obs_source_media_get_duration(src));
-
-    if (m_current.get<int>(meta::STATUS) <= state_paused) {
+    {
 #define check(t, d)              \
     do {                         \
         auto t = get_meta(#t);   \
@@ -19,6 +19,7 @@
 #pragma once
 #include "music_source.hpp"
 #include <QString>
+#include <atomic>
 #include <obs-module.h>
 #include <obs.hpp>
 
@@ -26,9 +27,23 @@ class vlc_obs_source : public music_source {
     std::string m_target_source_name {};
     std::string m_target_scene {};
     OBSWeakSourceAutoRelease m_weak_src {};
-    bool reload();
 
+    /* Set by scene changes and the signals of the tracked source, so
+     * that refreshes don't have to look at the scene and the metadata */
+    std::atomic<bool> m_target_dirty { true };
+    std::atomic<bool> m_meta_dirty { true };
+    uint64_t m_next_retarget = 0;
+
+    /* Source whose signals are connected. Only a weak reference, so a removed
+     * source isn't kept alive once VLC isn't the selected source anymore.
+     * Its signal handler goes away along with it */
+    OBSWeakSourceAutoRelease m_signal_src {};
+    void connect_signals(obs_source_t* src);
+    void disconnect_signals();
+
+    void retarget();
     void load_vlc_source();
+    void read_metadata(obs_source_t* src);
 
     std::string get_target_source_name();
     std::string get_current_scene_name();
@@ -52,6 +67,13 @@ public:
     bool execute_capability(capability c) override;
     bool enabled() const override;
 
+    /* Looks for the source to track again on the next refresh */
+    void invalidate_target();
+    /* Reads the tags again on the next refresh */
+    void invalidate_metadata();
+    /* Lets go of the tracked source */
+    void release_target();
+
     void next_vlc_source();
     void prev_vlc_source();
     void set_gui_values() override;
@@ -21,9 +21,13 @@
 #include "../gui/widgets/window_title.hpp"
 #include "../util/config.hpp"
 #include "../util/constants.hpp"
+#include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include "../util/window/window_helper.hpp"
-#include <QRegularExpression>
+#include <util/platform.h>
+
+/* Opening a display for a watcher that can't work isn't worth doing every refresh */
+static const uint64_t watch_retry_ns = 30000000000ull;
 
 window_source::window_source()
     : music_source(S_SOURCE_WINDOW_TITLE, T_SOURCE_WINDOW_TITLE, new window_title)
@@ -31,6 +35,20 @@ window_source::window_source()
     supported_metadata({ meta::TITLE });
 }
 
+window_source::~window_source()
+{
+    on_stop();
+}
+
+void window_source::on_stop()
+{
+    /* Started again by the next refresh */
+    if (m_watching)
+        StopWindowWatcher();
+    m_watching = false;
+    m_watch_retry = 0;
+}
+
 bool window_source::enabled() const
 {
     return true;
@@ -58,17 +76,18 @@ void window_source::load()
     m_cut_end = CGET_UINT(CFG_WINDOW_CUT_END);
     m_use_process_name = CGET_BOOL(CFG_WINDOW_USE_PROCRESS);
     m_process_name = utf8_to_qt(CGET_STR(CFG_WINDOW_PROCESS_NAME));
+    m_title_regex.setPattern(m_regex ? m_title : QString());
+    m_window_generation = ~0ull;
 }
 
 QString window_source::get_title(const std::vector<std::string>& windows)
 {
-    QRegularExpression regex(m_title);
     QString result = "";
 
     for (const auto& title : windows) {
         bool matches = false;
         if (m_regex) {
-            matches = regex.match(title.c_str()).hasMatch();
+            matches = m_title_regex.match(title.c_str()).hasMatch();
         } else {
             /* Direct search */
             QString tmp(title.c_str());
@@ -101,6 +120,24 @@ void window_source::refresh()
 {
     if (m_title.isEmpty())
         return;
+
+    /* Does nothing while the watcher runs, but restarts it (or falls back to
+     * X11) if it ended by itself. The lists are polled until the next try */
+    auto const now = os_gettime_ns();
+    if (m_watching || now >= m_watch_retry) {
+        m_watching = StartWindowWatcher([] { tuna_thread::wakeup(S_SOURCE_WINDOW_TITLE); });
+        if (!m_watching)
+            m_watch_retry = now + watch_retry_ns;
+    }
+    if (m_watching) {
+        auto const generation = WindowListGeneration();
+        if (generation == m_window_generation) {
+            begin_refresh();
+            return;
+        }
+        m_window_generation = generation;
+    }
+
     QString result;
 
     if (m_use_process_name) {
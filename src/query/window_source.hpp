@@ -19,6 +19,7 @@
 #pragma once
 
 #include "music_source.hpp"
+#include <QRegularExpression>
 #include <string>
 #include <utility>
 #include <vector>
@@ -29,12 +30,23 @@ class window_source : public music_source {
     QString m_search = "", m_replace = "", m_pause = "";
     uint16_t m_cut_begin = 0, m_cut_end;
     bool m_regex = false, m_use_process_name;
+    /* Compiled once when the settings are loaded */
+    QRegularExpression m_title_regex;
+
+    /* The window lists are only looked at again once the watcher saw a change */
+    bool m_watching = false;
+    uint64_t m_window_generation = ~0ull;
+    /* os_gettime_ns() after which a failed watcher start is tried again */
+    uint64_t m_watch_retry = 0;
 
     QString get_title(const std::vector<std::string>& windows);
     QString get_title(const std::vector<std::pair<std::string, std::string>>& processes);
 
+    void on_stop() override;
+
 public:
     window_source();
+    ~window_source();
 
     void load() override;
     void refresh() override;
@@ -20,8 +20,11 @@
 #include "../gui/widgets/wmc.hpp"
 #include "../util/config.hpp"
 #include "../util/constants.hpp"
+#include "../util/cover_tag_handler.hpp"
+#include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
-#include <QFile>
+#include <QBuffer>
+#include <QCryptographicHash>
 #include <QImage>
 
 /**
@@ -35,26 +38,35 @@
 static void _handle_media_property_change(GlobalSystemMediaTransportControlsSession session, MediaPropertiesChangedEventArgs const& args)
 {
     auto wmc_src = music_sources::get<wmc_source>(S_SOURCE_WMC);
-    if (wmc_src)
+    if (wmc_src) {
         wmc_src->handle_media_property_change(session, args);
+        tuna_thread::wakeup(S_SOURCE_WMC);
+    }
 }
 
 static void _handle_media_playback_info_change(GlobalSystemMediaTransportControlsSession session, PlaybackInfoChangedEventArgs const& args)
 {
     auto wmc_src = music_sources::get<wmc_source>(S_SOURCE_WMC);
-    if (wmc_src)
+    if (wmc_src) {
         wmc_src->handle_media_playback_info_change(session, args);
+        tuna_thread::wakeup(S_SOURCE_WMC);
+    }
 }
 
 static void _handle_session_change(GlobalSystemMediaTransportControlsSessionManager, SessionsChangedEventArgs const&)
 {
     auto wmc_src = music_sources::get<wmc_source>(S_SOURCE_WMC);
-    if (wmc_src)
+    if (wmc_src) {
         wmc_src->update_players();
+        tuna_thread::wakeup(S_SOURCE_WMC);
+    }
 }
 
 void wmc_source::update_players()
 {
+    /* A late notification after the source was stopped */
+    if (!m_session_manager)
+        return;
     std::vector<std::string> players_seen;
     auto sessions = m_session_manager.GetSessions();
     winrt::hstring AUMI;
@@ -65,8 +77,8 @@ void wmc_source::update_players()
 
         players_seen.push_back(s);
         if (std::find(m_registered_players.begin(), m_registered_players.end(), s) == m_registered_players.end()) { // not found
-            session.MediaPropertiesChanged(_handle_media_property_change);
-            session.PlaybackInfoChanged(_handle_media_playback_info_change);
+            m_session_handlers.push_back({ session, session.MediaPropertiesChanged(_handle_media_property_change),
+                session.PlaybackInfoChanged(_handle_media_playback_info_change) });
 
             m_registered_players.push_back(s);
 
@@ -82,6 +94,7 @@ void wmc_source::update_players()
     for (auto player_name : players_not_seen) {
         m_registered_players.erase(std::remove(m_registered_players.begin(), m_registered_players.end(), player_name), m_registered_players.end());
     }
+    emit tuna_thread::events()->players_changed();
 }
 
 bool wmc_source::execute_capability(capability c)
@@ -110,7 +123,7 @@ bool wmc_source::execute_capability(capability c)
 void wmc_source::request_manager()
 {
     m_session_manager = GlobalSystemMediaTransportControlsSessionManager::RequestAsync().get();
-    m_session_manager.SessionsChanged(_handle_session_change);
+    m_sessions_changed = m_session_manager.SessionsChanged(_handle_session_change);
     update_players();
 }
 
@@ -160,58 +173,59 @@ void wmc_source::handle_media_property_change(GlobalSystemMediaTransportControls
     }
 
     auto thumbnail = media_properties.Thumbnail();
-    com_array<uint8_t> pixel_data_detached;
-    uint8_t* data = NULL;
-    if (thumbnail != nullptr && id == m_selected_player) { // only fetch cover for selected source
-        auto stream = thumbnail.OpenReadAsync().get();
-
-        auto decoder = BitmapDecoder::CreateAsync(stream).get();
-        auto transform = BitmapTransform();
-        uint32_t width, height;
-
-        if (id == "Spotify.exe") { // The spotify player has branding on the thumbnail, cropping it out
-            static const int Wcrop = 34;
-            static const int Hcrop = 66;
-            BitmapBounds spotify_bound;
-            width = decoder.PixelWidth() - 2 * Wcrop;
-            height = decoder.PixelHeight() - Hcrop;
-
-            spotify_bound.X = Wcrop;
-            spotify_bound.Y = 0;
-            spotify_bound.Width = width;
-            spotify_bound.Height = height;
-
-            transform.Bounds(spotify_bound);
-
-        } else {
-            width = decoder.PixelWidth();
-            height = decoder.PixelHeight();
+    if (thumbnail != nullptr && id == m_selected_player) // only fetch cover for selected source
+        fetch_thumbnail(thumbnail, id);
+}
+
+void wmc_source::fetch_thumbnail(IRandomAccessStreamReference const& thumbnail, std::string const& id)
+{
+    auto const request = ++m_thumbnail_request;
+    thumbnail.OpenReadAsync().Completed([this, id, request](auto const& op, Windows::Foundation::AsyncStatus status) {
+        if (status != Windows::Foundation::AsyncStatus::Completed || request != m_thumbnail_request)
+            return;
+        try {
+            /* This runs on the thread pool, so waiting for the read is fine */
+            auto stream = op.GetResults();
+            auto const size = uint32_t(stream.Size());
+            if (size == 0)
+                return;
+            Buffer buffer(size);
+            auto result = stream.ReadAsync(buffer, size, InputStreamOptions::None).get();
+            store_thumbnail(id, QByteArray(reinterpret_cast<const char*>(result.data()), int(result.Length())), request);
+        } catch (...) {
+            berr("[WMC] Failed to read the thumbnail");
         }
+    });
+}
 
-        auto pixel_data = decoder.GetPixelDataAsync(BitmapPixelFormat::Rgba8,
-                                     BitmapAlphaMode::Premultiplied,
-                                     transform,
-                                     ExifOrientationMode::IgnoreExifOrientation,
-                                     ColorManagementMode::ColorManageToSRgb)
-                              .get();
-        pixel_data_detached = pixel_data.DetachPixelData();
-        data = (uint8_t*)pixel_data_detached.data();
-
-        QImage image(data, width, height, QImage::Format_RGBA8888);
-        auto tmp = config::cover_path + ".tmp";
-
-        if (image.save(tmp, "png")) {
-            QFile current(config::cover_path);
-            current.remove();
-            if (!QFile::rename(tmp, config::cover_path)) {
-                util::reset_cover();
-                berr("[WMC] Failed to move cover from temporary file to %s", qt_to_utf8(config::cover_path));
-            }
-
-        } else {
-            berr("[WMC] Failed to save cover to %s", qt_to_utf8(config::cover_path));
+void wmc_source::store_thumbnail(std::string const& id, QByteArray data, uint64_t request)
+{
+    {
+        /* Players send the same thumbnail again for every property change */
+        auto hash = QCryptographicHash::hash(data, QCryptographicHash::Md5);
+        std::lock_guard<std::mutex> lock(m_thumbnail_mutex);
+        if (request != m_thumbnail_request || hash == m_thumbnail_hash)
+            return;
+        m_thumbnail_hash = hash;
+    }
+
+    if (id == "Spotify.exe") { // The spotify player has branding on the thumbnail, cropping it out
+        static const int Wcrop = 34;
+        static const int Hcrop = 66;
+        QImage image;
+        if (image.loadFromData(data) && image.width() > 2 * Wcrop && image.height() > Hcrop) {
+            QBuffer out;
+            out.open(QIODevice::WriteOnly);
+            if (image.copy(Wcrop, 0, image.width() - 2 * Wcrop, image.height() - Hcrop).save(&out, "png"))
+                data = out.data();
         }
     }
+
+    /* Keeps the cover in memory if no image source needs the file */
+    if (!cover::write_bytes_to_file(data)) {
+        util::reset_cover();
+        berr("[WMC] Failed to save cover to %s", qt_to_utf8(config::cover_path));
+    }
 }
 
 void wmc_source::handle_media_playback_info_change(GlobalSystemMediaTransportControlsSession session, PlaybackInfoChangedEventArgs const&)
@@ -243,14 +257,47 @@ wmc_source::wmc_source()
 {
     m_capabilities = CAP_NEXT_SONG | CAP_PREV_SONG | CAP_PLAY_PAUSE | CAP_STOP_SONG;
     supported_metadata({ meta::TITLE, meta::ARTIST, meta::ALBUM, meta::COVER, meta::PROGRESS, meta::STATUS });
+}
+
+wmc_source::~wmc_source()
+{
+    stop();
+}
 
-    std::thread([this] {
+void wmc_source::on_start()
+{
+    m_manager_thread = std::thread([this] {
         try {
             this->request_manager();
         } catch (...) {
             berr("[WMC] An error occured while getting the GlobalSystemMediaTransportControlsSessionManager");
         }
-    }).detach();
+    });
+}
+
+void wmc_source::on_stop()
+{
+    if (m_manager_thread.joinable())
+        m_manager_thread.join();
+
+    try {
+        for (auto& h : m_session_handlers) {
+            h.session.MediaPropertiesChanged(h.properties_changed);
+            h.session.PlaybackInfoChanged(h.playback_changed);
+        }
+        if (m_session_manager)
+            m_session_manager.SessionsChanged(m_sessions_changed);
+    } catch (...) {
+        berr("[WMC] Couldn't remove media session handlers");
+    }
+    m_session_handlers.clear();
+    m_session_manager = nullptr;
+    m_registered_players.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_internal_mutex);
+        m_info.clear();
+    }
+    emit tuna_thread::events()->players_changed();
 }
 
 void wmc_source::refresh()
@@ -23,17 +23,19 @@
 
 #pragma comment(lib, "windowsapp")
 
+#include <QByteArray>
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <mutex>
+#include <thread>
 #include <winrt/Windows.Foundation.Collections.h>
-#include <winrt/Windows.Graphics.Imaging.h>
+#include <winrt/Windows.Foundation.h>
 #include <winrt/Windows.Media.Control.h>
 #include <winrt/Windows.Storage.Streams.h>
 #include <winrt/base.h>
 
 using namespace winrt;
-using namespace Windows::Graphics::Imaging;
 using namespace Windows::Media::Control;
 using namespace Windows::Storage::Streams;
 using namespace Windows::Foundation::Collections;
@@ -46,9 +48,29 @@ class wmc_source : public music_source {
     std::mutex m_internal_mutex;
     std::map<std::string, song> m_info;
 
+    /* Handlers are revoked when the source is stopped */
+    struct session_handlers {
+        GlobalSystemMediaTransportControlsSession session { nullptr };
+        winrt::event_token properties_changed, playback_changed;
+    };
+    winrt::event_token m_sessions_changed {};
+    std::vector<session_handlers> m_session_handlers;
+    std::thread m_manager_thread;
+
+    void on_start() override;
+    void on_stop() override;
+
+    /* Thumbnails are read on the WinRT thread pool, only the
+     * latest request is used and unchanged images are skipped */
+    std::atomic<uint64_t> m_thumbnail_request { 0 };
+    std::mutex m_thumbnail_mutex;
+    QByteArray m_thumbnail_hash;
+    void fetch_thumbnail(IRandomAccessStreamReference const& thumbnail, std::string const& id);
+    void store_thumbnail(std::string const& id, QByteArray data, uint64_t request);
+
 public:
     wmc_source();
-    ~wmc_source() = default;
+    ~wmc_source();
 
     void refresh() override;
     void handle_media_property_change(GlobalSystemMediaTransportControlsSession session, MediaPropertiesChangedEventArgs const& arg);
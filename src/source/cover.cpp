@@ -0,0 +1,203 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "cover.hpp"
+#include "../util/activity.hpp"
+#include "../util/constants.hpp"
+#include "../util/cover_image.hpp"
+#include "../util/utility.hpp"
+#include <QBuffer>
+#include <QImageReader>
+
+namespace obs_sources {
+cover_source::cover_source(obs_source_t* src, obs_data_t* settings)
+    : m_source(src)
+{
+    update(settings);
+    UNUSED_PARAMETER(m_source);
+
+    char* file = obs_module_file("cover_fade.effect");
+    obs_enter_graphics();
+    m_effect = gs_effect_create_from_file(file, nullptr);
+    obs_leave_graphics();
+    bfree(file);
+    if (!m_effect)
+        bwarn("Couldn't load the cover fade effect, covers won't crossfade");
+
+    m_decode_thread = std::thread(&cover_source::decode_method, this);
+}
+
+cover_source::~cover_source()
+{
+    m_running = false;
+    if (m_decode_thread.joinable())
+        m_decode_thread.join();
+
+    obs_enter_graphics();
+    gs_texture_destroy(m_texture);
+    gs_texture_destroy(m_old_texture);
+    gs_effect_destroy(m_effect);
+    obs_leave_graphics();
+}
+
+void cover_source::decode_method()
+{
+    util::set_thread_name("tuna-cover-source");
+    uint64_t seen = UINT64_MAX;
+    while (m_running) {
+        /* Wakes up regularly to notice that the source was removed */
+        auto const generation = cover_image::wait_for_change(seen, std::chrono::milliseconds(250));
+        if (generation == seen && !m_size_changed.exchange(false))
+            continue;
+        seen = generation;
+
+        QImage decoded;
+        if (auto const cover = cover_image::get()) {
+            QBuffer buf;
+            buf.setData(cover->data);
+            buf.open(QIODevice::ReadOnly);
+            QImageReader reader(&buf);
+            /* Large covers don't have to be uploaded at full size */
+            auto const size = reader.size();
+            if (size.isValid() && (uint32_t(size.width()) > m_cx || uint32_t(size.height()) > m_cy))
+                reader.setScaledSize(size.scaled(int(m_cx), int(m_cy), Qt::KeepAspectRatio));
+            decoded = reader.read().convertToFormat(QImage::Format_ARGB32);
+        }
+
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        m_pending = decoded;
+        m_has_pending = true;
+    }
+}
+
+void cover_source::tick(float seconds)
+{
+    if (m_fade < 1.f) {
+        auto const fade_ms = m_fade_ms.load();
+        m_fade = fade_ms ? fminf(m_fade + seconds * 1000.f / float(fade_ms), 1.f) : 1.f;
+    }
+}
+
+void cover_source::draw(gs_texture_t* tex, float opacity)
+{
+    auto const w = gs_texture_get_width(tex), h = gs_texture_get_height(tex);
+    if (!w || !h)
+        return;
+
+    /* Fit the cover into the source, keeping its aspect ratio */
+    auto const scale = fminf(float(m_cx) / float(w), float(m_cy) / float(h));
+    auto const cx = uint32_t(float(w) * scale), cy = uint32_t(float(h) * scale);
+
+    gs_effect_t* effect = m_effect ? m_effect : obs_get_base_effect(OBS_EFFECT_DEFAULT);
+    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), tex);
+    if (m_effect)
+        gs_effect_set_float(gs_effect_get_param_by_name(effect, "opacity"), opacity);
+
+    gs_technique_t* tech = gs_effect_get_technique(effect, "Draw");
+    gs_matrix_push();
+    gs_matrix_translate3f(float(m_cx - cx) / 2.f, float(m_cy - cy) / 2.f, 0);
+    gs_technique_begin(tech);
+    gs_technique_begin_pass(tech, 0);
+    gs_draw_sprite(tex, 0, cx, cy);
+    gs_technique_end_pass(tech);
+    gs_technique_end(tech);
+    gs_matrix_pop();
+}
+
+void cover_source::render(gs_effect_t* effect)
+{
+    UNUSED_PARAMETER(effect);
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        if (m_has_pending) {
+            m_has_pending = false;
+            /* The current cover fades out while the new one fades in */
+            gs_texture_destroy(m_old_texture);
+            m_old_texture = m_texture;
+            m_texture = nullptr;
+            if (!m_pending.isNull()) {
+                const uint8_t* data = m_pending.constBits();
+                m_texture = gs_texture_create(uint32_t(m_pending.width()), uint32_t(m_pending.height()), GS_BGRA, 1, &data, 0);
+            }
+            m_pending = QImage();
+            m_fade = m_effect && m_fade_ms ? 0.f : 1.f;
+        }
+    }
+
+    if (m_fade >= 1.f && m_old_texture) {
+        gs_texture_destroy(m_old_texture);
+        m_old_texture = nullptr;
+    }
+
+    if (m_old_texture)
+        draw(m_old_texture, 1.f - m_fade);
+    if (m_texture)
+        draw(m_texture, m_fade);
+}
+
+void cover_source::update(obs_data_t* settings)
+{
+    auto const cx = static_cast<uint32_t>(obs_data_get_int(settings, S_COVER_CX));
+    auto const cy = static_cast<uint32_t>(obs_data_get_int(settings, S_COVER_CY));
+    if (cx != m_cx || cy != m_cy)
+        m_size_changed = true;
+    m_cx = cx;
+    m_cy = cy;
+    m_fade_ms = static_cast<uint32_t>(obs_data_get_int(settings, S_COVER_FADE));
+}
+
+obs_properties_t* get_properties_for_cover(void* data)
+{
+    UNUSED_PARAMETER(data);
+    auto* p = obs_properties_create();
+    obs_properties_add_int(p, S_COVER_CX, T_COVER_CX, 2, UINT16_MAX, 1);
+    obs_properties_add_int(p, S_COVER_CY, T_COVER_CY, 2, UINT16_MAX, 1);
+    auto* fade = obs_properties_add_int_slider(p, S_COVER_FADE, T_COVER_FADE, 0, 5000, 50);
+    obs_property_int_set_suffix(fade, " ms");
+    return p;
+}
+
+void register_cover()
+{
+    obs_source_info si {};
+    si.id = S_COVER_ID;
+    si.type = OBS_SOURCE_TYPE_INPUT;
+    si.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW;
+    si.get_properties = get_properties_for_cover;
+    si.get_name = [](void*) { return T_COVER_NAME; };
+    si.create = [](obs_data_t* d, obs_source_t* s) { return static_cast<void*>(new cover_source(s, d)); };
+    si.destroy = [](void* data) { delete reinterpret_cast<cover_source*>(data); };
+    si.get_width = [](void* data) { return reinterpret_cast<cover_source*>(data)->get_width(); };
+    si.get_height = [](void* data) { return reinterpret_cast<cover_source*>(data)->get_height(); };
+    si.get_defaults = [](obs_data_t* settings) {
+        obs_data_set_default_int(settings, S_COVER_CX, 300);
+        obs_data_set_default_int(settings, S_COVER_CY, 300);
+        obs_data_set_default_int(settings, S_COVER_FADE, 300);
+    };
+
+    si.update = [](void* data, obs_data_t* settings) { reinterpret_cast<cover_source*>(data)->update(settings); };
+    si.show = [](void*) { activity::source_shown(); };
+    si.hide = [](void*) { activity::source_hidden(); };
+    si.video_tick = [](void* data, float seconds) { reinterpret_cast<cover_source*>(data)->tick(seconds); };
+    si.video_render = [](void* data, gs_effect_t* effect) {
+        reinterpret_cast<cover_source*>(data)->render(effect);
+    };
+
+    obs_register_source(&si);
+}
+}
@@ -0,0 +1,66 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QImage>
+#include <atomic>
+#include <mutex>
+#include <obs-module.h>
+#include <thread>
+namespace obs_sources {
+
+/* Shows the current cover straight from cover_image, so it doesn't
+ * have to be read back from config::cover_path by an image source.
+ * Covers are decoded on a worker thread and only uploaded once per track */
+class cover_source {
+    obs_source_t* m_source = nullptr;
+    std::atomic<uint32_t> m_cx { 300 }, m_cy { 300 };
+    std::atomic<uint32_t> m_fade_ms { 0 };
+
+    std::thread m_decode_thread;
+    std::atomic<bool> m_running { true };
+    std::atomic<bool> m_size_changed { false };
+
+    /* Decoded cover waiting to be uploaded in render() */
+    std::mutex m_pending_mutex;
+    QImage m_pending;
+    bool m_has_pending = false;
+
+    /* Only used on the graphics thread */
+    gs_effect_t* m_effect = nullptr;
+    gs_texture_t* m_texture = nullptr;
+    gs_texture_t* m_old_texture = nullptr;
+    float m_fade = 1.f;
+
+    void decode_method();
+    void draw(gs_texture_t* tex, float opacity);
+
+public:
+    cover_source(obs_source_t* src, obs_data_t* settings);
+    ~cover_source();
+
+    inline void update(obs_data_t* settings);
+    inline void tick(float seconds);
+    inline void render(gs_effect_t* effect);
+
+    uint32_t get_width() const { return m_cx; }
+    uint32_t get_height() const { return m_cy; }
+};
+
+extern void register_cover();
+}
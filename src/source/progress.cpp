@@ -17,8 +17,10 @@
  *************************************************************************/
 
 #include "progress.hpp"
+#include "../util/activity.hpp"
 #include "../util/constants.hpp"
 #include "../util/tuna_thread.hpp"
+#include <util/platform.h>
 
 namespace obs_sources {
 progress_source::progress_source(obs_source_t* src, obs_data_t* settings)
@@ -32,40 +34,26 @@ progress_source::~progress_source() { }
 
 void progress_source::tick(float seconds)
 {
-    song tmp {};
-    tuna_thread::copy_mutex.lock();
-    tmp = tuna_thread::copy;
-    tuna_thread::copy_mutex.unlock();
-    m_state = (play_state)tmp.get<int>(meta::STATUS);
-    if (m_state == state_playing && tmp.has(meta::DURATION)) {
-        seconds *= 1000; /* s -> ms */
-        if (tmp.has(meta::PROGRESS)) {
-            // Retrieve new progress, if it changed
-            // we allow difference of 3 seconds because otherwise the progress bar
-            // sometimes jumps around
-            m_synced_progress = tmp.get<int>(meta::PROGRESS);
-            auto diff = m_synced_progress - m_adjusted_progress;
-            if (abs(diff) > 3000) {
-                m_adjusted_progress = float(m_synced_progress) + seconds;
-            } else {
-                auto catchup = diff / 3000.f;
-                // basically speed up the progress bar if we are behind on the actual position
-                // or slow it down if we are ahead. Speedup/slowdown at most 2% of seconds
-                m_adjusted_progress += seconds * (1 + catchup * (seconds * 0.04));
-            }
-        } else if (m_synced_progress > 0) {
-            m_adjusted_progress += seconds;
+    /* No copy, lock or allocation on the video thread */
+    const auto timing = tuna_thread::timing();
+    m_state = (play_state)timing.status;
+    if (m_state == state_playing && timing.duration > 0) {
+        if (timing.duration != m_duration) { // Song changed, so we reset these values
+            m_duration = timing.duration;
+            m_shown_progress = 0;
         }
 
-        auto duration = tmp.get<int>(meta::DURATION);
-        if (duration != m_duration) { // Song changed, so we reset these values
-            m_duration = duration;
-            m_synced_progress = 0;
-            m_adjusted_progress = 0;
+        if (timing.progress >= 0) {
+            /* Interpolate from the time the progress was sampled at, small steps
+             * backwards are just timing jitter and would make the bar flicker */
+            auto const now = os_gettime_ns();
+            auto const elapsed = now > timing.sampled_at ? float(now - timing.sampled_at) / 1000000.f : 0.f;
+            auto const estimate = float(timing.progress) + elapsed;
+            if (estimate > m_shown_progress || m_shown_progress - estimate > 500.f)
+                m_shown_progress = estimate;
         }
-        if (duration > 0)
-            m_progress = m_adjusted_progress / float(duration);
-        m_progress = fmaxf(fminf(1, m_progress), 0);
+
+        m_progress = fmaxf(fminf(1, m_shown_progress / float(m_duration)), 0);
     } else if (m_state == state_paused) {
         float step = 0.0005f * m_cx;
         if (m_bounce_up)
@@ -182,6 +170,8 @@ void register_progress()
     };
 
     si.update = [](void* data, obs_data_t* settings) { reinterpret_cast<progress_source*>(data)->update(settings); };
+    si.show = [](void*) { activity::source_shown(); };
+    si.hide = [](void*) { activity::source_hidden(); };
     si.video_tick = [](void* data, float seconds) { reinterpret_cast<progress_source*>(data)->tick(seconds); };
     si.video_render = [](void* data, gs_effect_t* effect) {
         reinterpret_cast<progress_source*>(data)->render(effect);
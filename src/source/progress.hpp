@@ -28,11 +28,9 @@ class progress_source {
     float m_progress = 0.f;
     float m_bounce_progress = 0.f;
 
-    /* Song progress grabbed from current music source */
-    int32_t m_synced_progress = 0;
+    /* Last drawn progress in ms, used to hide small backwards jumps */
+    float m_shown_progress = 0.f;
     int32_t m_duration = 0;
-    /* Song progress adjusted with frame time */
-    float m_adjusted_progress = 0.f;
     bool m_bounce_up = true;
     play_state m_state = state_unknown;
     bool m_use_bg = true;
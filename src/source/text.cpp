@@ -0,0 +1,223 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "text.hpp"
+#include "../util/activity.hpp"
+#include "../util/constants.hpp"
+#include "../util/tuna_thread.hpp"
+#include <QFontMetrics>
+#include <QPainter>
+#include <cmath>
+
+namespace obs_sources {
+text_source::text_source(obs_source_t* src, obs_data_t* settings)
+    : m_source(src)
+{
+    update(settings);
+    UNUSED_PARAMETER(m_source);
+}
+
+text_source::~text_source()
+{
+    if (m_texture) {
+        obs_enter_graphics();
+        gs_texture_destroy(m_texture);
+        obs_leave_graphics();
+    }
+}
+
+void text_source::rasterize()
+{
+    QFont font;
+    uint32_t color;
+    {
+        std::lock_guard<std::mutex> lock(m_settings_mutex);
+        font = m_font;
+        color = m_color;
+    }
+
+    QFontMetrics metrics(font);
+    auto const w = std::max(1, metrics.horizontalAdvance(m_text));
+    auto const h = std::max(1, metrics.height());
+
+    QImage img(w, h, QImage::Format_ARGB32_Premultiplied);
+    img.fill(Qt::transparent);
+    {
+        QPainter p(&img);
+        p.setRenderHint(QPainter::TextAntialiasing);
+        p.setFont(font);
+        /* OBS colors are ABGR */
+        p.setPen(QColor(color & 0xff, (color >> 8) & 0xff, (color >> 16) & 0xff, (color >> 24) & 0xff));
+        p.drawText(0, metrics.ascent(), m_text);
+    }
+    /* Little endian ARGB32 is laid out as BGRA in memory */
+    m_pending = img.convertToFormat(QImage::Format_ARGB32);
+    m_has_pending = true;
+    m_text_cx = uint32_t(w);
+    m_text_cy = uint32_t(h);
+}
+
+void text_source::tick(float seconds)
+{
+    const auto snapshot = tuna_thread::snapshot();
+    bool settings_changed;
+    std::shared_ptr<const format::compiled> fmt;
+    {
+        std::lock_guard<std::mutex> lock(m_settings_mutex);
+        settings_changed = m_settings_changed;
+        m_settings_changed = false;
+        fmt = m_format;
+    }
+
+    /* Formatting only happens when a new song snapshot was published, or a
+     * few times a second for formats that move on with the time */
+    m_timed_elapsed += seconds;
+    bool const timed = fmt && fmt->timed() && m_timed_elapsed >= 0.1f;
+    if (fmt && (settings_changed || snapshot->generation != m_generation || timed)) {
+        m_generation = snapshot->generation;
+        m_timed_elapsed = 0.f;
+        QString text;
+        fmt->render(snapshot->info, text);
+        if (settings_changed || text != m_text) {
+            m_text = text;
+            rasterize();
+        }
+    }
+
+    auto const cx = m_cx.load();
+    auto const speed = m_scroll_speed.load();
+    auto const period = float(m_text_cx + m_gap);
+    if (speed != 0.f && cx && m_text_cx > cx) {
+        m_scroll_offset = fmodf(m_scroll_offset + speed * seconds, period);
+        if (m_scroll_offset < 0)
+            m_scroll_offset += period;
+    } else {
+        m_scroll_offset = 0;
+    }
+}
+
+void text_source::render(gs_effect_t* effect)
+{
+    UNUSED_PARAMETER(effect);
+    if (m_has_pending) {
+        m_has_pending = false;
+        if (m_texture)
+            gs_texture_destroy(m_texture);
+        const uint8_t* data = m_pending.constBits();
+        m_texture = gs_texture_create(uint32_t(m_pending.width()), uint32_t(m_pending.height()), GS_BGRA, 1, &data, 0);
+        m_pending = QImage();
+    }
+    if (!m_texture || m_text.isEmpty())
+        return;
+
+    gs_effect_t* def = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+    gs_eparam_t* image = gs_effect_get_param_by_name(def, "image");
+    gs_technique_t* tech = gs_effect_get_technique(def, "Draw");
+    gs_effect_set_texture(image, m_texture);
+
+    auto const cx = get_width();
+    auto const offset = uint32_t(m_scroll_offset);
+
+    gs_technique_begin(tech);
+    gs_technique_begin_pass(tech, 0);
+    /* The visible part of the text, followed by its start after the gap when scrolling */
+    if (offset < m_text_cx)
+        gs_draw_sprite_subregion(m_texture, 0, offset, 0, std::min(m_text_cx - offset, cx), m_text_cy);
+
+    auto const next = m_text_cx + m_gap - offset;
+    if (m_scroll_offset > 0 && next < cx) {
+        gs_matrix_push();
+        gs_matrix_translate3f(float(next), 0, 0);
+        gs_draw_sprite_subregion(m_texture, 0, 0, 0, std::min(cx - next, m_text_cx), m_text_cy);
+        gs_matrix_pop();
+    }
+    gs_technique_end_pass(tech);
+    gs_technique_end(tech);
+}
+
+void text_source::update(obs_data_t* settings)
+{
+    std::lock_guard<std::mutex> lock(m_settings_mutex);
+    m_format = format::compile(utf8_to_qt(obs_data_get_string(settings, S_TEXT_FORMAT)));
+
+    obs_data_t* font = obs_data_get_obj(settings, S_TEXT_FONT);
+    m_font = QFont(utf8_to_qt(obs_data_get_string(font, "face")));
+    m_font.setPixelSize(std::max(1, int(obs_data_get_int(font, "size"))));
+    auto const flags = obs_data_get_int(font, "flags");
+    m_font.setBold(flags & OBS_FONT_BOLD);
+    m_font.setItalic(flags & OBS_FONT_ITALIC);
+    m_font.setUnderline(flags & OBS_FONT_UNDERLINE);
+    m_font.setStrikeOut(flags & OBS_FONT_STRIKEOUT);
+    obs_data_release(font);
+
+    m_color = static_cast<uint32_t>(obs_data_get_int(settings, S_TEXT_COLOR));
+    m_cx = static_cast<uint32_t>(obs_data_get_int(settings, S_TEXT_CX));
+    m_scroll_speed = float(obs_data_get_double(settings, S_TEXT_SCROLL_SPEED));
+    m_gap = static_cast<uint32_t>(obs_data_get_int(settings, S_TEXT_GAP));
+    m_settings_changed = true;
+}
+
+obs_properties_t* get_properties_for_text(void* data)
+{
+    UNUSED_PARAMETER(data);
+    auto* p = obs_properties_create();
+    obs_properties_add_text(p, S_TEXT_FORMAT, T_TEXT_FORMAT, OBS_TEXT_DEFAULT);
+    obs_properties_add_font(p, S_TEXT_FONT, T_TEXT_FONT);
+    obs_properties_add_color(p, S_TEXT_COLOR, T_TEXT_COLOR);
+    obs_properties_add_int(p, S_TEXT_CX, T_TEXT_CX, 0, UINT16_MAX, 1);
+    obs_properties_add_float_slider(p, S_TEXT_SCROLL_SPEED, T_TEXT_SCROLL_SPEED, -500, 500, 1);
+    obs_properties_add_int(p, S_TEXT_GAP, T_TEXT_GAP, 0, UINT16_MAX, 1);
+    return p;
+}
+
+void register_text()
+{
+    obs_source_info si {};
+    si.id = S_TEXT_ID;
+    si.type = OBS_SOURCE_TYPE_INPUT;
+    si.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW;
+    si.get_properties = get_properties_for_text;
+    si.get_name = [](void*) { return T_TEXT_NAME; };
+    si.create = [](obs_data_t* d, obs_source_t* s) { return static_cast<void*>(new text_source(s, d)); };
+    si.destroy = [](void* data) { delete reinterpret_cast<text_source*>(data); };
+    si.get_width = [](void* data) { return reinterpret_cast<text_source*>(data)->get_width(); };
+    si.get_height = [](void* data) { return reinterpret_cast<text_source*>(data)->get_height(); };
+    si.get_defaults = [](obs_data_t* settings) {
+        obs_data_t* font = obs_data_create();
+        obs_data_set_default_string(font, "face", "Arial");
+        obs_data_set_default_int(font, "size", 32);
+        obs_data_set_default_obj(settings, S_TEXT_FONT, font);
+        obs_data_release(font);
+        obs_data_set_default_string(settings, S_TEXT_FORMAT, "{artists} - {title}");
+        obs_data_set_default_int(settings, S_TEXT_COLOR, 0xFFFFFFFF);
+        obs_data_set_default_int(settings, S_TEXT_CX, 0);
+        obs_data_set_default_double(settings, S_TEXT_SCROLL_SPEED, 0);
+        obs_data_set_default_int(settings, S_TEXT_GAP, 50);
+    };
+
+    si.update = [](void* data, obs_data_t* settings) { reinterpret_cast<text_source*>(data)->update(settings); };
+    si.show = [](void*) { activity::source_shown(); };
+    si.hide = [](void*) { activity::source_hidden(); };
+    si.video_tick = [](void* data, float seconds) { reinterpret_cast<text_source*>(data)->tick(seconds); };
+    si.video_render = [](void* data, gs_effect_t* effect) {
+        reinterpret_cast<text_source*>(data)->render(effect);
+    };
+
+    obs_register_source(&si);
+}
+}
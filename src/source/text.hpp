@@ -0,0 +1,75 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include "../util/format.hpp"
+#include <QFont>
+#include <QImage>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <obs-module.h>
+namespace obs_sources {
+
+/* Renders a format string with the current song straight into a texture.
+ * The text is only laid out again if the formatted string changes,
+ * scrolling just moves the region of the texture that is drawn */
+class text_source {
+    obs_source_t* m_source = nullptr;
+
+    /* Settings, changed on the UI thread */
+    std::mutex m_settings_mutex;
+    std::shared_ptr<const format::compiled> m_format;
+    QFont m_font;
+    uint32_t m_color = 0xFFFFFFFF;
+    bool m_settings_changed = true;
+    /* Read on the graphics thread without the lock */
+    std::atomic<uint32_t> m_cx { 0 }, m_gap { 0 };
+    std::atomic<float> m_scroll_speed { 0.f };
+
+    /* Only used on the graphics thread */
+    uint64_t m_generation = UINT64_MAX;
+    float m_timed_elapsed = 0.f;
+    QString m_text;
+    QImage m_pending; /* Rasterized text waiting to be uploaded in render() */
+    bool m_has_pending = false;
+    gs_texture_t* m_texture = nullptr;
+    uint32_t m_text_cx = 0, m_text_cy = 0;
+    float m_scroll_offset = 0.f;
+
+    void rasterize();
+
+public:
+    text_source(obs_source_t* src, obs_data_t* settings);
+    ~text_source();
+
+    inline void update(obs_data_t* settings);
+    inline void tick(float seconds);
+    inline void render(gs_effect_t* effect);
+
+    uint32_t get_width() const
+    {
+        auto const cx = m_cx.load();
+        return cx ? cx : m_text_cx;
+    }
+    uint32_t get_height() const { return m_text_cy; }
+};
+
+extern void register_text();
+}
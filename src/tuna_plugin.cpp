@@ -20,10 +20,17 @@
 #include "gui/tuna_gui.hpp"
 #include "gui/widgets/lastfm.hpp"
 #include "query/vlc_obs_source.hpp"
+#include "source/cover.hpp"
 #include "source/progress.hpp"
+#include "source/text.hpp"
+#include "util/activity.hpp"
+#include "util/async_http.hpp"
 #include "util/config.hpp"
 #include "util/constants.hpp"
+#include "util/history.hpp"
 #include "util/format.hpp"
+#include "util/media_thread.hpp"
+#include "util/output_thread.hpp"
 #include "util/tuna_thread.hpp"
 #include "util/utility.hpp"
 #include <QAction>
@@ -102,9 +109,16 @@ bool obs_module_load()
         config::init();
         register_gui();
         format::init();
+        async_http::start();
+        media_thread::start();
+        output_thread::start();
         music_sources::init();
         config::load();
+        activity::init();
+        history::init();
         obs_sources::register_progress();
+        obs_sources::register_cover();
+        obs_sources::register_text();
         obs_frontend_add_save_callback(&tuna_save_cb, nullptr);
 
         obs_frontend_add_event_callback([](enum obs_frontend_event event, void*) {
@@ -0,0 +1,129 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "activity.hpp"
+#include "config.hpp"
+#include "constants.hpp"
+#include "tuna_thread.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <atomic>
+#include <obs-frontend-api.h>
+#include <util/platform.h>
+
+namespace activity {
+
+/* Web clients count as active for a while after their last request */
+static const uint64_t web_timeout = 60ull * SECOND_TO_NS;
+static const uint64_t slow_refresh = 15ull * SECOND_TO_NS;
+/* Suspended queries still wake up rarely, in case an event was missed */
+static const uint64_t suspend_refresh = 600ull * SECOND_TO_NS;
+
+static std::atomic<bool> streaming { false }, recording { false }, buffering { false }, virtualcam { false };
+static std::atomic<int> shown_sources { 0 };
+static std::atomic<uint64_t> last_web_request { 0 };
+static std::atomic<bool> was_idle { false };
+
+/* Refreshes right away if tuna was idle and is used again */
+static void check_wakeup()
+{
+    if (was_idle && !idle()) {
+        binfo("Leaving idle mode");
+        tuna_thread::wakeup_selected();
+    }
+}
+
+void init()
+{
+    streaming = obs_frontend_streaming_active();
+    recording = obs_frontend_recording_active();
+    buffering = obs_frontend_replay_buffer_active();
+    virtualcam = obs_frontend_virtualcam_active();
+    obs_frontend_add_event_callback([](enum obs_frontend_event event, void*) {
+        switch (event) {
+        case OBS_FRONTEND_EVENT_STREAMING_STARTING:
+        case OBS_FRONTEND_EVENT_STREAMING_STARTED:
+            streaming = true;
+            break;
+        case OBS_FRONTEND_EVENT_STREAMING_STOPPED:
+            streaming = false;
+            break;
+        case OBS_FRONTEND_EVENT_RECORDING_STARTING:
+        case OBS_FRONTEND_EVENT_RECORDING_STARTED:
+            recording = true;
+            break;
+        case OBS_FRONTEND_EVENT_RECORDING_STOPPED:
+            recording = false;
+            break;
+        case OBS_FRONTEND_EVENT_REPLAY_BUFFER_STARTED:
+            buffering = true;
+            break;
+        case OBS_FRONTEND_EVENT_REPLAY_BUFFER_STOPPED:
+            buffering = false;
+            break;
+        case OBS_FRONTEND_EVENT_VIRTUALCAM_STARTED:
+            virtualcam = true;
+            break;
+        case OBS_FRONTEND_EVENT_VIRTUALCAM_STOPPED:
+            virtualcam = false;
+            break;
+        default:
+            return;
+        }
+        check_wakeup();
+    },
+        nullptr);
+}
+
+void source_shown()
+{
+    shown_sources++;
+    check_wakeup();
+}
+
+void source_hidden()
+{
+    shown_sources--;
+}
+
+void web_request()
+{
+    last_web_request = os_gettime_ns();
+    check_wakeup();
+}
+
+bool idle()
+{
+    if (config::idle_mode == IDLE_OFF)
+        return false;
+    if (streaming || recording || buffering || virtualcam || shown_sources > 0)
+        return false;
+    auto const last = last_web_request.load();
+    return !last || os_gettime_ns() - last > web_timeout;
+}
+
+uint64_t idle_refresh(uint64_t now, uint64_t next)
+{
+    bool const is_idle = idle();
+    if (was_idle.exchange(is_idle) != is_idle && is_idle)
+        binfo("Nothing uses the song information, entering idle mode");
+    if (!is_idle)
+        return next;
+    return std::max(next, now + (config::idle_mode == IDLE_SUSPEND ? suspend_refresh : slow_refresh));
+}
+}
@@ -0,0 +1,46 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <cstdint>
+
+/* Decides whether anybody uses the song information right now, so the
+ * query thread can slow down or pause while OBS isn't streaming or
+ * recording and neither tuna sources nor web clients are in use */
+namespace activity {
+enum idle_mode {
+    IDLE_OFF,     /* Always query at the normal rate */
+    IDLE_SLOW,    /* Query every few seconds to keep outputs roughly current */
+    IDLE_SUSPEND, /* Don't query at all until something uses tuna again */
+};
+
+void init();
+
+/* Called by tuna's OBS sources when they're shown or hidden in any view */
+void source_shown();
+void source_hidden();
+
+/* Called for every web server request and while event streams are open */
+void web_request();
+
+bool idle();
+
+/* Time at which the query thread should refresh next while idle,
+ * given the time it would refresh otherwise */
+uint64_t idle_refresh(uint64_t now, uint64_t next);
+}
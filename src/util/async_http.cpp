@@ -0,0 +1,282 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "async_http.hpp"
+#include "curl_pool.hpp"
+#include "metrics.hpp"
+#include "utility.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+/* curl_multi_poll and curl_multi_wakeup were added in 7.68.0 */
+#if LIBCURL_VERSION_NUM >= 0x074400
+#    define HAVE_MULTI_WAKEUP 1
+#endif
+
+namespace async_http {
+
+struct transfer {
+    request req;
+    callback done;
+    curl_pool::handle curl;
+    curl_slist* headers = nullptr;
+    response res;
+    char error[CURL_ERROR_SIZE] {};
+
+    transfer(request&& r, callback&& d)
+        : req(std::move(r))
+        , done(std::move(d))
+    {
+    }
+
+    ~transfer() { curl_slist_free_all(headers); }
+};
+
+struct pending {
+    request req;
+    callback done;
+};
+
+static std::thread thread_handle;
+static std::atomic<bool> thread_flag { false };
+static std::mutex queue_mutex;
+static std::vector<pending> queue;
+#ifndef HAVE_MULTI_WAKEUP
+/* Without curl_multi_wakeup the idle thread waits for new requests here */
+static std::condition_variable queue_cv;
+#endif
+static CURLM* multi = nullptr;
+
+static int transfer_progress(void* data, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+{
+    auto* t = static_cast<transfer*>(data);
+    return t->req.cancelled && t->req.cancelled() ? 1 : 0;
+}
+
+static size_t stream_header(char* ptr, size_t size, size_t nmemb, transfer* t)
+{
+    return t->req.on_header(ptr, size * nmemb) ? size * nmemb : 0;
+}
+
+static size_t stream_data(char* ptr, size_t size, size_t nmemb, transfer* t)
+{
+    return t->req.on_data(ptr, size * nmemb) ? size * nmemb : 0;
+}
+
+static bool setup(transfer& t)
+{
+    if (!t.curl) {
+        t.res.error = "curl_easy_init() failed";
+        return false;
+    }
+
+    for (auto const& h : t.req.headers)
+        t.headers = curl_slist_append(t.headers, h.c_str());
+
+    curl_easy_setopt(t.curl, CURLOPT_URL, t.req.url.c_str());
+    curl_easy_setopt(t.curl, CURLOPT_PRIVATE, &t);
+    curl_easy_setopt(t.curl, CURLOPT_HTTPHEADER, t.headers);
+    curl_easy_setopt(t.curl, CURLOPT_TIMEOUT_MS, t.req.timeout_ms);
+    if (t.req.on_data) {
+        curl_easy_setopt(t.curl, CURLOPT_WRITEFUNCTION, stream_data);
+        curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, &t);
+    } else {
+        curl_easy_setopt(t.curl, CURLOPT_WRITEFUNCTION, util::write_callback);
+        curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, &t.res.body);
+    }
+    if (t.req.on_header) {
+        curl_easy_setopt(t.curl, CURLOPT_HEADERFUNCTION, stream_header);
+        curl_easy_setopt(t.curl, CURLOPT_HEADERDATA, &t);
+    } else {
+        curl_easy_setopt(t.curl, CURLOPT_HEADERFUNCTION, util::write_callback);
+        curl_easy_setopt(t.curl, CURLOPT_HEADERDATA, &t.res.header);
+    }
+    curl_easy_setopt(t.curl, CURLOPT_ERRORBUFFER, t.error);
+    curl_easy_setopt(t.curl, CURLOPT_XFERINFOFUNCTION, transfer_progress);
+    curl_easy_setopt(t.curl, CURLOPT_XFERINFODATA, &t);
+    curl_easy_setopt(t.curl, CURLOPT_NOPROGRESS, 0L);
+    if (!t.req.method.empty())
+        curl_easy_setopt(t.curl, CURLOPT_CUSTOMREQUEST, t.req.method.c_str());
+    if (!t.req.body.empty()) {
+        curl_easy_setopt(t.curl, CURLOPT_POSTFIELDSIZE, long(t.req.body.size()));
+        curl_easy_setopt(t.curl, CURLOPT_POSTFIELDS, t.req.body.c_str());
+    }
+#ifdef DEBUG
+    curl_easy_setopt(t.curl, CURLOPT_VERBOSE, 1L);
+#endif
+    return true;
+}
+
+static void finish(transfer& t, CURLcode result)
+{
+    t.res.result = result;
+    if (t.curl)
+        curl_easy_getinfo(t.curl, CURLINFO_RESPONSE_CODE, &t.res.status);
+    metrics::http_status(result == CURLE_OK ? t.res.status : 0);
+    if (t.res.error.empty())
+        t.res.error = t.error[0] ? t.error : curl_easy_strerror(result);
+    if (t.done)
+        t.done(std::move(t.res));
+}
+
+static void thread_method()
+{
+    util::set_thread_name("tuna-http");
+    std::set<transfer*> active;
+
+    while (thread_flag) {
+        std::vector<pending> added;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            added.swap(queue);
+        }
+
+        for (auto& p : added) {
+            auto* t = new transfer(std::move(p.req), std::move(p.done));
+            if (setup(*t) && curl_multi_add_handle(multi, t->curl) == CURLM_OK) {
+                active.insert(t);
+            } else {
+                finish(*t, CURLE_FAILED_INIT);
+                delete t;
+            }
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg* msg;
+        int left = 0;
+        while ((msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            transfer* t = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &t);
+            auto const result = msg->data.result;
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            active.erase(t);
+            finish(*t, result);
+            delete t;
+        }
+
+#ifdef HAVE_MULTI_WAKEUP
+        curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+#else
+        if (active.empty()) {
+            /* Older versions return right away if there are no handles to wait on */
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [] { return !queue.empty() || !thread_flag; });
+        } else {
+            curl_multi_wait(multi, nullptr, 0, 50, nullptr);
+        }
+#endif
+    }
+
+    /* Nobody should wait forever for a response that won't come */
+    for (auto* t : active) {
+        curl_multi_remove_handle(multi, t->curl);
+        finish(*t, CURLE_ABORTED_BY_CALLBACK);
+        delete t;
+    }
+    std::vector<pending> left;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        left.swap(queue);
+    }
+    for (auto& p : left) {
+        transfer t(std::move(p.req), std::move(p.done));
+        finish(t, CURLE_ABORTED_BY_CALLBACK);
+    }
+}
+
+bool start()
+{
+    if (thread_flag)
+        return true;
+    multi = curl_multi_init();
+    if (!multi) {
+        berr("curl_multi_init() failed");
+        return false;
+    }
+    thread_flag = true;
+    thread_handle = std::thread(thread_method);
+    return true;
+}
+
+void stop()
+{
+    if (!thread_flag)
+        return;
+    bdebug("Stopping http thread...");
+    {
+        /* Nothing can be queued after this, see submit() */
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        thread_flag = false;
+#ifdef HAVE_MULTI_WAKEUP
+        curl_multi_wakeup(multi);
+#else
+        queue_cv.notify_one();
+#endif
+    }
+    if (thread_handle.joinable())
+        thread_handle.join();
+    curl_multi_cleanup(multi);
+    multi = nullptr;
+    bdebug("Http thread stopped.");
+}
+
+bool running()
+{
+    return thread_flag;
+}
+
+void submit(request req, callback done)
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (thread_flag) {
+            queue.push_back({ std::move(req), std::move(done) });
+#ifdef HAVE_MULTI_WAKEUP
+            curl_multi_wakeup(multi);
+#else
+            queue_cv.notify_one();
+#endif
+            return;
+        }
+    }
+
+    /* Not running (yet or anymore), so just do it right here */
+    transfer t(std::move(req), std::move(done));
+    finish(t, setup(t) ? curl_easy_perform(t.curl) : CURLE_FAILED_INIT);
+}
+
+std::future<response> fetch(request req, std::function<void()> ready)
+{
+    auto promise = std::make_shared<std::promise<response>>();
+    auto future = promise->get_future();
+    submit(std::move(req), [promise, ready = std::move(ready)](response&& res) {
+        promise->set_value(std::move(res));
+        if (ready)
+            ready();
+    });
+    return future;
+}
+}
@@ -0,0 +1,69 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <curl/curl.h>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+/* Runs HTTP requests on a single thread with curl_multi, so several of
+ * them can be in flight at once without blocking the thread that sent them */
+namespace async_http {
+
+struct request {
+    std::string url;
+    /* Custom method like "PUT", otherwise GET or POST if there's a body */
+    std::string method;
+    std::string body;
+    std::vector<std::string> headers;
+    /* Zero for transfers that run until they're cancelled */
+    long timeout_ms = 10000;
+    /* Polled while the transfer runs, which is aborted once this returns true */
+    std::function<bool()> cancelled;
+    /* Receive the header lines and the body as they arrive instead of
+     * collecting them in the response, returning false aborts the transfer */
+    std::function<bool(const char*, size_t)> on_header;
+    std::function<bool(const char*, size_t)> on_data;
+};
+
+struct response {
+    CURLcode result = CURLE_FAILED_INIT;
+    long status = -1;
+    std::string body;
+    std::string header;
+    std::string error;
+};
+
+typedef std::function<void(response&&)> callback;
+
+bool start();
+
+void stop();
+
+bool running();
+
+/* Queues the request, done is called on the http thread once it finished.
+ * Performs the request right away if the http thread isn't running */
+void submit(request req, callback done);
+
+/* Same as submit, but the response is picked up through the future.
+ * ready is called on the http thread once the future has its value */
+std::future<response> fetch(request req, std::function<void()> ready = nullptr);
+}
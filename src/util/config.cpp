@@ -18,7 +18,14 @@
 
 #include "config.hpp"
 #include "../query/music_source.hpp"
+#include "async_http.hpp"
 #include "constants.hpp"
+#include "format.hpp"
+#include "history.hpp"
+#include "media_thread.hpp"
+#include "output_thread.hpp"
+#include "render_pool.hpp"
+#include "shared_song.hpp"
 #include "tuna_thread.hpp"
 #include "utility.hpp"
 #include "web_server.hpp"
@@ -27,31 +34,141 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <obs-frontend-api.h>
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <obs-module.h>
+#include <thread>
 #include <tuple>
 #include <util/config-file.h>
 #include <util/platform.h>
+#include <variant>
 #include <vector>
 
 namespace config {
 
 bool post_load = false;
 QList<output> outputs;
+static std::shared_ptr<output_set> active_set = std::make_shared<output_set>();
 config_t* instance = nullptr;
 uint16_t refresh_rate = 1000;
 uint16_t webserver_port = 1608;
+uint16_t webserver_threads = 8;
+uint16_t webserver_keep_alive = 100;
+bool thread_priorities = true;
+uint64_t thread_affinity = 0;
 uint16_t cover_size = 256;
+uint32_t log_max_size = 0;
+uint32_t cover_cache_size = 64;
 QString placeholder = {};
 QString cover_path = {};
 QString lyrics_path = {};
 QString cover_placeholder = {};
 QString selected_source = {};
 bool webserver_enabled = false;
+bool webserver_local_only = false;
+bool webserver_control = false;
 bool download_cover = true;
 bool download_lyrics = false;
 bool download_missing_cover = true;
+bool auto_select_source = false;
 bool placeholder_when_paused = true;
 bool remove_file_extensions = true;
+bool shared_memory = false;
+bool restore_state = true;
+bool cover_by_reference = false;
+bool cover_normalize = false;
+uint16_t idle_mode = 0;
+
+/* Writes are only flushed once nothing changed for this long */
+static const auto flush_delay = std::chrono::seconds(2);
+
+static std::mutex pending_mutex;
+static std::condition_variable pending_cv;
+static std::map<std::string, std::variant<QString, int64_t, bool>> pending;
+static bool save_pending = false;
+static bool flush_running = false;
+static std::thread flush_thread;
+
+/* Expects pending_mutex to be locked, only called on the flush thread or
+ * when it isn't running */
+static void apply_pending(std::unique_lock<std::mutex>& lock)
+{
+    auto values = std::move(pending);
+    pending.clear();
+    bool const save = save_pending || !values.empty();
+    save_pending = false;
+    lock.unlock();
+
+    for (auto const& [id, value] : values) {
+        if (auto const* str = std::get_if<QString>(&value))
+            CSET_STR(id.c_str(), qt_to_utf8(*str));
+        else if (auto const* i = std::get_if<int64_t>(&value))
+            CSET_INT(id.c_str(), *i);
+        else
+            CSET_BOOL(id.c_str(), std::get<bool>(value));
+    }
+    if (save && config_save_safe(instance, "tmp", nullptr) != CONFIG_SUCCESS)
+        berr("Couldn't save config");
+    lock.lock();
+}
+
+static void flush_method()
+{
+    util::set_thread_name("tuna-config");
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    while (flush_running) {
+        pending_cv.wait(lock, [] { return !flush_running || save_pending || !pending.empty(); });
+        /* Every new write pushes the flush back a bit, so bursts are written at once */
+        auto size = pending.size();
+        while (flush_running && pending_cv.wait_for(lock, flush_delay, [&size] { return !flush_running || pending.size() != size; }))
+            size = pending.size();
+        apply_pending(lock);
+    }
+}
+
+static void defer(const char* id, std::variant<QString, int64_t, bool> value)
+{
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending[id] = std::move(value);
+    }
+    pending_cv.notify_all();
+}
+
+void defer_str(const char* id, const QString& value)
+{
+    defer(id, value);
+}
+
+void defer_int(const char* id, int64_t value)
+{
+    defer(id, value);
+}
+
+void defer_bool(const char* id, bool value)
+{
+    defer(id, value);
+}
+
+void request_save()
+{
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    save_pending = true;
+    if (flush_running) {
+        lock.unlock();
+        pending_cv.notify_all();
+    } else {
+        apply_pending(lock);
+    }
+}
+
+void flush()
+{
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    apply_pending(lock);
+}
 
 void init()
 {
@@ -71,48 +188,89 @@ void init()
     CDEF_STR(CFG_SPOTIFY_CLIENT_ID, "847d7cf0c5dc4ff185161d1f000a9d0e");
 
     CDEF_BOOL(CFG_REMOVE_EXTENSIONS, config::remove_file_extensions);
+    CDEF_BOOL(CFG_SHARED_MEMORY, config::shared_memory);
+    CDEF_BOOL(CFG_RESTORE_STATE, config::restore_state);
     CDEF_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED, config::placeholder_when_paused);
     CDEF_BOOL(CFG_RUNNING, false);
     CDEF_BOOL(CFG_DOWNLOAD_LYRICS, config::download_lyrics);
     CDEF_BOOL(CFG_DOWNLOAD_COVER, config::download_cover);
     CDEF_BOOL(CFG_DOWNLOAD_MISSING_COVER, config::download_missing_cover);
+    CDEF_BOOL(CFG_AUTO_SELECT_SOURCE, config::auto_select_source);
+    CDEF_BOOL(CFG_COVER_BY_REFERENCE, config::cover_by_reference);
+    CDEF_BOOL(CFG_COVER_NORMALIZE, config::cover_normalize);
     CDEF_UINT(CFG_COVER_SIZE, config::cover_size);
+    CDEF_UINT(CFG_LOG_MAX_SIZE, config::log_max_size);
+    CDEF_UINT(CFG_COVER_CACHE_SIZE, config::cover_cache_size);
     CDEF_UINT(CFG_REFRESH_RATE, config::refresh_rate);
+    CDEF_UINT(CFG_IDLE_MODE, config::idle_mode);
     CDEF_UINT(CFG_SERVER_PORT, config::webserver_port);
+    CDEF_UINT(CFG_SERVER_THREADS, config::webserver_threads);
+    CDEF_UINT(CFG_SERVER_KEEP_ALIVE, config::webserver_keep_alive);
+    CDEF_BOOL(CFG_THREAD_PRIORITIES, config::thread_priorities);
+    CDEF_UINT(CFG_THREAD_AFFINITY, config::thread_affinity);
     CDEF_STR(CFG_SONG_PLACEHOLDER, T_PLACEHOLDER);
 
     CDEF_BOOL(CFG_DOCK_VISIBLE, false);
     CDEF_BOOL(CFG_DOCK_INFO_VISIBLE, true);
     CDEF_BOOL(CFG_DOCK_VOLUME_VISIBLE, true);
     CDEF_BOOL(CFG_SERVER_ENABLED, false);
+    CDEF_BOOL(CFG_SERVER_LOCAL_ONLY, config::webserver_local_only);
+    CDEF_BOOL(CFG_SERVER_CONTROL, config::webserver_control);
 
     auto tmp = obs_module_file("placeholder.png");
     cover_placeholder = tmp;
     bfree((void*)tmp);
+
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    if (!flush_running) {
+        flush_running = true;
+        flush_thread = std::thread(flush_method);
+    }
 }
 
 void load()
 {
     if (!instance)
         init();
+    /* Values are read back below, so pending writes have to be in there first */
+    flush();
 
     tuna_thread::thread_mutex.lock();
     load_outputs();
     cover_path = CGET_STR(CFG_COVER_PATH);
     lyrics_path = CGET_STR(CFG_LYRICS_PATH);
     refresh_rate = CGET_UINT(CFG_REFRESH_RATE);
+    idle_mode = CGET_UINT(CFG_IDLE_MODE);
     placeholder = CGET_STR(CFG_SONG_PLACEHOLDER);
     download_lyrics = CGET_BOOL(CFG_DOWNLOAD_LYRICS);
     download_cover = CGET_BOOL(CFG_DOWNLOAD_COVER);
     download_missing_cover = CGET_BOOL(CFG_DOWNLOAD_MISSING_COVER);
     placeholder_when_paused = CGET_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED);
     remove_file_extensions = CGET_BOOL(CFG_REMOVE_EXTENSIONS);
+    shared_memory = CGET_BOOL(CFG_SHARED_MEMORY);
+    restore_state = CGET_BOOL(CFG_RESTORE_STATE);
     webserver_enabled = CGET_BOOL(CFG_SERVER_ENABLED);
     webserver_port = CGET_UINT(CFG_SERVER_PORT);
+    webserver_local_only = CGET_BOOL(CFG_SERVER_LOCAL_ONLY);
+    webserver_control = CGET_BOOL(CFG_SERVER_CONTROL);
+    webserver_threads = std::max<uint64_t>(CGET_UINT(CFG_SERVER_THREADS), 1);
+    webserver_keep_alive = CGET_UINT(CFG_SERVER_KEEP_ALIVE);
+    thread_priorities = CGET_BOOL(CFG_THREAD_PRIORITIES);
+    thread_affinity = CGET_UINT(CFG_THREAD_AFFINITY);
     selected_source = CGET_STR(CFG_SELECTED_SOURCE);
+    auto_select_source = CGET_BOOL(CFG_AUTO_SELECT_SOURCE);
     cover_size = CGET_UINT(CFG_COVER_SIZE);
+    log_max_size = CGET_UINT(CFG_LOG_MAX_SIZE);
+    cover_cache_size = CGET_UINT(CFG_COVER_CACHE_SIZE);
+    cover_by_reference = CGET_BOOL(CFG_COVER_BY_REFERENCE);
+    cover_normalize = CGET_BOOL(CFG_COVER_NORMALIZE);
     music_sources::load();
     tuna_thread::thread_mutex.unlock();
+    output_thread::reopen_logs();
+
+    /* Switching between querying one or all sources requires a restart */
+    if (tuna_thread::thread_flag && tuna_thread::parallel_mode() != auto_select_source)
+        tuna_thread::stop();
 
     auto run = CGET_BOOL(CFG_RUNNING);
     if (run && !tuna_thread::start())
@@ -126,6 +284,7 @@ void load()
         web_thread::stop();
 
     music_sources::select(qt_to_utf8(selected_source));
+    tuna_thread::invalidate();
 }
 
 void save()
@@ -135,16 +294,30 @@ void save()
     CSET_STR(CFG_COVER_PATH, qt_to_utf8(cover_path));
     CSET_STR(CFG_LYRICS_PATH, qt_to_utf8(lyrics_path));
     CSET_UINT(CFG_REFRESH_RATE, refresh_rate);
+    CSET_UINT(CFG_IDLE_MODE, idle_mode);
     CSET_STR(CFG_SONG_PLACEHOLDER, qt_to_utf8(placeholder));
     CSET_BOOL(CFG_DOWNLOAD_LYRICS, download_lyrics);
     CSET_BOOL(CFG_DOWNLOAD_COVER, download_cover);
     CSET_BOOL(CFG_DOWNLOAD_MISSING_COVER, download_missing_cover);
     CSET_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED, placeholder_when_paused);
     CSET_BOOL(CFG_REMOVE_EXTENSIONS, remove_file_extensions);
+    CSET_BOOL(CFG_SHARED_MEMORY, shared_memory);
+    CSET_BOOL(CFG_RESTORE_STATE, restore_state);
     CSET_BOOL(CFG_SERVER_ENABLED, webserver_enabled);
     CSET_UINT(CFG_SERVER_PORT, webserver_port);
+    CSET_BOOL(CFG_SERVER_LOCAL_ONLY, webserver_local_only);
+    CSET_BOOL(CFG_SERVER_CONTROL, webserver_control);
+    CSET_UINT(CFG_SERVER_THREADS, webserver_threads);
+    CSET_UINT(CFG_SERVER_KEEP_ALIVE, webserver_keep_alive);
+    CSET_BOOL(CFG_THREAD_PRIORITIES, thread_priorities);
+    CSET_UINT(CFG_THREAD_AFFINITY, thread_affinity);
     CSET_STR(CFG_SELECTED_SOURCE, qt_to_utf8(selected_source));
+    CSET_BOOL(CFG_AUTO_SELECT_SOURCE, auto_select_source);
     CSET_UINT(CFG_COVER_SIZE, cover_size);
+    CSET_UINT(CFG_LOG_MAX_SIZE, log_max_size);
+    CSET_UINT(CFG_COVER_CACHE_SIZE, cover_cache_size);
+    CSET_BOOL(CFG_COVER_BY_REFERENCE, cover_by_reference);
+    CSET_BOOL(CFG_COVER_NORMALIZE, cover_normalize);
     save_outputs();
     tuna_thread::thread_mutex.unlock();
     bdebug("Saved config.");
@@ -188,6 +361,7 @@ void load_outputs()
             tmp.format = legacy_convert(obj[JSON_FORMAT_ID].toString());
 
             tmp.path = obj[JSON_OUTPUT_PATH_ID].toString();
+            tmp.text_source = obj[JSON_TEXT_SOURCE].toString();
             if (obj[JSON_FORMAT_LOG_MODE].isBool())
                 tmp.log_mode = obj[JSON_FORMAT_LOG_MODE].toBool();
             else
@@ -201,17 +375,58 @@ void load_outputs()
         }
         binfo("Loaded %i outputs", (int)array.size());
     }
+    publish_outputs();
+}
+
+static bool same_output(const output& a, const output& b)
+{
+    return a.format == b.format && a.path == b.path && a.text_source == b.text_source && a.log_mode == b.log_mode;
+}
+
+static const output* find_output(const output_set& set, const output& o)
+{
+    auto it = std::find_if(set.outputs.begin(), set.outputs.end(), [&o](const output& other) { return same_output(o, other); });
+    return it == set.outputs.end() ? nullptr : &*it;
+}
+
+void publish_outputs()
+{
+    auto const previous = active_outputs();
+    auto next = std::make_shared<output_set>();
+    next->outputs.reserve(size_t(outputs.size()));
+    std::lock_guard<std::mutex> lock(previous->last_output_mutex);
+    for (const auto& o : std::as_const(outputs)) {
+        output tmp = o;
+        if (auto const* old = find_output(*previous, o)) {
+            tmp.compiled = old->compiled;
+            tmp.last_output = old->last_output;
+        } else {
+            tmp.compiled = format::compile(tmp.format);
+        }
+        next->outputs.push_back(std::move(tmp));
+    }
+    std::atomic_store_explicit(&active_set, std::move(next), std::memory_order_release);
+}
+
+std::shared_ptr<output_set> active_outputs()
+{
+    return std::atomic_load_explicit(&active_set, std::memory_order_acquire);
 }
 
 void save_outputs()
 {
     QJsonArray output_array;
+    auto const active = active_outputs();
+    std::lock_guard<std::mutex> lock(active->last_output_mutex);
     for (const auto& o : std::as_const(outputs)) {
+        /* The query thread only updates the last text in the active set */
+        auto const* current = find_output(*active, o);
         QJsonObject output;
         output[JSON_FORMAT_ID] = o.format;
         output[JSON_OUTPUT_PATH_ID] = QDir::toNativeSeparators(o.path);
         output[JSON_FORMAT_LOG_MODE] = o.log_mode;
-        output[JSON_LAST_OUTPUT] = o.last_output;
+        output[JSON_TEXT_SOURCE] = o.text_source;
+        output[JSON_LAST_OUTPUT] = current ? current->last_output : o.last_output;
         output_array.append(output);
     }
     util::save_config(OUTPUT_FILE, QJsonDocument(output_array));
@@ -221,7 +436,24 @@ void close()
 {
     save();
     tuna_thread::stop();
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        flush_running = false;
+    }
+    pending_cv.notify_all();
+    if (flush_thread.joinable())
+        flush_thread.join();
+    /* Whatever the stopped threads wrote last */
+    flush();
     web_thread::stop();
+    /* Only once the query thread is gone, it'd open these again otherwise */
+    history::close();
+    shared_song::close();
+    render_pool::stop();
+    media_thread::stop();
+    /* After the media threads, their downloads run on the http thread */
+    async_http::stop();
+    output_thread::stop();
     util::reset_cover();
     music_sources::deinit();
 }
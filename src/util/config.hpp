@@ -20,8 +20,15 @@
 
 #include <QList>
 #include <QString>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <util/config-file.h>
 
+namespace format {
+class compiled;
+}
+
 /* Config macros */
 #define CDEF_STR(id, value) config_set_default_string(config::instance, CFG_REGION, id, value)
 #define CDEF_INT(id, value) config_set_default_int(config::instance, CFG_REGION, id, value)
@@ -44,6 +51,12 @@
 
 #define CFG_SERVER_PORT                 "server_port"
 #define CFG_SERVER_ENABLED              "server_enabled"
+#define CFG_SERVER_LOCAL_ONLY           "server_local_only"
+#define CFG_SERVER_CONTROL              "server_control"
+#define CFG_SERVER_THREADS              "server_threads"
+#define CFG_SERVER_KEEP_ALIVE           "server_keep_alive"
+#define CFG_THREAD_PRIORITIES           "thread_priorities"
+#define CFG_THREAD_AFFINITY             "thread_affinity"
 
 #define CFG_RUNNING                     "running"
 #define CFG_SONG_PATH                   "song_path"
@@ -51,7 +64,9 @@
 #define CFG_PLACEHOLDER_WHEN_PAUSED     "placeholder_when_paused"
 #define CFG_LYRICS_PATH                 "lyrics_path"
 #define CFG_SELECTED_SOURCE             "music.source"
+#define CFG_AUTO_SELECT_SOURCE          "music.auto_select"
 #define CFG_REFRESH_RATE                "refresh_rate"
+#define CFG_IDLE_MODE                   "idle_mode"
 #define CFG_SONG_FORMAT                 "song_format"
 #define CFG_SONG_PLACEHOLDER            "song_placeholder"
 #define CFG_DOWNLOAD_LYRICS             "download_lyrics"
@@ -59,6 +74,12 @@
 #define CFG_DOWNLOAD_MISSING_COVER      "download_missing_cover"
 #define CFG_COVER_SIZE                  "cover_size"
 #define CFG_REMOVE_EXTENSIONS           "removeextensions"
+#define CFG_SHARED_MEMORY               "shared_memory"
+#define CFG_RESTORE_STATE               "restore_state"
+#define CFG_LOG_MAX_SIZE                "log_max_size"
+#define CFG_COVER_CACHE_SIZE            "cover_cache_size"
+#define CFG_COVER_BY_REFERENCE          "cover_by_reference"
+#define CFG_COVER_NORMALIZE             "cover_normalize"
 
 #define CFG_SPOTIFY_LOGGEDIN            "spotify.login"
 #define CFG_SPOTIFY_TOKEN               "spotify.token"
@@ -88,6 +109,12 @@
 #define CFG_MPRIS_PLAYER                "mpris.player"
 
 #define CFG_ICECAST_URL                 "icecast.url"
+#define CFG_ICECAST_STREAM              "icecast.stream"
+
+#define CFG_REPLAY_FILE                 "replay.file"
+#define CFG_REPLAY_RECORD               "replay.record"
+#define CFG_REPLAY_SPEED                "replay.speed"
+#define CFG_REPLAY_LOOP                 "replay.loop"
 
 #define CFG_WINDOW_TITLE                "window.title"
 #define CFG_WINDOW_PAUSE                "window.title.pause"
@@ -110,8 +137,20 @@ namespace config {
 struct output {
     QString format;
     QString path;
+    /* Name of an OBS text source that is updated directly, optional */
+    QString text_source;
     QString last_output;
     bool log_mode;
+    /* Parsed version of format, has to be updated whenever format changes */
+    std::shared_ptr<const format::compiled> compiled;
+};
+
+/* The outputs the query thread renders. Changed outputs are swapped in as a
+ * whole set, so the query thread keeps running and never sees half an edit */
+struct output_set {
+    std::vector<output> outputs;
+    /* Guards last_output, which is read when the set is saved or replaced */
+    std::mutex last_output_mutex;
 };
 
 extern config_t* instance;
@@ -120,6 +159,14 @@ extern bool post_load;
 /* Temp storage for config values */
 extern uint16_t refresh_rate;
 extern uint16_t webserver_port;
+/* Event streams the web server keeps open at once, each occupies a worker.
+ * Further streams get a 503, other requests have workers of their own */
+extern uint16_t webserver_threads;
+/* Requests per keep-alive connection before it's closed */
+extern uint16_t webserver_keep_alive;
+extern bool thread_priorities;
+/* Bit mask of the cores tuna threads may run on, 0 for all of them */
+extern uint64_t thread_affinity;
 
 extern QString selected_source;
 extern QString placeholder;
@@ -127,14 +174,34 @@ extern QString cover_path;
 extern QString lyrics_path;
 extern QString cover_placeholder;
 
+/* Output definitions as they are edited and saved, see publish_outputs() */
 extern QList<output> outputs;
 extern bool webserver_enabled;
+/* Binds the web server to 127.0.0.1 instead of all interfaces */
+extern bool webserver_local_only;
+/* Whether POST /control may send playback commands to the selected source */
+extern bool webserver_control;
 extern bool download_cover;
 extern bool download_lyrics;
 extern bool download_missing_cover;
 extern bool remove_file_extensions;
+extern bool shared_memory;
+extern bool restore_state;
 extern bool placeholder_when_paused;
+extern bool auto_select_source;
 extern uint16_t cover_size;
+/* Size in MiB after which song logs are rotated, zero disables rotation */
+extern uint32_t log_max_size;
+/* Size in MiB of the on-disk cover cache, zero disables it */
+extern uint32_t cover_cache_size;
+/* Local and embedded covers are served from where they are and only
+ * written to cover_path if an image source shows that file */
+extern bool cover_by_reference;
+/* Scales every cover down to cover_size and encodes it in the format
+ * of cover_path, instead of only using cover_size for iTunes searches */
+extern bool cover_normalize;
+/* activity::idle_mode, what the query thread does while nothing uses tuna */
+extern uint16_t idle_mode;
 
 void init();
 
@@ -143,7 +210,27 @@ void load();
 void save();
 void close();
 
+/* Config writes from the query or worker threads. They're collected and
+ * applied to config::instance by a background flush once no other write
+ * came in for a moment, which also saves the config file */
+void defer_str(const char* id, const QString& value);
+void defer_int(const char* id, int64_t value);
+void defer_bool(const char* id, bool value);
+
+/* Saves the config file on the next flush instead of right away */
+void request_save();
+
+/* Applies and saves everything that is pending, blocks until it's done */
+void flush();
+
 void load_outputs();
 
 void save_outputs();
+
+/* Compiles config::outputs into a new set and swaps it in. Outputs that didn't
+ * change keep their compiled format and last text, so they aren't written again */
+void publish_outputs();
+
+/* The current set, only the query thread may render it */
+std::shared_ptr<output_set> active_outputs();
 } // namespace config
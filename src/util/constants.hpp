@@ -34,6 +34,7 @@
 #define S_SOURCE_WEB            "web"
 #define S_SOURCE_DEEZER         "deezer"
 #define S_SOURCE_ICECAST        "icecast"
+#define S_SOURCE_REPLAY         "replay"
 
 #define S_PROGRESS_FG           "fg"
 #define S_PROGRESS_BG           "bg"
@@ -43,6 +44,19 @@
 #define S_PROGRESS_USE_BG       "use_bg"
 #define S_PROGRESS_HIDE_PAUSED  "hide_paused"
 
+#define S_TEXT_ID               "tuna_text"
+#define S_TEXT_FORMAT           "format"
+#define S_TEXT_FONT             "font"
+#define S_TEXT_COLOR            "color"
+#define S_TEXT_CX               "cx"
+#define S_TEXT_SCROLL_SPEED     "scroll_speed"
+#define S_TEXT_GAP              "gap"
+
+#define S_COVER_ID              "tuna_cover"
+#define S_COVER_CX              "cx"
+#define S_COVER_CY              "cy"
+#define S_COVER_FADE            "fade"
+
 #define S_HOTKEY_NEXT           "tuna.hotkey.vlc.next"
 #define S_HOTKEY_PREV           "tuna.hotkey.vlc.prev"
 
@@ -66,6 +80,7 @@
 #define T_SOURCE_WEB            T_("tuna.gui.tab.web")
 #define T_SOURCE_DEEZER         T_("tuna.gui.tab.deezer")
 #define T_SOURCE_MPRIS          T_("tuna.gui.tab.mpris")
+#define T_SOURCE_REPLAY         T_("tuna.gui.tab.replay")
 
 #define T_PLACEHOLDER           T_("tuna.config.song.placeholder")
 #define T_FORMAT                T_("tuna.config.song.format")
@@ -74,6 +89,9 @@
 #define T_SELECT_LYRICS_FILE    T_("tuna.gui.select.lyrics.file")
 #define T_SELECT_MPD_FOLDER     T_("tuna.gui.select.mpd.folder")
 #define T_LARGEST_COVER         T_("tuna.gui.tab.basics.song.cover.largest")
+#define T_IDLE_OFF              T_("tuna.gui.tab.basics.idle.off")
+#define T_IDLE_SLOW             T_("tuna.gui.tab.basics.idle.slow")
+#define T_IDLE_SUSPEND          T_("tuna.gui.tab.basics.idle.suspend")
 
 #define T_SONG_PATH             T_("tuna.gui.tab.basics.song.info")
 #define T_SONG_FORMAT           T_("tuna.gui.tab.basics.song.format")
@@ -97,6 +115,19 @@
 #define T_PROGRESS_USE_BG       T_("tuna.source.progress.use.bg")
 #define T_PROGRESS_HIDE_PAUSED  T_("tuna.source.progress.hide.paused")
 
+#define T_TEXT_NAME             T_("tuna.source.text.name")
+#define T_TEXT_FORMAT           T_("tuna.source.text.format")
+#define T_TEXT_FONT             T_("tuna.source.text.font")
+#define T_TEXT_COLOR            T_("tuna.source.text.color")
+#define T_TEXT_CX               T_("tuna.source.text.cx")
+#define T_TEXT_SCROLL_SPEED     T_("tuna.source.text.scroll.speed")
+#define T_TEXT_GAP              T_("tuna.source.text.gap")
+
+#define T_COVER_NAME            T_("tuna.source.cover.name")
+#define T_COVER_CX              T_("tuna.source.cover.cx")
+#define T_COVER_CY              T_("tuna.source.cover.cy")
+#define T_COVER_FADE            T_("tuna.source.cover.fade")
+
 #define T_DOCK_MENU_TITLE       T_("tuna.dock.menu.title")
 #define T_DOCK_TOGGLE_VOLUME    T_("tuna.dock.menu.toggle.volume")
 #define T_DOCK_TOGGLE_SOURCE    T_("tuna.dock.menu.toggle.source")
@@ -109,12 +140,18 @@
  * there */
 #define CONFIG_FOLDER ".config/"
 #define OUTPUT_FILE "outputs.json"
+#define COVER_CACHE_FOLDER "cover_cache"
+#define COVER_LOOKUP_FILE "cover_lookups.json"
+#define LYRICS_CACHE_FOLDER "lyrics_cache"
+#define HISTORY_FILE "history.bin"
+#define LAST_STATE_FILE "last_song.json"
 #define VLC_SCENE_MAPPING "tuna_vlc_mappings.json"
 
 #define JSON_OUTPUT_PATH_ID     "output"
 #define JSON_FORMAT_ID             "format"
 #define JSON_FORMAT_LOG_MODE    "log_mode"
 #define JSON_LAST_OUTPUT        "last_output"
+#define JSON_TEXT_SOURCE        "text_source"
 
 #define STATUS_RETRY_AFTER         429
 #define HTTP_NO_CONTENT            204
@@ -0,0 +1,194 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "cover_cache.hpp"
+#include "../query/song.hpp"
+#include "config.hpp"
+#include "constants.hpp"
+#include "metrics.hpp"
+#include "utility.hpp"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <mutex>
+
+namespace cover_cache {
+
+static std::mutex mutex;
+
+/* Search results expire so that newly added covers are found eventually */
+static const int64_t found_ttl = 30 * 24 * 60 * 60;
+static const int64_t not_found_ttl = 24 * 60 * 60;
+/* The iTunes search api allows roughly 20 requests per minute */
+static const int max_requests_per_minute = 15;
+
+static std::mutex lookup_mutex;
+static QJsonObject lookups;
+static bool lookups_loaded = false;
+
+static QDir cache_dir()
+{
+    QDir dir(util::get_config_file_path(COVER_CACHE_FOLDER));
+    if (!dir.exists() && !dir.mkpath("."))
+        berr("Couldn't create cover cache folder %s", qt_to_utf8(dir.path()));
+    return dir;
+}
+
+static QString file_for(const QString& key)
+{
+    auto hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return cache_dir().absoluteFilePath(QString::fromLatin1(hash));
+}
+
+/* Removes the least recently used covers until the cache fits its size limit */
+static void evict()
+{
+    const qint64 max_size = qint64(config::cover_cache_size) * 1024 * 1024;
+    auto files = cache_dir().entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 total = 0;
+    for (const auto& f : std::as_const(files))
+        total += f.size();
+
+    for (const auto& f : std::as_const(files)) {
+        if (total <= max_size)
+            break;
+        total -= f.size();
+        QFile::remove(f.absoluteFilePath());
+    }
+}
+
+static void load_lookups()
+{
+    if (lookups_loaded)
+        return;
+    lookups_loaded = true;
+
+    QJsonDocument doc;
+    if (util::open_config(COVER_LOOKUP_FILE, doc) && doc.isObject())
+        lookups = doc.object();
+
+    /* Drop expired entries */
+    auto const now = util::epoch();
+    for (auto it = lookups.begin(); it != lookups.end();) {
+        if (it->toObject()["expires"].toDouble() < now)
+            it = lookups.erase(it);
+        else
+            ++it;
+    }
+}
+
+lookup_result find_url(const QString& key, QString& url)
+{
+    std::lock_guard<std::mutex> lock(lookup_mutex);
+    load_lookups();
+    auto const it = lookups.find(key);
+    if (it == lookups.end())
+        return LOOKUP_UNKNOWN;
+
+    auto const entry = it->toObject();
+    if (entry["expires"].toDouble() < util::epoch()) {
+        lookups.erase(it);
+        return LOOKUP_UNKNOWN;
+    }
+    url = entry["url"].toString();
+    return url.isEmpty() ? LOOKUP_NOT_FOUND : LOOKUP_FOUND;
+}
+
+void remember_url(const QString& key, const QString& url)
+{
+    std::lock_guard<std::mutex> lock(lookup_mutex);
+    load_lookups();
+    QJsonObject entry;
+    entry["url"] = url;
+    entry["expires"] = double(util::epoch() + (url.isEmpty() ? not_found_ttl : found_ttl));
+    lookups[key] = entry;
+    util::save_config(COVER_LOOKUP_FILE, QJsonDocument(lookups));
+}
+
+bool take_request_budget()
+{
+    static std::mutex budget_mutex;
+    static int64_t window_start = 0;
+    static int requests = 0;
+
+    std::lock_guard<std::mutex> lock(budget_mutex);
+    auto const now = util::epoch();
+    if (now - window_start >= 60) {
+        window_start = now;
+        requests = 0;
+    }
+    if (requests >= max_requests_per_minute)
+        return false;
+    requests++;
+    return true;
+}
+
+QString album_key(const song& s)
+{
+    return "album:" + s.get<QStringList>(meta::ARTIST).join(", ") + "\n" + s.get(meta::ALBUM);
+}
+
+bool fetch(const QString& key, const QString& target)
+{
+    if (config::cover_cache_size == 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    QFile cached(file_for(key));
+    metrics::cover_cache_lookup(cached.exists());
+    if (!cached.exists())
+        return false;
+
+    QFile::remove(target);
+    if (!cached.copy(target))
+        return false;
+    /* The modification time doubles as the last use for eviction */
+    if (cached.open(QIODevice::ReadWrite))
+        cached.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    bdebug("Using cached cover for %s", qt_to_utf8(key));
+    return true;
+}
+
+bool contains(const QString& key)
+{
+    if (config::cover_cache_size == 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return QFile::exists(file_for(key));
+}
+
+void store(const QString& key, const QString& file)
+{
+    if (config::cover_cache_size == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto path = file_for(key);
+    QFile::remove(path);
+    if (!QFile::copy(file, path)) {
+        berr("Couldn't add cover to the cache");
+        return;
+    }
+    evict();
+}
+}
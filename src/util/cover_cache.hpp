@@ -0,0 +1,56 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QString>
+
+class song;
+
+/* Persistent cover cache in the plugin config folder. Covers are stored
+ * under a hash of their key (cover url or artist + album) and the least
+ * recently used ones are removed once the cache grows past config::cover_cache_size */
+namespace cover_cache {
+
+/* Key for covers looked up by artist and album instead of an url */
+QString album_key(const song& s);
+
+/* Copies the cached cover for key to target, returns false if there's none */
+bool fetch(const QString& key, const QString& target);
+
+bool contains(const QString& key);
+
+/* Adds a copy of file to the cache */
+void store(const QString& key, const QString& file);
+
+/* Remembered results of cover searches (e.g. iTunes), so that neither
+ * found nor missing covers are searched for again for a while */
+enum lookup_result {
+    LOOKUP_UNKNOWN,
+    LOOKUP_FOUND,
+    LOOKUP_NOT_FOUND
+};
+
+lookup_result find_url(const QString& key, QString& url);
+
+/* An empty url remembers that there's no cover */
+void remember_url(const QString& key, const QString& url);
+
+/* Limits how many searches can be sent per minute, returns false if
+ * the limit is reached and the search should be skipped */
+bool take_request_budget();
+}
@@ -0,0 +1,264 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "cover_image.hpp"
+#include "config.hpp"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+namespace cover_image {
+
+/* Scaled versions are requested with arbitrary sizes, so only keep a few */
+static const size_t max_variants = 4;
+
+static std::mutex mutex;
+static QString cover_path;
+static QDateTime cover_modified;
+static qint64 cover_size = -1;
+static std::shared_ptr<const image> original;
+struct variant {
+    std::shared_ptr<const image> img;
+    uint64_t last_use;
+};
+/* The least recently used variant is dropped once there are too many */
+static std::map<int, variant> variants;
+static uint64_t variant_uses = 0;
+/* Set while a cover is published by reference instead of config::cover_path */
+static QString reference;
+static bool in_memory = false;
+
+static std::atomic<uint64_t> changes { 0 };
+static std::condition_variable changed_cv;
+
+const char* sniff_mime(const QByteArray& data)
+{
+    if (data.startsWith("\x89PNG"))
+        return "image/png";
+    if (data.startsWith("\xFF\xD8\xFF"))
+        return "image/jpeg";
+    if (data.startsWith("GIF8"))
+        return "image/gif";
+    if (data.startsWith("RIFF") && data.mid(8, 4) == "WEBP")
+        return "image/webp";
+    if (data.startsWith("BM"))
+        return "image/bmp";
+    return "application/octet-stream";
+}
+
+bool normalize(QByteArray& data)
+{
+    if (!config::cover_normalize || config::cover_size == 0)
+        return false;
+
+    auto const suffix = QFileInfo(config::cover_path).suffix().toLower();
+    bool const jpeg = suffix == "jpg" || suffix == "jpeg";
+    QBuffer in(&data);
+    in.open(QIODevice::ReadOnly);
+    QImageReader reader(&in);
+    auto const size = reader.size();
+    if (!size.isValid())
+        return false;
+
+    int const max_size = config::cover_size;
+    bool const fits = size.width() <= max_size && size.height() <= max_size;
+    if (fits && strcmp(sniff_mime(data), jpeg ? "image/jpeg" : "image/png") == 0)
+        return false;
+    /* Lets the JPEG decoder skip most of the work for large covers */
+    if (!fits)
+        reader.setScaledSize(size.scaled(max_size, max_size, Qt::KeepAspectRatio));
+
+    auto const img = reader.read();
+    if (img.isNull())
+        return false;
+    QByteArray out;
+    QBuffer buf(&out);
+    buf.open(QIODevice::WriteOnly);
+    if (!img.save(&buf, jpeg ? "JPG" : "PNG", jpeg ? 90 : -1))
+        return false;
+    data = out;
+    return true;
+}
+
+/* Decoding and encoding happen here, so this is never called with the mutex held */
+static std::shared_ptr<const image> make_image(const QByteArray& data)
+{
+    auto img = std::make_shared<image>();
+    img->data = data;
+    img->mime = sniff_mime(data);
+    img->etag = "\"" + QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex().toStdString() + "\"";
+    return img;
+}
+
+static void replace(std::shared_ptr<const image> img, const QFileInfo& info)
+{
+    original = std::move(img);
+    variants.clear();
+
+    cover_path = info.filePath();
+    cover_modified = info.lastModified();
+    cover_size = info.size();
+}
+
+/* Reads the cover file again if it changed, the lock is released meanwhile */
+static bool reload(std::unique_lock<std::mutex>& lock)
+{
+    if (in_memory)
+        return original != nullptr;
+
+    QFileInfo info(reference.isEmpty() ? config::cover_path : reference);
+    if (!info.exists()) {
+        original = nullptr;
+        variants.clear();
+        return false;
+    }
+    if (original && info.filePath() == cover_path && info.lastModified() == cover_modified && info.size() == cover_size)
+        return true;
+
+    auto const generation = changes.load();
+    lock.unlock();
+    std::shared_ptr<const image> img;
+    QFile f(info.filePath());
+    if (f.open(QIODevice::ReadOnly)) {
+        auto data = f.readAll();
+        /* Covers read by reference haven't been normalized yet */
+        normalize(data);
+        img = make_image(data);
+    }
+    lock.lock();
+
+    /* Whatever was set meanwhile is newer than what we just read */
+    if (changes != generation)
+        return original != nullptr;
+    if (!img)
+        return false;
+    replace(std::move(img), info);
+    return true;
+}
+
+static std::shared_ptr<const image> scale(const std::shared_ptr<const image>& from, int max_size)
+{
+    QImage src;
+    if (!src.loadFromData(from->data))
+        return from;
+    if (src.width() <= max_size && src.height() <= max_size)
+        return from;
+
+    /* JPEGs stay JPEGs, everything else might have transparency */
+    bool jpeg = strcmp(from->mime, "image/jpeg") == 0;
+    auto img = std::make_shared<image>();
+    QBuffer buf(&img->data);
+    buf.open(QIODevice::WriteOnly);
+    src.scaled(max_size, max_size, Qt::KeepAspectRatio, Qt::SmoothTransformation).save(&buf, jpeg ? "JPG" : "PNG", jpeg ? 90 : -1);
+    img->mime = jpeg ? "image/jpeg" : "image/png";
+    img->etag = from->etag.substr(0, from->etag.size() - 1) + "-" + std::to_string(max_size) + "\"";
+    return img;
+}
+
+std::shared_ptr<const image> get(int max_size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!reload(lock))
+        return nullptr;
+    if (max_size <= 0)
+        return original;
+
+    auto it = variants.find(max_size);
+    if (it != variants.end()) {
+        it->second.last_use = ++variant_uses;
+        return it->second.img;
+    }
+
+    /* Scaled without the lock, so other requests and the cover source aren't blocked */
+    auto const from = original;
+    lock.unlock();
+    auto img = scale(from, max_size);
+    lock.lock();
+
+    /* The cover was replaced meanwhile, don't keep a variant of the old one */
+    if (original != from)
+        return img;
+    if (variants.size() >= max_variants && !variants.count(max_size)) {
+        auto oldest = std::min_element(variants.begin(), variants.end(), [](auto const& a, auto const& b) {
+            return a.second.last_use < b.second.last_use;
+        });
+        variants.erase(oldest);
+    }
+    variants[max_size] = { img, ++variant_uses };
+    return img;
+}
+
+void set(const QByteArray& data, const QString& path)
+{
+    /* The data was already normalized by whoever wrote it */
+    auto img = make_image(data);
+    const QFileInfo info(path);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reference.clear();
+        in_memory = path.isEmpty();
+        replace(std::move(img), info);
+        changes++;
+    }
+    changed_cv.notify_all();
+}
+
+void set_reference(const QString& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reference = path;
+        in_memory = false;
+        changes++;
+    }
+    changed_cv.notify_all();
+}
+
+void clear_reference()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reference.clear();
+        in_memory = false;
+        changes++;
+    }
+    changed_cv.notify_all();
+}
+
+uint64_t generation()
+{
+    return changes;
+}
+
+uint64_t wait_for_change(uint64_t generation, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed_cv.wait_for(lock, timeout, [generation] { return changes != generation; });
+    return changes;
+}
+}
@@ -0,0 +1,65 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QByteArray>
+#include <QString>
+#include <chrono>
+#include <memory>
+#include <string>
+
+/* Keeps the current cover in memory for the web server, so it's only
+ * read and encoded once per track instead of once per request */
+namespace cover_image {
+struct image {
+    QByteArray data;
+    const char* mime;
+    std::string etag;
+};
+
+/* Returns the cover, scaled down so that neither side is larger than max_size
+ * if max_size is greater than zero. The cover file is only read again once it
+ * changed, scaled versions are kept until the next cover.
+ * Returns nullptr if there's no cover */
+std::shared_ptr<const image> get(int max_size = 0);
+
+/* Replaces the cached cover with data that was just written to path, the
+ * data has to be normalized already. An empty path keeps the cover in memory only */
+void set(const QByteArray& data, const QString& path);
+
+/* Serves the cover from path instead of config::cover_path */
+void set_reference(const QString& path);
+
+/* Goes back to serving config::cover_path */
+void clear_reference();
+
+/* Scales data down to config::cover_size and re-encodes it in the format
+ * of config::cover_path if config::cover_normalize is set. Only the header
+ * is read if the image already fits. Returns true if data was replaced */
+bool normalize(QByteArray& data);
+
+/* Incremented whenever a new cover was set or the cover file might have been replaced */
+uint64_t generation();
+
+/* Blocks until the generation differs from the given one or the timeout
+ * ran out, returns the current generation either way */
+uint64_t wait_for_change(uint64_t generation, std::chrono::milliseconds timeout);
+
+/* Guesses the content type from the first few bytes */
+const char* sniff_mime(const QByteArray& data);
+}
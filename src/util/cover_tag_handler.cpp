@@ -24,11 +24,17 @@
 #include "cover_tag_handler.hpp"
 #include "../query/song.hpp"
 #include "config.hpp"
+#include "cover_image.hpp"
+#include "embedded_tags.hpp"
+#include "media_thread.hpp"
 #include "utility.hpp"
+#include <QDateTime>
 #include <QDir>
 #include <QDirIterator>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
 #include <taglib/apefile.h>
 #include <taglib/apeitem.h>
 #include <taglib/apetag.h>
@@ -44,26 +50,49 @@
 #include <taglib/opusfile.h>
 #include <taglib/tlist.h>
 #include <taglib/tmap.h>
+#include <mutex>
 
 namespace cover {
 
-bool write_bytes_to_file(const TagLib::ByteVector& data)
+bool write_bytes_to_file(const QByteArray& original)
 {
-    if (data.isEmpty())
+    if (original.isEmpty())
+        return false;
+    auto data = original;
+    cover_image::normalize(data);
+    if (!util::cover_file_needed()) {
+        if (media_thread::cancelled())
+            return false;
+        QFile::remove(config::cover_path);
+        cover_image::set(data, {});
+        return true;
+    }
+    /* QSaveFile writes to a temporary file and only replaces the cover
+     * on commit, so nobody ever reads a half written image */
+    QSaveFile f(config::cover_path);
+    if (!f.open(QIODevice::WriteOnly))
+        return false;
+    if (f.write(data) != data.size() || media_thread::cancelled()) {
+        f.cancelWriting();
+        f.commit();
         return false;
-    QFile f(config::cover_path);
-    bool success = true;
-    if (f.open(QIODevice::WriteOnly)) {
-        success = f.write(data.data(), data.size()) == data.size();
-        f.close();
-    } else {
-        success = false;
     }
+    if (!f.commit())
+        return false;
+    /* Saves the web server from reading the cover we just wrote */
+    cover_image::set(data, config::cover_path);
+    return true;
+}
 
-    return success;
+static bool to_bytes(const TagLib::ByteVector& data, QByteArray& out)
+{
+    if (data.isEmpty())
+        return false;
+    out = QByteArray(data.data(), int(data.size()));
+    return true;
 }
 
-bool extract_ape(TagLib::APE::Tag* tag)
+static bool extract_ape(TagLib::APE::Tag* tag, QByteArray& out)
 {
     const TagLib::APE::ItemListMap& listMap = tag->itemListMap();
     if (listMap.contains("COVER ART (FRONT)")) {
@@ -72,24 +101,24 @@ bool extract_ape(TagLib::APE::Tag* tag)
         const int pos = item.find(nullStringTerminator); // Skip the filename.
         if (pos != -1) {
             const TagLib::ByteVector& pic = item.mid(pos + 1);
-            return write_bytes_to_file(pic);
+            return to_bytes(pic, out);
         }
     }
 
     return false;
 }
 
-bool extract_id3(TagLib::ID3v2::Tag* tag)
+static bool extract_id3(TagLib::ID3v2::Tag* tag, QByteArray& out)
 {
     const TagLib::ID3v2::FrameList& frameList = tag->frameList("APIC");
     if (!frameList.isEmpty()) {
         const auto* frame = (TagLib::ID3v2::AttachedPictureFrame*)frameList.front();
-        return write_bytes_to_file(frame->picture());
+        return to_bytes(frame->picture(), out);
     }
     return false;
 }
 
-bool extract_asf(TagLib::ASF::File* file)
+static bool extract_asf(TagLib::ASF::File* file, QByteArray& out)
 {
     const TagLib::ASF::AttributeListMap& attrListMap = file->tag()->attributeListMap();
     if (attrListMap.contains("WM/Picture")) {
@@ -98,7 +127,7 @@ bool extract_asf(TagLib::ASF::File* file)
             // Let's grab the first cover. TODO: Check/loop for correct type.
             const TagLib::ASF::Picture& wmpic = attrList[0].toPicture();
             if (wmpic.isValid()) {
-                return write_bytes_to_file(wmpic.picture());
+                return to_bytes(wmpic.picture(), out);
             }
         }
     }
@@ -106,19 +135,19 @@ bool extract_asf(TagLib::ASF::File* file)
     return false;
 }
 
-bool extract_flac(TagLib::FLAC::File* file)
+static bool extract_flac(TagLib::FLAC::File* file, QByteArray& out)
 {
     const TagLib::List<TagLib::FLAC::Picture*>& picList = file->pictureList();
     if (!picList.isEmpty()) {
         // Just grab the first image.
         const TagLib::FLAC::Picture* pic = picList[0];
-        return write_bytes_to_file(pic->data());
+        return to_bytes(pic->data(), out);
     }
 
     return false;
 }
 
-bool extract_mp4(TagLib::MP4::File* file)
+static bool extract_mp4(TagLib::MP4::File* file, QByteArray& out)
 {
     TagLib::MP4::Tag* tag = file->tag();
     const TagLib::MP4::ItemMap& itemListMap = tag->itemMap();
@@ -126,51 +155,51 @@ bool extract_mp4(TagLib::MP4::File* file)
         const TagLib::MP4::CoverArtList& coverArtList = itemListMap["covr"].toCoverArtList();
         if (!coverArtList.isEmpty()) {
             const TagLib::MP4::CoverArt* pic = &(coverArtList.front());
-            return write_bytes_to_file(pic->data());
+            return to_bytes(pic->data(), out);
         }
     }
 
     return false;
 }
 
-bool extract_opus(TagLib::Ogg::Opus::File* file)
+static bool extract_opus(TagLib::Ogg::Opus::File* file, QByteArray& out)
 {
     auto* tag = file->tag();
     auto pictures = tag->pictureList();
     if (!pictures.isEmpty()) {
         /* I'll just assume that the last image is the one with the biggest size */
-        return write_bytes_to_file(pictures[pictures.size() - 1]->data());
+        return to_bytes(pictures[pictures.size() - 1]->data(), out);
     }
     return false;
 }
 
-bool get_embedded(TagLib::FileRef fr)
+bool extract_embedded(const TagLib::FileRef& fr, QByteArray& out)
 {
     bool found = false;
 
     if (TagLib::MPEG::File* mpeg = dynamic_cast<TagLib::MPEG::File*>(fr.file())) {
         if (mpeg->hasID3v2Tag()) {
-            found = extract_id3(mpeg->ID3v2Tag());
+            found = extract_id3(mpeg->ID3v2Tag(), out);
         } else if (mpeg->hasAPETag()) {
-            found = extract_ape(mpeg->APETag());
+            found = extract_ape(mpeg->APETag(), out);
         }
     } else if (TagLib::FLAC::File* flac = dynamic_cast<TagLib::FLAC::File*>(fr.file())) {
-        found = extract_flac(flac);
+        found = extract_flac(flac, out);
         if (!found && flac->ID3v2Tag())
-            found = extract_id3(flac->ID3v2Tag());
+            found = extract_id3(flac->ID3v2Tag(), out);
     } else if (TagLib::MP4::File* mp4 = dynamic_cast<TagLib::MP4::File*>(fr.file())) {
-        found = extract_mp4(mp4);
+        found = extract_mp4(mp4, out);
     } else if (TagLib::ASF::File* asf = dynamic_cast<TagLib::ASF::File*>(fr.file())) {
-        found = extract_asf(asf);
+        found = extract_asf(asf, out);
     } else if (TagLib::APE::File* ape = dynamic_cast<TagLib::APE::File*>(fr.file())) {
         if (ape->APETag())
-            found = extract_ape(ape->APETag());
+            found = extract_ape(ape->APETag(), out);
     } else if (TagLib::MPC::File* mpc = dynamic_cast<TagLib::MPC::File*>(fr.file())) {
         if (mpc->APETag())
-            found = extract_ape(mpc->APETag());
+            found = extract_ape(mpc->APETag(), out);
     } else if (TagLib::Ogg::Opus::File* ogg = dynamic_cast<TagLib::Ogg::Opus::File*>(fr.file())) {
         if (ogg->tag())
-            found = extract_opus(ogg);
+            found = extract_opus(ogg, out);
     }
 
     return found;
@@ -178,21 +207,11 @@ bool get_embedded(TagLib::FileRef fr)
 
 bool find_embedded_cover(const QString& path)
 {
-    bool result = false;
-#ifdef _WIN32
-    // Windoze can't into utf8
-    const auto wstr = path.toStdWString();
-    const TagLib::FileRef fr(wstr.c_str(), false);
-#else
-    const TagLib::FileRef fr(qt_to_utf8(path), false);
-#endif
-
-    if (!fr.isNull())
-        result = get_embedded(fr);
-    return result;
+    auto const tags = embedded_tags::read(path);
+    return tags && write_bytes_to_file(tags->cover);
 }
 
-bool find_local_cover(const QString& folder, QString& out)
+static bool scan_local_cover(const QString& folder, QString& out)
 {
     static QStringList exts = { "*.jpg", "*.jpeg", "*.png", "*.bmp" };
     QList<QString> OtherFiles;
@@ -227,6 +246,43 @@ bool find_local_cover(const QString& folder, QString& out)
     return false;
 }
 
+bool find_local_cover(const QString& folder, QString& out)
+{
+    /* Tracks of an album usually share a folder, so the scan result is kept
+     * until files in the folder are added, removed or renamed, which changes
+     * its modification time */
+    struct scan {
+        QDateTime modified;
+        QString cover;
+    };
+    static std::mutex mutex;
+    static QHash<QString, scan> scans;
+
+    auto const modified = QFileInfo(folder).lastModified();
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = scans.find(folder);
+    if (it == scans.end() || it->modified != modified) {
+        if (scans.size() > 256)
+            scans.clear();
+        QString cover;
+        scan_local_cover(folder, cover);
+        it = scans.insert(folder, { modified, cover });
+    }
+    out = it->cover;
+    return !out.isEmpty();
+}
+
+void prefetch(const QString& path)
+{
+    auto const tags = embedded_tags::read(path);
+    if (tags && !tags->cover.isEmpty())
+        return;
+
+    QString folder = path, cover;
+    get_file_folder(folder);
+    find_local_cover(folder, cover);
+}
+
 void get_file_folder(QString& path)
 {
     QFileInfo fi(path);
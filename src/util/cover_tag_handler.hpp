@@ -17,15 +17,29 @@
  *************************************************************************/
 
 #pragma once
+#include <QByteArray>
 #include <QString>
 
+namespace TagLib {
+class FileRef;
+}
+
 namespace cover {
+/* Copies the first embedded picture of the file into out */
+extern bool extract_embedded(const TagLib::FileRef& fr, QByteArray& out);
+
+/* Replaces the cover file with the image data */
+extern bool write_bytes_to_file(const QByteArray& data);
+
 /* Tries to get the song embbeded in the file */
 extern bool find_embedded_cover(const QString& path);
 
 /* Tries to find the cover in the folder that the file is located in */
 extern bool find_local_cover(const QString& path, QString& cover_out);
 
+/* Reads the embedded or local cover of an upcoming track into the caches */
+extern void prefetch(const QString& path);
+
 /* Turns /home/usr/file.flac into /home/usr/ */
 extern void get_file_folder(QString& path);
 }
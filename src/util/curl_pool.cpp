@@ -0,0 +1,103 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "curl_pool.hpp"
+#include <mutex>
+#include <vector>
+
+namespace curl_pool {
+
+/* More idle handles than this per thread are never needed */
+static const size_t max_idle_handles = 4;
+
+static std::mutex share_mutexes[CURL_LOCK_DATA_LAST];
+
+static void lock_share(CURL*, curl_lock_data data, curl_lock_access, void*)
+{
+    share_mutexes[data].lock();
+}
+
+static void unlock_share(CURL*, curl_lock_data data, void*)
+{
+    share_mutexes[data].unlock();
+}
+
+static CURLSH* create_share()
+{
+    auto* share = curl_share_init();
+    if (!share)
+        return nullptr;
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_share);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    /* Sharing connections between threads only became safe in 7.87.0,
+     * before that each handle keeps its own connection cache */
+#if LIBCURL_VERSION_NUM >= 0x075700
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    return share;
+}
+
+static CURLSH* shared()
+{
+    /* Never cleaned up, handles on other threads may outlive any static */
+    static CURLSH* share = create_share();
+    return share;
+}
+
+struct idle_handles {
+    std::vector<CURL*> handles;
+
+    ~idle_handles()
+    {
+        for (auto* curl : handles)
+            curl_easy_cleanup(curl);
+    }
+};
+
+static thread_local idle_handles idle;
+
+handle::handle()
+{
+    if (idle.handles.empty()) {
+        m_curl = curl_easy_init();
+    } else {
+        m_curl = idle.handles.back();
+        idle.handles.pop_back();
+    }
+
+    if (m_curl) {
+        curl_easy_setopt(m_curl, CURLOPT_SHARE, shared());
+        curl_easy_setopt(m_curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(m_curl, CURLOPT_NOSIGNAL, 1L);
+    }
+}
+
+handle::~handle()
+{
+    if (!m_curl)
+        return;
+    /* Resetting keeps the open connections of the handle */
+    curl_easy_reset(m_curl);
+    if (idle.handles.size() < max_idle_handles)
+        idle.handles.push_back(m_curl);
+    else
+        curl_easy_cleanup(m_curl);
+}
+}
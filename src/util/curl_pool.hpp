@@ -0,0 +1,42 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <curl/curl.h>
+
+/* Reuses curl handles per thread and shares the DNS cache and TLS sessions
+ * between all of them, so repeated requests to the same host skip the lookup
+ * and most of the handshake. Open connections are shared too on libcurl 7.87
+ * and newer */
+namespace curl_pool {
+
+/* Takes a reset handle from the calling thread's pool, or creates one,
+ * and gives it back once it goes out of scope */
+class handle {
+    CURL* m_curl;
+
+public:
+    handle();
+    ~handle();
+    handle(const handle&) = delete;
+    handle& operator=(const handle&) = delete;
+
+    CURL* get() const { return m_curl; }
+    operator CURL*() const { return m_curl; }
+};
+}
@@ -0,0 +1,94 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "embedded_tags.hpp"
+#include "cover_tag_handler.hpp"
+#include "lyrics_handler.hpp"
+#include "utility.hpp"
+#include <QDateTime>
+#include <QFileInfo>
+#include <list>
+#include <mutex>
+#include <taglib/fileref.h>
+
+namespace embedded_tags {
+
+/* Covers are a few MB at most, this fits a couple of albums */
+static const qint64 max_cache_size = 32 * 1024 * 1024;
+
+struct entry {
+    QString path;
+    QDateTime modified;
+    qint64 size;
+    std::shared_ptr<const tags> data;
+};
+
+static std::mutex mutex;
+/* Most recently used first */
+static std::list<entry> cache;
+static qint64 cache_size = 0;
+
+static std::shared_ptr<const tags> parse(const QString& path)
+{
+#ifdef _WIN32
+    // Windoze can't into utf8
+    const auto wstr = path.toStdWString();
+    const TagLib::FileRef fr(wstr.c_str(), false);
+#else
+    const TagLib::FileRef fr(qt_to_utf8(path), false);
+#endif
+    if (fr.isNull())
+        return nullptr;
+
+    auto result = std::make_shared<tags>();
+    cover::extract_embedded(fr, result->cover);
+    lyrics::extract_embedded(fr, result->lyrics);
+    return result;
+}
+
+std::shared_ptr<const tags> read(const QString& path)
+{
+    QFileInfo info(path);
+    /* Held while parsing, so the cover and lyrics jobs of a track share one parse */
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->path != path)
+            continue;
+        if (it->modified == info.lastModified() && it->size == info.size()) {
+            cache.splice(cache.begin(), cache, it);
+            return it->data;
+        }
+        /* The file changed since it was read */
+        cache_size -= it->data->cover.size();
+        cache.erase(it);
+        break;
+    }
+
+    auto data = parse(path);
+    if (!data)
+        return nullptr;
+
+    cache.push_front({ path, info.lastModified(), info.size(), data });
+    cache_size += data->cover.size();
+    while (cache.size() > 1 && cache_size > max_cache_size) {
+        cache_size -= cache.back().data->cover.size();
+        cache.pop_back();
+    }
+    return data;
+}
+}
@@ -0,0 +1,36 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QByteArray>
+#include <QString>
+#include <memory>
+
+/* Reads cover and lyrics of a local file in one pass and remembers them,
+ * so replaying a file doesn't parse its tags again */
+namespace embedded_tags {
+struct tags {
+    QByteArray cover;
+    QString lyrics;
+};
+
+/* Returns the embedded cover and lyrics of the file, either of them can
+ * be empty. Cached by path, size and modification time.
+ * Returns nullptr if the file couldn't be parsed */
+std::shared_ptr<const tags> read(const QString& path);
+}
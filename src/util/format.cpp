@@ -20,33 +20,71 @@
 #include "../query/music_source.hpp"
 #include "../query/song.hpp"
 #include "../util/config.hpp"
+#include "../util/history.hpp"
+#include "../util/synced_lyrics.hpp"
 #include "../util/tuna_thread.hpp"
+#include <QHash>
 #include <QJsonDocument>
-#include <QLocale>
+#include <algorithm>
+#include <util/platform.h>
 
 namespace format {
 
 std::vector<std::unique_ptr<specifier>> specifiers;
+/* Specifiers by id, built once all of them are registered */
+static QHash<QString, const specifier*> specifier_index;
 
 const specifier* get_specifier_by_id(QString const& id, bool& upper)
 {
-    for (const auto& s : specifiers) {
-        if (s->get_id() == id.toLower()) {
-            upper = id == s->get_id().toUpper();
-            return s.get();
-        }
-    }
-    return nullptr;
+    const auto lower = id.toLower();
+    const auto* s = specifier_index.value(lower, nullptr);
+    if (s)
+        upper = id == s->get_id().toUpper();
+    return s;
 }
 
+/* m:ss or h:mm:ss, written directly since every output calls this on every tick */
 QString time_format(int32_t ms)
 {
-    int secs = (ms / 1000) % 60;
-    int minute = (ms / 1000) / 60 % 60;
-    int hour = (ms / 1000) / 60 / 60 % 60;
-    QTime t(hour, minute, secs);
+    int total = std::max(ms, 0) / 1000;
+    int secs = total % 60;
+    int minute = total / 60 % 60;
+    int hour = total / 3600;
+
+    QChar buf[16];
+    int len = 0;
+    auto digits = [&](int value, bool pad) {
+        QChar tmp[10];
+        int n = 0;
+        do {
+            tmp[n++] = QChar('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+        if (pad && n < 2)
+            tmp[n++] = QChar('0');
+        while (n > 0)
+            buf[len++] = tmp[--n];
+    };
 
-    return t.toString(hour > 0 ? "h:mm:ss" : "m:ss");
+    if (hour > 0) {
+        digits(hour, false);
+        buf[len++] = QChar(':');
+    }
+    digits(minute, hour > 0);
+    buf[len++] = QChar(':');
+    digits(secs, true);
+    return QString(buf, len);
+}
+
+/* The published progress is only as recent as the last refresh, which can be
+ * a few seconds ago in the middle of a track, so it's moved on to now */
+static int lyrics_progress(song const& s)
+{
+    auto const progress = s.get<int>(meta::PROGRESS);
+    auto const t = tuna_thread::timing();
+    if (t.progress != progress || t.duration != s.get<int>(meta::DURATION))
+        return progress; /* Not the published song */
+    return t.progress_at(os_gettime_ns());
 }
 
 void init()
@@ -90,23 +128,25 @@ void init()
         auto year = s.has(meta::RELEASE_YEAR);
 
         if (day && month && year) {
-            QDate d;
-            d.setDate(s.get<int>(meta::RELEASE_YEAR), s.get<int>(meta::RELEASE_MONTH), s.get<int>(meta::RELEASE_DAY));
-            return QLocale::system().toString(d, QLocale::ShortFormat);
+            return util::short_date(s.get<int>(meta::RELEASE_YEAR), s.get<int>(meta::RELEASE_MONTH), s.get<int>(meta::RELEASE_DAY));
         } else if (month && year) {
-            return QString("%1.%2").arg(s.get<int>(meta::RELEASE_YEAR), s.get<int>(meta::RELEASE_MONTH));
+            return QString::number(s.get<int>(meta::RELEASE_YEAR)) + "." + QString::number(s.get<int>(meta::RELEASE_MONTH));
         } else if (year) {
             return QString::number(s.get<int>(meta::RELEASE_YEAR));
         }
         return "";
     }));
 
-    specifiers.emplace_back(new static_specifier("time", [](song const& s) {
-        return s.get(meta::PLAYBACK_TIME);
-    }));
-    specifiers.emplace_back(new static_specifier("date", [](song const& s) {
-        return s.get(meta::PLAYBACK_DATE);
-    }));
+    specifiers.emplace_back(new static_specifier(
+        "time", [](song const& s) {
+            return s.get(meta::PLAYBACK_TIME);
+        },
+        meta::mask(meta::bit(meta::PLAYBACK_TIME))));
+    specifiers.emplace_back(new static_specifier(
+        "date", [](song const& s) {
+            return s.get(meta::PLAYBACK_DATE);
+        },
+        meta::mask(meta::bit(meta::PLAYBACK_DATE))));
 
     specifiers.emplace_back(new specifier("first_artist", meta::ARTIST, [](song const& s) -> QString {
         auto l = s.get<QStringList>(meta::ARTIST);
@@ -120,18 +160,58 @@ void init()
     specifiers.emplace_back(new static_specifier("line_break", [](song const&) -> QString {
         return "\n";
     }));
-    specifiers.emplace_back(new static_specifier("json_compact", [](song const& s) -> QString {
-        QJsonObject obj;
-        s.to_json(obj);
-        QJsonDocument doc(obj);
-        return QString(doc.toJson(QJsonDocument::Compact));
-    }));
-    specifiers.emplace_back(new static_specifier("json_formatted", [](song const& s) -> QString {
-        QJsonObject obj;
-        s.to_json(obj);
-        QJsonDocument doc(obj);
-        return QString(doc.toJson(QJsonDocument::Indented));
-    }));
+    /* Timed lyrics, the line changes with the progress */
+    specifiers.emplace_back(new timed_specifier(
+        "lyrics_line", [](song const& s) {
+            return synced_lyrics::at(lyrics_progress(s)).line;
+        },
+        meta::mask(meta::bit(meta::PROGRESS))));
+    specifiers.emplace_back(new timed_specifier(
+        "lyrics_next", [](song const& s) {
+            return synced_lyrics::at(lyrics_progress(s)).next;
+        },
+        meta::mask(meta::bit(meta::PROGRESS))));
+    /* The track that was played before the current one */
+    static const meta::mask track_fields(meta::bit(meta::TITLE) | meta::bit(meta::ARTIST) | meta::bit(meta::ALBUM) | meta::bit(meta::STATUS));
+    specifiers.emplace_back(new static_specifier(
+        "prev_title", [](song const& s) {
+            return history::previous(s).title;
+        },
+        track_fields));
+    specifiers.emplace_back(new static_specifier(
+        "prev_artist", [](song const& s) {
+            return history::previous(s).artists.join(", ");
+        },
+        track_fields));
+    specifiers.emplace_back(new static_specifier(
+        "prev_album", [](song const& s) {
+            return history::previous(s).album;
+        },
+        track_fields));
+    /* These contain every field. If the song is the published snapshot
+     * its cached JSON is used instead of serializing it again */
+    specifiers.emplace_back(new static_specifier(
+        "json_compact", [](song const& s) -> QString {
+            const auto snap = tuna_thread::snapshot();
+            if (&snap->info == &s)
+                return QString::fromUtf8(snap->json(false));
+            QJsonObject obj;
+            s.to_json(obj);
+            QJsonDocument doc(obj);
+            return QString(doc.toJson(QJsonDocument::Compact));
+        },
+        meta::mask().set()));
+    specifiers.emplace_back(new static_specifier(
+        "json_formatted", [](song const& s) -> QString {
+            const auto snap = tuna_thread::snapshot();
+            if (&snap->info == &s)
+                return QString::fromUtf8(snap->json(true));
+            QJsonObject obj;
+            s.to_json(obj);
+            QJsonDocument doc(obj);
+            return QString(doc.toJson(QJsonDocument::Indented));
+        },
+        meta::mask().set()));
 
     // Spotify
     specifiers.emplace_back(new specifier("playlist_url", meta::CONTEXT_URL));
@@ -156,86 +236,146 @@ void init()
     int_specifier("disc_total", meta::DISC_TOTAL);
     int_specifier("track_total", meta::TRACK_TOTAL);
 
-    std::sort(specifiers.begin(), specifiers.end(), [](auto const& a, auto const& b) {
-        return a->get_id()[0] < b->get_id()[0];
-    });
+    specifier_index.clear();
+    specifier_index.reserve(int(specifiers.size()));
+    for (auto const& s : specifiers)
+        specifier_index.insert(s->get_id(), s.get());
 }
 
-bool execute(QString& q)
+compiled::compiled(QString const& format)
 {
-    auto src_ref = music_sources::selected_source();
-    auto copy = q;
-    auto result = true;
-    q = "";
-
-    auto handle_specifier = [&copy](QString::Iterator& it, int& truncate, bool& uppercase, bool& proper_formatting) -> specifier const* {
-        QString id = "";
+    QString literal;
+    auto flush_literal = [&] {
+        if (!literal.isEmpty()) {
+            token t;
+            t.literal = literal;
+            m_tokens.emplace_back(std::move(t));
+            literal.clear();
+        }
+    };
 
-        while (it != copy.end() && *it != '}' && *it != ':') {
-            id += *it;
+    auto it = format.begin();
+    const auto end = format.end();
+    while (it != end) {
+        if (*it == '\\') {
             ++it;
+            if (it == end)
+                break;
+            literal += *it++;
+            continue;
+        }
+
+        if (*it != '{') {
+            literal += *it++;
+            continue;
         }
 
-        if (*it == ':') {
+        ++it;
+        QString id, tr;
+        while (it != end && *it != '}' && *it != ':')
+            id += *it++;
+
+        if (it != end && *it == ':') {
             ++it;
-            QString tr = "";
-            while (it != copy.end() && *it != '}') {
-                tr += *it;
-                ++it;
+            while (it != end && *it != '}')
+                tr += *it++;
+        }
+
+        /* {player:NAME:field} and {player:NAME:field:truncate} */
+        QString player;
+        if (id.compare("player", Qt::CaseInsensitive) == 0) {
+            auto parts = tr.split(':');
+            if (parts.size() >= 2) {
+                player = parts[0];
+                id = parts[1];
+                tr = parts.size() > 2 ? parts[2] : QString();
             }
-            truncate = tr.toInt();
         }
 
-        if (*it == '}') {
-            proper_formatting = true;
-            return get_specifier_by_id(id, uppercase);
+        /* Unterminated specifiers like "{test" are just dropped */
+        if (it == end)
+            break;
+        ++it; /* Skip '}' */
+
+        token t;
+        t.spec = get_specifier_by_id(id, t.uppercase);
+        t.truncate = tr.toInt();
+        t.player = player;
+        if (t.spec) {
+            /* Other players change independently of the selected source */
+            m_timed |= t.spec->timed();
+            if (player.isEmpty()) {
+                m_dependencies |= t.spec->get_dependencies();
+            } else {
+                m_player_dependencies |= t.spec->get_dependencies();
+                m_uses_players = true;
+            }
+            flush_literal();
+            m_tokens.emplace_back(std::move(t));
+        } else {
+            // We only tell the user that the selected formatting specifier
+            // isn't supported if the formatting is correct eg. {test}
+            // but not with {test
+            m_unknown_specifier = true;
         }
-        return nullptr;
-    };
+    }
+    flush_literal();
 
-    for (auto it = copy.begin();; ++it) {
-        if (*it == '\\') {
-            ++it;
-            if (it == copy.end())
-                break;
-            q += *it;
+    /* The status of the selected source decides whether the placeholder is
+     * used instead, unless nothing of it is shown */
+    m_only_players = m_uses_players && m_dependencies.none();
+    if (!m_only_players)
+        m_dependencies.set(meta::STATUS);
+}
+
+bool compiled::render(song const& s, QString& out, music_source const* src) const
+{
+    bool result = !m_unknown_specifier;
+    out.clear();
+
+    for (auto const& t : m_tokens) {
+        if (!t.spec) {
+            out += t.literal;
             continue;
         }
 
-        if (*it == '{') {
-            ++it;
-            if (it == copy.end())
-                return result;
-            int truncate = 0;
-            bool uppercase = false;
-            bool formatting = false;
-            if (auto* spec = handle_specifier(it, truncate, uppercase, formatting)) {
-                auto data = spec->get_data(src_ref->song_info());
-                if (!src_ref->provides_metadata(spec->get_required_caps()))
-                    result = false;
-                if (truncate > 0 && data.length() > truncate) {
-                    data.truncate(truncate);
-                    data.append("...");
-                }
-                if (uppercase)
-                    data = data.toUpper();
-                q += data;
-            } else if (formatting) {
-                // We only tell the user that the selected formatting specifier
-                // isn't supported if the formatting is correct eg. {test}
-                // but not with {test
+        QString data;
+        if (t.player.isEmpty()) {
+            data = t.spec->get_data(s);
+            if (src && !src->provides_metadata(t.spec->get_required_caps()))
                 result = false;
-            }
         } else {
-            if (it != copy.end())
-                q += *it;
+            player_state p;
+            if (music_sources::find_player(t.player, p))
+                data = t.spec->get_data(p.info);
         }
-        if (it == copy.end())
-            return result;
+        if (t.truncate > 0 && data.length() > t.truncate) {
+            data.truncate(t.truncate);
+            data.append("...");
+        }
+        if (t.uppercase)
+            data = data.toUpper();
+        out += data;
     }
     return result;
 }
 
+std::shared_ptr<const compiled> compile(QString const& format)
+{
+    return std::make_shared<const compiled>(format);
+}
+
+bool execute(QString& q)
+{
+    auto src_ref = music_sources::selected_source();
+    if (!src_ref)
+        return false;
+    /* The published snapshot is immutable, so previews never race with the query thread */
+    const auto snap = tuna_thread::snapshot();
+    const compiled c(q);
+    return c.render(snap->info, q, src_ref.get());
+}
+
 const std::vector<std::unique_ptr<specifier>>& get_specifiers()
 {
     return specifiers;
@@ -25,10 +25,14 @@
 #include <vector>
 
 class song;
+class music_source;
 
 namespace format {
 
 void init();
+
+/* Formats the string with the published song information, returns false
+ * if the selected source doesn't provide all used specifiers */
 bool execute(QString& out);
 
 class specifier {
@@ -78,18 +82,89 @@ public:
 
     virtual bool for_encoding() const { return true; }
 
+    /* Uses the playback position extrapolated to now, so the result can
+     * change without the song changing */
+    virtual bool timed() const { return false; }
+
     std::vector<meta::type> const& get_required_caps() const { return m_required_caps; }
+
+    /* Fields that have to change for this specifier to produce a different result */
+    virtual meta::mask get_dependencies() const
+    {
+        meta::mask deps;
+        for (auto const& c : m_required_caps) {
+            if (c != meta::NONE)
+                deps.set(c);
+        }
+        return deps;
+    }
 };
 
 class static_specifier : public specifier {
+    meta::mask m_dependencies {};
+
 public:
-    static_specifier(const char* id, std::function<QString(const song&)> data_getter)
+    static_specifier(const char* id, std::function<QString(const song&)> data_getter, meta::mask deps = {})
         : specifier(id, meta::NONE, data_getter)
+        , m_dependencies(deps)
     {
     }
     bool for_encoding() const override { return false; }
+    meta::mask get_dependencies() const override { return m_dependencies; }
+};
+
+class timed_specifier : public static_specifier {
+public:
+    using static_specifier::static_specifier;
+    bool timed() const override { return true; }
 };
 
 extern const std::vector<std::unique_ptr<specifier>>& get_specifiers();
 
+/* A format string that was parsed once, so rendering only has
+ * to walk over the tokens instead of parsing it again */
+class compiled {
+    struct token {
+        QString literal {};                /* Inserted as is if there's no specifier */
+        const specifier* spec = nullptr;
+        QString player {};                 /* {player:NAME:title} reads the field of that player */
+        int truncate = 0;
+        bool uppercase = false;
+    };
+
+    std::vector<token> m_tokens {};
+    /* Set if the format contains a specifier that doesn't exist */
+    bool m_unknown_specifier = false;
+    /* All fields of the selected source used by the specifiers in this format */
+    meta::mask m_dependencies {};
+    /* Fields used by {player:...} specifiers */
+    meta::mask m_player_dependencies {};
+    bool m_uses_players = false, m_only_players = false;
+    bool m_timed = false;
+
+public:
+    explicit compiled(QString const& format);
+
+    /* Only if one of these fields changed the output has to be rendered again */
+    meta::mask const& dependencies() const { return m_dependencies; }
+
+    /* Has to be rendered again whenever a player changed, see music_sources::players_generation() */
+    bool uses_players() const { return m_uses_players; }
+
+    /* Other players keep playing on their own, so their progress moves on every tick */
+    bool follows_player_progress() const { return m_player_dependencies.test(meta::PROGRESS); }
+
+    /* Changes with the time that passes while playing, see specifier::timed() */
+    bool timed() const { return m_timed; }
+
+    /* Shows nothing of the selected source, so its status doesn't decide about the placeholder */
+    bool only_players() const { return m_only_players; }
+
+    /* Returns false if the format uses unknown specifiers or, if a source
+     * is given, specifiers that the source doesn't support */
+    bool render(song const& s, QString& out, music_source const* src = nullptr) const;
+};
+
+extern std::shared_ptr<const compiled> compile(QString const& format);
+
 }
@@ -0,0 +1,270 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "history.hpp"
+#include "constants.hpp"
+#include "utility.hpp"
+#include <QDateTime>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+namespace history {
+
+static const size_t max_entries = 200;
+/* The file is rewritten with only the entries in memory once it's this big */
+static const qint64 max_file_size = 512 * 1024;
+static const char magic[4] = { 'T', 'N', 'A', 'H' };
+static const uint32_t version = 1;
+
+static std::mutex mutex;
+/* Newest entry first */
+static std::deque<entry> entries;
+static QFile file;
+
+/* Record layout: u32 payload size, i64 played at, i32 duration and
+ * u16 length prefixed utf8 strings for title, artists (joined by \n),
+ * album and cover */
+static void put_string(QByteArray& out, const QString& str)
+{
+    auto utf8 = str.toUtf8().left(0xffff);
+    const auto len = uint16_t(utf8.size());
+    out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    out.append(utf8);
+}
+
+static bool get_string(const uchar*& p, const uchar* end, QString& out)
+{
+    uint16_t len;
+    if (end - p < qint64(sizeof(len)))
+        return false;
+    memcpy(&len, p, sizeof(len));
+    p += sizeof(len);
+    if (end - p < len)
+        return false;
+    out = QString::fromUtf8(reinterpret_cast<const char*>(p), len);
+    p += len;
+    return true;
+}
+
+static QByteArray serialize(const entry& e)
+{
+    QByteArray payload;
+    payload.append(reinterpret_cast<const char*>(&e.played_at), sizeof(e.played_at));
+    payload.append(reinterpret_cast<const char*>(&e.duration), sizeof(e.duration));
+    put_string(payload, e.title);
+    put_string(payload, e.artists.join("\n"));
+    put_string(payload, e.album);
+    put_string(payload, e.cover);
+
+    const auto size = uint32_t(payload.size());
+    return QByteArray(reinterpret_cast<const char*>(&size), sizeof(size)) + payload;
+}
+
+static bool deserialize(const uchar* p, const uchar* end, entry& e)
+{
+    if (end - p < qint64(sizeof(e.played_at) + sizeof(e.duration)))
+        return false;
+    memcpy(&e.played_at, p, sizeof(e.played_at));
+    p += sizeof(e.played_at);
+    memcpy(&e.duration, p, sizeof(e.duration));
+    p += sizeof(e.duration);
+
+    QString artists;
+    if (!get_string(p, end, e.title) || !get_string(p, end, artists) || !get_string(p, end, e.album) || !get_string(p, end, e.cover))
+        return false;
+    e.artists = artists.isEmpty() ? QStringList() : artists.split("\n");
+    return true;
+}
+
+static QByteArray header()
+{
+    return QByteArray(magic, sizeof(magic)) + QByteArray(reinterpret_cast<const char*>(&version), sizeof(version));
+}
+
+/* Reads all records from the mapped file, a truncated last record is ignored */
+static void read_file()
+{
+    const qint64 size = file.size();
+    const qint64 header_size = sizeof(magic) + sizeof(version);
+    if (size < header_size)
+        return;
+
+    uchar* data = file.map(0, size);
+    if (!data) {
+        berr("Couldn't map song history %s", qt_to_utf8(file.fileName()));
+        return;
+    }
+
+    uint32_t file_version = 0;
+    memcpy(&file_version, data + sizeof(magic), sizeof(file_version));
+    if (memcmp(data, magic, sizeof(magic)) != 0 || file_version != version) {
+        bwarn("Ignoring song history with unknown format %s", qt_to_utf8(file.fileName()));
+        file.unmap(data);
+        return;
+    }
+
+    const uchar* p = data + header_size;
+    const uchar* end = data + size;
+    while (end - p >= qint64(sizeof(uint32_t))) {
+        uint32_t record_size;
+        memcpy(&record_size, p, sizeof(record_size));
+        p += sizeof(record_size);
+        if (end - p < record_size)
+            break;
+        entry e;
+        if (deserialize(p, p + record_size, e)) {
+            entries.push_front(std::move(e));
+            if (entries.size() > max_entries)
+                entries.pop_back();
+        }
+        p += record_size;
+    }
+    file.unmap(data);
+}
+
+/* Rewrites the file with only the entries in memory */
+static void compact()
+{
+    file.close();
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        berr("Couldn't rewrite song history %s", qt_to_utf8(file.fileName()));
+        return;
+    }
+    QByteArray data = header();
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+        data += serialize(*it);
+    file.write(data);
+    file.close();
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        berr("Couldn't open song history %s", qt_to_utf8(file.fileName()));
+}
+
+void init()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    file.setFileName(util::get_config_file_path(HISTORY_FILE));
+    if (file.open(QIODevice::ReadOnly)) {
+        read_file();
+        file.close();
+    }
+
+    if (!file.exists() || file.size() == 0 || file.size() > max_file_size) {
+        compact();
+    } else if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        berr("Couldn't open song history %s", qt_to_utf8(file.fileName()));
+    }
+    bdebug("Loaded %i song history entries", int(entries.size()));
+}
+
+void close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    file.close();
+}
+
+static bool same_track(const entry& e, const song& s)
+{
+    return e.title == s.get(meta::TITLE) && e.artists == s.get<QStringList>(meta::ARTIST) && e.album == s.get(meta::ALBUM);
+}
+
+void add(const song& s, const meta::mask& changes)
+{
+    static const meta::mask track_fields = meta::mask(meta::bit(meta::TITLE) | meta::bit(meta::ARTIST) | meta::bit(meta::ALBUM) | meta::bit(meta::STATUS));
+    if ((changes & track_fields).none() || s.get<int>(meta::STATUS) != state_playing || s.get(meta::TITLE).isEmpty())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    /* Pausing and resuming doesn't count as playing the track again */
+    if (!entries.empty() && same_track(entries.front(), s))
+        return;
+
+    entry e;
+    e.played_at = QDateTime::currentMSecsSinceEpoch();
+    e.duration = s.get<int>(meta::DURATION);
+    e.title = s.get(meta::TITLE);
+    e.artists = s.get<QStringList>(meta::ARTIST);
+    e.album = s.get(meta::ALBUM);
+    e.cover = s.get(meta::COVER);
+    if (file.isOpen()) {
+        file.write(serialize(e));
+        file.flush();
+    }
+    entries.push_front(std::move(e));
+    if (entries.size() > max_entries)
+        entries.pop_back();
+    if (file.size() > max_file_size)
+        compact();
+}
+
+size_t size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+std::vector<entry> get(size_t offset, size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<entry> result;
+    for (size_t i = offset; i < entries.size() && result.size() < limit; i++)
+        result.push_back(entries[i]);
+    return result;
+}
+
+entry previous(const song& current)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto const& e : entries) {
+        if (!same_track(e, current))
+            return e;
+    }
+    return {};
+}
+
+QByteArray json(size_t offset, size_t limit)
+{
+    QJsonArray arr;
+    size_t total;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        total = entries.size();
+        for (size_t i = offset; i < entries.size() && size_t(arr.size()) < limit; i++) {
+            auto const& e = entries[i];
+            QJsonObject obj;
+            obj["played_at"] = qint64(e.played_at);
+            obj["duration"] = e.duration;
+            obj["title"] = e.title;
+            obj["artists"] = QJsonArray::fromStringList(e.artists);
+            obj["album"] = e.album;
+            obj["cover_url"] = e.cover;
+            arr.append(obj);
+        }
+    }
+    QJsonObject obj;
+    obj["total"] = qint64(total);
+    obj["offset"] = qint64(offset);
+    obj["entries"] = arr;
+    return QJsonDocument(obj).toJson(QJsonDocument::Compact);
+}
+}
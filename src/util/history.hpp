@@ -0,0 +1,55 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include "../query/song.hpp"
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+/* Recently played tracks, kept in memory and in a compact append-only
+ * binary file so the history survives restarts. The file is memory-mapped
+ * when it's loaded and rewritten once it grows too large */
+namespace history {
+
+struct entry {
+    int64_t played_at = 0; /* Unix time in milliseconds */
+    int32_t duration = 0;  /* Milliseconds */
+    QString title, album, cover;
+    QStringList artists;
+};
+
+void init();
+void close();
+
+/* Adds the song if a new track started playing */
+void add(const song& s, const meta::mask& changes);
+
+/* Total amount of entries in memory */
+size_t size();
+
+/* Entries starting at offset, newest first */
+std::vector<entry> get(size_t offset, size_t limit);
+
+/* The most recent entry that isn't the given song, used for {prev_title} etc. */
+entry previous(const song& current);
+
+/* Paginated JSON for the web server */
+QByteArray json(size_t offset, size_t limit);
+}
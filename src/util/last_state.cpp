@@ -0,0 +1,101 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "last_state.hpp"
+#include "config.hpp"
+#include "constants.hpp"
+#include "cover_cache.hpp"
+#include "media_thread.hpp"
+#include "output_thread.hpp"
+#include "tuna_thread.hpp"
+#include "utility.hpp"
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <atomic>
+#include <util/platform.h>
+
+namespace last_state {
+
+static const uint64_t hold_timeout = 10ull * SECOND_TO_NS;
+static std::atomic<bool> held { false };
+static std::atomic<uint64_t> hold_until { 0 };
+
+void save(const song& s, const meta::mask& changes)
+{
+    if (!config::restore_state || (changes & ~meta::mask().set(meta::PROGRESS)).none() || held)
+        return;
+
+    QJsonObject obj;
+    s.to_json(obj);
+    /* Written on the output thread through a temporary file, so a crash never leaves half a file */
+    auto const json = QString::fromUtf8(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    output_thread::write(util::get_config_file_path(LAST_STATE_FILE), json, false);
+}
+
+void restore()
+{
+    static bool restored = false;
+    if (restored || !config::restore_state)
+        return;
+    restored = true;
+
+    QFile file(util::get_config_file_path(LAST_STATE_FILE));
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    auto const doc = QJsonDocument::fromJson(file.readAll());
+    if (!doc.isObject())
+        return;
+
+    song s;
+    s.from_json(doc.object());
+    if (!s.has(meta::TITLE))
+        return;
+
+    binfo("Restoring last song '%s'", qt_to_utf8(s.get(meta::TITLE)));
+    hold_until = os_gettime_ns() + hold_timeout;
+    held = true;
+    auto const snap = tuna_thread::publish(s);
+    util::handle_outputs(snap->info);
+
+    /* Covers are only taken from the cover cache, nothing is downloaded before the sources are up */
+    if (config::download_cover) {
+        media_thread::submit(media_thread::JOB_COVER, [s] {
+            if (!util::use_cached_cover(s.get(meta::COVER)) && !util::use_cached_cover(cover_cache::album_key(s)))
+                util::reset_cover();
+        });
+    }
+}
+
+bool hold(const song& current)
+{
+    if (!held)
+        return false;
+    if (current.has(meta::TITLE)) {
+        held = false;
+        return false;
+    }
+    if (os_gettime_ns() < hold_until)
+        return true;
+
+    /* The sources had their chance, whatever they report now replaces the restored song */
+    held = false;
+    tuna_thread::invalidate();
+    return true;
+}
+}
@@ -0,0 +1,37 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include "../query/song.hpp"
+
+/* The last published song, kept in the config folder so outputs, overlays
+ * and the cover are correct right after OBS starts instead of staying empty
+ * until the sources answered for the first time */
+namespace last_state {
+
+/* Queues a rewrite of the state file if the song changed beyond its progress */
+void save(const song& s, const meta::mask& changes);
+
+/* Publishes the saved song and writes the outputs and the cover once, called
+ * when the query thread is started for the first time */
+void restore();
+
+/* True while the restored song should stay up, the sources are still warming
+ * up until one of them reports a title or a few seconds passed */
+bool hold(const song& current);
+}
@@ -0,0 +1,134 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "lyrics_cache.hpp"
+#include "../query/song.hpp"
+#include "constants.hpp"
+#include "utility.hpp"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <list>
+#include <mutex>
+
+namespace lyrics_cache {
+
+static const size_t max_memory_entries = 32;
+static const int max_disk_entries = 256;
+
+static std::mutex mutex;
+/* Most recently used entries are at the front */
+static std::list<std::pair<QString, QString>> recent;
+static QHash<QString, std::list<std::pair<QString, QString>>::iterator> index;
+
+static QDir cache_dir()
+{
+    QDir dir(util::get_config_file_path(LYRICS_CACHE_FOLDER));
+    if (!dir.exists() && !dir.mkpath("."))
+        berr("Couldn't create lyrics cache folder %s", qt_to_utf8(dir.path()));
+    return dir;
+}
+
+static QString file_for(const QString& key)
+{
+    auto hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return cache_dir().absoluteFilePath(QString::fromLatin1(hash));
+}
+
+/* Removes the least recently used files until the cache fits its limit */
+static void evict()
+{
+    auto files = cache_dir().entryInfoList(QDir::Files, QDir::Time);
+    for (int i = max_disk_entries; i < files.size(); i++)
+        QFile::remove(files[i].absoluteFilePath());
+}
+
+static void remember(const QString& key, const QString& lyrics)
+{
+    auto const it = index.find(key);
+    if (it != index.end())
+        recent.erase(it.value());
+
+    recent.emplace_front(key, lyrics);
+    index[key] = recent.begin();
+    if (recent.size() > max_memory_entries) {
+        index.remove(recent.back().first);
+        recent.pop_back();
+    }
+}
+
+QString track_key(const song& s)
+{
+    return "track:" + s.get<QStringList>(meta::ARTIST).join(", ") + "\n" + s.get(meta::TITLE) + "\n" + s.get(meta::ALBUM);
+}
+
+QString file_key(const QString& path)
+{
+    QFileInfo info(path);
+    if (path.isEmpty() || !info.exists())
+        return {};
+    return "file:" + info.absoluteFilePath() + "\n" + QString::number(info.size()) + "\n"
+        + QString::number(info.lastModified().toMSecsSinceEpoch());
+}
+
+bool find(const QString& key, QString& lyrics)
+{
+    if (key.isEmpty())
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto const it = index.find(key);
+    if (it != index.end()) {
+        lyrics = it.value()->second;
+        recent.splice(recent.begin(), recent, it.value());
+        return true;
+    }
+
+    QFile cached(file_for(key));
+    if (!cached.open(QIODevice::ReadWrite))
+        return false;
+    lyrics = QString::fromUtf8(cached.readAll());
+    /* The modification time doubles as the last use for eviction */
+    cached.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    remember(key, lyrics);
+    bdebug("Using cached lyrics for %s", qt_to_utf8(key));
+    return true;
+}
+
+void store(const QString& key, const QString& lyrics)
+{
+    if (key.isEmpty())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    remember(key, lyrics);
+    if (lyrics.isEmpty())
+        return;
+
+    QFile out(file_for(key));
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate) || out.write(lyrics.toUtf8()) < 0) {
+        berr("Couldn't add lyrics to the cache");
+        return;
+    }
+    out.close();
+    evict();
+}
+}
@@ -0,0 +1,42 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QString>
+
+class song;
+
+/* Lyrics that were already found, kept in memory and in the plugin config
+ * folder so that switching between tracks doesn't download them again.
+ * Both caches drop their least recently used entries once they're full */
+namespace lyrics_cache {
+
+/* Key for lyrics looked up by artist, title and album */
+QString track_key(const song& s);
+
+/* Key for lyrics embedded in a local file, changes when the file is modified.
+ * Empty if the file doesn't exist */
+QString file_key(const QString& path);
+
+/* Returns false if nothing is cached for key. An empty result means the
+ * track is known to have no lyrics */
+bool find(const QString& key, QString& lyrics);
+
+/* Empty lyrics are only remembered in memory */
+void store(const QString& key, const QString& lyrics);
+}
@@ -17,46 +17,77 @@
  *************************************************************************/
 
 #include "lyrics_handler.hpp"
+#include "../query/song.hpp"
+#include "embedded_tags.hpp"
+#include "lyrics_cache.hpp"
 #include "utility.hpp"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QUrlQuery>
 #include <taglib/fileref.h>
 #include <taglib/tpropertymap.h>
 namespace lyrics {
 
-bool download_missing_lyrics(const song&)
+bool download_missing_lyrics(const song& s)
 {
-    /* TODO */
-    return false;
+    auto const artists = s.get<QStringList>(meta::ARTIST);
+    auto const title = s.get(meta::TITLE);
+    if (artists.isEmpty() || title.isEmpty())
+        return false;
+
+    auto const key = lyrics_cache::track_key(s);
+    QString lyrics;
+    if (lyrics_cache::find(key, lyrics))
+        return !lyrics.isEmpty() && util::write_lyrics(lyrics);
+
+    /* LRCLIB has timed lyrics for a lot of tracks, the duration
+     * helps it pick the right version */
+    QUrlQuery query;
+    query.addQueryItem("artist_name", artists[0]);
+    query.addQueryItem("track_name", title);
+    if (s.has(meta::ALBUM))
+        query.addQueryItem("album_name", s.get(meta::ALBUM));
+    if (s.get<int>(meta::DURATION) > 0)
+        query.addQueryItem("duration", QString::number(s.get<int>(meta::DURATION) / 1000));
+
+    auto const url = "https://lrclib.net/api/get?" + query.toString(QUrl::FullyEncoded);
+    auto const obj = util::curl_get_json(qt_to_utf8(url)).object();
+    lyrics = obj["syncedLyrics"].toString();
+    if (lyrics.isEmpty())
+        lyrics = obj["plainLyrics"].toString();
+
+    /* Only remember missing lyrics if LRCLIB said so, not if the request failed */
+    if (!lyrics.isEmpty() || obj["code"].toInt() == 404)
+        lyrics_cache::store(key, lyrics);
+    return !lyrics.isEmpty() && util::write_lyrics(lyrics);
 }
 
-bool get_embedded(TagLib::FileRef fr)
+bool extract_embedded(const TagLib::FileRef& fr, QString& out)
 {
-    bool found = false;
-    TagLib::PropertyMap tags = fr.file()->properties();
+    const TagLib::PropertyMap tags = fr.file()->properties();
 
+    /* Property keys are upper case, so they can be checked without converting them */
     for (TagLib::PropertyMap::ConstIterator i = tags.begin(); i != tags.end(); ++i) {
-        for (TagLib::StringList::ConstIterator j = i->second.begin(); j != i->second.end(); ++j) {
-            if (utf8_to_qt(i->first.toCString(true)).toLower().contains("lyrics")) {
-                return util::write_lyrics(utf8_to_qt((*j).toCString(true)));
-            }
-        }
+        if (i->second.isEmpty() || i->first.upper().find("LYRICS") < 0)
+            continue;
+        out = utf8_to_qt(i->second.front().toCString(true));
+        return true;
     }
-    return found;
+    return false;
 }
 
 bool find_embedded_lyrics(const QString& path)
 {
-#ifdef _WIN32
-    // Windoze can't into utf8
-    const auto wstr = path.toStdWString();
-    const TagLib::FileRef fr(wstr.c_str(), false);
-#else
-    const TagLib::FileRef fr(qt_to_utf8(path), false);
-#endif
-
-    if (fr.isNull())
-        return false;
-
-    return get_embedded(fr);
+    auto const key = lyrics_cache::file_key(path);
+    QString lyrics;
+    if (!lyrics_cache::find(key, lyrics)) {
+        auto const tags = embedded_tags::read(path);
+        if (!tags)
+            return false;
+        lyrics = tags->lyrics;
+        lyrics_cache::store(key, lyrics);
+    }
+    return !lyrics.isEmpty() && util::write_lyrics(lyrics);
 }
 
 }
@@ -21,7 +21,14 @@
 
 class song;
 
+namespace TagLib {
+class FileRef;
+}
+
 namespace lyrics {
+/* Copies the first lyrics tag of the file into out */
+extern bool extract_embedded(const TagLib::FileRef& fr, QString& out);
+
 
 extern bool download_missing_lyrics(song const&);
 
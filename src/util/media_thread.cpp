@@ -0,0 +1,125 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "media_thread.hpp"
+#include "utility.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace media_thread {
+
+struct worker {
+    std::thread thread_handle;
+    job pending;
+    /* Incremented for every submitted job, a running job is stale
+     * once this no longer matches the generation it was started with */
+    std::atomic<uint64_t> generation { 0 };
+};
+
+static const char* thread_names[JOB_COUNT] = { "tuna-cover", "tuna-lyrics", "tuna-prefetch" };
+static worker workers[JOB_COUNT];
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;
+static std::atomic<bool> thread_flag { false };
+
+static thread_local worker* current_worker = nullptr;
+static thread_local uint64_t current_generation = 0;
+
+static void thread_method(worker* w, const char* name)
+{
+    util::set_thread_name(name, util::PRIORITY_LOW);
+    current_worker = w;
+
+    while (thread_flag) {
+        job j;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [w] { return w->pending || !thread_flag; });
+            if (!thread_flag)
+                break;
+            j = std::move(w->pending);
+            w->pending = nullptr;
+            current_generation = w->generation;
+        }
+        j();
+    }
+    current_worker = nullptr;
+}
+
+bool start()
+{
+    if (thread_flag)
+        return true;
+    thread_flag = true;
+    for (int i = 0; i < JOB_COUNT; i++)
+        workers[i].thread_handle = std::thread(thread_method, &workers[i], thread_names[i]);
+    return true;
+}
+
+void stop()
+{
+    if (!thread_flag)
+        return;
+    bdebug("Stopping media threads...");
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        thread_flag = false;
+        for (auto& w : workers) {
+            w.pending = nullptr;
+            w.generation++;
+        }
+    }
+    queue_cv.notify_all();
+    for (auto& w : workers) {
+        if (w.thread_handle.joinable())
+            w.thread_handle.join();
+    }
+    bdebug("Media threads stopped.");
+}
+
+void submit(job_type type, job j)
+{
+    if (!thread_flag) {
+        /* Not running (yet or anymore), so just do it right here */
+        if (type != JOB_PREFETCH)
+            j();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        workers[type].pending = std::move(j);
+        workers[type].generation++;
+    }
+    queue_cv.notify_all();
+}
+
+bool cancelled()
+{
+    return current_worker && current_worker->generation != current_generation;
+}
+
+std::function<bool()> cancel_check()
+{
+    if (!current_worker)
+        return nullptr;
+    return [w = current_worker, generation = current_generation] { return w->generation != generation; };
+}
+}
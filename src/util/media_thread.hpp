@@ -0,0 +1,54 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+
+#include <functional>
+
+/* Background workers for cover and lyrics retrieval, so that slow
+ * downloads never hold up the query thread and the text outputs */
+namespace media_thread {
+
+enum job_type {
+    JOB_COVER,
+    JOB_LYRICS,
+    /* Warms the caches for the upcoming track, only runs while the
+     * workers are running and is dropped otherwise */
+    JOB_PREFETCH,
+    JOB_COUNT
+};
+
+typedef std::function<void()> job;
+
+bool start();
+
+void stop();
+
+/* Queues a job, any job of the same type that hasn't started yet is
+ * dropped, since its result would be outdated anyway */
+void submit(job_type type, job j);
+
+/* Returns true if the job running on the calling thread has been
+ * superseded by a newer job and should stop without publishing anything.
+ * Always false when not called from a worker thread */
+bool cancelled();
+
+/* Returns a check for cancelled() of the calling job that can be run on
+ * any thread, e.g. while another thread performs a download for the job */
+std::function<bool()> cancel_check();
+}
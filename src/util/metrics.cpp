@@ -0,0 +1,122 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "metrics.hpp"
+#include "timing.hpp"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace metrics {
+
+static std::mutex mutex;
+static std::map<long, uint64_t> http_statuses;
+static std::map<std::string, uint64_t> rate_limits;
+static std::atomic<uint64_t> cover_hits { 0 }, cover_misses { 0 };
+static std::atomic<int> web_clients { 0 };
+static timing::histogram output_writes;
+
+void http_status(long status)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    http_statuses[status]++;
+}
+
+void rate_limited(const char* source_id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    rate_limits[source_id]++;
+}
+
+void cover_cache_lookup(bool hit)
+{
+    if (hit)
+        cover_hits++;
+    else
+        cover_misses++;
+}
+
+void output_written(uint64_t ns)
+{
+    output_writes.add(ns);
+}
+
+void client_connected()
+{
+    web_clients++;
+}
+
+void client_disconnected()
+{
+    web_clients--;
+}
+
+static void write_summary(std::ostringstream& out, const char* name, const std::string& labels, const timing::percentiles& p)
+{
+    auto const sep = labels.empty() ? "" : ",";
+    out << name << "{" << labels << sep << "quantile=\"0.5\"} " << p.p50 / 1e9 << "\n";
+    out << name << "{" << labels << sep << "quantile=\"0.99\"} " << p.p99 / 1e9 << "\n";
+    out << name << "_count{" << labels << "} " << p.samples << "\n";
+}
+
+std::string text()
+{
+    std::ostringstream out;
+
+    out << "# HELP tuna_source_refresh_seconds Duration of recent source refreshes\n";
+    out << "# TYPE tuna_source_refresh_seconds summary\n";
+    timing::for_each_source([&out](const char* id, const timing::percentiles& p) {
+        write_summary(out, "tuna_source_refresh_seconds", std::string("source=\"") + id + "\"", p);
+    });
+
+    out << "# HELP tuna_stage_seconds Duration of recent query thread stages\n";
+    out << "# TYPE tuna_stage_seconds summary\n";
+    for (int i = 0; i < timing::STAGE_COUNT; i++) {
+        auto const s = timing::stage(i);
+        write_summary(out, "tuna_stage_seconds", std::string("stage=\"") + timing::stage_name(s) + "\"", timing::get(s));
+    }
+
+    out << "# HELP tuna_output_write_seconds Duration of recent output file writes\n";
+    out << "# TYPE tuna_output_write_seconds summary\n";
+    write_summary(out, "tuna_output_write_seconds", "", output_writes.get());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "# HELP tuna_http_responses_total Finished HTTP requests by status, 0 means the transfer failed\n";
+        out << "# TYPE tuna_http_responses_total counter\n";
+        for (auto const& s : http_statuses)
+            out << "tuna_http_responses_total{status=\"" << s.first << "\"} " << s.second << "\n";
+
+        out << "# HELP tuna_rate_limited_total Times a source was told to back off\n";
+        out << "# TYPE tuna_rate_limited_total counter\n";
+        for (auto const& r : rate_limits)
+            out << "tuna_rate_limited_total{source=\"" << r.first << "\"} " << r.second << "\n";
+    }
+
+    out << "# HELP tuna_cover_cache_lookups_total Cover cache lookups by result\n";
+    out << "# TYPE tuna_cover_cache_lookups_total counter\n";
+    out << "tuna_cover_cache_lookups_total{result=\"hit\"} " << cover_hits << "\n";
+    out << "tuna_cover_cache_lookups_total{result=\"miss\"} " << cover_misses << "\n";
+
+    out << "# HELP tuna_web_clients Web clients with an open event stream\n";
+    out << "# TYPE tuna_web_clients gauge\n";
+    out << "tuna_web_clients " << web_clients << "\n";
+    return out.str();
+}
+}
@@ -0,0 +1,42 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <cstdint>
+#include <string>
+
+/* Counters about tuna's health, exported by the web server on /metrics
+ * in the Prometheus text format */
+namespace metrics {
+
+/* Result of a finished HTTP request, status 0 means the transfer failed */
+void http_status(long status);
+
+/* A source was told to back off by an API (e.g. HTTP 429 from Spotify) */
+void rate_limited(const char* source_id);
+
+void cover_cache_lookup(bool hit);
+
+void output_written(uint64_t ns);
+
+/* Web clients with an open event stream */
+void client_connected();
+void client_disconnected();
+
+std::string text();
+}
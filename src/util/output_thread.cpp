@@ -0,0 +1,244 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "output_thread.hpp"
+#include "config.hpp"
+#include "metrics.hpp"
+#include "utility.hpp"
+#include <QFile>
+#include <QMap>
+#include <QSaveFile>
+#include <QStringList>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <util/platform.h>
+
+namespace output_thread {
+
+struct pending_output {
+    QString text;      /* Replaces the file content */
+    QStringList lines; /* Appended to the file in log mode */
+    bool log_mode = false;
+};
+
+static std::thread thread_handle;
+static std::atomic<bool> thread_flag { false };
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;
+static QMap<QString, pending_output> queue;
+static bool close_requested = false;
+
+/* Log mode files are kept open and only flushed every now and then. Written
+ * by the output thread, or by write() while it isn't running, so the files
+ * are only touched with file_mutex held */
+static std::mutex file_mutex;
+static QMap<QString, std::shared_ptr<QFile>> log_files;
+static std::atomic<bool> logs_dirty { false };
+static const auto flush_interval = std::chrono::seconds(2);
+
+static void replace_file(const QString& path, const QString& text)
+{
+    /* Write to a temporary file first and then rename it,
+     * so text sources never read a half written file */
+    QSaveFile out(path);
+    const auto data = text.toUtf8();
+    if (out.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        out.write(data);
+        if (out.commit())
+            return;
+    }
+
+    /* Renaming can fail on Windows if another program has the file open */
+    QFile direct(path);
+    if (direct.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        direct.write(data);
+        direct.close();
+    } else {
+        berr("Couldn't open song output file %s", qt_to_utf8(path));
+    }
+}
+
+static void close_logs()
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    for (auto& f : log_files)
+        f->close();
+    log_files.clear();
+    logs_dirty = false;
+}
+
+static void flush_logs()
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    for (auto& f : log_files)
+        f->flush();
+    logs_dirty = false;
+}
+
+static std::shared_ptr<QFile> open_log(const QString& path)
+{
+    auto it = log_files.find(path);
+    if (it != log_files.end())
+        return *it;
+
+    auto f = std::make_shared<QFile>(path);
+    if (!f->open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Append)) {
+        berr("Couldn't open song output file %s", qt_to_utf8(path));
+        return nullptr;
+    }
+    log_files[path] = f;
+    return f;
+}
+
+static void rotate_log(const QString& path)
+{
+    /* Keep one old log around next to the current one */
+    log_files.remove(path);
+    const auto old = path + ".1";
+    QFile::remove(old);
+    if (!QFile::rename(path, old))
+        berr("Couldn't rotate song log %s", qt_to_utf8(path));
+    else
+        binfo("Rotated song log %s", qt_to_utf8(path));
+}
+
+static void append_file(const QString& path, const QStringList& lines)
+{
+    auto out = open_log(path);
+    if (!out)
+        return;
+
+    for (const auto& line : lines) {
+        out->write(line.toUtf8());
+        out->write("\n");
+    }
+    logs_dirty = true;
+
+    const qint64 max_size = qint64(config::log_max_size) * 1024 * 1024;
+    if (max_size > 0 && out->size() >= max_size) {
+        out->close();
+        rotate_log(path);
+    }
+}
+
+static void write_pending(const QMap<QString, pending_output>& outputs)
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+        const uint64_t start = os_gettime_ns();
+        if (it->log_mode)
+            append_file(it.key(), it->lines);
+        else
+            replace_file(it.key(), it->text);
+        metrics::output_written(os_gettime_ns() - start);
+    }
+}
+
+static void thread_method()
+{
+    util::set_thread_name("tuna-output");
+
+    for (;;) {
+        QMap<QString, pending_output> batch;
+        bool close = false;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            auto pred = [] { return !queue.isEmpty() || close_requested || !thread_flag; };
+            /* Unflushed log lines are written after a short while at the latest */
+            if (logs_dirty) {
+                if (!queue_cv.wait_for(lock, flush_interval, pred)) {
+                    lock.unlock();
+                    flush_logs();
+                    continue;
+                }
+            } else {
+                queue_cv.wait(lock, pred);
+            }
+            batch.swap(queue);
+            std::swap(close, close_requested);
+        }
+        if (close)
+            close_logs();
+        write_pending(batch);
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (!thread_flag && queue.isEmpty())
+            break;
+    }
+    close_logs();
+}
+
+bool start()
+{
+    if (thread_flag)
+        return true;
+    thread_flag = true;
+    thread_handle = std::thread(thread_method);
+    return true;
+}
+
+void stop()
+{
+    if (!thread_flag)
+        return;
+    bdebug("Stopping output thread...");
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        thread_flag = false;
+    }
+    queue_cv.notify_one();
+    thread_handle.join();
+    bdebug("Output thread stopped.");
+}
+
+void reopen_logs()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        close_requested = true;
+    }
+    queue_cv.notify_one();
+}
+
+void write(const QString& path, const QString& text, bool log_mode)
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    auto& pending = queue[path];
+    pending.log_mode = log_mode;
+    if (log_mode)
+        pending.lines.append(text);
+    else
+        pending.text = text;
+
+    if (!thread_flag) {
+        /* Not running (yet or anymore), so just write it right here */
+        QMap<QString, pending_output> batch;
+        batch.swap(queue);
+        lock.unlock();
+        write_pending(batch);
+        close_logs();
+        return;
+    }
+    lock.unlock();
+    queue_cv.notify_one();
+}
+}
@@ -0,0 +1,39 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+
+#include <QString>
+
+/* Writes song outputs to disk, so that file I/O never holds up the query thread */
+namespace output_thread {
+
+bool start();
+
+/* Writes everything that is still queued and closes all files before returning */
+void stop();
+
+/* Queues the text for the given file. If the file is written to multiple
+ * times before the writer gets to it, only the latest text is written.
+ * In log mode the text is appended as a new line instead and nothing is dropped */
+void write(const QString& path, const QString& text, bool log_mode);
+
+/* Closes all log files that are kept open, so that files of removed
+ * outputs aren't held open until shutdown */
+void reopen_logs();
+}
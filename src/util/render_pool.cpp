@@ -0,0 +1,117 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "render_pool.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace render_pool {
+
+static const size_t max_workers = 4;
+
+static std::mutex run_mutex;
+static std::mutex mutex;
+static std::condition_variable work_cv, done_cv;
+static std::vector<std::thread> workers;
+static bool stopping = false;
+
+/* The current batch */
+static const std::function<void(size_t)>* current_job = nullptr;
+static size_t job_count = 0;
+static uint64_t batch = 0;
+static size_t next_index = 0;
+static size_t finished = 0;
+
+/* Takes jobs from the given batch until there are none left. Jobs are only
+ * claimed while their batch is current, so a worker that woke up late never
+ * calls the job of a batch that already returned */
+static void work(uint64_t own_batch)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (batch == own_batch && next_index < job_count) {
+        const size_t i = next_index++;
+        const auto* job = current_job;
+        lock.unlock();
+        (*job)(i);
+        lock.lock();
+        if (++finished == job_count)
+            done_cv.notify_all();
+    }
+}
+
+static void worker_method()
+{
+    util::set_thread_name("tuna-render");
+    uint64_t last_batch = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [&] { return stopping || batch != last_batch; });
+            if (stopping)
+                return;
+            last_batch = batch;
+        }
+        work(last_batch);
+    }
+}
+
+void run(size_t count, const std::function<void(size_t)>& job)
+{
+    if (count == 0)
+        return;
+
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+    uint64_t own_batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (workers.empty()) {
+            stopping = false;
+            const size_t n = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 2u) - 1, max_workers);
+            for (size_t i = 0; i < n; i++)
+                workers.emplace_back(worker_method);
+        }
+        current_job = &job;
+        job_count = count;
+        finished = 0;
+        next_index = 0;
+        own_batch = ++batch;
+    }
+    work_cv.notify_all();
+    work(own_batch);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&] { return finished == job_count; });
+}
+
+void stop()
+{
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& t : workers)
+        t.join();
+    workers.clear();
+}
+}
@@ -0,0 +1,34 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <functional>
+
+/* A few worker threads that render outputs in parallel, so the time until
+ * the last output is written stays flat with many outputs */
+namespace render_pool {
+
+/* Calls job(i) for every i < count, spread over the workers and the
+ * calling thread. Returns once all jobs are done. Only one batch runs at
+ * a time, concurrent callers wait for each other */
+void run(size_t count, const std::function<void(size_t)>& job);
+
+/* Stops the workers, they're started again on the next run() */
+void stop();
+}
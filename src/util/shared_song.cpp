@@ -0,0 +1,194 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "shared_song.hpp"
+#include "config.hpp"
+#include "tuna_thread.hpp"
+#include "utility.hpp"
+#include <QDateTime>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#ifdef _WIN32
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <unistd.h>
+#    if defined(__linux__)
+#        include <linux/futex.h>
+#        include <sys/syscall.h>
+#    endif
+#endif
+
+namespace shared_song {
+
+/* Serializes writers, the sequence protocol only works with one at a time */
+static std::mutex mutex;
+static header* segment = nullptr;
+static uint64_t last_generation = 0;
+static bool logged_too_big = false;
+
+#ifdef _WIN32
+static HANDLE mapping = nullptr;
+static HANDLE changed_event = nullptr;
+
+static bool open_segment()
+{
+    mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, segment_size, L"Local\\tuna_song");
+    if (!mapping) {
+        berr("Couldn't create shared memory segment: %lu", GetLastError());
+        return false;
+    }
+    segment = static_cast<header*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, segment_size));
+    if (!segment) {
+        berr("Couldn't map shared memory segment: %lu", GetLastError());
+        CloseHandle(mapping);
+        mapping = nullptr;
+        return false;
+    }
+    changed_event = CreateEventW(nullptr, FALSE, FALSE, L"Local\\tuna_song_changed");
+    return true;
+}
+
+static void close_segment()
+{
+    UnmapViewOfFile(segment);
+    CloseHandle(mapping);
+    if (changed_event)
+        CloseHandle(changed_event);
+    mapping = changed_event = nullptr;
+}
+
+static void notify()
+{
+    if (changed_event)
+        SetEvent(changed_event);
+}
+#else
+static const char* segment_name = "/tuna_song";
+
+static bool open_segment()
+{
+    int fd = shm_open(segment_name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        berr("Couldn't create shared memory segment: %s", strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, segment_size) != 0) {
+        berr("Couldn't resize shared memory segment: %s", strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        berr("Couldn't map shared memory segment: %s", strerror(errno));
+        return false;
+    }
+    segment = static_cast<header*>(data);
+    return true;
+}
+
+static void close_segment()
+{
+    munmap(segment, segment_size);
+    shm_unlink(segment_name);
+}
+
+static void notify()
+{
+#    if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&segment->sequence), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#    endif
+}
+#endif
+
+static bool ensure_open()
+{
+    if (segment)
+        return true;
+    if (!open_segment())
+        return false;
+
+    /* Readers only look at a segment with a valid magic */
+    new (&segment->sequence) std::atomic<uint32_t>(0);
+    segment->version = version;
+    segment->json_size = 0;
+    memcpy(segment->magic, "TUNA", sizeof(segment->magic));
+    last_generation = 0;
+    binfo("Publishing song information in shared memory");
+    return true;
+}
+
+static void close_locked()
+{
+    if (!segment)
+        return;
+    close_segment();
+    segment = nullptr;
+}
+
+void publish(const tuna_thread::song_snapshot& snap)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!config::shared_memory) {
+        close_locked();
+        return;
+    }
+    /* The dialog may hand in a snapshot the query thread already replaced */
+    if (!ensure_open() || snap.generation <= last_generation)
+        return;
+    last_generation = snap.generation;
+
+    const auto& json = snap.json();
+    const uint32_t capacity = segment_size - sizeof(header);
+    const bool fits = uint32_t(json.size()) <= capacity;
+    if (!fits && !logged_too_big) {
+        bwarn("Song information is too large for shared memory (%i bytes)", int(json.size()));
+        logged_too_big = true;
+    }
+
+    auto const timing = tuna_thread::timing();
+    const uint32_t seq = segment->sequence.load(std::memory_order_relaxed);
+    segment->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    segment->generation = snap.generation;
+    segment->status = timing.status;
+    segment->progress = timing.progress;
+    segment->duration = timing.duration;
+    /* sampled_at is a os_gettime_ns() timestamp, which other processes can't use */
+    segment->sampled_at = QDateTime::currentMSecsSinceEpoch();
+    segment->json_size = fits ? uint32_t(json.size()) : 0;
+    if (fits)
+        memcpy(reinterpret_cast<char*>(segment) + sizeof(header), json.constData(), json.size());
+
+    segment->sequence.store(seq + 2, std::memory_order_release);
+    notify();
+}
+
+void close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    close_locked();
+}
+}
@@ -0,0 +1,63 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace tuna_thread {
+class song_snapshot;
+}
+
+/* Publishes the current song into a named shared memory segment, so local
+ * tools can read it without polling the web server or output files.
+ *
+ * The segment is called "/tuna_song" (shm_open) or "Local\tuna_song"
+ * (OpenFileMapping) and starts with the header below, followed by
+ * json_size bytes of compact UTF-8 JSON, the same as GET / returns.
+ * Readers copy the header and json, then check that sequence was even and
+ * didn't change in the meantime, otherwise they retry.
+ *
+ * Readers can wait for changes instead of polling: on Linux by calling
+ * FUTEX_WAIT (not private) on sequence, on Windows by waiting on the
+ * auto-reset event "Local\tuna_song_changed" (intended for one reader) */
+namespace shared_song {
+
+static const uint32_t version = 1;
+static const uint32_t segment_size = 256 * 1024;
+
+struct header {
+    char magic[4];                   /* "TUNA" */
+    uint32_t version;                /* shared_song::version */
+    std::atomic<uint32_t> sequence;  /* Odd while the segment is written */
+    uint32_t json_size;              /* Zero if the json didn't fit */
+    uint64_t generation;             /* See tuna_thread::song_snapshot */
+    int32_t status, progress, duration;
+    int32_t reserved;
+    int64_t sampled_at;              /* Unix time in ms at which progress was sampled */
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory needs lock free atomics");
+
+/* Writes the snapshot if config::shared_memory is enabled. Called by the query
+ * thread and by the settings dialog, so writers are serialized internally */
+void publish(const tuna_thread::song_snapshot& snap);
+
+/* Removes the segment */
+void close();
+}
@@ -0,0 +1,160 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "synced_lyrics.hpp"
+#include <QStringList>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace synced_lyrics {
+
+static std::mutex mutex;
+static std::shared_ptr<const std::vector<line>> timeline;
+static std::atomic<uint64_t> generation { 0 };
+
+/* Reads "mm:ss", "mm:ss.xx" or "mm:ss:xx", returns -1 if it's not a time */
+static int parse_time(const QString& tag)
+{
+    QStringList parts;
+    int start = 0;
+    for (int i = 0; i <= tag.size(); i++) {
+        if (i == tag.size() || tag[i] == ':' || tag[i] == '.') {
+            parts.append(tag.mid(start, i - start));
+            start = i + 1;
+        }
+    }
+    if (parts.size() < 2 || parts.size() > 3)
+        return -1;
+
+    bool ok_min = false, ok_sec = false;
+    auto const minutes = parts[0].toInt(&ok_min);
+    auto const seconds = parts[1].toInt(&ok_sec);
+    if (!ok_min || !ok_sec || minutes < 0 || seconds < 0)
+        return -1;
+
+    int ms = 0;
+    if (parts.size() == 3) {
+        /* Hundredths are the norm, but some files have milliseconds */
+        auto frac = parts[2].left(3);
+        bool ok = false;
+        ms = frac.toInt(&ok);
+        if (!ok)
+            return -1;
+        for (auto i = frac.length(); i < 3; i++)
+            ms *= 10;
+    }
+    return (minutes * 60 + seconds) * 1000 + ms;
+}
+
+/* Enhanced LRC has word timings like <00:12.34>, which aren't shown */
+static QString strip_word_times(const QString& text)
+{
+    if (!text.contains('<'))
+        return text;
+    QString result;
+    result.reserve(text.size());
+    for (int i = 0; i < text.size(); i++) {
+        if (text[i] == '<') {
+            auto const end = text.indexOf('>', i);
+            if (end > i && parse_time(text.mid(i + 1, end - i - 1)) >= 0) {
+                i = end;
+                continue;
+            }
+        }
+        result += text[i];
+    }
+    return result.trimmed();
+}
+
+std::vector<line> parse(const QString& lyrics)
+{
+    std::vector<line> result;
+    int offset = 0;
+
+    for (auto const& raw : lyrics.split('\n')) {
+        auto text = raw.trimmed();
+        std::vector<int> times;
+
+        /* A line can have several time tags if it's repeated */
+        while (text.startsWith('[')) {
+            auto const end = text.indexOf(']');
+            if (end < 0)
+                break;
+            auto const tag = text.mid(1, end - 1);
+            auto const time = parse_time(tag);
+            if (time >= 0)
+                times.push_back(time);
+            else if (tag.startsWith("offset:", Qt::CaseInsensitive))
+                offset = tag.mid(7).trimmed().toInt();
+            text = text.mid(end + 1);
+        }
+
+        if (times.empty())
+            continue;
+        text = strip_word_times(text.trimmed());
+        /* A positive offset shows the lyrics earlier */
+        for (auto t : times)
+            result.push_back({ std::max(0, t - offset), text });
+    }
+
+    std::stable_sort(result.begin(), result.end(), [](const line& a, const line& b) { return a.time < b.time; });
+    return result;
+}
+
+void set(const QString& lyrics)
+{
+    auto parsed = std::make_shared<const std::vector<line>>(parse(lyrics));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        timeline = parsed->empty() ? nullptr : parsed;
+    }
+    generation++;
+}
+
+void reset()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        timeline = nullptr;
+    }
+    generation++;
+}
+
+position at(int progress)
+{
+    position pos;
+    std::shared_ptr<const std::vector<line>> lines;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lines = timeline;
+        pos.generation = generation;
+    }
+    if (!lines)
+        return pos;
+
+    auto const it = std::upper_bound(lines->begin(), lines->end(), progress, [](int p, const line& l) { return p < l.time; });
+    pos.index = int(it - lines->begin()) - 1;
+    if (pos.index >= 0)
+        pos.line = (*lines)[pos.index].text;
+    if (it != lines->end())
+        pos.next = it->text;
+    return pos;
+}
+}
@@ -0,0 +1,49 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QString>
+#include <cstdint>
+#include <vector>
+
+/* Timed (LRC) lyrics of the current track, parsed once when the lyrics
+ * are found so that looking up the current line is a binary search */
+namespace synced_lyrics {
+struct line {
+    int time; /* ms */
+    QString text;
+};
+
+struct position {
+    int index = -1; /* -1 before the first line or without a timeline */
+    QString line, next;
+    /* Changes whenever a new timeline was set */
+    uint64_t generation = 0;
+};
+
+/* Sorted lines of LRC lyrics, empty if there are no time tags */
+std::vector<line> parse(const QString& lyrics);
+
+/* Replaces the timeline with the lyrics of the current track */
+void set(const QString& lyrics);
+
+void reset();
+
+/* Line that is sung at the given progress and the one after it */
+position at(int progress);
+}
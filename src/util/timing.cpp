@@ -0,0 +1,154 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "timing.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <util/platform.h>
+#include <util/profiler.h>
+#include <vector>
+
+namespace timing {
+
+static histogram stages[STAGE_COUNT];
+
+/* Sources are never removed, so references into the map stay valid */
+static std::mutex source_mutex;
+static std::map<std::string, histogram> sources;
+
+static histogram& source_histogram(const char* id)
+{
+    std::lock_guard<std::mutex> lock(source_mutex);
+    return sources[id];
+}
+
+void histogram::add(uint64_t ns)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_samples[m_next] = ns;
+    m_next = (m_next + 1) % m_samples.size();
+    m_count = std::min(m_count + 1, m_samples.size());
+}
+
+percentiles histogram::get() const
+{
+    std::vector<uint64_t> sorted;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        sorted.assign(m_samples.begin(), m_samples.begin() + m_count);
+    }
+
+    percentiles result;
+    if (sorted.empty())
+        return result;
+    std::sort(sorted.begin(), sorted.end());
+    result.samples = uint32_t(sorted.size());
+    result.p50 = sorted[sorted.size() / 2];
+    result.p99 = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+    result.max = sorted.back();
+    return result;
+}
+
+const char* stage_name(stage s)
+{
+    switch (s) {
+    case STAGE_TICK:
+        return "tuna-tick";
+    case STAGE_REFRESH:
+        return "tuna-refresh";
+    case STAGE_POST_REFRESH:
+        return "tuna-post-refresh";
+    case STAGE_PUBLISH:
+        return "tuna-publish";
+    case STAGE_OUTPUTS:
+        return "tuna-outputs";
+    case STAGE_COVER:
+        return "tuna-cover";
+    case STAGE_LYRICS:
+        return "tuna-lyrics";
+    default:
+        return "tuna-unknown";
+    }
+}
+
+percentiles get(stage s)
+{
+    return s < STAGE_COUNT ? stages[s].get() : percentiles {};
+}
+
+percentiles get_source(const char* id)
+{
+    std::lock_guard<std::mutex> lock(source_mutex);
+    auto it = sources.find(id);
+    return it == sources.end() ? percentiles {} : it->second.get();
+}
+
+void for_each_source(const std::function<void(const char*, const percentiles&)>& f)
+{
+    std::lock_guard<std::mutex> lock(source_mutex);
+    for (auto const& s : sources)
+        f(s.first.c_str(), s.second.get());
+}
+
+void record(stage s, uint64_t ns)
+{
+    if (s >= STAGE_COUNT)
+        return;
+    stages[s].add(ns);
+}
+
+void log_summary()
+{
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        auto const p = stages[i].get();
+        if (p.samples)
+            binfo("%s: p50 %.2fms, p99 %.2fms, max %.2fms (%u samples)", stage_name(stage(i)),
+                p.p50 / 1e6, p.p99 / 1e6, p.max / 1e6, p.samples);
+    }
+}
+
+scope::scope(stage s)
+    : m_stage(s)
+    , m_name(stage_name(s))
+    , m_source(nullptr)
+    , m_start(os_gettime_ns())
+{
+    profile_start(m_name);
+}
+
+scope::scope(stage s, const char* source_id)
+    : m_stage(s)
+    , m_name(source_id)
+    , m_source(&source_histogram(source_id))
+    , m_start(os_gettime_ns())
+{
+    /* Profiler names are compared by pointer, the source ids are static */
+    profile_start(m_name);
+}
+
+scope::~scope()
+{
+    profile_end(m_name);
+    const uint64_t elapsed = os_gettime_ns() - m_start;
+    record(m_stage, elapsed);
+    if (m_source)
+        m_source->add(elapsed);
+}
+}
@@ -0,0 +1,88 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+/* Timing of the work done on every tick. Each stage shows up in OBS's
+ * profiler and keeps a rolling histogram that can be queried at runtime */
+namespace timing {
+
+enum stage {
+    STAGE_TICK,         /* One whole iteration of a query thread */
+    STAGE_REFRESH,      /* music_source::refresh */
+    STAGE_POST_REFRESH, /* music_source::post_refresh */
+    STAGE_PUBLISH,      /* tuna_thread::publish, including the snapshot JSON */
+    STAGE_OUTPUTS,      /* util::handle_outputs */
+    STAGE_COVER,        /* music_source::handle_cover */
+    STAGE_LYRICS,       /* music_source::handle_lyrics */
+    STAGE_COUNT
+};
+
+struct percentiles {
+    uint64_t p50 = 0, p99 = 0, max = 0; /* In nanoseconds */
+    uint32_t samples = 0;
+};
+
+/* Keeps the most recent durations of something that's measured repeatedly */
+class histogram {
+    mutable std::mutex m_mutex;
+    std::array<uint64_t, 256> m_samples {};
+    size_t m_next = 0, m_count = 0;
+
+public:
+    void add(uint64_t ns);
+    percentiles get() const;
+};
+
+const char* stage_name(stage s);
+
+percentiles get(stage s);
+
+/* Refresh durations of the music source with this id, see music_source::id */
+percentiles get_source(const char* id);
+
+/* Calls f(id, percentiles) for every source that was refreshed so far */
+void for_each_source(const std::function<void(const char*, const percentiles&)>& f);
+
+/* Records how long a stage took */
+void record(stage s, uint64_t ns);
+
+/* Writes p50/p99 of every stage that was measured to the log */
+void log_summary();
+
+/* Measures the surrounding scope as a profiler section. For refreshes
+ * the source id is used as the section name, so that every source
+ * shows up on its own in the profiler */
+class scope {
+    stage m_stage;
+    const char* m_name;
+    histogram* m_source;
+    uint64_t m_start;
+
+public:
+    explicit scope(stage s);
+    scope(stage s, const char* source_id);
+    ~scope();
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+};
+}
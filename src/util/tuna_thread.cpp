@@ -18,26 +18,213 @@
 
 #include "tuna_thread.hpp"
 #include "../query/music_source.hpp"
+#include "../query/replay_source.hpp"
+#include "activity.hpp"
 #include "config.hpp"
+#include "history.hpp"
+#include "last_state.hpp"
+#include "shared_song.hpp"
+#include "timing.hpp"
 #include "utility.hpp"
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <algorithm>
 #include <obs-module.h>
 #include <util/platform.h>
 
 namespace tuna_thread {
 std::atomic<bool> thread_flag { false };
-song copy;
-std::mutex thread_mutex;
-std::mutex copy_mutex;
+std::shared_mutex thread_mutex;
 std::thread thread_handle;
 
+static std::atomic<uint64_t> generation { 0 };
+static std::shared_ptr<const song_snapshot> published = std::make_shared<const song_snapshot>(song(), 0);
+
+static std::atomic<bool> invalidated { false };
+
+/* Seqlock around the playback timing, odd while the query thread writes it */
+static std::atomic<uint32_t> timing_sequence { 0 };
+static std::atomic<int32_t> timing_status { 0 };
+static std::atomic<int32_t> timing_duration { 0 };
+static std::atomic<int32_t> timing_progress { -1 };
+static std::atomic<uint64_t> timing_sampled_at { 0 };
+
+/* Notifies readers waiting for a new snapshot, e.g. event stream connections */
+static std::mutex publish_mutex;
+static std::condition_variable publish_cv;
+
+static std::mutex wakeup_mutex;
+static std::condition_variable wakeup_cv;
+static uint64_t wakeup_count = 0;
+
+/* Used when all sources are queried in parallel, only one
+ * of them can process its song information at a time */
+static std::mutex process_mutex;
+static std::vector<std::thread> source_threads;
+static bool parallel = false;
+
+static std::mutex command_mutex;
+static std::vector<uint32_t> commands;
+
+void wakeup()
+{
+    {
+        std::lock_guard<std::mutex> lock(wakeup_mutex);
+        wakeup_count++;
+    }
+    wakeup_cv.notify_all();
+}
+
+void wakeup(const char* source_id)
+{
+    auto src = music_sources::get<music_source>(source_id);
+    if (!src)
+        return;
+    {
+        /* Every query thread wakes up, but only the one of this source finds it due */
+        std::lock_guard<std::mutex> lock(wakeup_mutex);
+        src->request_refresh();
+        wakeup_count++;
+    }
+    wakeup_cv.notify_all();
+}
+
+void wakeup_selected()
+{
+    auto src = music_sources::selected_source();
+    if (src)
+        wakeup(src->id());
+}
+
+bool queue_command(uint32_t capability)
+{
+    if (!thread_flag)
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        commands.push_back(capability);
+    }
+    wakeup_selected();
+    return true;
+}
+
+event_source* events()
+{
+    static event_source* instance = [] {
+        qRegisterMetaType<std::shared_ptr<const song_snapshot>>();
+        return new event_source;
+    }();
+    return instance;
+}
+
+const QByteArray& song_snapshot::json(bool indented) const
+{
+    std::call_once(m_json_once[indented], [this, indented] {
+        QJsonObject obj;
+        info.to_json(obj);
+        m_json[indented] = QJsonDocument(obj).toJson(indented ? QJsonDocument::Indented : QJsonDocument::Compact);
+    });
+    return m_json[indented];
+}
+
+const QByteArray& song_snapshot::json_gzip(bool indented) const
+{
+    std::call_once(m_gzip_once[indented], [this, indented] {
+        if (!util::gzip(json(indented), m_gzip[indented]))
+            m_gzip[indented].clear();
+    });
+    return m_gzip[indented];
+}
+
+std::shared_ptr<const song_snapshot> snapshot()
+{
+    return std::atomic_load_explicit(&published, std::memory_order_acquire);
+}
+
+static void store_timing(const song& s)
+{
+    auto const seq = timing_sequence.load(std::memory_order_relaxed);
+    timing_sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    timing_status.store(s.get<int>(meta::STATUS), std::memory_order_relaxed);
+    timing_duration.store(s.get<int>(meta::DURATION), std::memory_order_relaxed);
+    timing_progress.store(s.has(meta::PROGRESS) ? s.get<int>(meta::PROGRESS) : -1, std::memory_order_relaxed);
+    timing_sampled_at.store(os_gettime_ns(), std::memory_order_relaxed);
+    timing_sequence.store(seq + 2, std::memory_order_release);
+}
+
+playback_timing timing()
+{
+    playback_timing t;
+    uint32_t before, after;
+    do {
+        before = timing_sequence.load(std::memory_order_acquire);
+        t.status = timing_status.load(std::memory_order_relaxed);
+        t.duration = timing_duration.load(std::memory_order_relaxed);
+        t.progress = timing_progress.load(std::memory_order_relaxed);
+        t.sampled_at = timing_sampled_at.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = timing_sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return t;
+}
+
+std::shared_ptr<const song_snapshot> publish(const song& s)
+{
+    timing::scope t(timing::STAGE_PUBLISH);
+    store_timing(s);
+    auto snap = std::make_shared<const song_snapshot>(s, ++generation);
+    replay_source::record(*snap);
+    shared_song::publish(*snap);
+    std::atomic_store_explicit(&published, snap, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(publish_mutex);
+    }
+    publish_cv.notify_all();
+    emit events()->published(snap);
+    return snap;
+}
+
+std::shared_ptr<const song_snapshot> wait_for_snapshot(uint64_t generation, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(publish_mutex);
+    publish_cv.wait_for(lock, timeout, [generation] { return snapshot()->generation != generation; });
+    return snapshot();
+}
+
+void invalidate()
+{
+    invalidated = true;
+    wakeup_selected();
+}
+
+bool parallel_mode()
+{
+    return parallel;
+}
+
 bool start()
 {
     if (thread_flag)
         return true;
-    std::lock_guard<std::mutex> lock(thread_mutex);
-    thread_handle = std::thread(thread_method);
-    return thread_flag = thread_handle.native_handle();
+    std::lock_guard<std::shared_mutex> lock(thread_mutex);
+    thread_flag = true;
+    invalidated = true;
+    parallel = config::auto_select_source;
+    last_state::restore();
+
+    if (parallel) {
+        for (const auto& src : std::as_const(music_sources::instances)) {
+            if (src->enabled())
+                source_threads.emplace_back(source_thread_method, src);
+        }
+        thread_flag = !source_threads.empty();
+    } else {
+        thread_handle = std::thread(thread_method);
+        thread_flag = thread_handle.native_handle();
+    }
+    emit events()->state_changed();
+    return thread_flag;
 }
 
 void stop()
@@ -46,68 +233,180 @@ void stop()
         return;
     bdebug("Stopping query thread...");
     thread_flag = false;
-    thread_handle.join();
+    wakeup();
+    if (thread_handle.joinable())
+        thread_handle.join();
+    for (auto& t : source_threads)
+        t.join();
+    if (!source_threads.empty())
+        music_sources::stop_unused();
+    source_threads.clear();
     bdebug("Query thread stopped.");
+    timing::log_summary();
 
     bdebug("Resetting song information...");
     /* Set status to nothing before stopping */
     auto src = music_sources::selected_source();
     src->reset_info();
+    publish(src->song_info());
     util::handle_outputs(src->song_info());
     bdebug("Song information reset.");
+    emit events()->state_changed();
+}
+
+static void run_commands(const std::shared_ptr<music_source>& ref)
+{
+    std::vector<uint32_t> pending;
+    {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        pending.swap(commands);
+    }
+    if (pending.empty())
+        return;
+
+    std::shared_lock<std::shared_mutex> lock(thread_mutex);
+    for (auto c : pending) {
+        if (ref->has_capability(capability(c)))
+            ref->execute_capability(capability(c));
+    }
+}
+
+static void refresh(const std::shared_ptr<music_source>& ref)
+{
+    ref->take_refresh_request();
+    /* Only blocks while the config is changed, sources can still refresh in parallel */
+    std::shared_lock<std::shared_mutex> lock(thread_mutex);
+    {
+        timing::scope t(timing::STAGE_REFRESH, ref->id());
+        ref->refresh();
+    }
+    timing::scope t(timing::STAGE_POST_REFRESH);
+    ref->post_refresh();
+}
+
+/* Outputs that show other players or timed lyrics move on,
+ * even while nothing of the selected source changes */
+static void follow_players()
+{
+    util::handle_outputs(snapshot()->info, {});
+}
+
+static void process(const std::shared_ptr<music_source>& ref)
+{
+    if (invalidated.exchange(false))
+        ref->force_update();
+    if (last_state::hold(ref->song_info()))
+        return;
+
+    /* Nothing changed since the last refresh, so there's nothing to do */
+    if (ref->changes().none()) {
+        follow_players();
+        return;
+    }
+
+    /* Publish a snapshot for the progress bar source, because it can't
+     * wait for the other processes to finish, otherwise it'll block
+     * the video thread
+     */
+    const auto snap = publish(ref->song_info());
+    history::add(snap->info, ref->changes());
+    last_state::save(snap->info, ref->changes());
+
+    /* Process song data, the outputs use the snapshot so that the JSON
+     * specifiers can use its cached JSON */
+    {
+        timing::scope t(timing::STAGE_OUTPUTS);
+        util::handle_outputs(snap->info, ref->changes());
+    }
+    if (config::download_cover) {
+        timing::scope t(timing::STAGE_COVER);
+        ref->handle_cover();
+    }
+    if (config::download_lyrics) {
+        timing::scope t(timing::STAGE_LYRICS);
+        ref->handle_lyrics();
+    }
+}
+
+/* Sleeps until the next refresh is due or until a source (or stop()) wakes us up */
+static void wait_until(uint64_t next, uint64_t& last_wakeup)
+{
+    /* Only wait the remaining time until the next refresh is due,
+     * but we wait at least 10 ms otherwise we will immediately lock the mutex
+     * again which can stall other threads that are waiting to lock it
+     */
+    const uint64_t now = os_gettime_ns();
+    int64_t wait = std::max<int64_t>(next > now ? int64_t((next - now) / 1000000) : 0, 10);
+
+    bdebug("Query thread sleeping for %ims", int(wait)); // macOS doesn't like %lu so we'll just cast to int, who cares
+
+    std::unique_lock<std::mutex> lock(wakeup_mutex);
+    wakeup_cv.wait_for(lock, std::chrono::milliseconds(wait), [&] { return wakeup_count != last_wakeup || !thread_flag; });
+    last_wakeup = wakeup_count;
 }
 
 void thread_method()
 {
-    util::set_thread_name("tuna-query");
+    util::set_thread_name("tuna-query", util::PRIORITY_HIGH);
+    uint64_t last_wakeup = 0;
 
     while (thread_flag) {
-        const uint64_t start = os_gettime_ns() / 1000000;
-        {
-            auto ref = music_sources::selected_source();
-            if (ref) {
-                {
-                    // We don't want to hold the lock while waiting
-                    std::lock_guard<std::mutex> lock(thread_mutex);
-                    ref->refresh();
-                    ref->post_refresh();
-                }
-                auto s = ref->song_info();
-
-                /* Make a copy for the progress bar source, because it can't
-                 * wait for the other processes to finish, otherwise it'll block
-                 * the video thread
-                 */
-                copy_mutex.lock();
-                copy = s;
-                copy_mutex.unlock();
-
-                /* Process song data */
-                util::handle_outputs(s);
-                if (config::download_cover)
-                    ref->handle_cover();
-                if (config::download_lyrics)
-                    ref->handle_lyrics();
+        const uint64_t start = os_gettime_ns();
+        uint64_t next = start + uint64_t(config::refresh_rate) * 1000000;
+        auto ref = music_sources::selected_source();
+        if (ref) {
+            run_commands(ref);
+            if (ref->refresh_due(start)) {
+                timing::scope t(timing::STAGE_TICK);
+                refresh(ref);
+                process(ref);
+                /* Each source decides when it wants to be queried again */
+                ref->schedule(ref->next_refresh(start));
+            } else {
+                follow_players();
             }
+            next = ref->due();
+            if (util::outputs_move_on())
+                next = std::min(next, start + uint64_t(config::refresh_rate) * 1000000);
         }
+        wait_until(activity::idle_refresh(start, next), last_wakeup);
+    }
+    binfo("Query thread stopped.");
+}
 
-        /* Calculate how long refresh took and only wait the remaining time
-         * but we wait at least 10 ms otherwise we will immediately lock the mutex
-         * again which can stall other threads that are waiting to lock it
-         */
-        const uint64_t end = os_gettime_ns() / 1000000;
-        uint64_t delta = std::clamp<uint64_t>(end - start, 10ul, config::refresh_rate - 10);
-        int64_t wait = config::refresh_rate - delta;
-        const int64_t step = 50;
-
-        bdebug("Query thread sleeping for %ims", int(wait)); // macOS doesn't like %lu so we'll just cast to int, who cares
-
-        // We only wait int 50 ms steps so we can catch the thread stopping faster
-        while (wait > 0 && thread_flag) {
-            os_sleep_ms(step);
-            wait -= step;
+void source_thread_method(std::shared_ptr<music_source> src)
+{
+    util::set_thread_name("tuna-query", util::PRIORITY_HIGH);
+    uint64_t last_wakeup = 0;
+    /* Every source has to run to notice when it starts playing */
+    src->start();
+
+    while (thread_flag) {
+        const uint64_t start = os_gettime_ns();
+        if (music_sources::selected_source() == src)
+            run_commands(src);
+        if (src->refresh_due(start)) {
+            timing::scope t(timing::STAGE_TICK);
+            refresh(src);
+
+            /* The source that most recently started playing is the one
+             * whose information is published */
+            std::lock_guard<std::mutex> lock(process_mutex);
+            if (music_sources::auto_select() == src) {
+                if (src->take_activation())
+                    src->force_update();
+                process(src);
+            } else {
+                follow_players();
+            }
+            src->schedule(src->next_refresh(start));
         }
+        uint64_t next = src->due();
+        /* The thread of the published source keeps those outputs moving */
+        if (music_sources::selected_source() == src && util::outputs_move_on())
+            next = std::min(next, start + uint64_t(config::refresh_rate) * 1000000);
+        wait_until(activity::idle_refresh(start, next), last_wakeup);
     }
-    binfo("Query thread stopped.");
+    bdebug("Query thread for %s stopped.", src->id());
 }
 }
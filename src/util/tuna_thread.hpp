@@ -19,20 +19,136 @@
 #pragma once
 
 #include "query/song.hpp"
+#include <QByteArray>
+#include <QObject>
 #include <QString>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
 
+class music_source;
+
 namespace tuna_thread {
+
+/* Immutable song information published by the query thread */
+class song_snapshot {
+    mutable std::once_flag m_json_once[2];
+    mutable QByteArray m_json[2];
+    mutable std::once_flag m_gzip_once[2];
+    mutable QByteArray m_gzip[2];
+
+public:
+    song_snapshot(const song& s, uint64_t generation)
+        : info(s)
+        , generation(generation)
+    {
+    }
+
+    const song info;
+    /* Incremented whenever new song information is published */
+    const uint64_t generation;
+
+    /* UTF-8 JSON of the song information, only serialized once per snapshot */
+    const QByteArray& json(bool indented = false) const;
+
+    /* Gzip compressed json(), also only compressed once. Empty if compression failed */
+    const QByteArray& json_gzip(bool indented = false) const;
+};
+
+/* The few values the progress bar needs, sampled when the song was published */
+struct playback_timing {
+    int32_t status = 0;
+    int32_t duration = 0;
+    /* -1 if the source doesn't report the progress */
+    int32_t progress = -1;
+    /* os_gettime_ns() at which the progress was sampled */
+    uint64_t sampled_at = 0;
+
+    /* The progress moved on by the time since it was sampled while playing,
+     * sources are only asked every few seconds in the middle of a track */
+    int32_t progress_at(uint64_t now) const
+    {
+        if (progress < 0 || status != state_playing || now <= sampled_at)
+            return progress;
+        auto const estimate = int64_t(progress) + int64_t((now - sampled_at) / 1000000);
+        return int32_t(duration > 0 ? std::min<int64_t>(estimate, duration) : estimate);
+    }
+};
+
+/* Lets the UI react to changes instead of polling, signals are emitted
+ * on the query (or source) threads so they arrive queued in the UI thread */
+class event_source : public QObject {
+    Q_OBJECT
+
+signals:
+    /* A new snapshot was published */
+    void published(std::shared_ptr<const tuna_thread::song_snapshot> snapshot);
+    /* The query thread was started or stopped */
+    void state_changed();
+    /* A source found or lost a player, e.g. over MPRIS */
+    void players_changed();
+};
+
+event_source* events();
+
 extern std::atomic<bool> thread_flag;
-extern std::mutex thread_mutex;
-extern std::mutex copy_mutex;
+/* Held exclusively when config values change, sources hold it shared while refreshing */
+extern std::shared_mutex thread_mutex;
 extern std::thread thread_handle;
-extern song copy;
 
 bool start();
 
 void stop();
 
+/* Wakes up the query threads so they check again which source is due,
+ * e.g. after stopping. Nothing is refreshed early */
+void wakeup();
+
+/* Refreshes the source with this id before its refresh interval runs out,
+ * sources that receive push notifications (D-Bus, WinRT, POST) call this
+ * so their changes are processed right away. Other sources keep their schedule */
+void wakeup(const char* source_id);
+
+/* Refreshes the selected source right away */
+void wakeup_selected();
+
+/* Makes the query thread process the current song again even if
+ * it didn't change, e.g. because the outputs were reconfigured */
+void invalidate();
+
+/* Queues a playback command (see capability) for the selected source. It's
+ * run by the query thread, so network threads never wait for a player.
+ * Returns false if the query thread isn't running */
+bool queue_command(uint32_t capability);
+
+/* Returns the most recently published song information. The snapshot is
+ * immutable and picked up with an atomic load, so readers like the progress
+ * source on the video thread never have to wait for the query thread */
+std::shared_ptr<const song_snapshot> snapshot();
+
+/* Replaces the published snapshot, only called by the query thread */
+std::shared_ptr<const song_snapshot> publish(const song& s);
+
+/* Lock and allocation free read of the published playback timing,
+ * used by the progress source on every frame */
+playback_timing timing();
+
+/* Blocks until a snapshot other than the given generation was published
+ * or the timeout ran out, returns the current snapshot either way */
+std::shared_ptr<const song_snapshot> wait_for_snapshot(uint64_t generation, std::chrono::milliseconds timeout);
+
 void thread_method();
+
+/* Used instead of thread_method() if all sources are queried in parallel */
+void source_thread_method(std::shared_ptr<music_source> src);
+
+/* True if the running threads query all sources in parallel */
+bool parallel_mode();
 } // namespace thread
+
+Q_DECLARE_METATYPE(std::shared_ptr<const tuna_thread::song_snapshot>)
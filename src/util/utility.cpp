@@ -20,20 +20,39 @@
 #include "../query/music_source.hpp"
 #include "config.hpp"
 #include "constants.hpp"
+#include "cover_cache.hpp"
+#include "cover_image.hpp"
+#include "cover_tag_handler.hpp"
+#include "async_http.hpp"
+#include "lyrics_cache.hpp"
+#include "synced_lyrics.hpp"
 #include "format.hpp"
+#include "media_thread.hpp"
+#include "output_thread.hpp"
+#include "render_pool.hpp"
 #include <QGuiApplication>
 #include <QScreen>
 
+#include <QDate>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QJsonDocument>
+#include <QLocale>
 #include <QTextStream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
 #include <ctime>
 #include <curl/curl.h>
 #include <obs-module.h>
+#include <obs.hpp>
 #include <sstream>
+#include <vector>
 #include <stdio.h>
 #include <util/platform.h>
+#include <zlib.h>
 #if _WIN32
 #    include <windows.h>
 const DWORD MS_VC_EXCEPTION = 0x406D1388;
@@ -60,7 +79,16 @@ inline void os_set_thread_name(const char* name)
     }
 }
 #else
+#    include <pthread.h>
+#    include <sys/resource.h>
+#    include <unistd.h>
 #    include <util/threading.h>
+#    if __APPLE__
+#        include <pthread/qos.h>
+#    else
+#        include <sched.h>
+#        include <sys/syscall.h>
+#    endif
 #endif
 #include <util/util.hpp>
 
@@ -68,66 +96,132 @@ namespace util {
 
 bool have_vlc_source = false;
 
-size_t write_data(void* ptr, size_t size, size_t nmemb, FILE* stream)
+bool curl_download(const char* url, const char* path)
 {
-    size_t written;
-    written = fwrite(ptr, size, nmemb, stream);
-    return written;
+    async_http::request req;
+    req.url = url;
+    req.timeout_ms = 60000;
+    /* Abort downloads that were superseded by a newer cover/lyrics job */
+    req.cancelled = media_thread::cancel_check();
+    auto const res = async_http::fetch(std::move(req)).get();
+
+    if (res.result != CURLE_OK) {
+        berr("Couldn't fetch file from %s to %s, curl error: %s (%i)", url, path, res.error.c_str(), res.result);
+        return false;
+    }
+    if (res.status >= 400) {
+        berr("Couldn't fetch file from %s to %s, HTTP error %i", url, path, int(res.status));
+        return false;
+    }
+
+    QFile f(utf8_to_qt(path));
+    if (!f.open(QIODevice::WriteOnly) || f.write(res.body.data(), qint64(res.body.size())) != qint64(res.body.size())) {
+        berr("Couldn't write %s", path);
+        return false;
+    }
+    bdebug("Fetched %s to %s", url, path);
+    return true;
 }
 
-bool curl_download(const char* url, const char* path)
+void download_lyrics(const song& song)
 {
-    CURL* curl = curl_easy_init();
-    FILE* fp = nullptr;
-#ifdef _WIN32
-    wchar_t* wstr = NULL;
-    os_utf8_to_wcs_ptr(path, strlen(path), &wstr);
-    fp = _wfopen(wstr, L"wb");
-    bfree(wstr);
-#else
-    fp = fopen(path, "wb");
-#endif
+    static QString last_lyrics = "";
 
-    bool result = false;
-    if (fp && curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-#ifdef DEBUG
-        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-#endif
-        CURLcode res = curl_easy_perform(curl);
+    auto l = song.get(meta::LYRICS);
+    if (l.isEmpty() || l == last_lyrics)
+        return;
+    last_lyrics = l;
 
-        if (res != CURLE_OK) {
-            berr("Couldn't fetch file from %s to %s, curl error: %s (%i)", url, path, curl_easy_strerror(res), res);
-        } else {
-            result = true;
-            bdebug("Fetched %s to %s", url, path);
+    QString lyrics;
+    if (lyrics_cache::find("url:" + l, lyrics)) {
+        write_lyrics(lyrics);
+    } else if (!curl_download(qt_to_utf8(l), qt_to_utf8(config::lyrics_path))) {
+        berr("Couldn't dowload lyrics from '%s' to '%s'", qt_to_utf8(l), qt_to_utf8(config::lyrics_path));
+    } else {
+        QFile f(config::lyrics_path);
+        if (f.open(QIODevice::ReadOnly)) {
+            lyrics = QString::fromUtf8(f.readAll());
+            synced_lyrics::set(lyrics);
+            lyrics_cache::store("url:" + l, lyrics);
         }
     }
+}
 
-    if (fp)
-        fclose(fp);
+/* Moves a finished download over the current cover */
+static bool replace_cover(const QString& tmp)
+{
+    /* A newer cover is already on its way, so don't overwrite the current one */
+    if (media_thread::cancelled()) {
+        QFile::remove(tmp);
+        return false;
+    }
 
-    if (curl)
-        curl_easy_cleanup(curl);
-    return result;
+    if (config::cover_normalize) {
+        QFile f(tmp);
+        auto data = f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+        f.close();
+        QFile::remove(tmp);
+        /* Normalizes the cover once and writes it */
+        return cover::write_bytes_to_file(data);
+    }
+
+    QFile::remove(config::cover_path);
+    if (!QFile::rename(tmp, config::cover_path)) {
+        berr("Couldn't rename temporary cover file");
+        return false;
+    }
+    cover_image::clear_reference();
+    return true;
 }
 
-void download_lyrics(const song& song)
+bool cover_file_needed()
 {
-    static QString last_lyrics = "";
+    if (!config::cover_by_reference)
+        return true;
 
-    auto l = song.get(meta::LYRICS);
-    if (!l.isEmpty() && l != last_lyrics) {
-        last_lyrics = l;
-        if (!curl_download(qt_to_utf8(l), qt_to_utf8(config::lyrics_path))) {
-            berr("Couldn't dowload lyrics from '%s' to '%s'", qt_to_utf8(l), qt_to_utf8(config::lyrics_path));
-        }
-    }
+    struct search {
+        QString path;
+        bool found;
+    } s { QFileInfo(config::cover_path).absoluteFilePath(), false };
+
+    obs_enum_sources(
+        [](void* param, obs_source_t* src) {
+            auto* s = static_cast<search*>(param);
+            auto const* id = obs_source_get_unversioned_id(src);
+            if (!id || strcmp(id, "image_source") != 0)
+                return true;
+            OBSDataAutoRelease settings = obs_source_get_settings(src);
+            auto const file = QFileInfo(utf8_to_qt(obs_data_get_string(settings, "file"))).absoluteFilePath();
+#if _WIN32
+            s->found = file.compare(s->path, Qt::CaseInsensitive) == 0;
+#else
+            s->found = file == s->path;
+#endif
+            return !s->found;
+        },
+        &s);
+    return s.found;
+}
+
+bool link_or_copy(const QString& from, const QString& to)
+{
+#if _WIN32
+    if (CreateHardLinkW(reinterpret_cast<LPCWSTR>(to.utf16()), reinterpret_cast<LPCWSTR>(from.utf16()), nullptr))
+        return true;
+#else
+    if (link(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0)
+        return true;
+#endif
+    return QFile::copy(from, to);
 }
 
-bool download_cover(const QString& url)
+bool use_cached_cover(const QString& cache_key)
+{
+    auto tmp = config::cover_path + ".tmp";
+    return cover_cache::fetch(cache_key, tmp) && replace_cover(tmp);
+}
+
+bool download_cover(const QString& url, const QString& cache_key)
 {
     if (url == "n/a")
         return false;
@@ -145,29 +239,55 @@ bool download_cover(const QString& url)
         // Don't use curl for local files
         QString new_cover_path = QUrl::fromPercentEncoding(url.mid(prefix_length).toUtf8());
         QFile cover(new_cover_path);
-        if (cover.exists()) {
-            QFile current(output_path);
-            current.remove();
-            if (QFile::copy(new_cover_path, output_path))
-                return true;
-            berr("Couldn't copy cover file from '%s' to '%s'", qt_to_utf8(new_cover_path), qt_to_utf8(output_path));
+        if (!cover.exists()) {
+            berr("Cover file '%s' does not exist", qt_to_utf8(new_cover_path));
             return false;
         }
-        berr("Cover file '%s' does not exist", qt_to_utf8(new_cover_path));
-        return false;
+        if (!cover_file_needed()) {
+            if (media_thread::cancelled())
+                return false;
+            /* Nothing shows the cover file, so don't leave an outdated one around */
+            QFile::remove(output_path);
+            cover_image::set_reference(new_cover_path);
+            return true;
+        }
+        QFile::remove(tmp);
+        /* Hard links are only used by reference, since nothing may edit the copy then */
+        if (config::cover_by_reference)
+            result = link_or_copy(new_cover_path, tmp);
+        else
+            result = QFile::copy(new_cover_path, tmp);
+        if (!result)
+            berr("Couldn't copy cover file from '%s' to '%s'", qt_to_utf8(new_cover_path), qt_to_utf8(tmp));
+    } else if (cover_cache::fetch(url, tmp)) {
+        result = true;
+    } else {
+        result = curl_download(qt_to_utf8(url), qt_to_utf8(tmp));
+        if (result && !media_thread::cancelled())
+            cover_cache::store(url, tmp);
     }
+    if (result && !cache_key.isEmpty() && !media_thread::cancelled())
+        cover_cache::store(cache_key, tmp);
 
-    result = curl_download(qt_to_utf8(url), qt_to_utf8(tmp));
-
+    if (!result) {
+        QFile::remove(tmp);
+        return false;
+    }
     /* Replace cover only after download is done */
-    QFile current(output_path);
-    current.remove();
+    return replace_cover(tmp);
+}
 
-    if (result && !QFile::rename(tmp, output_path)) {
-        berr("Couldn't rename temporary cover file");
-        result = false;
+void prefetch_cover(const QString& url)
+{
+    if (config::cover_cache_size == 0 || url.isEmpty() || url == "n/a" || url.startsWith("file://") || cover_cache::contains(url))
+        return;
+
+    auto tmp = config::cover_path + ".prefetch";
+    if (curl_download(qt_to_utf8(url), qt_to_utf8(tmp)) && !media_thread::cancelled()) {
+        cover_cache::store(url, tmp);
+        bdebug("Prefetched cover %s", qt_to_utf8(url));
     }
-    return result;
+    QFile::remove(tmp);
 }
 
 void reset_cover()
@@ -177,61 +297,122 @@ void reset_cover()
     current.remove();
     if (!QFile::copy(config::cover_placeholder, path))
         berr("Couldn't move placeholder cover");
+    /* After the copy, so the placeholder is there once readers are notified */
+    cover_image::clear_reference();
 }
 
-void write_song(config::output& o, const QString& str)
+bool is_text_source(obs_source_t* src)
 {
-    if (o.last_output == str)
+    auto const* id = obs_source_get_unversioned_id(src);
+    return id && (strcmp(id, "text_gdiplus") == 0 || strcmp(id, "text_ft2_source") == 0);
+}
+
+static void update_text_source(const QString& name, const QString& str)
+{
+    OBSSourceAutoRelease src = obs_get_source_by_name(qt_to_utf8(name));
+    if (!src || !is_text_source(src)) {
+        bdebug("'%s' is not a text source", qt_to_utf8(name));
         return;
-    o.last_output = str;
+    }
 
-    QFile out(o.path);
-    bool success = false;
-    if (o.log_mode)
-        success = out.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Append);
-    else
-        success = out.open(QIODevice::WriteOnly | QIODevice::Text);
+    OBSDataAutoRelease data = obs_data_create();
+    obs_data_set_string(data, "text", qt_to_utf8(str));
+    /* The text would be ignored if the source reads from a file */
+    obs_data_set_bool(data, "read_from_file", false);
+    obs_data_set_bool(data, "from_file", false);
+    obs_source_update(src, data);
+}
 
-    if (success) {
-        QTextStream stream(&out);
-#if QT_VERSION_MAJOR < 6
-        stream.setCodec("UTF-8");
-#else
-        stream.setEncoding(QStringConverter::Utf8);
-#endif
-        stream << str;
-        if (o.log_mode)
-            stream << "\n";
-        stream.flush();
-        out.close();
-    } else {
-        berr("Couldn't open song output file %s", qt_to_utf8(o.path));
+static void write_song(config::output_set& set, config::output& o, const QString& str)
+{
+    {
+        std::lock_guard<std::mutex> lock(set.last_output_mutex);
+        if (o.last_output == str)
+            return;
+        o.last_output = str;
     }
+    if (!o.path.isEmpty())
+        output_thread::write(o.path, str, o.log_mode);
+    if (!o.text_source.isEmpty())
+        update_text_source(o.text_source, str);
 }
 
-void handle_outputs(const song& s)
-{
-    static QString tmp_text = "";
+/* Below this many outputs handing them to the render pool costs more than it saves */
+static const size_t parallel_outputs = 4;
 
-    for (auto& o : config::outputs) {
-        tmp_text.clear();
-        tmp_text = o.format;
-        format::execute(tmp_text);
+void handle_outputs(const song& s, const meta::mask& changes)
+{
+    /* Held until we're done, a new set can be swapped in meanwhile */
+    auto const set = config::active_outputs();
+    /* Players of other sources change without the selected source noticing */
+    static std::atomic<uint64_t> seen_players { ~0ull };
+    auto const players = music_sources::players_generation();
+    const bool players_changed = seen_players.exchange(players) != players;
+
+    std::vector<config::output*> pending;
+    for (auto& o : set->outputs) {
+        auto const& c = *o.compiled;
+        /* Nothing this output shows has changed */
+        if ((c.dependencies() & changes).any() || c.timed() || (c.uses_players() && (players_changed || c.follows_player_progress())))
+            pending.push_back(&o);
+    }
 
-        if (tmp_text.isEmpty() || s.get<int>(meta::STATUS) >= state_paused) {
-            tmp_text = config::placeholder;
+    const bool paused = s.get<int>(meta::STATUS) >= state_paused;
+    std::vector<QString> texts(pending.size());
+    auto render = [&](size_t i) {
+        auto& text = texts[i];
+        pending[i]->compiled->render(s, text);
+        if (text.isEmpty() || (paused && !pending[i]->compiled->only_players())) {
+            text = config::placeholder;
             /* OBS seems to cut leading and trailing spaces
              * when loading the config file so this workaround
              * allows users to still use them */
-            tmp_text.replace("%s", " ");
-            tmp_text.replace("%e", "\n");
+            text.replace("%s", " ");
+            text.replace("%e", "\n");
         }
-        if (s.get<int>(meta::STATUS) >= state_paused && o.log_mode)
+    };
+    if (pending.size() < parallel_outputs) {
+        for (size_t i = 0; i < pending.size(); i++)
+            render(i);
+    } else {
+        render_pool::run(pending.size(), render);
+    }
+
+    /* Text sources are updated and files are queued for the output thread in order */
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (paused && pending[i]->log_mode && !pending[i]->compiled->only_players())
             continue; /* No song playing text doesn't make sense in the log */
-        write_song(o, tmp_text);
+        write_song(*set, *pending[i], texts[i]);
     }
 }
 
+bool outputs_move_on()
+{
+    auto const set = config::active_outputs();
+    return std::any_of(set->outputs.begin(), set->outputs.end(), [](auto const& o) {
+        return o.compiled->timed() || o.compiled->follows_player_progress();
+    });
+}
+
+bool gzip(const QByteArray& in, QByteArray& out)
+{
+    z_stream zs {};
+    /* 15 window bits + 16 writes a gzip header instead of a zlib one */
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(int(deflateBound(&zs, uLong(in.size()))));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.constData()));
+    zs.avail_in = uInt(in.size());
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = uInt(out.size());
+
+    auto result = deflate(&zs, Z_FINISH);
+    out.resize(int(zs.total_out));
+    deflateEnd(&zs);
+    return result == Z_STREAM_END;
+}
+
 int64_t epoch()
 {
     return time(nullptr);
@@ -260,42 +441,100 @@ size_t write_callback(char* ptr, size_t size, size_t nmemb, std::string* str)
 
 QJsonDocument curl_get_json(const char* url)
 {
-    CURL* curl = curl_easy_init();
-    if (curl) {
-        std::string response {};
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-#ifdef DEBUG
-        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-#endif
-        CURLcode res = curl_easy_perform(curl);
+    async_http::request req;
+    req.url = url;
+    req.cancelled = media_thread::cancel_check();
+    auto const res = async_http::fetch(std::move(req)).get();
 
-        if (res != CURLE_OK) {
-            berr("Couldn't fetch json from %s curl error: %s (%i)", url, curl_easy_strerror(res), res);
-        } else {
-            QJsonParseError err;
-            auto doc = QJsonDocument::fromJson(response.c_str(), &err);
-            if (doc.isNull())
-                berr("Couldn't parse json from url %s: %s", url, err.errorString().toStdString().c_str());
-            else
-                return doc;
-        }
-        curl_easy_cleanup(curl);
+    if (res.result != CURLE_OK) {
+        berr("Couldn't fetch json from %s curl error: %s (%i)", url, res.error.c_str(), res.result);
+    } else {
+        QJsonParseError err;
+        auto doc = QJsonDocument::fromJson(QByteArray::fromRawData(res.body.data(), int(res.body.size())), &err);
+        if (doc.isNull())
+            berr("Couldn't parse json from url %s: %s", url, err.errorString().toStdString().c_str());
+        else
+            return doc;
     }
-    berr("curl_easy_init() failed when receiving json from %s", url);
     return {};
 }
 
-void set_thread_name(const char* name)
+static void set_thread_priority(const char* name, thread_priority priority)
+{
+#if _WIN32
+    static const int priorities[] = { THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_NORMAL, THREAD_PRIORITY_ABOVE_NORMAL };
+    if (!SetThreadPriority(GetCurrentThread(), priorities[priority]))
+        bwarn("Couldn't change priority of thread %s", name);
+#elif __APPLE__
+    static const qos_class_t classes[] = { QOS_CLASS_UTILITY, QOS_CLASS_DEFAULT, QOS_CLASS_USER_INITIATED };
+    if (pthread_set_qos_class_self_np(classes[priority], 0) != 0)
+        bwarn("Couldn't change priority of thread %s", name);
+#else
+    if (priority == PRIORITY_NORMAL)
+        return;
+    /* Linux keeps a nice value per thread, relative to the one inherited from OBS */
+    auto const tid = id_t(syscall(SYS_gettid));
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, tid);
+    if (errno != 0)
+        return;
+    nice += priority == PRIORITY_HIGH ? -5 : 5;
+    /* Raising the priority needs CAP_SYS_NICE, which OBS usually doesn't have */
+    if (setpriority(PRIO_PROCESS, tid, nice) != 0)
+        bdebug("Couldn't change priority of thread %s", name);
+#endif
+}
+
+static void set_thread_affinity(const char* name, uint64_t mask)
+{
+#if _WIN32
+    if (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(mask)))
+        bwarn("Couldn't set core affinity of thread %s", name);
+#elif __APPLE__
+    /* macOS only takes affinity hints for cache sharing, not core masks */
+    UNUSED_PARAMETER(name);
+    UNUSED_PARAMETER(mask);
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+        if (mask & (1ull << i))
+            CPU_SET(i, &set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        bwarn("Couldn't set core affinity of thread %s", name);
+#endif
+}
+
+void set_thread_name(const char* name, thread_priority priority)
 {
     os_set_thread_name(name);
+    if (config::thread_priorities)
+        set_thread_priority(name, priority);
+    if (config::thread_affinity)
+        set_thread_affinity(name, config::thread_affinity);
+}
+
+QString short_date(int year, int month, int day)
+{
+    static const QLocale locale = QLocale::system();
+    static const QString pattern = locale.dateFormat(QLocale::ShortFormat);
+    thread_local int last_year = 0, last_month = 0, last_day = 0;
+    thread_local QString last;
+
+    if (year != last_year || month != last_month || day != last_day || last.isNull()) {
+        last = locale.toString(QDate(year, month, day), pattern);
+        last_year = year;
+        last_month = month;
+        last_day = day;
+    }
+    return last;
 }
 
 QString remove_extensions(QString const& str)
 {
     QString result = str;
-    if (CGET_BOOL(CFG_REMOVE_EXTENSIONS)) {
+    if (config::remove_file_extensions) {
         /* that's every single format supported by vlc, i think */
         auto exts = { ".aac", ".ac3", ".adts", ".aif", ".aifc", ".aiff", ".amr", ".amv",
             ".aob", ".aqt", ".asf", ".ass", ".asx", ".au", ".avc", ".avchd",
@@ -411,6 +650,7 @@ void create_config_folder()
 
 void reset_lyrics()
 {
+    synced_lyrics::reset();
     QFile out(config::lyrics_path);
     if (out.open(QIODevice::WriteOnly | QIODevice::Text)) {
         QTextStream stream(&out);
@@ -429,6 +669,7 @@ void reset_lyrics()
 
 bool write_lyrics(const QString& lyrics)
 {
+    synced_lyrics::set(lyrics);
     QFile out(config::lyrics_path);
     if (out.open(QIODevice::WriteOnly | QIODevice::Text)) {
         QTextStream stream(&out);
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "../query/song.hpp"
 #include <QRect>
 #include <QString>
 #include <obs-module.h>
@@ -53,17 +54,42 @@ extern bool curl_download(const char* url, const char* path);
 
 QJsonDocument curl_get_json(const char* url);
 
-extern bool download_cover(const QString& url);
+/* Downloads the cover and also stores it in the cover cache under cache_key, if set */
+extern bool download_cover(const QString& url, const QString& cache_key = {});
+
+/* Downloads a remote cover into the cover cache without replacing the current one */
+extern void prefetch_cover(const QString& url);
+
+/* Replaces the cover with the cached one, returns false if it isn't cached */
+extern bool use_cached_cover(const QString& cache_key);
 
 extern void reset_cover();
 
+/* True if an image source shows config::cover_path, always true unless
+ * config::cover_by_reference is set */
+extern bool cover_file_needed();
+
+/* Hard links from to to if possible and copies it otherwise */
+extern bool link_or_copy(const QString& from, const QString& to);
+
 extern void reset_lyrics();
 
 extern bool write_lyrics(QString const& lyrics);
 
 extern void download_lyrics(const song& song);
 
-extern void handle_outputs(const song& song);
+/* Renders and writes all outputs that depend on one of the changed fields */
+extern void handle_outputs(const song& song, const meta::mask& changes = meta::mask().set());
+
+/* True if an output changes with the time, like timed lyrics or the progress of
+ * another player, and has to be rendered on every tick */
+extern bool outputs_move_on();
+
+/* True for the text sources that outputs can update directly (GDI+ and FreeType 2) */
+extern bool is_text_source(obs_source_t* src);
+
+/* Compresses data into the gzip format, used for http responses */
+extern bool gzip(const QByteArray& in, QByteArray& out);
 
 extern int64_t epoch();
 
@@ -71,13 +97,30 @@ extern bool window_pos_valid(QRect rect);
 
 extern size_t write_callback(char* ptr, size_t size, size_t nmemb, std::string* str);
 
-/* Redirected from util/threading.h because it clashes with mongoose */
-extern void set_thread_name(const char* name);
+enum thread_priority {
+    /* Cover and lyrics downloads, nothing waits for them */
+    PRIORITY_LOW,
+    PRIORITY_NORMAL,
+    /* The query thread, title changes shouldn't lag behind while encoding */
+    PRIORITY_HIGH
+};
+
+/* Redirected from util/threading.h because it clashes with mongoose. Also
+ * applies config::thread_priorities and config::thread_affinity to the calling
+ * thread, threads started before the config is loaded get the defaults */
+extern void set_thread_name(const char* name, thread_priority priority = PRIORITY_NORMAL);
 
 extern QString remove_extensions(QString const& str);
 
+/* The date in the short format of the system locale. The locale is read once
+ * and the last result is kept per thread, since songs rarely change their date */
+extern QString short_date(int year, int month, int day);
+
 extern QString file_from_path(QString const& file);
 
+/* Path of a file in the plugin config folder */
+extern QString get_config_file_path(QString const& name);
+
 extern bool open_config(const char* name, QJsonDocument&);
 extern bool save_config(const char* name, const QJsonDocument&);
 
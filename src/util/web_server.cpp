@@ -17,15 +17,26 @@
  *************************************************************************/
 
 #include "web_server.hpp"
+#include "../query/music_source.hpp"
+#include "activity.hpp"
 #include "config.hpp"
+#include "constants.hpp"
+#include "cover_image.hpp"
+#include "history.hpp"
+#include "metrics.hpp"
 #include "plugin-macros.generated.h"
+#include "synced_lyrics.hpp"
 #include "tuna_thread.hpp"
 #include "utility.hpp"
 #include <QDateTime>
 #include <QFile>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <algorithm>
+#include <cstring>
 #include <ctime>
+#include <functional>
 #include <httplib.h>
 #include <sstream>
 #include <util/platform.h>
@@ -35,89 +46,468 @@ namespace web_thread {
 std::thread thread_handle;
 std::mutex current_song_mutex;
 song current_song;
+std::atomic<bool> thread_flag { false };
 
 httplib::Server* server {};
 
+/* Address the running server was started with, it's restarted if they change */
+static std::string listening_host;
+static uint16_t listening_port = 0;
+
+/* Every event stream holds a worker of the pool until it's closed, these
+ * are kept free for short requests and idle keep-alive connections */
+static const size_t reserved_workers = 4;
+static size_t max_streams = 0;
+static std::atomic<size_t> open_streams { 0 };
+
+static std::string configured_host()
+{
+    return config::webserver_local_only ? "127.0.0.1" : "0.0.0.0";
+}
+
+/* Sets the ETag and turns the response into a 304 if the client already has this version */
+static bool not_modified(const httplib::Request& req, httplib::Response& res, const std::string& etag)
+{
+    res.set_header("ETag", etag.c_str());
+    res.set_header("Access-Control-Expose-Headers", "ETag");
+    if (req.get_header_value("If-None-Match") != etag)
+        return false;
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.set_header("Cache-Control", "no-cache");
+    res.status = 304;
+    return true;
+}
+
+//* Serves the cover, /cover.png?size=128 scales it down to fit 128x128 */
+static void handle_cover_get(const httplib::Request& req, httplib::Response& res)
+{
+    int size = 0;
+    if (req.has_param("size"))
+        size = std::clamp(atoi(req.get_param_value("size").c_str()), 0, 4096);
+
+    auto cover = cover_image::get(size);
+    if (!cover) {
+        res.set_content("500 Internal Server Error: Couldn't open cover file", "text/plain");
+        res.set_header("Server", "tuna/" PLUGIN_VERSION);
+        res.status = 500;
+        return;
+    }
+    if (not_modified(req, res, cover->etag))
+        return;
+
+    /* The name says png, but embedded covers are usually jpegs */
+    res.set_content(cover->data.constData(), cover->data.size(), cover->mime);
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Cache-Control", "no-cache");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.status = 200;
+}
+
 //* GET requests will result in song information */
-static inline void handle_info_get(const httplib::Request&, httplib::Response& res)
+/* Sends bytes owned by the snapshot without copying them into the response,
+ * the snapshot is kept alive until the response was written */
+static void set_snapshot_content(httplib::Response& res, std::shared_ptr<const tuna_thread::song_snapshot> snap, const QByteArray& data, const char* type)
+{
+    const char* bytes = data.constData();
+    res.set_content_provider(size_t(data.size()), type, [snap, bytes](size_t offset, size_t length, httplib::DataSink& sink) {
+        return sink.write(bytes + offset, length);
+    });
+}
+
+static inline void handle_info_get(const httplib::Request& req, httplib::Response& res)
+{
+    /* The snapshot already contains its song information as utf8 json */
+    const auto snap = tuna_thread::snapshot();
+    /* Generations restart with the plugin, the start time keeps old tags from matching */
+    static const auto boot = std::to_string(os_gettime_ns());
+    if (not_modified(req, res, "\"" + boot + "-" + std::to_string(snap->generation) + "\""))
+        return;
+
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.set_header("Cache-Control", "no-cache");
+    res.set_header("Content-Language", "en-US");
+    res.set_header("Vary", "Accept-Encoding");
+    res.status = 200;
+
+    /* Lyrics and descriptions can make this quite long, so it's compressed once per snapshot */
+    if (req.get_header_value("Accept-Encoding").find("gzip") != std::string::npos) {
+        const auto& compressed = snap->json_gzip(true);
+        if (!compressed.isEmpty()) {
+            res.set_header("Content-Encoding", "gzip");
+            set_snapshot_content(res, snap, compressed, "application/json; charset=utf-8");
+            return;
+        }
+    }
+    set_snapshot_content(res, snap, snap->json(true), "application/json; charset=utf-8");
+}
+
+/* Changes to these fields are sent as a small progress event instead of the full song */
+static const meta::mask progress_fields = meta::mask(meta::bit(meta::PROGRESS) | meta::bit(meta::PLAYBACK_DATE) | meta::bit(meta::PLAYBACK_TIME));
+
+static void write_event(httplib::DataSink& sink, const char* type, const QByteArray& data)
+{
+    std::string event = "event: ";
+    event += type;
+    event += "\ndata: ";
+    event.append(data.constData(), data.size());
+    event += "\n\n";
+    sink.write(event.data(), event.size());
+}
+
+/* Takes one of the stream slots, responds with 503 if they're all in use */
+static bool open_stream(httplib::Response& res)
+{
+    if (open_streams.fetch_add(1) < max_streams)
+        return true;
+    open_streams--;
+    res.set_header("Retry-After", "5");
+    res.status = 503;
+    return false;
+}
+
+static void close_stream()
+{
+    open_streams--;
+    metrics::client_disconnected();
+}
+
+//* Server-sent events, pushes the song whenever a new one is published */
+static void handle_events_get(const httplib::Request&, httplib::Response& res)
+{
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.set_header("Cache-Control", "no-store");
+    if (!open_stream(res))
+        return;
+
+    /* Last snapshot sent over this connection, nullptr until the first event */
+    auto last = std::make_shared<std::shared_ptr<const tuna_thread::song_snapshot>>();
+    metrics::client_connected();
+    res.set_chunked_content_provider("text/event-stream", [last](size_t, httplib::DataSink& sink) {
+        if (!thread_flag || !sink.is_writable())
+            return false;
+        activity::web_request();
+
+        auto& prev = *last;
+        if (!prev) {
+            prev = tuna_thread::snapshot();
+            write_event(sink, "song", prev->json());
+            return true;
+        }
+
+        /* Wake up regularly to notice shutdowns and closed connections */
+        auto snap = tuna_thread::wait_for_snapshot(prev->generation, std::chrono::seconds(1));
+        if (snap->generation == prev->generation)
+            return true;
+
+        auto const changes = snap->info.diff(prev->info);
+        if ((changes & ~progress_fields).any()) {
+            write_event(sink, "song", snap->json());
+        } else if (changes.test(meta::PROGRESS)) {
+            write_event(sink, "progress", QByteArray("{\"progress\":") + QByteArray::number(snap->info.get<int>(meta::PROGRESS)) + "}");
+        }
+        prev = snap;
+        return true;
+    },
+        [](bool) { close_stream(); });
+    res.status = 200;
+}
+
+static QByteArray lyrics_json(const synced_lyrics::position& pos)
 {
-    /* Write current song to json
-     * and properly convert it to utf8
-     */
     QJsonObject obj;
-    QJsonDocument doc;
-    QString json;
+    obj["index"] = pos.index;
+    obj["line"] = pos.line;
+    obj["next"] = pos.next;
+    return QJsonDocument(obj).toJson(QJsonDocument::Compact);
+}
+
+//* Server-sent events with the current line of timed lyrics, only sent when it changes */
+static void handle_lyrics_events_get(const httplib::Request&, httplib::Response& res)
+{
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.set_header("Cache-Control", "no-store");
+    if (!open_stream(res))
+        return;
+
+    struct state {
+        std::shared_ptr<const tuna_thread::song_snapshot> snap;
+        synced_lyrics::position pos;
+    };
+    auto last = std::make_shared<state>();
+    metrics::client_connected();
+    res.set_chunked_content_provider("text/event-stream", [last](size_t, httplib::DataSink& sink) {
+        if (!thread_flag || !sink.is_writable())
+            return false;
+        activity::web_request();
+
+        auto snap = last->snap ? tuna_thread::wait_for_snapshot(last->snap->generation, std::chrono::seconds(1)) : tuna_thread::snapshot();
+        auto pos = synced_lyrics::at(snap->info.get<int>(meta::PROGRESS));
+        if (!last->snap || pos.index != last->pos.index || pos.generation != last->pos.generation)
+            write_event(sink, "lyrics", lyrics_json(pos));
+        last->snap = snap;
+        last->pos = pos;
+        return true;
+    },
+        [](bool) { close_stream(); });
+    res.status = 200;
+}
+
+//* Recently played tracks, newest first. ?offset=0&limit=50 */
+static void handle_history_get(const httplib::Request& req, httplib::Response& res)
+{
+    size_t offset = 0, limit = 50;
+    if (req.has_param("offset"))
+        offset = size_t(std::max(atoi(req.get_param_value("offset").c_str()), 0));
+    if (req.has_param("limit"))
+        limit = size_t(std::clamp(atoi(req.get_param_value("limit").c_str()), 1, 200));
+
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.set_header("Cache-Control", "no-cache");
+    const auto json = history::json(offset, limit);
+    res.set_content(json.constData(), json.size(), "application/json; charset=utf-8");
+    res.status = 200;
+}
+
+/* Any website could otherwise control playback from the streamer's browser,
+ * so commands are only taken from local pages, browser extensions and clients
+ * that don't send an origin at all, like stream deck plugins */
+static bool trusted_origin(const std::string& origin)
+{
+    static const char* extensions[] = { "chrome-extension://", "moz-extension://", "safari-web-extension://" };
+    static const char* hosts[] = { "localhost", "127.0.0.1", "[::1]" };
+    if (origin.empty())
+        return true;
+    for (auto const* e : extensions) {
+        if (origin.rfind(e, 0) == 0)
+            return true;
+    }
+
+    const auto scheme = origin.find("://");
+    if (scheme == std::string::npos)
+        return false;
+    const auto host = origin.substr(scheme + 3);
+    for (auto const* h : hosts) {
+        const size_t len = strlen(h);
+        if (host.compare(0, len, h) == 0 && (host.size() == len || host[len] == ':'))
+            return true;
+    }
+    return false;
+}
+
+/* Answers trusted origins with their own origin instead of a wildcard */
+static bool allow_control_origin(const httplib::Request& req, httplib::Response& res)
+{
+    const auto origin = req.get_header_value("Origin");
+    res.set_header("Vary", "Origin");
+    if (!trusted_origin(origin)) {
+        res.status = 403;
+        return false;
+    }
+    if (!origin.empty())
+        res.set_header("Access-Control-Allow-Origin", origin.c_str());
+    return true;
+}
 
-    tuna_thread::copy_mutex.lock();
-    tuna_thread::copy.to_json(obj);
-    tuna_thread::copy_mutex.unlock();
+//* Playback commands for the selected source, {"command": "next"} */
+static void handle_control_post(const httplib::Request& req, httplib::Response& res)
+{
+    static const std::pair<const char*, capability> names[] = {
+        { "next", CAP_NEXT_SONG },
+        { "previous", CAP_PREV_SONG },
+        { "play_pause", CAP_PLAY_PAUSE },
+        { "stop", CAP_STOP_SONG },
+        { "volume_up", CAP_VOLUME_UP },
+        { "volume_down", CAP_VOLUME_DOWN },
+        { "mute", CAP_VOLUME_MUTE },
+    };
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
 
-    doc.setObject(obj);
-    json = QString(doc.toJson(QJsonDocument::Indented));
-    std::wstring wstr = json.toStdWString();
-    std::string str;
+    if (!allow_control_origin(req, res))
+        return;
+    if (!config::webserver_control) {
+        res.status = 403;
+        return;
+    }
 
-    size_t len = os_wcs_to_utf8(wstr.c_str(), 0, nullptr, 0);
-    str.resize(len);
-    os_wcs_to_utf8(wstr.c_str(), 0, &str[0], len + 1);
+    const auto command = QJsonDocument::fromJson(QByteArray::fromStdString(req.body)).object()["command"].toString();
+    for (auto const& n : names) {
+        if (command != n.first)
+            continue;
+        const auto src = music_sources::selected_source();
+        if (!src || !src->has_capability(n.second)) {
+            res.status = 409;
+        } else {
+            /* Accepted, the outcome shows up on /events once the query thread ran it */
+            res.status = tuna_thread::queue_command(n.second) ? 202 : 503;
+        }
+        return;
+    }
+    res.status = 400;
+}
+
+//* Every player that sources like MPRIS follow at the same time */
+static void handle_players_get(const httplib::Request&, httplib::Response& res)
+{
+    QJsonArray players;
+    for (const auto& src : std::as_const(music_sources::instances)) {
+        for (const auto& p : src->players()) {
+            QJsonObject song, obj;
+            p.info.to_json(song);
+            obj["source"] = src->id();
+            obj["id"] = p.id;
+            obj["name"] = p.name;
+            obj["song"] = song;
+            players.append(obj);
+        }
+    }
 
     res.set_header("Access-Control-Allow-Origin", "*");
     res.set_header("Server", "tuna/" PLUGIN_VERSION);
-    res.set_header("Content-Type", "application/json; charset=utf-8");
-    res.set_header("Connection", "close");
+    res.set_header("Cache-Control", "no-cache");
+    const auto json = QJsonDocument(players).toJson(QJsonDocument::Compact);
+    res.set_content(json.constData(), json.size(), "application/json; charset=utf-8");
+    res.status = 200;
+}
+
+//* Health of the query thread and network requests in the Prometheus text format */
+static void handle_metrics_get(const httplib::Request&, httplib::Response& res)
+{
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
     res.set_header("Cache-Control", "no-store");
-    res.set_header("Content-Language", "en-US");
-    res.set_content(str.c_str(), "application/json; charset=utf-8");
+    res.body = metrics::text();
+    res.set_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
     res.status = 200;
 }
 
 //* POST means we're getting information */
+/* Tab of the userscript that currently reports to tuna. Other tabs are
+ * ignored until they start playing or the owner goes quiet */
+static std::mutex owner_mutex;
+static std::string owner_tab;
+static uint64_t owner_time = 0;
+static const uint64_t owner_timeout = 5ull * SECOND_TO_NS;
+
+/* Takes over ownership for tabs that play something, returns whether the tab may report */
+static bool claim_tab(const QString& tab, const QJsonObject& data)
+{
+    /* Scripts older than the handshake don't send a tab id */
+    if (tab.isEmpty())
+        return true;
+    auto const id = qt_to_utf8(tab);
+    auto const now = os_gettime_ns();
+    std::lock_guard<std::mutex> lock(owner_mutex);
+    bool const playing = data["status"].toString() == "playing";
+    if (owner_tab != id && !playing && !owner_tab.empty() && now - owner_time < owner_timeout)
+        return false;
+    owner_tab = id;
+    owner_time = now;
+    return true;
+}
+
+/* Applies one report of the userscript, returns false if its tab isn't the active one */
+static bool apply_post(const QJsonObject& root)
+{
+    auto const data = root["data"];
+    if (!data.isObject())
+        return true;
+    if (!claim_tab(root["tab"].toString(), data.toObject()))
+        return false;
+
+    /* Parsed before locking so the query thread doesn't have to wait */
+    song parsed;
+    auto const fields = parsed.from_json(data.toObject());
+    /* Deltas only contain the fields that changed, e.g. just the progress */
+    bool delta = root["delta"].toBool();
+    std::lock_guard<std::mutex> lock(current_song_mutex);
+    if (delta)
+        current_song.merge(parsed, fields);
+    else
+        current_song = std::move(parsed);
+    return true;
+}
+
 static void handle_post(const httplib::Request& req, httplib::Response& res)
 {
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.set_header("Cache-Control", "no-store");
+
+    /* The userscript posts about once per second, most of the time nothing changed */
+    static std::atomic<size_t> last_hash { 0 };
+    const auto hash = std::hash<std::string> {}(req.body);
+    if (hash == last_hash) {
+        res.set_content("{\"active\":true}", "application/json; charset=utf-8");
+        res.status = 200;
+        return;
+    }
+
     /* Parse POST data JSON */
-    auto str = utf8_to_qt(req.body.c_str());
     QJsonParseError err {};
-    QJsonDocument doc = QJsonDocument::fromJson(str.toUtf8(), &err);
-
-    if (err.error == QJsonParseError::NoError && doc.isObject()) {
-        auto const data = doc.object()["data"];
+    QJsonDocument doc = QJsonDocument::fromJson(QByteArray::fromRawData(req.body.data(), int(req.body.size())), &err);
 
-        if (data.isObject()) {
-            auto const obj = data.toObject();
-            std::lock_guard<std::mutex> lock(current_song_mutex);
-            current_song.from_json(obj);
-        }
-    } else {
+    if (err.error != QJsonParseError::NoError || !doc.isObject()) {
         bwarn("Error while parsing JSON received via POST: %s", qt_to_utf8(err.errorString()));
         bwarn("JSON: %s", req.body.c_str());
         res.set_content(qt_to_utf8(err.errorString()), "text/plain");
-        res.set_header("Access-Control-Allow-Origin", "*");
-        res.set_header("Server", "tuna/" PLUGIN_VERSION);
         res.status = 500;
         return;
     }
 
-    /* Simple OK reponse */
-    res.set_content("200 OK", "text/plain; charset=utf-8");
-    res.set_header("Connection", "close");
-    res.set_header("Cache-Control", "no-store");
-    res.set_header("Access-Control-Allow-Origin", "*");
-    res.set_header("Server", "tuna/" PLUGIN_VERSION);
-    res.set_header("Connection", "close");
-    res.set_header("Cache-Control", "no-store");
+    /* Beacons from the userscript carry several reports in the order they were made */
+    auto const root = doc.object();
+    bool active = true;
+    if (root["batch"].isArray()) {
+        for (auto const& entry : root["batch"].toArray())
+            active = apply_post(entry.toObject()) && active;
+    } else {
+        active = apply_post(root);
+    }
+
+    if (active) {
+        last_hash = hash;
+        tuna_thread::wakeup(S_SOURCE_WEB);
+    }
+
+    /* Tells the tab whether it should keep reporting */
+    res.set_content(active ? "{\"active\":true}" : "{\"active\":false}", "application/json; charset=utf-8");
     res.set_header("Content-Language", "en-US");
     res.status = 200;
 }
 
 bool start()
 {
-    if (server && server->is_running() && server->is_valid())
+    if (server && server->is_running() && server->is_valid()
+        && listening_host == configured_host() && listening_port == config::webserver_port)
         return true;
     stop();
     server = new httplib::Server;
+    listening_host = configured_host();
+    listening_port = config::webserver_port;
+
+    /* Overlays and the userscript send requests continuously, so connections are reused */
+    server->set_keep_alive_max_count(std::max<size_t>(config::webserver_keep_alive, 1));
+    server->set_keep_alive_timeout(5);
+    /* Event streams can occupy webserver_threads workers, the rest always serves other requests */
+    max_streams = config::webserver_threads;
+    const size_t threads = max_streams + reserved_workers;
+    server->new_task_queue = [threads] { return new httplib::ThreadPool(threads); };
 
     server->set_logger([](const httplib::Request&, const httplib::Response&) {});
-    server->Options("/", [](const httplib::Request&, httplib::Response& res) {
+    /* Posts from the userscript feed tuna and monitoring doesn't read the song,
+     * only overlays, control panels and other readers keep it out of idle mode */
+    server->set_pre_routing_handler([](const httplib::Request& req, httplib::Response&) {
+        if ((req.method != "POST" || req.path == "/control") && req.path != "/metrics")
+            activity::web_request();
+        return httplib::Server::HandlerResponse::Unhandled;
+    });
+    server->Options("/|/control", [](const httplib::Request& req, httplib::Response& res) {
+        if (req.path == "/control" && !allow_control_origin(req, res))
+            return;
         time_t now = time(nullptr);
         char date[100];
         strftime(date, sizeof(date), "%d, %b %Y %H:%M:%S GMT", gmtime(&now));
@@ -125,29 +515,23 @@ bool start()
         res.set_header("Access-Control-Allow-Methods", "POST");
         res.set_header("Access-Control-Allow-Headers", "*");
         res.set_header("Access-Control-Max-Age", "84600");
-        res.set_header("Access-Control-Allow-Origin", "*");
+        if (req.path != "/control")
+            res.set_header("Access-Control-Allow-Origin", "*");
         res.set_header("Date", date);
         res.set_header("Server", "tuna/" PLUGIN_VERSION);
         res.set_content(date, "text/plain");
     });
-    server->Get("/cover.png", [](const httplib::Request&, httplib::Response& res) {
-        QFile f(config::cover_path);
-        if (f.open(QIODevice::ReadOnly)) {
-            auto data = f.readAll();
-            res.set_content(data, data.length(), "image/png");
-            res.set_header("Access-Control-Allow-Origin", "*");
-            res.set_header("Cache-Control", "no-cache");
-            res.set_header("Server", "tuna/" PLUGIN_VERSION);
-            res.status = 200;
-        } else {
-            res.set_content("500 Internal Server Error: Couldn't open cover file", "text/plain");
-            res.set_header("Server", "tuna/" PLUGIN_VERSION);
-            res.status = 500;
-        }
-    });
+    server->Get("/cover.png", handle_cover_get);
     server->Get("/", handle_info_get);
+    server->Get("/events", handle_events_get);
+    server->Get("/lyrics/events", handle_lyrics_events_get);
+    server->Get("/metrics", handle_metrics_get);
+    server->Get("/history", handle_history_get);
+    server->Get("/players", handle_players_get);
     server->Post("/", handle_post);
+    server->Post("/control", handle_control_post);
 
+    thread_flag = true;
     thread_handle = std::thread(thread_method);
     return thread_handle.native_handle();
 }
@@ -156,6 +540,8 @@ void stop()
 {
     if (server) {
         bdebug("Stopping webserver...");
+        /* Makes open event streams end */
+        thread_flag = false;
         if (server->is_running() && server->is_valid())
             server->stop();
         thread_handle.join();
@@ -168,8 +554,7 @@ void stop()
 void thread_method()
 {
     util::set_thread_name("tuna-webserver");
-    auto port = CGET_STR(CFG_SERVER_PORT);
-    binfo("Webserver listening on %s", port);
-    server->listen("0.0.0.0", atoi(port));
+    binfo("Webserver listening on %s:%i", listening_host.c_str(), listening_port);
+    server->listen(listening_host.c_str(), listening_port);
 }
 }
@@ -7,9 +7,21 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <utility>
 #include <vector>
 
 void GetWindowList(std::vector<std::string>& windows);
 void GetWindowAndExeList(std::vector<std::pair<std::string, std::string>>& list);
+
+/* Keeps the window lists up to date from window system events on a background
+ * thread, the lists above are then read from that cache. changed is called on
+ * that thread after every update. Returns false if the platform can't do that,
+ * in which case the lists are enumerated on every call */
+bool StartWindowWatcher(std::function<void()> changed);
+void StopWindowWatcher();
+
+/* Increased whenever the watcher updated the cached lists */
+uint64_t WindowListGeneration();
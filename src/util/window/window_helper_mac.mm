@@ -81,3 +81,12 @@ void GetWindowAndExeList(vector<pair<string, string>> &list) {
     }
   }
 }
+
+bool StartWindowWatcher(std::function<void()>) {
+  /* Not implemented, the window list is polled instead */
+  return false;
+}
+
+void StopWindowWatcher() {}
+
+uint64_t WindowListGeneration() { return 0; }
@@ -1,10 +1,18 @@
 #include "window_helper.hpp"
+#if WITH_WAYLAND
+#include "window_helper_wayland.hpp"
+#endif
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <atomic>
 #include <list>
+#include <map>
+#include <mutex>
 #include <obs-module.h>
+#include <poll.h>
 #include <string>
+#include <thread>
 #include <unistd.h>
 #include <util/platform.h>
 #include <utility>
@@ -25,10 +33,31 @@ Display* disp()
     return xdisplay;
 }
 
-bool ewmhIsSupported()
+/* Interned once per connection instead of on every lookup */
+struct atoms {
+    Atom supporting_wm_check;
+    Atom client_list;
+    Atom wm_name;
+    Atom wm_pid;
+
+    explicit atoms(Display* d)
+        : supporting_wm_check(XInternAtom(d, "_NET_SUPPORTING_WM_CHECK", true))
+        , client_list(XInternAtom(d, "_NET_CLIENT_LIST", true))
+        , wm_name(XInternAtom(d, "_NET_WM_NAME", false))
+        , wm_pid(XInternAtom(d, "_NET_WM_PID", true))
+    {
+    }
+};
+
+const atoms& disp_atoms()
+{
+    static atoms a(disp());
+    return a;
+}
+
+bool ewmhIsSupported(Display* display = disp(), const atoms& a = disp_atoms())
 {
-    Display* display = disp();
-    Atom netSupportingWmCheck = XInternAtom(display, "_NET_SUPPORTING_WM_CHECK", true);
+    Atom netSupportingWmCheck = a.supporting_wm_check;
     Atom actualType;
     int format = 0;
     unsigned long num = 0, bytes = 0;
@@ -62,11 +91,11 @@ bool ewmhIsSupported()
     return ewmh_window != 0;
 }
 
-list<Window> getTopLevelWindows()
+list<Window> getTopLevelWindows(Display* display = disp(), const atoms& a = disp_atoms())
 {
     list<Window> res;
 
-    if (!ewmhIsSupported()) {
+    if (!ewmhIsSupported(display, a)) {
         blog(LOG_WARNING, "Unable to query window list "
                           "because window manager "
                           "does not support extended "
@@ -74,16 +103,16 @@ list<Window> getTopLevelWindows()
         return res;
     }
 
-    Atom netClList = XInternAtom(disp(), "_NET_CLIENT_LIST", true);
+    Atom netClList = a.client_list;
     Atom actualType;
     int format;
     unsigned long num, bytes;
     Window* data = 0;
 
-    for (int i = 0; i < ScreenCount(disp()); ++i) {
-        Window rootWin = RootWindow(disp(), i);
+    for (int i = 0; i < ScreenCount(display); ++i) {
+        Window rootWin = RootWindow(display, i);
 
-        int status = XGetWindowProperty(disp(), rootWin, netClList, 0L, ~0L, false, AnyPropertyType, &actualType,
+        int status = XGetWindowProperty(display, rootWin, netClList, 0L, ~0L, false, AnyPropertyType, &actualType,
             &format, &num, &bytes, (uint8_t**)&data);
 
         if (status != Success) {
@@ -102,18 +131,17 @@ list<Window> getTopLevelWindows()
     return res;
 }
 
-string getWindowAtom(Window win, const char* atom)
+string getWindowAtom(Window win, Atom netWmName, Display* display = disp())
 {
-    Atom netWmName = XInternAtom(disp(), atom, false);
     int n;
     char** list = 0;
-    XTextProperty tp;
+    XTextProperty tp {};
     string res = "unknown";
 
-    XGetTextProperty(disp(), win, &tp, netWmName);
+    XGetTextProperty(display, win, &tp, netWmName);
 
     if (!tp.nitems)
-        XGetWMName(disp(), win, &tp);
+        XGetWMName(display, win, &tp);
 
     if (!tp.nitems)
         return "error";
@@ -121,7 +149,7 @@ string getWindowAtom(Window win, const char* atom)
     if (tp.encoding == XA_STRING) {
         res = (char*)tp.value;
     } else {
-        int ret = XmbTextPropertyToTextList(disp(), &tp, &list, &n);
+        int ret = XmbTextPropertyToTextList(display, &tp, &list, &n);
 
         if (ret >= Success && n > 0 && *list) {
             res = *list;
@@ -139,25 +167,20 @@ string getWindowAtom(Window win, const char* atom)
     return res;
 }
 
-inline string getWindowName(Window win)
-{
-    return getWindowAtom(win, "_NET_WM_NAME");
-}
-
-inline string getWindowClass(Window win)
+inline string getWindowName(Window win, Display* display = disp(), const atoms& a = disp_atoms())
 {
-    return getWindowAtom(win, "WM_CLASS");
+    return getWindowAtom(win, a.wm_name, display);
 }
 
-inline string getWindowExe(Window win)
+inline string getWindowExe(Window win, Display* display = disp(), const atoms& a = disp_atoms())
 {
-    Atom windowPID = XInternAtom(disp(), "_NET_WM_PID", true);
+    Atom windowPID = a.wm_pid;
     Atom actualType;
     int format;
     unsigned long num, bytes;
     unsigned char* propPID = nullptr;
     if (windowPID != None) {
-        if (XGetWindowProperty(disp(), win, windowPID, 0, 1, False, XA_CARDINAL, &actualType, &format, &num, &bytes,
+        if (XGetWindowProperty(display, win, windowPID, 0, 1, False, XA_CARDINAL, &actualType, &format, &num, &bytes,
                 &propPID)
             == Success) {
             if (propPID != nullptr) {
@@ -177,8 +200,189 @@ inline string getWindowExe(Window win)
 
 } // namespace x11util
 
+/* Window list kept up to date by the watcher thread from PropertyNotify events */
+namespace watcher {
+static std::thread thread_handle;
+static std::atomic<bool> thread_flag { false };
+/* Set instead of thread_flag while the Wayland backend fills the cache */
+static std::atomic<bool> wayland { false };
+static std::atomic<uint64_t> generation { 0 };
+static std::mutex cache_mutex;
+static vector<pair<string, string>> cache; /* exe and title in client list order */
+
+/* The display of the watcher thread, whose errors are ignored */
+static Display* watch_display = nullptr;
+static XErrorHandler previous_handler = nullptr;
+
+/* Windows can be gone by the time we ask for their properties, which
+ * would otherwise end up in Xlib's default handler that exits */
+static int ignore_errors(Display* d, XErrorEvent* e)
+{
+    if (d == watch_display)
+        return 0;
+    return previous_handler ? previous_handler(d, e) : 0;
+}
+
+static bool running()
+{
+#if WITH_WAYLAND
+    /* The Wayland thread ends by itself if the compositor goes away */
+    if (wayland && !wayland_toplevel::running())
+        wayland = false;
+#endif
+    return thread_flag || wayland;
+}
+
+struct tracked_window {
+    string exe, title;
+};
+
+static void thread_method(std::function<void()> changed)
+{
+    os_set_thread_name("tuna-x11-watch");
+    Display* d = watch_display;
+    const x11util::atoms a(d);
+    map<Window, tracked_window> windows;
+    vector<Window> order;
+
+    auto publish = [&] {
+        vector<pair<string, string>> list;
+        list.reserve(order.size());
+        for (auto w : order)
+            list.emplace_back(windows[w].exe, windows[w].title);
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            cache.swap(list);
+        }
+        generation++;
+        changed();
+    };
+
+    auto rescan = [&] {
+        auto top_level = x11util::getTopLevelWindows(d, a);
+        map<Window, tracked_window> next;
+        order.assign(top_level.begin(), top_level.end());
+        for (auto w : order) {
+            auto it = windows.find(w);
+            if (it != windows.end()) {
+                next[w] = std::move(it->second);
+                continue;
+            }
+            /* Title changes of new windows are reported from now on */
+            XSelectInput(d, w, PropertyChangeMask);
+            next[w] = { x11util::getWindowExe(w, d, a), x11util::getWindowName(w, d, a) };
+        }
+        windows.swap(next);
+    };
+
+    for (int i = 0; i < ScreenCount(d); ++i)
+        XSelectInput(d, RootWindow(d, i), PropertyChangeMask);
+    rescan();
+    publish();
+
+    pollfd fd { ConnectionNumber(d), POLLIN, 0 };
+    while (thread_flag) {
+        /* Wake up regularly to check if we should stop */
+        if (!XPending(d) && poll(&fd, 1, 250) <= 0)
+            continue;
+
+        bool dirty = false, list_changed = false;
+        while (XPending(d)) {
+            XEvent e;
+            XNextEvent(d, &e);
+            if (e.type != PropertyNotify)
+                continue;
+            auto const& p = e.xproperty;
+            if (p.atom == a.client_list) {
+                list_changed = true;
+            } else if (p.atom == a.wm_name || p.atom == XA_WM_NAME) {
+                auto it = windows.find(p.window);
+                if (it != windows.end()) {
+                    it->second.title = x11util::getWindowName(p.window, d, a);
+                    dirty = true;
+                }
+            }
+        }
+
+        if (list_changed)
+            rescan();
+        if (dirty || list_changed)
+            publish();
+    }
+}
+}
+
+bool StartWindowWatcher(std::function<void()> changed)
+{
+    if (watcher::running())
+        return true;
+#if WITH_WAYLAND
+    /* Native Wayland windows don't show up in the XWayland client list at all */
+    watcher::wayland = wayland_toplevel::start([changed](wayland_toplevel::window_list&& list) {
+        {
+            std::lock_guard<std::mutex> lock(watcher::cache_mutex);
+            watcher::cache.swap(list);
+        }
+        watcher::generation++;
+        changed();
+    });
+    if (watcher::wayland)
+        return true;
+#endif
+    /* Xlib connections can't be shared between threads, so the watcher gets its own */
+    auto* d = XOpenDisplay(nullptr);
+    if (!d)
+        return false;
+    if (!x11util::ewmhIsSupported(d, x11util::atoms(d))) {
+        XCloseDisplay(d);
+        return false;
+    }
+
+    watcher::watch_display = d;
+    watcher::previous_handler = XSetErrorHandler(watcher::ignore_errors);
+    watcher::thread_flag = true;
+    watcher::thread_handle = std::thread(watcher::thread_method, std::move(changed));
+    return true;
+}
+
+void StopWindowWatcher()
+{
+#if WITH_WAYLAND
+    /* Also joins the thread if it already ended by itself */
+    wayland_toplevel::stop();
+    if (watcher::wayland) {
+        watcher::wayland = false;
+        return;
+    }
+#endif
+    if (!watcher::thread_flag)
+        return;
+    watcher::thread_flag = false;
+    if (watcher::thread_handle.joinable())
+        watcher::thread_handle.join();
+
+    /* Only put the old handler back if nobody replaced ours in the meantime */
+    auto current = XSetErrorHandler(watcher::previous_handler);
+    if (current != watcher::ignore_errors)
+        XSetErrorHandler(current);
+    XCloseDisplay(watcher::watch_display);
+    watcher::watch_display = nullptr;
+}
+
+uint64_t WindowListGeneration()
+{
+    return watcher::generation;
+}
+
 void GetWindowList(vector<string>& windows)
 {
+    if (watcher::running()) {
+        std::lock_guard<std::mutex> lock(watcher::cache_mutex);
+        for (const auto& w : watcher::cache)
+            windows.emplace_back(w.second);
+        return;
+    }
+
     list<Window> top_level = x11util::getTopLevelWindows();
     for (const auto& window : top_level) {
         windows.emplace_back(x11util::getWindowName(window));
@@ -187,6 +391,15 @@ void GetWindowList(vector<string>& windows)
 
 void GetWindowAndExeList(vector<pair<string, string>>& list)
 {
+    if (watcher::running()) {
+        std::lock_guard<std::mutex> lock(watcher::cache_mutex);
+        for (const auto& w : watcher::cache) {
+            if (!w.first.empty())
+                list.emplace_back(w);
+        }
+        return;
+    }
+
     auto top_level = x11util::getTopLevelWindows();
     for (const auto& window : top_level) {
         auto exe = x11util::getWindowExe(window);
@@ -0,0 +1,226 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "window_helper_wayland.hpp"
+#include "../utility.hpp"
+#include "wlr-foreign-toplevel-management-unstable-v1-client-protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <thread>
+#include <util/platform.h>
+#include <wayland-client.h>
+
+namespace wayland_toplevel {
+struct toplevel {
+    zwlr_foreign_toplevel_handle_v1* handle = nullptr;
+    std::string app_id, title;
+};
+
+static wl_display* display = nullptr;
+static wl_registry* registry = nullptr;
+static zwlr_foreign_toplevel_manager_v1* manager = nullptr;
+static std::vector<toplevel*> toplevels;
+static bool dirty = false;
+
+static std::thread thread_handle;
+/* Cleared by stop(), or by the thread itself once the compositor is gone */
+static std::atomic<bool> thread_flag { false };
+
+/* Only the display thread touches the toplevels, the events below are
+ * dispatched from it once start() handed the connection over */
+static void on_title(void* data, zwlr_foreign_toplevel_handle_v1*, const char* title)
+{
+    static_cast<toplevel*>(data)->title = title ? title : "";
+}
+
+static void on_app_id(void* data, zwlr_foreign_toplevel_handle_v1*, const char* app_id)
+{
+    static_cast<toplevel*>(data)->app_id = app_id ? app_id : "";
+}
+
+static void on_output_enter(void*, zwlr_foreign_toplevel_handle_v1*, wl_output*) { }
+static void on_output_leave(void*, zwlr_foreign_toplevel_handle_v1*, wl_output*) { }
+static void on_state(void*, zwlr_foreign_toplevel_handle_v1*, wl_array*) { }
+static void on_parent(void*, zwlr_foreign_toplevel_handle_v1*, zwlr_foreign_toplevel_handle_v1*) { }
+
+/* Sent after every batch of changes to a window */
+static void on_done(void*, zwlr_foreign_toplevel_handle_v1*)
+{
+    dirty = true;
+}
+
+static void on_closed(void* data, zwlr_foreign_toplevel_handle_v1* handle)
+{
+    auto* t = static_cast<toplevel*>(data);
+    toplevels.erase(std::remove(toplevels.begin(), toplevels.end(), t), toplevels.end());
+    zwlr_foreign_toplevel_handle_v1_destroy(handle);
+    delete t;
+    dirty = true;
+}
+
+static const zwlr_foreign_toplevel_handle_v1_listener toplevel_listener {
+    on_title,
+    on_app_id,
+    on_output_enter,
+    on_output_leave,
+    on_state,
+    on_done,
+    on_closed,
+    on_parent,
+};
+
+static void on_toplevel(void*, zwlr_foreign_toplevel_manager_v1*, zwlr_foreign_toplevel_handle_v1* handle)
+{
+    auto* t = new toplevel;
+    t->handle = handle;
+    toplevels.emplace_back(t);
+    zwlr_foreign_toplevel_handle_v1_add_listener(handle, &toplevel_listener, t);
+}
+
+static void on_finished(void*, zwlr_foreign_toplevel_manager_v1* m)
+{
+    zwlr_foreign_toplevel_manager_v1_destroy(m);
+    if (m == manager)
+        manager = nullptr;
+}
+
+static const zwlr_foreign_toplevel_manager_v1_listener manager_listener {
+    on_toplevel,
+    on_finished,
+};
+
+static void on_global(void*, wl_registry* r, uint32_t name, const char* interface, uint32_t version)
+{
+    if (manager || strcmp(interface, zwlr_foreign_toplevel_manager_v1_interface.name) != 0)
+        return;
+    version = std::min<uint32_t>(version, zwlr_foreign_toplevel_manager_v1_interface.version);
+    manager = static_cast<zwlr_foreign_toplevel_manager_v1*>(
+        wl_registry_bind(r, name, &zwlr_foreign_toplevel_manager_v1_interface, version));
+    zwlr_foreign_toplevel_manager_v1_add_listener(manager, &manager_listener, nullptr);
+}
+
+static void on_global_remove(void*, wl_registry*, uint32_t) { }
+
+static const wl_registry_listener registry_listener {
+    on_global,
+    on_global_remove,
+};
+
+static void disconnect()
+{
+    for (auto* t : toplevels) {
+        zwlr_foreign_toplevel_handle_v1_destroy(t->handle);
+        delete t;
+    }
+    toplevels.clear();
+    if (manager)
+        zwlr_foreign_toplevel_manager_v1_destroy(manager);
+    if (registry)
+        wl_registry_destroy(registry);
+    wl_display_disconnect(display);
+    manager = nullptr;
+    registry = nullptr;
+    display = nullptr;
+}
+
+static void thread_method(std::function<void(window_list&&)> update)
+{
+    os_set_thread_name("tuna-wl-watch");
+
+    auto publish = [&] {
+        window_list list;
+        list.reserve(toplevels.size());
+        for (auto const* t : toplevels)
+            list.emplace_back(t->app_id, t->title);
+        dirty = false;
+        update(std::move(list));
+    };
+
+    publish();
+    pollfd fd { wl_display_get_fd(display), POLLIN, 0 };
+    while (thread_flag && manager) {
+        while (wl_display_prepare_read(display) != 0)
+            wl_display_dispatch_pending(display);
+        wl_display_flush(display);
+
+        /* Wake up regularly to check if we should stop */
+        if (poll(&fd, 1, 250) > 0) {
+            if (wl_display_read_events(display) < 0) {
+                berr("Lost the connection to the Wayland compositor");
+                break;
+            }
+        } else {
+            wl_display_cancel_read(display);
+        }
+        wl_display_dispatch_pending(display);
+
+        if (dirty)
+            publish();
+    }
+
+    /* Never leave stale titles behind if the compositor went away, the
+     * connection is only cleaned up by the next start() or stop() */
+    thread_flag = false;
+    update({});
+}
+
+bool start(std::function<void(window_list&&)> update)
+{
+    if (thread_flag)
+        return true;
+    /* Joins a thread that ended by itself */
+    stop();
+    if (!getenv("WAYLAND_DISPLAY"))
+        return false;
+    display = wl_display_connect(nullptr);
+    if (!display)
+        return false;
+
+    registry = wl_display_get_registry(display);
+    wl_registry_add_listener(registry, &registry_listener, nullptr);
+    /* One round trip to learn the globals, one more for the initial windows */
+    wl_display_roundtrip(display);
+    if (!manager) {
+        binfo("Wayland compositor doesn't support wlr foreign toplevel management");
+        disconnect();
+        return false;
+    }
+    wl_display_roundtrip(display);
+
+    thread_flag = true;
+    thread_handle = std::thread(thread_method, std::move(update));
+    return true;
+}
+
+void stop()
+{
+    if (!thread_handle.joinable())
+        return;
+    thread_flag = false;
+    thread_handle.join();
+    disconnect();
+}
+
+bool running()
+{
+    return thread_flag;
+}
+}
@@ -0,0 +1,40 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Window titles from compositors that implement the wlr foreign toplevel
+ * protocol (sway, Hyprland, labwc, ...). Wayland doesn't tell clients which
+ * process a window belongs to, so the app id stands in for the executable */
+namespace wayland_toplevel {
+/* App id and title in the order the windows were opened */
+using window_list = std::vector<std::pair<std::string, std::string>>;
+
+/* Returns false if there's no Wayland session or the compositor doesn't offer
+ * the protocol. update is called on the watcher thread after every change */
+bool start(std::function<void(window_list&&)> update);
+void stop();
+
+/* False once the compositor went away, start() can then be called again */
+bool running();
+}
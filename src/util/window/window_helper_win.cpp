@@ -6,6 +6,10 @@
  */
 
 #include "window_helper.hpp"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <util/platform.h>
 #include <windows.h>
 
@@ -70,8 +74,163 @@ static bool WindowValid(HWND window)
     return true;
 }
 
+/* Window list kept up to date by the watcher thread from WinEvents */
+namespace watcher {
+static std::thread thread_handle;
+static std::atomic<bool> thread_flag { false };
+static std::atomic<DWORD> thread_id { 0 };
+static std::atomic<uint64_t> generation { 0 };
+static std::mutex cache_mutex;
+static std::vector<std::pair<std::string, std::string>> cache; /* exe and title in z-order */
+
+/* Only touched on the watcher thread */
+struct tracked_window {
+    std::string exe, title;
+};
+static std::map<HWND, tracked_window> windows;
+static std::vector<HWND> order;
+static std::map<DWORD, std::string> exes; /* by process id */
+static bool title_changed = false, list_changed = false;
+
+static void rescan()
+{
+    std::map<HWND, tracked_window> next;
+    std::map<DWORD, std::string> next_exes;
+    order.clear();
+
+    HWND window = GetWindow(GetDesktopWindow(), GW_CHILD);
+    while (window) {
+        std::string title;
+        if (WindowValid(window) && GetWindowTitle(window, title)) {
+            DWORD proc_id = 0;
+            GetWindowThreadProcessId(window, &proc_id);
+
+            /* Opening the process is the expensive part, so that's
+             * only done once for every process */
+            auto it = exes.find(proc_id);
+            std::string exe;
+            if (it != exes.end())
+                exe = it->second;
+            else if (!GetWindowExe(window, exe))
+                exe.clear();
+            next_exes[proc_id] = exe;
+            next[window] = { exe, title };
+            order.push_back(window);
+        }
+        window = GetNextWindow(window, GW_HWNDNEXT);
+    }
+    windows.swap(next);
+    exes.swap(next_exes);
+}
+
+static void publish(const std::function<void()>& changed)
+{
+    std::vector<std::pair<std::string, std::string>> list;
+    list.reserve(order.size());
+    for (auto w : order)
+        list.emplace_back(windows[w].exe, windows[w].title);
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        cache.swap(list);
+    }
+    generation++;
+    changed();
+}
+
+static void CALLBACK handle_event(HWINEVENTHOOK, DWORD event, HWND window, LONG object, LONG child, DWORD, DWORD)
+{
+    if (!window || object != OBJID_WINDOW || child != CHILDID_SELF || GetAncestor(window, GA_ROOT) != window)
+        return;
+
+    if (event == EVENT_OBJECT_NAMECHANGE) {
+        auto it = windows.find(window);
+        if (it != windows.end()) {
+            std::string title;
+            if (GetWindowTitle(window, title) && title != it->second.title) {
+                it->second.title = title;
+                title_changed = true;
+            }
+        }
+    } else {
+        /* Windows came or went, the list is enumerated again
+         * once all queued events are handled */
+        list_changed = true;
+    }
+}
+
+static void thread_method(std::function<void()> changed)
+{
+    os_set_thread_name("tuna-win-watch");
+    thread_id = GetCurrentThreadId();
+
+    /* Two hooks, so that the very frequent location changes in between aren't delivered */
+    const DWORD flags = WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS;
+    auto name_hook = SetWinEventHook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, nullptr, handle_event, 0, 0, flags);
+    auto list_hook = SetWinEventHook(EVENT_OBJECT_CREATE, EVENT_OBJECT_HIDE, nullptr, handle_event, 0, 0, flags);
+
+    rescan();
+    publish(changed);
+
+    MSG msg;
+    while (thread_flag) {
+        MsgWaitForMultipleObjects(0, nullptr, FALSE, 250, QS_ALLINPUT);
+        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT)
+                thread_flag = false;
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+
+        if (list_changed)
+            rescan();
+        if (list_changed || title_changed)
+            publish(changed);
+        list_changed = title_changed = false;
+    }
+
+    UnhookWinEvent(name_hook);
+    UnhookWinEvent(list_hook);
+    windows.clear();
+    order.clear();
+    exes.clear();
+}
+}
+
+bool StartWindowWatcher(std::function<void()> changed)
+{
+    if (watcher::thread_flag)
+        return true;
+    watcher::thread_flag = true;
+    watcher::thread_handle = std::thread(watcher::thread_method, std::move(changed));
+    return true;
+}
+
+void StopWindowWatcher()
+{
+    if (!watcher::thread_flag)
+        return;
+    watcher::thread_flag = false;
+    if (watcher::thread_id)
+        PostThreadMessage(watcher::thread_id, WM_QUIT, 0, 0);
+    if (watcher::thread_handle.joinable())
+        watcher::thread_handle.join();
+    watcher::thread_id = 0;
+}
+
+uint64_t WindowListGeneration()
+{
+    return watcher::generation;
+}
+
 void GetWindowList(std::vector<std::string>& windows)
 {
+    if (watcher::thread_flag) {
+        std::lock_guard<std::mutex> lock(watcher::cache_mutex);
+        for (const auto& w : watcher::cache)
+            windows.emplace_back(w.second);
+        return;
+    }
+
     HWND window = GetWindow(GetDesktopWindow(), GW_CHILD);
 
     while (window) {
@@ -84,6 +243,15 @@ void GetWindowList(std::vector<std::string>& windows)
 
 void GetWindowAndExeList(std::vector<std::pair<std::string, std::string>>& list)
 {
+    if (watcher::thread_flag) {
+        std::lock_guard<std::mutex> lock(watcher::cache_mutex);
+        for (const auto& w : watcher::cache) {
+            if (!w.first.empty())
+                list.emplace_back(w);
+        }
+        return;
+    }
+
     HWND window = GetWindow(GetDesktopWindow(), GW_CHILD);
 
     while (window) {